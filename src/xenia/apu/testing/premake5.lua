@@ -0,0 +1,27 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+group("tests")
+project("xenia-apu-xma-benchmark")
+  uuid("5314f011-931a-4361-ab67-bcfa86f104bf")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "fmt",
+    "libavcodec",
+    "libavutil",
+    "snappy",
+    "xenia-apu",
+    "xenia-base",
+    "xenia-core",
+  })
+  includedirs({
+    project_root.."/third_party/FFmpeg/",
+  })
+  files({
+    "xma_decoder_benchmark_main.cc",
+    "../../base/console_app_main_"..platform_suffix..".cc",
+  })
+  filter("platforms:Windows")
+    -- xenia-base needs this
+    links({"xenia-ui"})
@@ -0,0 +1,270 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/apu/xma_context.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/console_app_main.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
+#include "xenia/memory.h"
+
+// Decodes captured XMA streams on a pool of threads the way XmaDecoder does,
+// to measure decode throughput independently of any title.
+DEFINE_path(xma_capture_path, "",
+            "Directory with captured XMA streams, one raw file of 2048 byte "
+            "packets per stream.",
+            "Other");
+DEFINE_bool(xma_capture_stereo, false,
+            "Whether the captured streams are stereo.", "Other");
+DEFINE_int32(xma_capture_sample_rate, 2,
+             "Sample rate of the captured streams as stored in the XMA "
+             "context: 0 = 24 kHz, 1 = 32 kHz, 2 = 44.1 kHz, 3 = 48 kHz.",
+             "Other");
+DEFINE_int32(xma_benchmark_contexts, 32,
+             "Number of contexts decoding simultaneously. Captures are reused "
+             "if there are fewer of them.",
+             "Other");
+DEFINE_int32(xma_benchmark_passes, 4,
+             "Number of times each context decodes its stream.", "Other");
+// Not --xma_decoder_threads, which would link in XmaDecoder and everything
+// it depends on.
+DEFINE_int32(xma_benchmark_threads, 2,
+             "Number of decoding threads, like --xma_decoder_threads.",
+             "Other");
+
+namespace xe {
+namespace apu {
+namespace test {
+
+// Input buffers hold up to 4095 packets.
+constexpr uint32_t kMaxPacketCount = 4095;
+// Output buffers hold up to 31 blocks of 256 bytes.
+constexpr uint32_t kOutputBlockCount = 31;
+
+struct Stream {
+  uint32_t input_ptr;
+  uint32_t packet_count;
+  uint32_t first_frame_offset;
+};
+
+struct BenchmarkContext {
+  XmaContext context;
+  const Stream* stream;
+  uint32_t output_ptr;
+  uint32_t passes_left;
+};
+
+static void ArmContext(Memory* memory, BenchmarkContext& bc) {
+  uint8_t* context_ptr = memory->TranslateVirtual(bc.context.guest_ptr());
+  XMA_CONTEXT_DATA data(context_ptr);
+  std::memset(&data, 0, sizeof(data));
+  data.input_buffer_0_ptr = memory->GetPhysicalAddress(bc.stream->input_ptr);
+  data.input_buffer_0_packet_count = bc.stream->packet_count;
+  data.input_buffer_0_valid = 1;
+  data.input_buffer_read_offset = bc.stream->first_frame_offset;
+  data.output_buffer_ptr = memory->GetPhysicalAddress(bc.output_ptr);
+  data.output_buffer_block_count = kOutputBlockCount;
+  data.output_buffer_valid = 1;
+  data.is_stereo = cvars::xma_capture_stereo ? 1 : 0;
+  data.sample_rate = uint32_t(cvars::xma_capture_sample_rate) & 0x3;
+  data.Store(context_ptr);
+}
+
+// Consumes all decoded output like a title would, and returns whether the
+// context needs to be kicked again.
+static bool ConsumeOutput(Memory* memory, BenchmarkContext& bc,
+                          uint64_t* out_decoded_bytes) {
+  uint8_t* context_ptr = memory->TranslateVirtual(bc.context.guest_ptr());
+  XMA_CONTEXT_DATA data(context_ptr);
+  uint32_t read_block = data.output_buffer_read_offset;
+  uint32_t write_block = data.output_buffer_write_offset;
+  uint32_t block_count = write_block >= read_block
+                             ? write_block - read_block
+                             : kOutputBlockCount - read_block + write_block;
+  *out_decoded_bytes += block_count * XmaContext::kBytesPerSubframeChannel;
+  data.output_buffer_read_offset = write_block;
+  data.output_buffer_valid = 1;
+  data.Store(context_ptr);
+  if (data.input_buffer_0_valid || data.input_buffer_1_valid) {
+    return true;
+  }
+  if (--bc.passes_left) {
+    ArmContext(memory, bc);
+    return true;
+  }
+  return false;
+}
+
+static bool LoadStreams(Memory* memory, std::vector<Stream>& streams) {
+  for (const auto& file_info :
+       xe::filesystem::ListFiles(cvars::xma_capture_path)) {
+    if (file_info.type != xe::filesystem::FileInfo::Type::kFile) {
+      continue;
+    }
+    uint32_t packet_count = uint32_t(
+        std::min(file_info.total_size / XmaContext::kBytesPerPacket,
+                 size_t(kMaxPacketCount)));
+    if (!packet_count) {
+      continue;
+    }
+    uint32_t size = packet_count * XmaContext::kBytesPerPacket;
+    uint32_t input_ptr =
+        memory->SystemHeapAlloc(size, 256, kSystemHeapPhysical);
+    FILE* file = xe::filesystem::OpenFile(
+        cvars::xma_capture_path / file_info.name, "rb");
+    if (!input_ptr || !file) {
+      XELOGE("Unable to load {}", xe::path_to_utf8(file_info.name));
+      if (file) {
+        fclose(file);
+      }
+      return false;
+    }
+    uint8_t* input = memory->TranslateVirtual(input_ptr);
+    bool read = fread(input, 1, size, file) == size;
+    fclose(file);
+    if (!read) {
+      XELOGE("Unable to read {}", xe::path_to_utf8(file_info.name));
+      return false;
+    }
+    // The first frame starts after the bit offset in the packet header.
+    uint32_t first_frame_offset =
+        (((input[0] & 0x3) << 13) | (input[1] << 5) | (input[2] >> 3)) + 32;
+    streams.push_back({input_ptr, packet_count, first_frame_offset});
+  }
+  return !streams.empty();
+}
+
+int main(const std::vector<std::string>& args) {
+  auto memory = std::make_unique<Memory>();
+  if (!memory->Initialize()) {
+    XELOGE("Unable to initialize guest memory");
+    return 1;
+  }
+
+  std::vector<Stream> streams;
+  if (!LoadStreams(memory.get(), streams)) {
+    XELOGE("No XMA captures found in {}",
+           xe::path_to_utf8(cvars::xma_capture_path));
+    return 1;
+  }
+
+  uint32_t context_count =
+      uint32_t(std::max(cvars::xma_benchmark_contexts, int32_t(1)));
+  uint32_t pass_count =
+      uint32_t(std::max(cvars::xma_benchmark_passes, int32_t(1)));
+  std::vector<std::unique_ptr<BenchmarkContext>> contexts;
+  for (uint32_t i = 0; i < context_count; ++i) {
+    auto bc = std::make_unique<BenchmarkContext>();
+    uint32_t guest_ptr = memory->SystemHeapAlloc(sizeof(XMA_CONTEXT_DATA), 256,
+                                                 kSystemHeapPhysical);
+    bc->output_ptr = memory->SystemHeapAlloc(
+        kOutputBlockCount * XmaContext::kBytesPerSubframeChannel, 256,
+        kSystemHeapPhysical);
+    if (bc->context.Setup(i, memory.get(), guest_ptr)) {
+      XELOGE("Unable to set up XMA context {}", i);
+      return 1;
+    }
+    bc->context.set_is_allocated(true);
+    bc->stream = &streams[i % streams.size()];
+    bc->passes_left = pass_count;
+    ArmContext(memory.get(), *bc);
+    contexts.push_back(std::move(bc));
+  }
+
+  // Same scheduling as XmaDecoder: a ready queue of kicked contexts serviced
+  // by the first free thread.
+  std::mutex queue_mutex;
+  std::condition_variable queue_cond;
+  std::deque<BenchmarkContext*> ready_contexts;
+  uint32_t active_count = context_count;
+  std::atomic<uint64_t> work_count = {0};
+  std::atomic<uint64_t> decoded_bytes = {0};
+  for (auto& bc : contexts) {
+    ready_contexts.push_back(bc.get());
+  }
+
+  uint32_t thread_count =
+      uint32_t(std::max(cvars::xma_benchmark_threads, int32_t(1)));
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads.push_back(xe::threading::Thread::Create({}, [&]() {
+      uint64_t thread_decoded_bytes = 0;
+      while (true) {
+        BenchmarkContext* bc;
+        {
+          std::unique_lock<std::mutex> lock(queue_mutex);
+          queue_cond.wait(lock, [&]() {
+            return !ready_contexts.empty() || !active_count;
+          });
+          if (ready_contexts.empty()) {
+            break;
+          }
+          bc = ready_contexts.front();
+          ready_contexts.pop_front();
+        }
+        bc->context.Enable();
+        bc->context.Work();
+        ++work_count;
+        bool requeue =
+            ConsumeOutput(memory.get(), *bc, &thread_decoded_bytes);
+        {
+          std::lock_guard<std::mutex> lock(queue_mutex);
+          if (requeue) {
+            ready_contexts.push_back(bc);
+          } else {
+            --active_count;
+          }
+        }
+        queue_cond.notify_all();
+      }
+      decoded_bytes += thread_decoded_bytes;
+    }));
+  }
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  double seconds = double(Clock::QueryHostTickCount() - start_ticks) /
+                   double(Clock::QueryHostTickFrequency());
+
+  // Decoded output is 16-bit PCM.
+  static const uint32_t kSampleRates[] = {24000, 32000, 44100, 48000};
+  double audio_seconds =
+      double(decoded_bytes) /
+      (XmaContext::kBytesPerSample * (cvars::xma_capture_stereo ? 2 : 1) *
+       kSampleRates[uint32_t(cvars::xma_capture_sample_rate) & 0x3]);
+  XELOGI(
+      "{} streams, {} contexts, {} threads: {} context decodes in {:.3f}s "
+      "({:.0f} contexts/s), {:.1f}s of audio ({:.1f}x realtime)",
+      streams.size(), context_count, thread_count, uint64_t(work_count),
+      seconds, work_count / seconds, audio_seconds, audio_seconds / seconds);
+
+  for (auto& bc : contexts) {
+    bc->context.Release();
+  }
+  return 0;
+}
+
+}  // namespace test
+}  // namespace apu
+}  // namespace xe
+
+XE_DEFINE_CONSOLE_APP("xenia-apu-xma-benchmark", xe::apu::test::main,
+                      "[capture directory]", "xma_capture_path");
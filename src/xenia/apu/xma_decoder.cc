@@ -9,6 +9,9 @@
 
 #include "xenia/apu/xma_decoder.h"
 
+#include <algorithm>
+
+#include "third_party/fmt/include/fmt/format.h"
 #include "xenia/apu/xma_context.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/logging.h"
@@ -50,6 +53,11 @@ extern "C" {
 
 DEFINE_bool(ffmpeg_verbose, false, "Verbose FFmpeg output (debug and above)",
             "APU");
+DEFINE_int32(xma_decoder_threads, 2,
+             "Number of threads decoding XMA contexts. Kicked contexts are "
+             "decoded by the first free thread, so titles playing many streams "
+             "at once benefit from more threads.",
+             "APU");
 
 namespace xe {
 namespace apu {
@@ -138,72 +146,83 @@ X_STATUS XmaDecoder::Setup(kernel::KernelState* kernel_state) {
   context_bitmap_.Resize(kContextCount);
 
   worker_running_ = true;
-  work_event_ = xe::threading::Event::CreateAutoResetEvent(false);
-  assert_not_null(work_event_);
-  worker_thread_ = kernel::object_ref<kernel::XHostThread>(
-      new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
-        WorkerThreadMain();
-        return 0;
-      }));
-  worker_thread_->set_name("XMA Decoder");
-  worker_thread_->set_can_debugger_suspend(true);
-  worker_thread_->Create();
+  uint32_t worker_count =
+      uint32_t(std::max(cvars::xma_decoder_threads, int32_t(1)));
+  worker_count =
+      std::min(worker_count, xe::threading::logical_processor_count());
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    auto worker_thread = kernel::object_ref<kernel::XHostThread>(
+        new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
+          WorkerThreadMain();
+          return 0;
+        }));
+    worker_thread->set_name(worker_count > 1
+                                ? fmt::format("XMA Decoder {}", i)
+                                : std::string("XMA Decoder"));
+    worker_thread->set_can_debugger_suspend(true);
+    worker_thread->Create();
+    worker_threads_.push_back(std::move(worker_thread));
+  }
 
   return X_STATUS_SUCCESS;
 }
 
-void XmaDecoder::WorkerThreadMain() {
-  uint32_t idle_loop_count = 0;
-  while (worker_running_) {
-    // Okay, let's loop through XMA contexts to find ones we need to decode!
-    bool did_work = false;
-    for (uint32_t n = 0; n < kContextCount; n++) {
-      XmaContext& context = contexts_[n];
-      did_work = context.Work() || did_work;
-
-      // TODO: Need thread safety to do this.
-      // Probably not too important though.
-      // registers_.current_context = n;
-      // registers_.next_context = (n + 1) % kContextCount;
-    }
-
-    if (paused_) {
-      pause_fence_.Signal();
-      resume_fence_.Wait();
-    }
-
-    if (!did_work) {
-      idle_loop_count++;
-    } else {
-      idle_loop_count = 0;
-    }
+bool XmaDecoder::ScheduleContext(uint32_t context_id) {
+  if (context_queued_[context_id].exchange(true)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(work_mutex_);
+  ready_contexts_.push_back(context_id);
+  return true;
+}
 
-    if (idle_loop_count > 500) {
-      // Idle for an extended period. Introduce a 20ms wait.
-      xe::threading::Wait(work_event_.get(), false,
-                          std::chrono::milliseconds(20));
+void XmaDecoder::WorkerThreadMain() {
+  while (true) {
+    uint32_t context_id;
+    {
+      std::unique_lock<std::mutex> lock(work_mutex_);
+      if (paused_ && worker_running_) {
+        ++paused_worker_count_;
+        pause_cond_.notify_all();
+        work_cond_.wait(lock,
+                        [this]() { return !paused_ || !worker_running_; });
+        --paused_worker_count_;
+        continue;
+      }
+      if (!worker_running_) {
+        return;
+      }
+      if (ready_contexts_.empty()) {
+        work_cond_.wait(lock);
+        continue;
+      }
+      context_id = ready_contexts_.front();
+      ready_contexts_.pop_front();
     }
 
-    xe::threading::MaybeYield();
+    // Cleared before decoding, so that a kick arriving meanwhile queues the
+    // context again. Work serializes on the context lock if another thread
+    // picks it up before this one is done.
+    context_queued_[context_id] = false;
+    contexts_[context_id].Work();
   }
 }
 
 void XmaDecoder::Shutdown() {
-  worker_running_ = false;
-
-  if (work_event_) {
-    work_event_->Set();
-  }
-
-  if (paused_) {
-    Resume();
+  {
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    worker_running_ = false;
+    ready_contexts_.clear();
   }
+  work_cond_.notify_all();
+  pause_cond_.notify_all();
 
-  if (worker_thread_) {
-    // Wait for work thread.
-    xe::threading::Wait(worker_thread_->thread(), false);
-    worker_thread_.reset();
+  // Wait for the work threads.
+  for (auto& worker_thread : worker_threads_) {
+    xe::threading::Wait(worker_thread->thread(), false);
   }
+  worker_threads_.clear();
+  paused_ = false;
 
   if (context_data_first_ptr_) {
     memory()->SystemHeapFree(context_data_first_ptr_);
@@ -308,15 +327,23 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
 
     // The context ID is a bit in the range of the entire context array.
     uint32_t base_context_id = (r - XmaRegister::Context0Kick) * 32;
+    uint32_t scheduled_count = 0;
     for (int i = 0; value && i < 32; ++i, value >>= 1) {
       if (value & 1) {
         uint32_t context_id = base_context_id + i;
         auto& context = contexts_[context_id];
         context.Enable();
+        if (ScheduleContext(context_id)) {
+          ++scheduled_count;
+        }
       }
     }
-    // Signal the decoder thread to start processing.
-    work_event_->Set();
+    // Wake up enough decoder threads to start processing.
+    if (scheduled_count > 1) {
+      work_cond_.notify_all();
+    } else if (scheduled_count) {
+      work_cond_.notify_one();
+    }
   } else if (r >= XmaRegister::Context0Lock && r <= XmaRegister::Context9Lock) {
     // Context lock command.
     // This requests a lock by flagging the context.
@@ -329,8 +356,6 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
         context.Disable();
       }
     }
-    // Signal the decoder thread to start processing.
-    // work_event_->Set();
   } else if (r >= XmaRegister::Context0Clear &&
              r <= XmaRegister::Context9Clear) {
     // Context clear command.
@@ -363,21 +388,27 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
 }
 
 void XmaDecoder::Pause() {
+  std::unique_lock<std::mutex> lock(work_mutex_);
   if (paused_) {
     return;
   }
   paused_ = true;
+  work_cond_.notify_all();
 
-  pause_fence_.Wait();
+  pause_cond_.wait(lock, [this]() {
+    return paused_worker_count_ == worker_threads_.size() || !worker_running_;
+  });
 }
 
 void XmaDecoder::Resume() {
-  if (!paused_) {
-    return;
+  {
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    if (!paused_) {
+      return;
+    }
+    paused_ = false;
   }
-  paused_ = false;
-
-  resume_fence_.Signal();
+  work_cond_.notify_all();
 }
 
 }  // namespace apu
@@ -11,8 +11,10 @@
 #define XENIA_APU_XMA_DECODER_H_
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
-#include <queue>
+#include <vector>
 
 #include "xenia/apu/xma_context.h"
 #include "xenia/apu/xma_register_file.h"
@@ -48,6 +50,8 @@ class XmaDecoder {
   void WriteRegister(uint32_t addr, uint32_t value);
 
   bool is_paused() const { return paused_; }
+  // Stops all decoder threads once they have finished the contexts they are
+  // decoding, until Resume is called.
   void Pause();
   void Resume();
 
@@ -56,6 +60,9 @@ class XmaDecoder {
 
  private:
   void WorkerThreadMain();
+  // Queues a kicked context for the decoder threads, unless it's queued
+  // already. Returns whether it was queued.
+  bool ScheduleContext(uint32_t context_id);
 
   static uint32_t MMIOReadRegisterThunk(void* ppc_context, XmaDecoder* as,
                                         uint32_t addr) {
@@ -70,17 +77,26 @@ class XmaDecoder {
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
 
-  std::atomic<bool> worker_running_ = {false};
-  kernel::object_ref<kernel::XHostThread> worker_thread_;
-  std::unique_ptr<xe::threading::Event> work_event_ = nullptr;
+  static const uint32_t kContextCount = 320;
+
+  // Contexts are decoded by a pool of threads as soon as they are kicked.
+  // The ready queue, pausing and shutdown are all guarded by work_mutex_.
+  std::vector<kernel::object_ref<kernel::XHostThread>> worker_threads_;
+  std::mutex work_mutex_;
+  std::condition_variable work_cond_;
+  std::deque<uint32_t> ready_contexts_;
+  // Whether each context is in ready_contexts_, so kicks don't queue it
+  // multiple times.
+  std::atomic<bool> context_queued_[kContextCount] = {};
+  bool worker_running_ = false;
 
   bool paused_ = false;
-  xe::threading::Fence pause_fence_;   // Signaled when worker paused.
-  xe::threading::Fence resume_fence_;  // Signaled when resume requested.
+  // Signaled by the workers as they stop for a pause.
+  std::condition_variable pause_cond_;
+  size_t paused_worker_count_ = 0;
 
   XmaRegisterFile register_file_;
 
-  static const uint32_t kContextCount = 320;
   XmaContext contexts_[kContextCount];
   BitMap context_bitmap_;
 
@@ -16,6 +16,10 @@
 #include "xenia/base/assert.h"
 #include "xenia/base/math.h"
 
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#endif
+
 DEFINE_bool(clock_no_scaling, false,
             "Disable scaling code. Time management and locking is bypassed. "
             "Guest system time is directly pulled from host.",
@@ -38,13 +42,76 @@ uint64_t guest_system_time_base_ = Clock::QueryHostSystemTime();
 // Computed by RecomputeGuestTickScalar.
 std::pair<uint64_t, uint64_t> guest_tick_ratio_ = std::make_pair(1, 1);
 
-// Native guest ticks.
-uint64_t last_guest_tick_count_ = 0;
-// Last sampled host tick count.
-uint64_t last_host_tick_count_ = Clock::QueryHostTickCount();
-// Mutex to ensure last_host_tick_count_ and last_guest_tick_count_ are in sync
+// Guest tick conversion, written with tick_mutex_ held.
+Clock::GuestTickParameters guest_tick_parameters_ = {
+    {0}, {Clock::QueryHostTickCount()}, {0}, {1}, {0}};
+// Mutex to serialize changes of the guest tick ratio.
 std::mutex tick_mutex_;
 
+static uint64_t MultiplyHigh(uint64_t a, uint64_t b) {
+#if XE_COMPILER_MSVC
+  return __umulh(a, b);
+#else
+  return uint64_t((unsigned __int128)a * b >> 64);
+#endif
+}
+
+// Converts host ticks to guest ticks, see Clock::GuestTickParameters.
+static uint64_t HostToGuestTicks(uint64_t host_tick_count) {
+  auto& params = guest_tick_parameters_;
+  uint64_t sequence, host_tick_base, guest_tick_base, ratio_integer,
+      ratio_fraction;
+  do {
+    sequence = params.sequence.load(std::memory_order_acquire);
+    host_tick_base = params.host_tick_base.load(std::memory_order_relaxed);
+    guest_tick_base = params.guest_tick_base.load(std::memory_order_relaxed);
+    ratio_integer = params.ratio_integer.load(std::memory_order_relaxed);
+    ratio_fraction = params.ratio_fraction.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) ||
+           sequence != params.sequence.load(std::memory_order_relaxed));
+
+  if (cvars::clock_no_scaling) {
+    return host_tick_count * ratio_integer +
+           MultiplyHigh(host_tick_count, ratio_fraction);
+  }
+  uint64_t host_tick_delta = host_tick_count > host_tick_base
+                                 ? host_tick_count - host_tick_base
+                                 : 0;
+  return guest_tick_base + host_tick_delta * ratio_integer +
+         MultiplyHigh(host_tick_delta, ratio_fraction);
+}
+
+// Publishes a new guest tick ratio, continuing the guest tick count from the
+// current one. tick_mutex_ must be held.
+static void SetGuestTickRatio(std::pair<uint64_t, uint64_t> ratio) {
+  uint64_t host_tick_count = Clock::QueryHostTickCount();
+  uint64_t guest_tick_count = HostToGuestTicks(host_tick_count);
+
+  // Long division of the remainder for the fixed point fraction.
+  uint64_t ratio_integer = ratio.first / ratio.second;
+  uint64_t remainder = ratio.first % ratio.second;
+  uint64_t ratio_fraction = 0;
+  for (uint32_t i = 0; i < 64; ++i) {
+    remainder <<= 1;
+    ratio_fraction <<= 1;
+    if (remainder >= ratio.second) {
+      remainder -= ratio.second;
+      ratio_fraction |= 1;
+    }
+  }
+
+  auto& params = guest_tick_parameters_;
+  uint64_t sequence = params.sequence.load(std::memory_order_relaxed);
+  params.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  params.host_tick_base.store(host_tick_count, std::memory_order_relaxed);
+  params.guest_tick_base.store(guest_tick_count, std::memory_order_relaxed);
+  params.ratio_integer.store(ratio_integer, std::memory_order_relaxed);
+  params.ratio_fraction.store(ratio_fraction, std::memory_order_relaxed);
+  params.sequence.store(sequence + 2, std::memory_order_release);
+}
+
 void RecomputeGuestTickScalar() {
   // Create a rational number with numerator (first) and denominator (second)
   auto frac =
@@ -63,34 +130,7 @@ void RecomputeGuestTickScalar() {
 
   std::lock_guard<std::mutex> lock(tick_mutex_);
   guest_tick_ratio_ = frac;
-}
-
-// Update the guest timer for all threads.
-// Return a copy of the value so locking is reduced.
-uint64_t UpdateGuestClock() {
-  uint64_t host_tick_count = Clock::QueryHostTickCount();
-
-  if (cvars::clock_no_scaling) {
-    // Nothing to update, calculate on the fly
-    return host_tick_count * guest_tick_ratio_.first / guest_tick_ratio_.second;
-  }
-
-  std::unique_lock<std::mutex> lock(tick_mutex_, std::defer_lock);
-  if (lock.try_lock()) {
-    // Translate host tick count to guest tick count.
-    uint64_t host_tick_delta = host_tick_count > last_host_tick_count_
-                                   ? host_tick_count - last_host_tick_count_
-                                   : 0;
-    last_host_tick_count_ = host_tick_count;
-    uint64_t guest_tick_delta =
-        host_tick_delta * guest_tick_ratio_.first / guest_tick_ratio_.second;
-    last_guest_tick_count_ += guest_tick_delta;
-    return last_guest_tick_count_;
-  } else {
-    // Wait until another thread has finished updating the clock.
-    lock.lock();
-    return last_guest_tick_count_;
-  }
+  SetGuestTickRatio(frac);
 }
 
 // Offset of the current guest system file time relative to the guest base time.
@@ -99,7 +139,7 @@ inline uint64_t QueryGuestSystemTimeOffset() {
     return Clock::QueryHostSystemTime() - guest_system_time_base_;
   }
 
-  auto guest_tick_count = UpdateGuestClock();
+  auto guest_tick_count = Clock::QueryGuestTickCount();
 
   uint64_t numerator = 10000000;  // 100ns/10MHz resolution
   uint64_t denominator = guest_tick_frequency_;
@@ -141,6 +181,10 @@ std::pair<uint64_t, uint64_t> Clock::guest_tick_ratio() {
   return guest_tick_ratio_;
 }
 
+const Clock::GuestTickParameters& Clock::guest_tick_parameters() {
+  return guest_tick_parameters_;
+}
+
 uint64_t Clock::guest_tick_frequency() { return guest_tick_frequency_; }
 
 void Clock::set_guest_tick_frequency(uint64_t frequency) {
@@ -155,8 +199,7 @@ void Clock::set_guest_system_time_base(uint64_t time_base) {
 }
 
 uint64_t Clock::QueryGuestTickCount() {
-  auto guest_tick_count = UpdateGuestClock();
-  return guest_tick_count;
+  return HostToGuestTicks(QueryHostTickCount());
 }
 
 uint64_t Clock::QueryGuestSystemTime() {
@@ -204,7 +247,7 @@ uint32_t Clock::ScaleGuestDurationMillis(uint32_t guest_ms) {
 
 int64_t Clock::ScaleGuestDurationFileTime(int64_t guest_file_time) {
   if (cvars::clock_no_scaling) {
-    return static_cast<uint64_t>(guest_file_time);
+    return guest_file_time;
   }
 
   if (!guest_file_time) {
@@ -217,11 +260,10 @@ int64_t Clock::ScaleGuestDurationFileTime(int64_t guest_file_time) {
         static_cast<int64_t>(relative_time * guest_time_scalar_);
     return static_cast<int64_t>(guest_time) + scaled_time;
   } else {
-    // Relative time.
-    uint64_t scaled_file_time = static_cast<uint64_t>(
-        (static_cast<uint64_t>(guest_file_time) * guest_time_scalar_));
+    // Relative time. Scaled signed, as the unsigned value of a short negative
+    // duration is beyond the precision of a double.
     // TODO(benvanik): check for overflow?
-    return scaled_file_time;
+    return static_cast<int64_t>(guest_file_time * guest_time_scalar_);
   }
 }
 
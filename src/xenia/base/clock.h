@@ -10,6 +10,7 @@
 #ifndef XENIA_BASE_CLOCK_H_
 #define XENIA_BASE_CLOCK_H_
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 
@@ -57,6 +58,23 @@ class Clock {
   static void set_guest_time_scalar(double scalar);
   // Get the tick ration between host and guest including time scaling if set.
   static std::pair<uint64_t, uint64_t> guest_tick_ratio();
+
+  // Conversion of host ticks to guest ticks. Guest ticks are
+  // guest_tick_base + (host_ticks - host_tick_base) * ratio, or only
+  // host_ticks * ratio with clock_no_scaling. The ratio is split into an
+  // integer and a 0.64 fixed point fraction, so no division is needed.
+  // Published with a sequence lock, so that readers (including generated
+  // code) never block: sequence is odd while the parameters are being updated,
+  // and must be unchanged after reading them.
+  struct GuestTickParameters {
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> host_tick_base;
+    std::atomic<uint64_t> guest_tick_base;
+    std::atomic<uint64_t> ratio_integer;
+    std::atomic<uint64_t> ratio_fraction;
+  };
+  static const GuestTickParameters& guest_tick_parameters();
+
   // Guest ticks-per-second.
   static uint64_t guest_tick_frequency();
   // Sets the guest ticks-per-second.
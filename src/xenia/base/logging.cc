@@ -16,10 +16,6 @@
 #include <mutex>
 #include <vector>
 
-#include "third_party/disruptorplus/include/disruptorplus/multi_threaded_claim_strategy.hpp"
-#include "third_party/disruptorplus/include/disruptorplus/ring_buffer.hpp"
-#include "third_party/disruptorplus/include/disruptorplus/sequence_barrier.hpp"
-#include "third_party/disruptorplus/include/disruptorplus/spin_wait_strategy.hpp"
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/console.h"
@@ -60,7 +56,6 @@ DEFINE_int32(
     "Maximum level to be logged. (0=error, 1=warning, 2=info, 3=debug)",
     "Logging");
 
-namespace dp = disruptorplus;
 using namespace xe::literals;
 
 namespace xe {
@@ -71,6 +66,8 @@ Logger* logger_ = nullptr;
 
 struct LogLine {
   size_t buffer_length;
+  // Formats the arguments of a deferred line, which are the line data.
+  logging::internal::DeferredFormatFunction format_function;
   uint32_t thread_id;
   uint16_t _pad_0;  // (2b) padding
   bool terminate;
@@ -214,13 +211,21 @@ void AndroidLogSink::WriteLineBuffer() {
 }
 #endif  // XE_PLATFORM_ANDROID
 
+// Lines are passed to the writer thread through a ring of 256 byte blocks.
+// Producers claim whole blocks for a line with a single atomic add, copy the
+// line in and publish it by storing the sequence number of its first block in
+// the slot of that block. The writer consumes lines in claim order, which is
+// the order their prefixes were claimed, and sleeps on an event when the ring
+// is empty instead of polling.
 class Logger {
  public:
   explicit Logger(const std::string_view app_name)
-      : wait_strategy_(),
-        claim_strategy_(kBlockCount, wait_strategy_),
-        consumed_(wait_strategy_) {
-    claim_strategy_.add_claim_barrier(consumed_);
+      : staging_buffer_(kStagingBufferSize) {
+    for (auto& published : published_) {
+      published.store(UINT64_MAX, std::memory_order_relaxed);
+    }
+    write_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+    assert_not_null(write_event_);
 
     write_thread_ =
         xe::threading::Thread::Create({}, [this]() { WriteThread(); });
@@ -245,10 +250,12 @@ class Logger {
   static const size_t kBlockCount = kBufferSize / kBlockSize;
   static const size_t kBlockIndexMask = kBlockCount - 1;
 
-  static const size_t kClaimStrategyFootprint =
-      sizeof(std::atomic<dp::sequence_t>[kBlockCount]);
+  // Lines are gathered here and written to the sinks with one call per batch.
+  static const size_t kStagingBufferSize = 1_MiB;
+  // Longest line the writer can produce, with its prefix and newline.
+  static const size_t kMaxFormattedLineSize = 64_KiB + 16;
 
-  static size_t BlockOffset(dp::sequence_t sequence) {
+  static size_t BlockOffset(uint64_t sequence) {
     return (sequence & kBlockIndexMask) * kBlockSize;
   }
 
@@ -256,171 +263,205 @@ class Logger {
     return (byte_size + (kBlockSize - 1)) / kBlockSize;
   }
 
-  dp::spin_wait_strategy wait_strategy_;
-  dp::multi_threaded_claim_strategy<dp::spin_wait_strategy> claim_strategy_;
-  dp::sequence_barrier<dp::spin_wait_strategy> consumed_;
+  // Next block to claim.
+  alignas(64) std::atomic<uint64_t> claim_sequence_ = {0};
+  // Blocks before this one have been read by the writer and can be reused.
+  alignas(64) std::atomic<uint64_t> consumed_sequence_ = {0};
+  alignas(64) std::atomic<bool> writer_waiting_ = {false};
+  // Sequence number of the line starting in each block once it's published.
+  std::atomic<uint64_t> published_[kBlockCount];
+
+  std::vector<char> staging_buffer_;
+  size_t staging_used_ = 0;
 
   std::vector<std::unique_ptr<LogSink>> sinks_;
 
+  std::unique_ptr<xe::threading::Event> write_event_;
   std::unique_ptr<xe::threading::Thread> write_thread_;
 
-  void Write(const char* buf, size_t size) {
-    for (const auto& sink : sinks_) {
-      sink->Write(buf, size);
+  void WakeWriter() {
+    // Pairs with the fence in WriteThread, so either the writer sees the line
+    // published, or the producer sees the writer waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_waiting_.load(std::memory_order_relaxed)) {
+      write_event_->Set();
     }
   }
 
-  void WriteThread() {
-    RingBuffer rb(buffer_, kBufferSize);
-
-    size_t idle_loops = 0;
-
-    dp::sequence_t next_sequence = 0;
-    dp::sequence_t last_sequence = -1;
-
-    size_t desired_count = 1;
-    while (true) {
-      // We want one block to find out how many blocks we need or we know how
-      // many blocks needed for at least one log line.
-      auto next_range = dp::sequence_range(next_sequence, desired_count);
-
-      claim_strategy_.wait_until_published(next_range.last(), last_sequence);
+  void WriteStaging() {
+    if (!staging_used_) {
+      return;
+    }
+    for (const auto& sink : sinks_) {
+      sink->Write(staging_buffer_.data(), staging_used_);
+    }
+    staging_used_ = 0;
+  }
 
-      size_t read_count = 0;
-      auto available_range = next_range;
-      auto available_count = available_range.size();
+  // Formats the line starting at the read offset of the ring into the staging
+  // buffer.
+  void StageLine(RingBuffer& rb, const LogLine& line) {
+    if (kStagingBufferSize - staging_used_ < kMaxFormattedLineSize) {
+      WriteStaging();
+    }
+    char* out = staging_buffer_.data() + staging_used_;
+    char* out_start = out;
+
+    if (line.prefix_char) {
+      out[0] = line.prefix_char;
+      out[1] = '>';
+      out[2] = ' ';
+      // Thread ID gets placed here (8 chars).
+      fmt::format_to_n(out + 3, 8, "{:08X}", line.thread_id);
+      out[11] = ' ';
+      out += 12;
+    }
 
-      rb.set_write_offset(BlockOffset(available_range.end()));
+    if (line.format_function) {
+      alignas(16) uint8_t payload[logging::internal::kMaxDeferredPayloadSize];
+      rb.Read(payload, line.buffer_length);
+      out += line.format_function(payload, out, 64_KiB);
+    } else if (line.buffer_length) {
+      auto line_range = rb.BeginRead(line.buffer_length);
+      char last_char =
+          line_range.second
+              ? line_range.second[line_range.second_length - 1]
+              : line_range.first[line_range.first_length - 1];
+      if (line.buffer_length <= 64_KiB) {
+        std::memcpy(out, line_range.first, line_range.first_length);
+        out += line_range.first_length;
+        if (line_range.second_length) {
+          std::memcpy(out, line_range.second, line_range.second_length);
+          out += line_range.second_length;
+        }
+      } else {
+        // Only formatted lines are bounded, write long strings directly.
+        staging_used_ += size_t(out - out_start);
+        WriteStaging();
+        for (const auto& sink : sinks_) {
+          sink->Write(reinterpret_cast<const char*>(line_range.first),
+                      line_range.first_length);
+          if (line_range.second_length) {
+            sink->Write(reinterpret_cast<const char*>(line_range.second),
+                        line_range.second_length);
+          }
+        }
+        out = out_start = staging_buffer_.data();
+      }
+      rb.EndRead(std::move(line_range));
+      // Always ensure there is a newline.
+      if (last_char != '\n') {
+        *out++ = '\n';
+      }
+      staging_used_ += size_t(out - out_start);
+      return;
+    }
 
-      bool terminate = false;
-      for (size_t i = available_range.first(); i != available_range.end();) {
-        rb.set_read_offset(BlockOffset(i));
+    // Always ensure there is a newline.
+    if (out == out_start || out[-1] != '\n') {
+      *out++ = '\n';
+    }
+    staging_used_ += size_t(out - out_start);
+  }
 
+  void WriteThread() {
+    RingBuffer rb(buffer_, kBufferSize);
+    uint64_t next_sequence = 0;
+    bool terminate = false;
+    while (!terminate) {
+      bool read_any = false;
+      while (published_[next_sequence & kBlockIndexMask].load(
+                 std::memory_order_acquire) == next_sequence) {
+        rb.set_read_offset(BlockOffset(next_sequence));
+        rb.set_write_offset(BlockOffset(next_sequence + 1));
         LogLine line;
         rb.Read(&line, sizeof(line));
+        size_t count = BlockCount(sizeof(LogLine) + line.buffer_length);
+        rb.set_write_offset(BlockOffset(next_sequence + count));
+        if (!line.terminate) {
+          StageLine(rb, line);
+        }
 
-        auto needed_count = BlockCount(sizeof(LogLine) + line.buffer_length);
-        if (read_count + needed_count > available_count) {
-          // More blocks are needed for a complete line.
-          desired_count = needed_count;
+        // The line has been copied out, let producers reuse its blocks.
+        next_sequence += count;
+        consumed_sequence_.store(next_sequence, std::memory_order_release);
+        read_any = true;
+        if (line.terminate) {
+          terminate = true;
           break;
-        } else {
-          // Enough blocks to read this log line, advance by that many.
-          read_count += needed_count;
-          i += needed_count;
-
-          if (line.prefix_char) {
-            char prefix[] = {
-                line.prefix_char,
-                '>',
-                ' ',
-                '?',  // Thread ID gets placed here (8 chars).
-                '?',
-                '?',
-                '?',
-                '?',
-                '?',
-                '?',
-                '?',
-                ' ',
-                0,
-            };
-            fmt::format_to_n(prefix + 3, sizeof(prefix) - 3, "{:08X}",
-                             line.thread_id);
-            Write(prefix, sizeof(prefix) - 1);
-          }
-
-          if (line.buffer_length) {
-            // Get access to the line data - which may be split in the ring
-            // buffer - and write it out in parts.
-            auto line_range = rb.BeginRead(line.buffer_length);
-            Write(reinterpret_cast<const char*>(line_range.first),
-                  line_range.first_length);
-            if (line_range.second_length) {
-              Write(reinterpret_cast<const char*>(line_range.second),
-                    line_range.second_length);
-            }
-
-            // Always ensure there is a newline.
-            char last_char =
-                line_range.second
-                    ? line_range.second[line_range.second_length - 1]
-                    : line_range.first[line_range.first_length - 1];
-            if (last_char != '\n') {
-              const char suffix[1] = {'\n'};
-              Write(suffix, 1);
-            }
-
-            rb.EndRead(std::move(line_range));
-          } else {
-            // Always ensure there is a newline.
-            const char suffix[1] = {'\n'};
-            Write(suffix, 1);
-          }
-
-          if (line.terminate) {
-            terminate = true;
-            break;
-          }
         }
       }
 
-      if (terminate) {
-        break;
-      }
-
-      if (read_count) {
-        // Advance by the number of blocks we read.
-        auto read_range = dp::sequence_range(next_sequence, read_count);
-        next_sequence = read_range.end();
-        last_sequence = read_range.last();
-        consumed_.publish(last_sequence);
-
-        desired_count = 1;
-
-        if (cvars::flush_log) {
+      if (read_any) {
+        WriteStaging();
+        if (cvars::flush_log || terminate) {
           for (const auto& sink : sinks_) {
             sink->Flush();
           }
         }
+        continue;
+      }
 
-        idle_loops = 0;
-      } else {
-        if (idle_loops >= 1000) {
-          // Introduce a waiting period.
-          xe::threading::Sleep(std::chrono::milliseconds(50));
-        } else {
-          idle_loops++;
-        }
+      writer_waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (published_[next_sequence & kBlockIndexMask].load(
+              std::memory_order_relaxed) != next_sequence) {
+        xe::threading::Wait(write_event_.get(), false);
       }
+      writer_waiting_.store(false, std::memory_order_relaxed);
     }
   }
 
- public:
-  void AppendLine(uint32_t thread_id, const char prefix_char,
-                  const char* buffer_data, size_t buffer_length,
-                  bool terminate = false) {
-    size_t count = BlockCount(sizeof(LogLine) + buffer_length);
-
-    auto range = claim_strategy_.claim(count);
-    assert_true(range.size() == count);
+  void AppendRecord(uint32_t thread_id, const char prefix_char,
+                    logging::internal::DeferredFormatFunction format_function,
+                    const void* data, size_t length, bool terminate) {
+    size_t count = BlockCount(sizeof(LogLine) + length);
+    assert_true(count < kBlockCount);
+
+    uint64_t first =
+        claim_sequence_.fetch_add(count, std::memory_order_relaxed);
+    // Wait for the writer to free the blocks if the ring is full.
+    while (first + count - consumed_sequence_.load(std::memory_order_acquire) >
+           kBlockCount) {
+      write_event_->Set();
+      xe::threading::MaybeYield();
+    }
 
     RingBuffer rb(buffer_, kBufferSize);
-    rb.set_write_offset(BlockOffset(range.first()));
-    rb.set_read_offset(BlockOffset(range.end()));
+    rb.set_write_offset(BlockOffset(first));
+    rb.set_read_offset(BlockOffset(first + count));
 
     LogLine line = {};
-    line.buffer_length = buffer_length;
+    line.buffer_length = length;
+    line.format_function = format_function;
     line.thread_id = thread_id;
     line.prefix_char = prefix_char;
     line.terminate = terminate;
 
     rb.Write(&line, sizeof(LogLine));
-    if (buffer_length) {
-      rb.Write(buffer_data, buffer_length);
+    if (length) {
+      rb.Write(data, length);
     }
 
-    claim_strategy_.publish(range);
+    published_[first & kBlockIndexMask].store(first,
+                                              std::memory_order_release);
+    WakeWriter();
+  }
+
+ public:
+  void AppendLine(uint32_t thread_id, const char prefix_char,
+                  const char* buffer_data, size_t buffer_length,
+                  bool terminate = false) {
+    AppendRecord(thread_id, prefix_char, nullptr, buffer_data, buffer_length,
+                 terminate);
+  }
+
+  void AppendDeferredLine(
+      uint32_t thread_id, const char prefix_char,
+      logging::internal::DeferredFormatFunction format_function,
+      const void* payload, size_t payload_size) {
+    AppendRecord(thread_id, prefix_char, format_function, payload,
+                 payload_size, false);
   }
 };
 
@@ -485,6 +526,17 @@ void logging::internal::AppendLogLine(LogLevel log_level,
                       thread_log_buffer_, written);
 }
 
+void logging::internal::AppendDeferredLogLine(
+    LogLevel log_level, const char prefix_char,
+    DeferredFormatFunction format_function, const void* payload,
+    size_t payload_size) {
+  if (!ShouldLog(log_level)) {
+    return;
+  }
+  logger_->AppendDeferredLine(xe::threading::current_thread_id(), prefix_char,
+                              format_function, payload, payload_size);
+}
+
 void logging::AppendLogLine(LogLevel log_level, const char prefix_char,
                             const std::string_view str) {
   if (!internal::ShouldLog(log_level) || !str.size()) {
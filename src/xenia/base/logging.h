@@ -10,9 +10,12 @@
 #ifndef XENIA_BASE_LOGGING_H_
 #define XENIA_BASE_LOGGING_H_
 
+#include <algorithm>
 #include <cstdarg>
 #include <cstdint>
 #include <string>
+#include <tuple>
+#include <type_traits>
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/string.h"
@@ -77,6 +80,33 @@ std::pair<char*, size_t> GetThreadBuffer();
 
 void AppendLogLine(LogLevel log_level, const char prefix_char, size_t written);
 
+// Formats the payload of a deferred line to out, returning the length.
+typedef size_t (*DeferredFormatFunction)(const void* payload, char* out,
+                                         size_t out_size);
+constexpr size_t kMaxDeferredPayloadSize = 128;
+
+template <typename... Args>
+struct DeferredPayload {
+  const char* format;
+  std::tuple<Args...> args;
+};
+
+template <typename... Args>
+size_t FormatDeferred(const void* payload, char* out, size_t out_size) {
+  auto& deferred = *static_cast<const DeferredPayload<Args...>*>(payload);
+  return std::apply(
+      [&](const Args&... args) {
+        return std::min(
+            fmt::format_to_n(out, out_size, deferred.format, args...).size,
+            out_size);
+      },
+      deferred.args);
+}
+
+void AppendDeferredLogLine(LogLevel log_level, const char prefix_char,
+                           DeferredFormatFunction format_function,
+                           const void* payload, size_t payload_size);
+
 }  // namespace internal
 
 // Appends a line to the log with {fmt}-style formatting.
@@ -91,6 +121,27 @@ void AppendLogLineFormat(LogLevel log_level, const char prefix_char,
   internal::AppendLogLine(log_level, prefix_char, result.size);
 }
 
+// Appends a line to the log with {fmt}-style formatting done later on the
+// logging thread, so the caller only copies the arguments. For hot paths like
+// tracing. The format must be a string literal, and the arguments must be
+// numbers, as they're formatted after the call returns.
+template <typename... Args>
+void AppendLogLineDeferred(LogLevel log_level, const char prefix_char,
+                           const char* format, const Args&... args) {
+  static_assert((std::is_arithmetic_v<Args> && ...),
+                "Only numbers can be formatted by the logging thread");
+  static_assert(sizeof(internal::DeferredPayload<Args...>) <=
+                    internal::kMaxDeferredPayloadSize,
+                "Too many arguments to defer formatting");
+  if (!internal::ShouldLog(log_level)) {
+    return;
+  }
+  internal::DeferredPayload<Args...> payload = {format, {args...}};
+  internal::AppendDeferredLogLine(log_level, prefix_char,
+                                  internal::FormatDeferred<Args...>, &payload,
+                                  sizeof(payload));
+}
+
 // Appends a line to the log.
 void AppendLogLine(LogLevel log_level, const char prefix_char,
                    const std::string_view str);
@@ -89,6 +89,18 @@ bool Protect(void* base_address, size_t length, PageAccess access,
 // the region.
 bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out);
 
+// Starts tracking writes to all memory of the process from scratch. Returns
+// false if the host can't track writes to pages.
+bool ResetPageWriteTracking();
+
+// Sets the bit for each page() in the range that was written to since the last
+// ResetPageWriteTracking in written_bits, and for each page backed by physical
+// memory in resident_bits. Pages that have left physical memory may no longer
+// report writes. Either output may be null. base_address must be page
+// aligned, and the bitmaps must hold a bit for every page in the range.
+bool QueryPageWriteTracking(const void* base_address, size_t length,
+                            uint64_t* written_bits, uint64_t* resident_bits);
+
 // Allocates a block of memory for a type with the given alignment.
 // The memory must be freed with AlignedFree.
 template <typename T>
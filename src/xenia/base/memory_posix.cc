@@ -12,7 +12,9 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 
 #include "xenia/base/math.h"
 #include "xenia/base/platform.h"
@@ -112,6 +114,97 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return false;
 }
 
+#if XE_PLATFORM_LINUX
+// Clears the soft-dirty bits of all pages of the process.
+static bool ClearSoftDirtyBits() {
+  int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool result = write(fd, "4", 1) == 1;
+  close(fd);
+  return result;
+}
+
+// Kernels built without soft-dirty support accept clearing the bits, but
+// never set them, so check that a write is actually reported.
+static bool IsSoftDirtySupported() {
+  static const bool supported = []() {
+    size_t system_page_size = page_size();
+    void* page = mmap(nullptr, system_page_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+      return false;
+    }
+    *static_cast<volatile uint8_t*>(page) = 1;
+    uint64_t written_bits = 0;
+    bool result =
+        ClearSoftDirtyBits() &&
+        (*static_cast<volatile uint8_t*>(page) = 2,
+         QueryPageWriteTracking(page, system_page_size, &written_bits,
+                                nullptr)) &&
+        written_bits == 1;
+    munmap(page, system_page_size);
+    return result;
+  }();
+  return supported;
+}
+#endif  // XE_PLATFORM_LINUX
+
+bool ResetPageWriteTracking() {
+#if XE_PLATFORM_LINUX
+  return IsSoftDirtySupported() && ClearSoftDirtyBits();
+#else
+  return false;
+#endif  // XE_PLATFORM_LINUX
+}
+
+bool QueryPageWriteTracking(const void* base_address, size_t length,
+                            uint64_t* written_bits, uint64_t* resident_bits) {
+#if XE_PLATFORM_LINUX
+  int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  size_t system_page_size = page_size();
+  size_t first_page = reinterpret_cast<uintptr_t>(base_address) /
+                      system_page_size;
+  size_t page_count = (length + system_page_size - 1) / system_page_size;
+  if (written_bits) {
+    std::memset(written_bits, 0, (page_count + 63) / 64 * sizeof(uint64_t));
+  }
+  if (resident_bits) {
+    std::memset(resident_bits, 0, (page_count + 63) / 64 * sizeof(uint64_t));
+  }
+  // Each entry is 64 bits: bit 55 is soft-dirty, bit 63 is present.
+  uint64_t entries[4096];
+  for (size_t i = 0; i < page_count;) {
+    size_t entry_count = std::min(page_count - i, xe::countof(entries));
+    ssize_t read_size = pread(fd, entries, entry_count * sizeof(uint64_t),
+                              off_t((first_page + i) * sizeof(uint64_t)));
+    if (read_size <= 0) {
+      close(fd);
+      return false;
+    }
+    entry_count = size_t(read_size) / sizeof(uint64_t);
+    for (size_t j = 0; j < entry_count; ++j) {
+      uint64_t bit = uint64_t(1) << ((i + j) & 63);
+      if (written_bits && (entries[j] & (uint64_t(1) << 55))) {
+        written_bits[(i + j) >> 6] |= bit;
+      }
+      if (resident_bits && (entries[j] & (uint64_t(1) << 63))) {
+        resident_bits[(i + j) >> 6] |= bit;
+      }
+    }
+    i += entry_count;
+  }
+  close(fd);
+  return true;
+#else
+  return false;
+#endif  // XE_PLATFORM_LINUX
+}
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
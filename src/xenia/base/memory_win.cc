@@ -172,6 +172,17 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return true;
 }
 
+bool ResetPageWriteTracking() {
+  // Write watching with GetWriteWatch is only available for VirtualAlloc
+  // allocations, not for file mapping views.
+  return false;
+}
+
+bool QueryPageWriteTracking(const void* base_address, size_t length,
+                            uint64_t* written_bits, uint64_t* resident_bits) {
+  return false;
+}
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
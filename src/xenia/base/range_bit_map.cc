@@ -0,0 +1,344 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/range_bit_map.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+void RangeBitMap::Resize(uint32_t size_bits) {
+  size_bits_ = size_bits;
+  size_t word_count = (size_t(size_bits) + 63) >> 6;
+  size_t summary_word_count = (word_count + 63) >> 6;
+  words_.assign(word_count, 0);
+  words_with_set_.assign(summary_word_count, 0);
+  words_with_clear_.assign(summary_word_count, 0);
+  for (size_t i = 0; i < word_count; ++i) {
+    words_with_clear_[i >> 6] |= uint64_t(1) << (i & 63);
+  }
+  run_leaf_base_ = 1;
+  while (run_leaf_base_ < word_count) {
+    run_leaf_base_ <<= 1;
+  }
+  runs_.assign(run_leaf_base_ * 2, Runs{0, 0, 0});
+}
+
+void RangeBitMap::UpdateSummary(size_t word_index) {
+  uint64_t summary_bit = uint64_t(1) << (word_index & 63);
+  uint64_t word = words_[word_index];
+  if (word) {
+    words_with_set_[word_index >> 6] |= summary_bit;
+  } else {
+    words_with_set_[word_index >> 6] &= ~summary_bit;
+  }
+  if (~word) {
+    words_with_clear_[word_index >> 6] |= summary_bit;
+  } else {
+    words_with_clear_[word_index >> 6] &= ~summary_bit;
+  }
+}
+
+void RangeBitMap::SetRange(uint32_t first, uint32_t count, bool value) {
+  if (!count) {
+    return;
+  }
+  assert_true(uint64_t(first) + count <= size_bits_);
+  uint32_t last = first + count - 1;
+  size_t first_word = first >> 6;
+  size_t last_word = last >> 6;
+  for (size_t i = first_word; i <= last_word; ++i) {
+    uint64_t mask = ~uint64_t(0);
+    if (i == first_word) {
+      mask &= ~uint64_t(0) << (first & 63);
+    }
+    if (i == last_word) {
+      mask &= ~uint64_t(0) >> (63 - (last & 63));
+    }
+    if (value) {
+      words_[i] |= mask;
+    } else {
+      words_[i] &= ~mask;
+    }
+    UpdateSummary(i);
+  }
+  UpdateRuns(first_word, last_word);
+}
+
+void RangeBitMap::UpdateRuns(size_t first_word, size_t last_word) {
+  for (size_t i = first_word; i <= last_word; ++i) {
+    uint64_t word = words_[i];
+    Runs& leaf = runs_[run_leaf_base_ + i];
+    leaf.prefix = xe::tzcnt(~word);
+    leaf.suffix = xe::lzcnt(~word);
+    leaf.longest = 0;
+    for (uint64_t run_bits = word; run_bits; run_bits &= run_bits << 1) {
+      ++leaf.longest;
+    }
+  }
+  size_t first_node = run_leaf_base_ + first_word;
+  size_t last_node = run_leaf_base_ + last_word;
+  uint32_t child_size = 64;
+  while (first_node > 1) {
+    first_node >>= 1;
+    last_node >>= 1;
+    for (size_t i = first_node; i <= last_node; ++i) {
+      const Runs& left = runs_[i * 2];
+      const Runs& right = runs_[i * 2 + 1];
+      Runs& node = runs_[i];
+      node.prefix = left.prefix == child_size ? child_size + right.prefix
+                                              : left.prefix;
+      node.suffix = right.suffix == child_size ? child_size + left.suffix
+                                               : right.suffix;
+      node.longest = std::max(std::max(left.longest, right.longest),
+                              left.suffix + right.prefix);
+    }
+    child_size *= 2;
+  }
+}
+
+size_t RangeBitMap::FindFirstWord(bool value, size_t begin, size_t end) const {
+  const std::vector<uint64_t>& summary =
+      value ? words_with_set_ : words_with_clear_;
+  if (begin >= end) {
+    return SIZE_MAX;
+  }
+  size_t summary_index = begin >> 6;
+  uint64_t bits = summary[summary_index] & (~uint64_t(0) << (begin & 63));
+  while (!bits) {
+    if (++summary_index >= summary.size() || (summary_index << 6) >= end) {
+      return SIZE_MAX;
+    }
+    bits = summary[summary_index];
+  }
+  size_t word_index = (summary_index << 6) + xe::tzcnt(bits);
+  return word_index < end ? word_index : SIZE_MAX;
+}
+
+size_t RangeBitMap::FindLastWord(bool value, size_t begin, size_t end) const {
+  const std::vector<uint64_t>& summary =
+      value ? words_with_set_ : words_with_clear_;
+  if (begin >= end) {
+    return SIZE_MAX;
+  }
+  size_t summary_index = (end - 1) >> 6;
+  uint64_t bits =
+      summary[summary_index] & (~uint64_t(0) >> (63 - ((end - 1) & 63)));
+  while (!bits) {
+    if (!summary_index || (summary_index << 6) <= begin) {
+      return SIZE_MAX;
+    }
+    bits = summary[--summary_index];
+  }
+  size_t word_index = (summary_index << 6) + 63 - xe::lzcnt(bits);
+  return word_index >= begin ? word_index : SIZE_MAX;
+}
+
+uint32_t RangeBitMap::FindFirst(bool value, uint32_t begin,
+                                uint32_t end) const {
+  end = std::min(end, size_bits_);
+  if (begin >= end) {
+    return kNotFound;
+  }
+  size_t word_index = begin >> 6;
+  uint64_t bits = GetWord(value, word_index) & (~uint64_t(0) << (begin & 63));
+  if (!bits) {
+    word_index =
+        FindFirstWord(value, word_index + 1, (size_t(end) + 63) >> 6);
+    if (word_index == SIZE_MAX) {
+      return kNotFound;
+    }
+    bits = GetWord(value, word_index);
+  }
+  uint32_t index = uint32_t(word_index << 6) + xe::tzcnt(bits);
+  return index < end ? index : kNotFound;
+}
+
+uint32_t RangeBitMap::FindLast(bool value, uint32_t begin,
+                               uint32_t end) const {
+  end = std::min(end, size_bits_);
+  if (begin >= end) {
+    return kNotFound;
+  }
+  size_t word_index = (end - 1) >> 6;
+  uint64_t bits = GetWord(value, word_index) &
+                  (~uint64_t(0) >> (63 - ((end - 1) & 63)));
+  if (!bits) {
+    word_index = FindLastWord(value, begin >> 6, word_index);
+    if (word_index == SIZE_MAX) {
+      return kNotFound;
+    }
+    bits = GetWord(value, word_index);
+  }
+  uint32_t index = uint32_t(word_index << 6) + 63 - xe::lzcnt(bits);
+  return index >= begin ? index : kNotFound;
+}
+
+uint32_t RangeBitMap::FindRunForward(size_t node, uint32_t node_begin,
+                                     uint32_t node_size, uint32_t position,
+                                     uint32_t count, uint32_t& carry) const {
+  uint64_t node_end = uint64_t(node_begin) + node_size;
+  if (node_end <= position) {
+    carry = 0;
+    return kNotFound;
+  }
+  if (node_begin >= position) {
+    const Runs& runs = runs_[node];
+    if (carry + runs.prefix >= count) {
+      return node_begin - carry;
+    }
+    if (runs.longest < count) {
+      carry = runs.prefix == node_size ? carry + node_size : runs.suffix;
+      return kNotFound;
+    }
+  }
+  if (node >= run_leaf_base_) {
+    uint64_t bits = words_[node - run_leaf_base_];
+    if (position > node_begin) {
+      bits &= ~uint64_t(0) << (position - node_begin);
+    }
+    uint32_t i = 0;
+    while (i < 64) {
+      uint32_t ones = xe::tzcnt(~(bits >> i));
+      if (ones) {
+        if (carry + ones >= count) {
+          return node_begin + i - carry;
+        }
+        if (i + ones >= 64) {
+          carry += ones;
+          return kNotFound;
+        }
+        i += ones;
+      }
+      carry = 0;
+      uint64_t rest = bits >> i;
+      i = rest ? i + xe::tzcnt(rest) : 64;
+    }
+    return kNotFound;
+  }
+  uint32_t child_size = node_size / 2;
+  uint32_t result = FindRunForward(node * 2, node_begin, child_size, position,
+                                   count, carry);
+  if (result != kNotFound) {
+    return result;
+  }
+  return FindRunForward(node * 2 + 1, node_begin + child_size, child_size,
+                        position, count, carry);
+}
+
+uint32_t RangeBitMap::FindRunBackward(size_t node, uint32_t node_begin,
+                                      uint32_t node_size, uint32_t position,
+                                      uint32_t count, uint32_t& carry) const {
+  uint64_t node_end = uint64_t(node_begin) + node_size;
+  if (node_begin >= position) {
+    carry = 0;
+    return kNotFound;
+  }
+  if (node_end <= position) {
+    const Runs& runs = runs_[node];
+    if (carry + runs.suffix >= count) {
+      return uint32_t(node_end + carry - count);
+    }
+    if (runs.longest < count) {
+      carry = runs.suffix == node_size ? carry + node_size : runs.prefix;
+      return kNotFound;
+    }
+  }
+  if (node >= run_leaf_base_) {
+    uint64_t bits = words_[node - run_leaf_base_];
+    if (node_end > position) {
+      bits &= (uint64_t(1) << (position - node_begin)) - 1;
+    }
+    // i is the end of the part of the word not searched yet.
+    uint32_t i = 64;
+    while (i) {
+      uint32_t ones = xe::lzcnt(~(bits << (64 - i)));
+      if (ones) {
+        if (carry + ones >= count) {
+          return node_begin + i + carry - count;
+        }
+        if (ones >= i) {
+          carry += ones;
+          return kNotFound;
+        }
+        i -= ones;
+      }
+      carry = 0;
+      uint64_t rest = bits << (64 - i);
+      i = rest ? i - xe::lzcnt(rest) : 0;
+    }
+    return kNotFound;
+  }
+  uint32_t child_size = node_size / 2;
+  uint32_t result =
+      FindRunBackward(node * 2 + 1, node_begin + child_size, child_size,
+                      position, count, carry);
+  if (result != kNotFound) {
+    return result;
+  }
+  return FindRunBackward(node * 2, node_begin, child_size, position, count,
+                         carry);
+}
+
+uint32_t RangeBitMap::FindSetRun(uint32_t begin, uint32_t end, uint32_t count,
+                                 uint32_t alignment, bool highest) const {
+  end = std::min(end, size_bits_);
+  if (!count || begin >= end || count > end - begin) {
+    return kNotFound;
+  }
+  alignment = std::max(alignment, uint32_t(1));
+  uint32_t root_size = uint32_t(run_leaf_base_ * 64);
+  if (highest) {
+    // Take the highest run that is long enough, align its start down, and if
+    // that doesn't fit in it, retry below the run.
+    uint32_t position = end;
+    while (true) {
+      uint32_t carry = 0;
+      uint32_t run_begin =
+          FindRunBackward(1, 0, root_size, position, count, carry);
+      if (run_begin == kNotFound || run_begin < begin) {
+        return kNotFound;
+      }
+      run_begin -= run_begin % alignment;
+      if (run_begin < begin) {
+        return kNotFound;
+      }
+      uint32_t last_clear = FindLast(false, run_begin, run_begin + count);
+      if (last_clear == kNotFound) {
+        return run_begin;
+      }
+      position = last_clear;
+    }
+  }
+  uint32_t position = begin;
+  while (true) {
+    uint32_t carry = 0;
+    uint32_t run_begin =
+        FindRunForward(1, 0, root_size, position, count, carry);
+    if (run_begin == kNotFound) {
+      return kNotFound;
+    }
+    uint64_t aligned_run_begin =
+        (uint64_t(run_begin) + alignment - 1) / alignment * alignment;
+    if (aligned_run_begin + count > end) {
+      return kNotFound;
+    }
+    uint32_t first_clear = FindFirst(false, uint32_t(aligned_run_begin),
+                                     uint32_t(aligned_run_begin + count));
+    if (first_clear == kNotFound) {
+      return uint32_t(aligned_run_begin);
+    }
+    position = first_clear + 1;
+  }
+}
+
+}  // namespace xe
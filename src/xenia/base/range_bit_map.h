@@ -0,0 +1,97 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_RANGE_BIT_MAP_H_
+#define XENIA_BASE_RANGE_BIT_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Range Bit Map: finds runs of set bits, such as free pages for allocations.
+// Bits are stored 64 per word. A summary level with one bit per word records
+// whether the word has any set or any clear bits, so single bit searches skip
+// 4096 uniform bits per summary bit test and scan words with bit scans. Run
+// searches use a tree over the words holding the longest run of set bits in
+// each subtree, so runs too short for a request are skipped without being
+// visited. Not thread safe.
+class RangeBitMap {
+ public:
+  RangeBitMap() = default;
+  explicit RangeBitMap(uint32_t size_bits) { Resize(size_bits); }
+
+  uint32_t size() const { return size_bits_; }
+
+  // Resizes the bitmap and clears all bits.
+  void Resize(uint32_t size_bits);
+
+  bool Test(uint32_t index) const {
+    return (words_[index >> 6] >> (index & 63)) & 1;
+  }
+  void SetRange(uint32_t first, uint32_t count, bool value);
+  void SetAll(bool value) { SetRange(0, size_bits_, value); }
+
+  // Return the first or last index in [begin, end) with the given value, or
+  // kNotFound.
+  uint32_t FindFirst(bool value, uint32_t begin, uint32_t end) const;
+  uint32_t FindLast(bool value, uint32_t begin, uint32_t end) const;
+
+  // Returns the lowest, or highest if highest is set, index of a run of count
+  // set bits within [begin, end), starting at a multiple of alignment, or
+  // kNotFound.
+  uint32_t FindSetRun(uint32_t begin, uint32_t end, uint32_t count,
+                      uint32_t alignment, bool highest) const;
+
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+ private:
+  // Set bit runs of a subtree: at its start, at its end and the longest one.
+  struct Runs {
+    uint32_t prefix;
+    uint32_t suffix;
+    uint32_t longest;
+  };
+
+  void UpdateSummary(size_t word_index);
+  void UpdateRuns(size_t first_word, size_t last_word);
+  // Find the first run of count set bits starting at or after position, or
+  // the last one ending at or before it, within a subtree. carry is the
+  // length of the set run adjoining the subtree in the search direction.
+  uint32_t FindRunForward(size_t node, uint32_t node_begin, uint32_t node_size,
+                          uint32_t position, uint32_t count,
+                          uint32_t& carry) const;
+  uint32_t FindRunBackward(size_t node, uint32_t node_begin,
+                           uint32_t node_size, uint32_t position,
+                           uint32_t count, uint32_t& carry) const;
+  // Returns the first or last word index in [begin, end) containing any bits
+  // with the given value, or SIZE_MAX.
+  size_t FindFirstWord(bool value, size_t begin, size_t end) const;
+  size_t FindLastWord(bool value, size_t begin, size_t end) const;
+  uint64_t GetWord(bool value, size_t word_index) const {
+    return value ? words_[word_index] : ~words_[word_index];
+  }
+
+  uint32_t size_bits_ = 0;
+  // Bits past size_bits_ are kept clear.
+  std::vector<uint64_t> words_;
+  // Bit per word, set if the word has any set bits.
+  std::vector<uint64_t> words_with_set_;
+  // Bit per word, set if the word has any clear bits.
+  std::vector<uint64_t> words_with_clear_;
+  // Implicit binary tree, node i has children 2i and 2i + 1, and the leaves
+  // starting at run_leaf_base_ are the words, padded to a power of two.
+  size_t run_leaf_base_ = 0;
+  std::vector<Runs> runs_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_RANGE_BIT_MAP_H_
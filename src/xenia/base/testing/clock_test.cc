@@ -0,0 +1,149 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/clock.h"
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace base {
+namespace test {
+
+// Restores the guest clock configuration changed by a test.
+class ScopedGuestClock {
+ public:
+  ScopedGuestClock()
+      : no_scaling_(cvars::clock_no_scaling),
+        time_scalar_(Clock::guest_time_scalar()),
+        tick_frequency_(Clock::guest_tick_frequency()) {}
+  ~ScopedGuestClock() {
+    cvars::clock_no_scaling = false;
+    Clock::set_guest_time_scalar(time_scalar_);
+    Clock::set_guest_tick_frequency(tick_frequency_);
+    cvars::clock_no_scaling = no_scaling_;
+  }
+
+ private:
+  bool no_scaling_;
+  double time_scalar_;
+  uint64_t tick_frequency_;
+};
+
+TEST_CASE("Guest tick count without scaling", "[clock]") {
+  ScopedGuestClock scoped_clock;
+  cvars::clock_no_scaling = false;
+  Clock::set_guest_time_scalar(1.0);
+  cvars::clock_no_scaling = true;
+  uint64_t host_frequency = Clock::QueryHostTickFrequency();
+
+  SECTION("Same frequency") {
+    Clock::set_guest_tick_frequency(host_frequency);
+    uint64_t host_before = Clock::QueryHostTickCount();
+    uint64_t guest = Clock::QueryGuestTickCount();
+    uint64_t host_after = Clock::QueryHostTickCount();
+    REQUIRE(guest >= host_before);
+    REQUIRE(guest <= host_after);
+  }
+
+  SECTION("Fractional ratio") {
+    // Not exactly representable in binary.
+    Clock::set_guest_tick_frequency(host_frequency * 10 / 3);
+    uint64_t start_host = Clock::QueryHostTickCount();
+    uint64_t start_guest = Clock::QueryGuestTickCount();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    uint64_t end_guest = Clock::QueryGuestTickCount();
+    uint64_t end_host = Clock::QueryHostTickCount();
+    double ratio =
+        double(end_guest - start_guest) / double(end_host - start_host);
+    REQUIRE(ratio > 10.0 / 3.0 * 0.99);
+    REQUIRE(ratio <= 10.0 / 3.0);
+  }
+}
+
+TEST_CASE("Guest tick count with scaling", "[clock]") {
+  ScopedGuestClock scoped_clock;
+  cvars::clock_no_scaling = false;
+  Clock::set_guest_time_scalar(1.0);
+  uint64_t guest_frequency = Clock::guest_tick_frequency();
+
+  SECTION("Continues across ratio changes") {
+    uint64_t last_guest = Clock::QueryGuestTickCount();
+    for (double scalar : {2.0, 0.5, 4.0, 1.0}) {
+      Clock::set_guest_time_scalar(scalar);
+      uint64_t guest = Clock::QueryGuestTickCount();
+      REQUIRE(guest >= last_guest);
+      // Well below a second, even on a busy machine.
+      REQUIRE(guest - last_guest < guest_frequency);
+      last_guest = guest;
+    }
+  }
+
+  SECTION("Runs at the guest frequency") {
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t start_guest = Clock::QueryGuestTickCount();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint64_t end_guest = Clock::QueryGuestTickCount();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_time;
+    double guest_seconds =
+        double(end_guest - start_guest) / double(guest_frequency);
+    REQUIRE(guest_seconds > elapsed.count() * 0.9);
+    REQUIRE(guest_seconds < elapsed.count() * 1.1);
+  }
+}
+
+TEST_CASE("Guest tick count throughput", "[.benchmark][clock]") {
+  ScopedGuestClock scoped_clock;
+  const uint32_t queries_per_thread = 10000000;
+  for (bool no_scaling : {false, true}) {
+    cvars::clock_no_scaling = false;
+    Clock::set_guest_time_scalar(1.0);
+    cvars::clock_no_scaling = no_scaling;
+    // The 6 hardware threads of the guest busy-polling the time base.
+    for (uint32_t thread_count : {1, 6}) {
+      std::atomic<bool> start(false);
+      std::atomic<uint64_t> checksum(0);
+      std::vector<std::thread> threads;
+      for (uint32_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&]() {
+          while (!start.load(std::memory_order_acquire)) {
+          }
+          uint64_t local_checksum = 0;
+          for (uint32_t n = 0; n < queries_per_thread; ++n) {
+            local_checksum += Clock::QueryGuestTickCount();
+          }
+          checksum += local_checksum;
+        });
+      }
+      auto start_time = std::chrono::steady_clock::now();
+      start.store(true, std::memory_order_release);
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start_time;
+      REQUIRE(checksum != 0);
+
+      double queries = double(queries_per_thread) * thread_count;
+      fmt::print("Guest clock, clock_no_scaling {}: {} thread(s): {:.2f} "
+                 "Mqueries/s\n",
+                 no_scaling, thread_count, queries / elapsed.count() / 1e6);
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
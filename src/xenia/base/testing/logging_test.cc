@@ -0,0 +1,162 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+DECLARE_path(log_file);
+DECLARE_bool(log_to_stdout);
+DECLARE_bool(flush_log);
+
+namespace xe {
+namespace base {
+namespace test {
+
+// Restarts the logger of the test suite with only a file sink, and restores it
+// when done.
+class ScopedFileLogging {
+ public:
+  explicit ScopedFileLogging(bool flush)
+      : path_(std::filesystem::temp_directory_path() /
+              "xenia_logging_test.log"),
+        old_log_file_(cvars::log_file),
+        old_log_to_stdout_(cvars::log_to_stdout),
+        old_flush_log_(cvars::flush_log) {
+    ShutdownLogging();
+    cvars::log_file = path_;
+    cvars::log_to_stdout = false;
+    cvars::flush_log = flush;
+    InitializeLogging("xenia-base-tests");
+  }
+
+  ~ScopedFileLogging() {
+    Stop();
+    std::filesystem::remove(path_);
+    cvars::log_file = old_log_file_;
+    cvars::log_to_stdout = old_log_to_stdout_;
+    cvars::flush_log = old_flush_log_;
+    InitializeLogging("xenia-base-tests");
+  }
+
+  // Writes out everything logged so far.
+  void Stop() {
+    if (!stopped_) {
+      ShutdownLogging();
+      stopped_ = true;
+    }
+  }
+
+  std::vector<std::string> ReadLines() {
+    std::vector<std::string> lines;
+    std::ifstream file(path_);
+    std::string line;
+    while (std::getline(file, line)) {
+      lines.push_back(line);
+    }
+    return lines;
+  }
+
+ private:
+  std::filesystem::path path_;
+  std::filesystem::path old_log_file_;
+  bool old_log_to_stdout_;
+  bool old_flush_log_;
+  bool stopped_ = false;
+};
+
+void LogLines(uint32_t thread_index, uint32_t line_count) {
+  for (uint32_t i = 0; i < line_count; ++i) {
+    if (i & 1) {
+      logging::AppendLogLineDeferred(LogLevel::Info, 'i',
+                                     "thread {} line {} value {:.2f}",
+                                     thread_index, i, i * 0.5);
+    } else {
+      logging::AppendLogLineFormat(LogLevel::Info, 'i',
+                                   "thread {} line {} value {:.2f}",
+                                   thread_index, i, i * 0.5);
+    }
+  }
+}
+
+TEST_CASE("Log lines from many threads", "[logging]") {
+  const uint32_t thread_count = 4;
+  const uint32_t line_count = 20000;
+  ScopedFileLogging logging(true);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back(LogLines, i, line_count);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // Longer than the formatting buffer of a thread.
+  std::string long_line(100000, 'x');
+  logging::AppendLogLine(LogLevel::Info, 'i', long_line);
+  logging.Stop();
+
+  auto lines = logging.ReadLines();
+  REQUIRE(lines.size() == thread_count * line_count + 1);
+  // Lines of a thread are in order, and every line is intact.
+  std::vector<uint32_t> next_lines(thread_count, 0);
+  for (size_t i = 0; i + 1 < lines.size(); ++i) {
+    const std::string& line = lines[i];
+    REQUIRE(line.size() > 12);
+    REQUIRE(line.compare(0, 3, "i> ") == 0);
+    uint32_t thread_index = uint32_t(std::stoul(line.substr(19)));
+    REQUIRE(thread_index < thread_count);
+    uint32_t line_index = next_lines[thread_index]++;
+    REQUIRE(line.substr(12) == fmt::format("thread {} line {} value {:.2f}",
+                                           thread_index, line_index,
+                                           line_index * 0.5));
+  }
+  REQUIRE(lines.back() == "i> " + lines.back().substr(3, 9) + long_line);
+}
+
+TEST_CASE("Logging throughput", "[.benchmark][logging]") {
+  const uint32_t line_count = 1000000;
+  for (uint32_t thread_count : {1, 4}) {
+    for (bool flush : {false, true}) {
+      using Clock = std::chrono::steady_clock;
+      auto start_time = Clock::now();
+      std::chrono::duration<double> append_time;
+      {
+        ScopedFileLogging logging(flush);
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < thread_count; ++i) {
+          threads.emplace_back(LogLines, i, line_count / thread_count);
+        }
+        for (auto& thread : threads) {
+          thread.join();
+        }
+        append_time = Clock::now() - start_time;
+        logging.Stop();
+      }
+      std::chrono::duration<double> total_time = Clock::now() - start_time;
+      fmt::print(
+          "{} threads, flush_log {}: {:.2f} M lines/s logged, {:.2f} M "
+          "lines/s written\n",
+          thread_count, flush, line_count / append_time.count() / 1e6,
+          line_count / total_time.count() / 1e6);
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -0,0 +1,263 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/range_bit_map.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace base {
+namespace test {
+
+static uint32_t FindSetRunReference(const std::vector<bool>& bits,
+                                    uint32_t begin, uint32_t end,
+                                    uint32_t count, uint32_t alignment,
+                                    bool highest) {
+  uint32_t result = RangeBitMap::kNotFound;
+  for (uint64_t run_begin = (begin + alignment - 1) / alignment * alignment;
+       run_begin + count <= end; run_begin += alignment) {
+    bool all_set = true;
+    for (uint32_t i = 0; all_set && i < count; ++i) {
+      all_set = bits[size_t(run_begin) + i];
+    }
+    if (all_set) {
+      result = uint32_t(run_begin);
+      if (!highest) {
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+TEST_CASE("RangeBitMap set and find", "[range_bit_map]") {
+  RangeBitMap bit_map(200);
+  REQUIRE(bit_map.FindFirst(true, 0, 200) == RangeBitMap::kNotFound);
+  REQUIRE(bit_map.FindFirst(false, 0, 200) == 0);
+  REQUIRE(bit_map.FindLast(false, 0, 200) == 199);
+
+  bit_map.SetRange(60, 10, true);
+  REQUIRE(bit_map.Test(60));
+  REQUIRE(bit_map.Test(69));
+  REQUIRE_FALSE(bit_map.Test(70));
+  REQUIRE(bit_map.FindFirst(true, 0, 200) == 60);
+  REQUIRE(bit_map.FindFirst(true, 65, 200) == 65);
+  REQUIRE(bit_map.FindFirst(true, 70, 200) == RangeBitMap::kNotFound);
+  REQUIRE(bit_map.FindLast(true, 0, 200) == 69);
+  REQUIRE(bit_map.FindLast(true, 0, 65) == 64);
+  REQUIRE(bit_map.FindLast(true, 0, 60) == RangeBitMap::kNotFound);
+  REQUIRE(bit_map.FindFirst(false, 60, 200) == 70);
+  REQUIRE(bit_map.FindLast(false, 0, 70) == 59);
+
+  REQUIRE(bit_map.FindSetRun(0, 200, 10, 1, false) == 60);
+  REQUIRE(bit_map.FindSetRun(0, 200, 11, 1, false) == RangeBitMap::kNotFound);
+  REQUIRE(bit_map.FindSetRun(0, 200, 4, 4, false) == 60);
+  REQUIRE(bit_map.FindSetRun(0, 200, 4, 4, true) == 64);
+  REQUIRE(bit_map.FindSetRun(0, 200, 4, 8, false) == 64);
+  REQUIRE(bit_map.FindSetRun(0, 68, 4, 8, false) == 64);
+  REQUIRE(bit_map.FindSetRun(0, 67, 4, 8, false) == RangeBitMap::kNotFound);
+
+  bit_map.SetAll(true);
+  REQUIRE(bit_map.FindFirst(false, 0, 200) == RangeBitMap::kNotFound);
+  REQUIRE(bit_map.FindSetRun(0, 200, 200, 1, true) == 0);
+  REQUIRE(bit_map.FindSetRun(0, 200, 199, 1, true) == 1);
+}
+
+TEST_CASE("RangeBitMap matches linear search", "[range_bit_map]") {
+  std::mt19937 random(0x5EED);
+  for (uint32_t size : {64u, 1000u, 4096u, 9000u}) {
+    RangeBitMap bit_map(size);
+    std::vector<bool> bits(size, false);
+    for (uint32_t step = 0; step < 2000; ++step) {
+      uint32_t first = random() % size;
+      uint32_t count = 1 + random() % std::min(size - first, uint32_t(300));
+      bool value = random() & 1;
+      bit_map.SetRange(first, count, value);
+      for (uint32_t i = first; i < first + count; ++i) {
+        bits[i] = value;
+      }
+
+      uint32_t begin = random() % size;
+      uint32_t end = begin + random() % (size - begin + 1);
+      for (uint32_t i = 0; i < 4; ++i) {
+        uint32_t run_count = 1 + random() % 64;
+        uint32_t alignment = 1u << (random() % 5);
+        bool highest = i & 1;
+        REQUIRE(bit_map.FindSetRun(begin, end, run_count, alignment,
+                                   highest) ==
+                FindSetRunReference(bits, begin, end, run_count, alignment,
+                                    highest));
+      }
+    }
+  }
+}
+
+// The page table walk BaseHeap::AllocRange used before, for comparison.
+static uint32_t FindSetRunPageWalk(const std::vector<bool>& bits,
+                                   uint32_t begin, uint32_t end,
+                                   uint32_t count, uint32_t alignment,
+                                   bool highest) {
+  if (highest) {
+    for (int64_t base = int64_t(end) - (count + alignment - 1) / alignment *
+                                           alignment;
+         base >= int64_t(begin); base -= alignment) {
+      if (!bits[size_t(base)]) {
+        continue;
+      }
+      uint32_t i = 0;
+      for (; i < count && bits[size_t(base) + i]; ++i) {
+      }
+      if (i == count) {
+        return uint32_t(base);
+      }
+      uint32_t used = uint32_t(base) + i;
+      if (used < count) {
+        break;
+      }
+      base = used - count;
+      base = base - base % alignment + alignment;
+    }
+    return RangeBitMap::kNotFound;
+  }
+  for (uint32_t base = begin; base + count <= end; base += alignment) {
+    if (!bits[base]) {
+      continue;
+    }
+    uint32_t i = 0;
+    for (; i < count && bits[base + i]; ++i) {
+    }
+    if (i == count) {
+      return base;
+    }
+    base = (base + i + 1 + alignment - 1) / alignment * alignment - alignment;
+  }
+  return RangeBitMap::kNotFound;
+}
+
+TEST_CASE("RangeBitMap heap allocation", "[.benchmark][range_bit_map]") {
+  // A 512 MB heap of 4 KB pages, set bits are free pages.
+  const uint32_t page_count = 512 * 1024 / 4;
+  const uint32_t operation_count = 20000;
+
+  struct Pattern {
+    const char* name;
+    uint32_t min_pages;
+    uint32_t max_pages;
+    uint32_t alignment;
+    // Percentage of the heap filled before measuring.
+    uint32_t fill_percent;
+    bool top_down;
+  };
+  const Pattern patterns[] = {
+      {"streaming, small", 1, 16, 1, 50, false},
+      {"streaming, small, top-down", 1, 16, 1, 50, true},
+      {"streaming, mixed, 64 KB aligned", 1, 256, 16, 70, false},
+      {"fragmented, large", 64, 1024, 16, 85, false},
+  };
+
+  for (const Pattern& pattern : patterns) {
+    std::mt19937 random(0xA110C);
+    RangeBitMap bit_map(page_count);
+    bit_map.SetAll(true);
+    std::vector<bool> bits(page_count, true);
+    struct Allocation {
+      uint32_t first;
+      uint32_t count;
+    };
+    std::vector<Allocation> allocations;
+    uint32_t used_pages = 0;
+    auto random_count = [&]() {
+      return pattern.min_pages +
+             random() % (pattern.max_pages - pattern.min_pages + 1);
+    };
+    auto allocate = [&](uint32_t count, uint32_t first) {
+      bit_map.SetRange(first, count, false);
+      for (uint32_t i = first; i < first + count; ++i) {
+        bits[i] = false;
+      }
+      allocations.push_back({first, count});
+      used_pages += count;
+    };
+    auto release_random = [&]() {
+      size_t index = random() % allocations.size();
+      Allocation allocation = allocations[index];
+      allocations[index] = allocations.back();
+      allocations.pop_back();
+      bit_map.SetRange(allocation.first, allocation.count, true);
+      for (uint32_t i = allocation.first;
+           i < allocation.first + allocation.count; ++i) {
+        bits[i] = true;
+      }
+      used_pages -= allocation.count;
+    };
+
+    // Fill and then punch holes to fragment the heap.
+    while (used_pages < page_count / 100 * pattern.fill_percent) {
+      uint32_t count = random_count();
+      uint32_t first = bit_map.FindSetRun(0, page_count, count,
+                                          pattern.alignment, pattern.top_down);
+      if (first == RangeBitMap::kNotFound) {
+        break;
+      }
+      allocate(count, first);
+    }
+    for (size_t i = allocations.size() / 4; i; --i) {
+      release_random();
+    }
+    while (used_pages < page_count / 100 * pattern.fill_percent) {
+      uint32_t count = random_count();
+      uint32_t first = bit_map.FindSetRun(0, page_count, count,
+                                          pattern.alignment, pattern.top_down);
+      if (first == RangeBitMap::kNotFound) {
+        break;
+      }
+      allocate(count, first);
+    }
+
+    // Steady state churn: allocate and release one allocation at a time,
+    // timing only the searches.
+    std::chrono::steady_clock::duration bit_map_time{}, page_walk_time{};
+    for (uint32_t i = 0; i < operation_count; ++i) {
+      uint32_t count = random_count();
+      auto start_time = std::chrono::steady_clock::now();
+      uint32_t first = bit_map.FindSetRun(0, page_count, count,
+                                          pattern.alignment, pattern.top_down);
+      auto bit_map_end_time = std::chrono::steady_clock::now();
+      uint32_t walk_first = FindSetRunPageWalk(
+          bits, 0, page_count, count, pattern.alignment, pattern.top_down);
+      auto page_walk_end_time = std::chrono::steady_clock::now();
+      bit_map_time += bit_map_end_time - start_time;
+      page_walk_time += page_walk_end_time - bit_map_end_time;
+      REQUIRE(first == walk_first);
+      if (first != RangeBitMap::kNotFound) {
+        allocate(count, first);
+      }
+      release_random();
+    }
+
+    auto per_operation_ns = [&](std::chrono::steady_clock::duration time) {
+      return std::chrono::duration<double, std::nano>(time).count() /
+             operation_count;
+    };
+    fmt::print(
+        "{}: {} live allocations, bit map {:.0f} ns, page walk {:.0f} ns per "
+        "search\n",
+        pattern.name, allocations.size(), per_operation_ns(bit_map_time),
+        per_operation_ns(page_walk_time));
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -7,15 +7,21 @@
 ******************************************************************************
 */
 
+#include <algorithm>
 #include <array>
 
+#include "xenia/base/cvar.h"
 #include "xenia/base/threading.h"
 
+#include "third_party/fmt/include/fmt/format.h"
+
 #define CATCH_CONFIG_ENABLE_CHRONO_STRINGMAKER
 #include "third_party/catch/include/catch.hpp"
 
 #include "third_party/disruptorplus/include/disruptorplus/spin_wait.hpp"
 
+DECLARE_uint32(sleep_spin_us);
+
 namespace xe {
 namespace base {
 namespace test {
@@ -145,6 +151,25 @@ TEST_CASE("Sleep Current Thread in Alertable State", "[sleep]") {
   // Need callback to call extended I/O function (ReadFileEx or WriteFileEx)
 }
 
+TEST_CASE("Sleep Current Thread for less than a Millisecond", "[sleep]") {
+  for (uint32_t spin_us : {0, 200}) {
+    INFO(spin_us);
+    auto old_spin_us = cvars::sleep_spin_us;
+    cvars::sleep_spin_us = spin_us;
+    for (auto wait_time : {100us, 500us}) {
+      auto start = std::chrono::steady_clock::now();
+      Sleep(wait_time);
+      auto duration = std::chrono::steady_clock::now() - start;
+      REQUIRE(duration >= wait_time);
+      start = std::chrono::steady_clock::now();
+      AlertableSleep(wait_time);
+      duration = std::chrono::steady_clock::now() - start;
+      REQUIRE(duration >= wait_time);
+    }
+    cvars::sleep_spin_us = old_spin_us;
+  }
+}
+
 TEST_CASE("TlsHandle") {
   // Test Allocate
   auto handle = threading::AllocateTlsHandle();
@@ -333,6 +358,21 @@ TEST_CASE("Wait on Multiple Handles", "[wait]") {
   REQUIRE(all_result == WaitResult::kSuccess);
 }
 
+TEST_CASE("Wait with a Timeout too long for a Deadline", "[wait]") {
+  auto timeout = std::chrono::nanoseconds::max() - 1ns;
+  REQUIRE(DeadlineAfter(timeout) ==
+          std::chrono::steady_clock::time_point::max());
+
+  auto event_ = Event::CreateManualResetEvent(false);
+  REQUIRE(event_);
+  auto thread = Thread::Create({}, [&event_] {
+    Sleep(10ms);
+    event_->Set();
+  });
+  REQUIRE(Wait(event_.get(), false, timeout) == WaitResult::kSuccess);
+  REQUIRE(Wait(thread.get(), false, 100ms) == WaitResult::kSuccess);
+}
+
 TEST_CASE("Signal and Wait") {
   WaitResult result;
   auto mutant = Mutant::Create(true);
@@ -846,6 +886,28 @@ TEST_CASE("Wait on Timer", "[timer]") {
   REQUIRE(result == WaitResult::kTimeout);  // No more signals from repeating
 }
 
+TEST_CASE("Timer due in less than a Millisecond", "[timer]") {
+  auto timer = Timer::CreateSynchronizationTimer();
+  REQUIRE(timer);
+  for (auto due_time : {100us, 500us}) {
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(timer->SetOnceAfter(due_time));
+    REQUIRE(Wait(timer.get(), false, 100ms) == WaitResult::kSuccess);
+    auto duration = std::chrono::steady_clock::now() - start;
+    REQUIRE(duration >= due_time);
+  }
+
+  // Periods are not rounded to milliseconds.
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(timer->SetRepeatingAfter(250us, 250us));
+  for (int i = 0; i < 8; ++i) {
+    REQUIRE(Wait(timer.get(), false, 100ms) == WaitResult::kSuccess);
+  }
+  auto duration = std::chrono::steady_clock::now() - start;
+  timer->Cancel();
+  REQUIRE(duration >= 2ms);
+}
+
 TEST_CASE("Wait on Multiple Timers", "[timer]") {
   WaitResult all_result;
   std::pair<WaitResult, size_t> any_result;
@@ -1142,6 +1204,96 @@ TEST_CASE("Test Thread QueueUserCallback", "[thread]") {
   // callbacks.
 }
 
+TEST_CASE("Signal to wake latency under contention", "[.benchmark][event]") {
+  // Each waiter blocks on its own event while one of them is pinged at a
+  // time, so every signal has many uninvolved waiting threads around it.
+  const size_t waiter_count = 128;
+  const size_t round_count = 100;
+  std::vector<std::unique_ptr<Event>> ping_events;
+  std::vector<std::unique_ptr<Event>> pong_events;
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (size_t i = 0; i < waiter_count; ++i) {
+    ping_events.push_back(Event::CreateAutoResetEvent(false));
+    pong_events.push_back(Event::CreateAutoResetEvent(false));
+  }
+  std::vector<std::chrono::steady_clock::time_point> wake_times(waiter_count);
+  for (size_t i = 0; i < waiter_count; ++i) {
+    threads.push_back(Thread::Create({}, [&, i] {
+      for (size_t round = 0; round < round_count; ++round) {
+        Wait(ping_events[i].get(), false);
+        wake_times[i] = std::chrono::steady_clock::now();
+        pong_events[i]->Set();
+      }
+    }));
+  }
+
+  std::vector<double> latencies_us;
+  latencies_us.reserve(waiter_count * round_count);
+  for (size_t round = 0; round < round_count; ++round) {
+    for (size_t i = 0; i < waiter_count; ++i) {
+      auto signal_time = std::chrono::steady_clock::now();
+      ping_events[i]->Set();
+      REQUIRE(Wait(pong_events[i].get(), false, 1s) == WaitResult::kSuccess);
+      latencies_us.push_back(std::chrono::duration<double, std::micro>(
+                                 wake_times[i] - signal_time)
+                                 .count());
+    }
+  }
+  for (auto& thread : threads) {
+    REQUIRE(Wait(thread.get(), false, 1s) == WaitResult::kSuccess);
+  }
+
+  std::sort(latencies_us.begin(), latencies_us.end());
+  double total_us = 0.0;
+  for (double latency_us : latencies_us) {
+    total_us += latency_us;
+  }
+  fmt::print(
+      "Signal to wake with {} waiters: mean {:.2f}us, median {:.2f}us, "
+      "p99 {:.2f}us\n",
+      waiter_count, total_us / latencies_us.size(),
+      latencies_us[latencies_us.size() / 2],
+      latencies_us[latencies_us.size() * 99 / 100]);
+}
+
+TEST_CASE("Sleep and timer overshoot", "[.benchmark][sleep]") {
+  // How late sleeps and timers wake up past their deadline, which is what a
+  // guest frame limiter or audio pump waiting on short delays sees as jitter.
+  const size_t round_count = 200;
+  auto old_spin_us = cvars::sleep_spin_us;
+  auto timer = Timer::CreateSynchronizationTimer();
+  for (uint32_t spin_us : {0, 200}) {
+    cvars::sleep_spin_us = spin_us;
+    for (auto wait_time : {100us, 500us, 1000us}) {
+      for (bool use_timer : {false, true}) {
+        double total_us = 0.0;
+        double max_us = 0.0;
+        for (size_t round = 0; round < round_count; ++round) {
+          auto start = std::chrono::steady_clock::now();
+          if (use_timer) {
+            REQUIRE(timer->SetOnceAfter(wait_time));
+            REQUIRE(Wait(timer.get(), false, 1s) == WaitResult::kSuccess);
+          } else {
+            Sleep(wait_time);
+          }
+          double overshoot_us = std::chrono::duration<double, std::micro>(
+                                    std::chrono::steady_clock::now() - start -
+                                    wait_time)
+                                    .count();
+          total_us += overshoot_us;
+          max_us = std::max(max_us, overshoot_us);
+        }
+        fmt::print(
+            "{} {}us, sleep_spin_us {}: overshoot mean {:.2f}us, max "
+            "{:.2f}us\n",
+            use_timer ? "Timer" : "Sleep", wait_time.count(), spin_us,
+            total_us / round_count, max_us);
+      }
+    }
+  }
+  cvars::sleep_spin_us = old_spin_us;
+}
+
 }  // namespace test
 }  // namespace base
 }  // namespace xe
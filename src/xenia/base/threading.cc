@@ -9,6 +9,15 @@
 
 #include "xenia/base/threading.h"
 
+#include "xenia/base/cvar.h"
+
+DEFINE_uint32(
+    sleep_spin_us, 0,
+    "Microseconds at the end of sleeps and timer waits to spend spinning "
+    "instead of waiting for the host scheduler. Makes short guest delays and "
+    "timers more precise at the cost of CPU time.",
+    "CPU");
+
 namespace xe {
 namespace threading {
 
@@ -29,5 +38,25 @@ uint32_t current_thread_id() {
 
 void set_current_thread_id(uint32_t id) { current_thread_id_ = id; }
 
+std::chrono::steady_clock::time_point DeadlineAfter(
+    std::chrono::nanoseconds duration) {
+  auto now = std::chrono::steady_clock::now();
+  if (duration >= std::chrono::steady_clock::time_point::max() - now) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return now + duration;
+}
+
+std::chrono::steady_clock::time_point SpinStartTime(
+    std::chrono::steady_clock::time_point deadline) {
+  return deadline - std::chrono::microseconds(cvars::sleep_spin_us);
+}
+
+void SpinUntil(std::chrono::steady_clock::time_point deadline) {
+  while (std::chrono::steady_clock::now() < deadline) {
+    MaybeYield();
+  }
+}
+
 }  // namespace threading
 }  // namespace xe
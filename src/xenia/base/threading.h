@@ -114,12 +114,24 @@ void MaybeYield();
 void SyncMemory();
 
 // Sleeps the current thread for at least as long as the given duration.
-void Sleep(std::chrono::microseconds duration);
+void Sleep(std::chrono::nanoseconds duration);
 template <typename Rep, typename Period>
 void Sleep(std::chrono::duration<Rep, Period> duration) {
-  Sleep(std::chrono::duration_cast<std::chrono::microseconds>(duration));
+  Sleep(std::chrono::duration_cast<std::chrono::nanoseconds>(duration));
 }
 
+// Time point the given duration after now, saturated to
+// steady_clock::time_point::max() if it can't be represented.
+std::chrono::steady_clock::time_point DeadlineAfter(
+    std::chrono::nanoseconds duration);
+
+// Sleeps and timer waits end this long before their deadline, set by the
+// sleep_spin_us cvar, and spin until the deadline with SpinUntil for precision
+// beyond the granularity of the host scheduler.
+std::chrono::steady_clock::time_point SpinStartTime(
+    std::chrono::steady_clock::time_point deadline);
+void SpinUntil(std::chrono::steady_clock::time_point deadline);
+
 enum class SleepResult {
   kSuccess,
   kAlerted,
@@ -128,11 +140,11 @@ enum class SleepResult {
 // The thread is put in an alertable state and may wake to dispatch user
 // callbacks. If this happens the sleep returns early with
 // SleepResult::kAlerted.
-SleepResult AlertableSleep(std::chrono::microseconds duration);
+SleepResult AlertableSleep(std::chrono::nanoseconds duration);
 template <typename Rep, typename Period>
 SleepResult AlertableSleep(std::chrono::duration<Rep, Period> duration) {
   return AlertableSleep(
-      std::chrono::duration_cast<std::chrono::microseconds>(duration));
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration));
 }
 
 typedef uint32_t TlsHandle;
@@ -217,7 +229,7 @@ class WaitHandle {
 // if the timeout is max() the wait will not time out.
 WaitResult Wait(
     WaitHandle* wait_handle, bool is_alertable,
-    std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
 
 // Signals one object and waits on another object as a single operation.
 // Waits until the wait handle is in the signaled state, an alert triggers and
@@ -227,12 +239,12 @@ WaitResult Wait(
 WaitResult SignalAndWait(
     WaitHandle* wait_handle_to_signal, WaitHandle* wait_handle_to_wait_on,
     bool is_alertable,
-    std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
 
 std::pair<WaitResult, size_t> WaitMultiple(
     WaitHandle* wait_handles[], size_t wait_handle_count, bool wait_all,
     bool is_alertable,
-    std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
 
 // Waits until all of the specified objects are in the signaled state, a
 // user callback is queued to the thread, or the time-out interval elapses.
@@ -240,14 +252,14 @@ std::pair<WaitResult, size_t> WaitMultiple(
 // if the timeout is max() the wait will not time out.
 inline WaitResult WaitAll(
     WaitHandle* wait_handles[], size_t wait_handle_count, bool is_alertable,
-    std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) {
   return WaitMultiple(wait_handles, wait_handle_count, true, is_alertable,
                       timeout)
       .first;
 }
 inline WaitResult WaitAll(
     std::vector<WaitHandle*> wait_handles, bool is_alertable,
-    std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) {
   return WaitAll(wait_handles.data(), wait_handles.size(), is_alertable,
                  timeout);
 }
@@ -260,13 +272,13 @@ inline WaitResult WaitAll(
 // the wait to be satisfied or abandoned.
 inline std::pair<WaitResult, size_t> WaitAny(
     WaitHandle* wait_handles[], size_t wait_handle_count, bool is_alertable,
-    std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) {
   return WaitMultiple(wait_handles, wait_handle_count, false, is_alertable,
                       timeout);
 }
 inline std::pair<WaitResult, size_t> WaitAny(
     std::vector<WaitHandle*> wait_handles, bool is_alertable,
-    std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) {
   return WaitAny(wait_handles.data(), wait_handles.size(), is_alertable,
                  timeout);
 }
@@ -371,13 +383,13 @@ class Timer : public WaitHandle {
   // the period elapses, until the timer is canceled or reset.
   // Returns true on success.
   virtual bool SetRepeatingAfter(
-      xe::chrono::hundrednanoseconds rel_time, std::chrono::milliseconds period,
+      xe::chrono::hundrednanoseconds rel_time, std::chrono::nanoseconds period,
       std::function<void()> opt_callback = nullptr) = 0;
   virtual bool SetRepeatingAt(WClock_::time_point due_time,
-                              std::chrono::milliseconds period,
+                              std::chrono::nanoseconds period,
                               std::function<void()> opt_callback = nullptr) = 0;
   virtual bool SetRepeatingAt(GClock_::time_point due_time,
-                              std::chrono::milliseconds period,
+                              std::chrono::nanoseconds period,
                               std::function<void()> opt_callback = nullptr) = 0;
 
   // Stops the timer before it can be set to the signaled state and cancels
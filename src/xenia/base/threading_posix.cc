@@ -17,12 +17,16 @@
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
+#include <linux/futex.h>
 #include <sys/eventfd.h>
+#include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <ctime>
 #include <memory>
@@ -145,23 +149,35 @@ void MaybeYield() {
 
 void SyncMemory() { __sync_synchronize(); }
 
-void Sleep(std::chrono::microseconds duration) {
-  timespec rqtp = DurationToTimeSpec(duration);
-  timespec rmtp = {};
-  auto p_rqtp = &rqtp;
-  auto p_rmtp = &rmtp;
-  int ret = 0;
-  do {
-    ret = nanosleep(p_rqtp, p_rmtp);
-    // Swap requested for remaining in case of signal interruption
-    // in which case, we start sleeping again for the remainder
-    std::swap(p_rqtp, p_rmtp);
-  } while (ret == -1 && errno == EINTR);
+void Sleep(std::chrono::nanoseconds duration) {
+  if (duration <= std::chrono::nanoseconds::zero()) {
+    // Like Sleep(0) on Windows, only give up the rest of the time slice.
+    MaybeYield();
+    return;
+  }
+#if XE_PLATFORM_LINUX
+  // Let the kernel wake the thread at the deadline rather than within the
+  // default 50us slack it may use to group wakeups.
+  static thread_local bool timer_slack_set = false;
+  if (!timer_slack_set) {
+    prctl(PR_SET_TIMERSLACK, 1);
+    timer_slack_set = true;
+  }
+#endif
+  // Sleep until an absolute deadline, so that restarting after a signal
+  // doesn't extend the sleep.
+  auto deadline = DeadlineAfter(duration);
+  auto spin_start = SpinStartTime(deadline);
+  timespec deadline_spec = DurationToTimeSpec(spin_start.time_since_epoch());
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline_spec,
+                         nullptr) == EINTR) {
+  }
+  SpinUntil(deadline);
 }
 
 // TODO(bwrsandman) Implement by allowing alert interrupts from IO operations
 thread_local bool alertable_state_ = false;
-SleepResult AlertableSleep(std::chrono::microseconds duration) {
+SleepResult AlertableSleep(std::chrono::nanoseconds duration) {
   alertable_state_ = true;
   Sleep(duration);
   alertable_state_ = false;
@@ -190,94 +206,182 @@ bool SetTlsValue(TlsHandle handle, uintptr_t value) {
                              reinterpret_cast<void*>(value)) == 0;
 }
 
+// Every wait registers one of these with each object it waits on. Objects
+// wake their own waiters when they become signaled, through a futex on the
+// wake token, so signaling an object never disturbs threads waiting on
+// anything else. A waiter blocked on several objects shares a single token
+// between them.
+struct PosixWaiter {
+  std::atomic<uint32_t> wake_token{0};
+
+  // Blocks until woken, or until the deadline if there is one.
+  // Returns false on timeout.
+  bool Sleep(const std::chrono::steady_clock::time_point* deadline) {
+    static_assert(sizeof(wake_token) == sizeof(uint32_t),
+                  "Wake token must be usable as a futex");
+    while (!wake_token.load(std::memory_order_acquire)) {
+      timespec timeout_spec;
+      timespec* timeout_spec_ptr = nullptr;
+      if (deadline) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= *deadline) {
+          return false;
+        }
+        timeout_spec = DurationToTimeSpec(*deadline - now);
+        timeout_spec_ptr = &timeout_spec;
+      }
+      // Returns early when the token has already changed, on spurious
+      // wakeups and on signals (suspension, user callbacks), all of which
+      // just recheck the token.
+      syscall(SYS_futex, &wake_token, FUTEX_WAIT_PRIVATE, 0, timeout_spec_ptr,
+              nullptr, 0);
+    }
+    return true;
+  }
+
+  void Wake() {
+    if (!wake_token.exchange(1, std::memory_order_release)) {
+      syscall(SYS_futex, &wake_token, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr,
+              0);
+    }
+  }
+};
+
 class PosixConditionBase {
  public:
+  virtual ~PosixConditionBase() = default;
+
   virtual bool Signal() = 0;
 
-  WaitResult Wait(std::chrono::milliseconds timeout) {
-    bool executed;
-    auto predicate = [this] { return this->signaled(); };
-    auto lock = std::unique_lock<std::mutex>(mutex_);
-    if (predicate()) {
-      executed = true;
-    } else {
-      if (timeout == std::chrono::milliseconds::max()) {
-        cond_.wait(lock, predicate);
-        executed = true;  // Did not time out;
-      } else {
-        executed = cond_.wait_for(lock, timeout, predicate);
-      }
-    }
-    if (executed) {
-      post_execution();
-      return WaitResult::kSuccess;
-    } else {
-      return WaitResult::kTimeout;
-    }
+  WaitResult Wait(std::chrono::nanoseconds timeout) {
+    PosixConditionBase* handle = this;
+    return WaitMultiple(&handle, 1, false, timeout).first;
   }
 
   static std::pair<WaitResult, size_t> WaitMultiple(
       std::vector<PosixConditionBase*>&& handles, bool wait_all,
-      std::chrono::milliseconds timeout) {
-    assert_true(handles.size() > 0);
+      std::chrono::nanoseconds timeout) {
+    return WaitMultiple(handles.data(), handles.size(), wait_all, timeout);
+  }
 
-    // Construct a condition for all or any depending on wait_all
-    std::function<bool()> predicate;
-    {
-      using iter_t = std::vector<PosixConditionBase*>::const_iterator;
-      const auto predicate_inner = [](auto h) { return h->signaled(); };
-      const auto operation =
-          wait_all ? std::all_of<iter_t, decltype(predicate_inner)>
-                   : std::any_of<iter_t, decltype(predicate_inner)>;
-      predicate = [&handles, operation, predicate_inner] {
-        return operation(handles.cbegin(), handles.cend(), predicate_inner);
-      };
+  static std::pair<WaitResult, size_t> WaitMultiple(
+      PosixConditionBase* const* handles, size_t handle_count, bool wait_all,
+      std::chrono::nanoseconds timeout) {
+    assert_true(handle_count > 0);
+
+    // Objects are always locked in address order so that waits on
+    // overlapping sets of objects can't deadlock. Holding all of them makes
+    // checking and acquiring the whole set atomic, as wait_all requires.
+    PosixConditionBase* single_lock_order = handles[0];
+    std::vector<PosixConditionBase*> multiple_lock_order;
+    PosixConditionBase* const* lock_order = &single_lock_order;
+    size_t lock_count = 1;
+    if (handle_count > 1) {
+      multiple_lock_order.assign(handles, handles + handle_count);
+      std::sort(multiple_lock_order.begin(), multiple_lock_order.end());
+      multiple_lock_order.erase(
+          std::unique(multiple_lock_order.begin(), multiple_lock_order.end()),
+          multiple_lock_order.end());
+      lock_order = multiple_lock_order.data();
+      lock_count = multiple_lock_order.size();
     }
+    auto lock_all = [lock_order, lock_count]() {
+      for (size_t i = 0; i < lock_count; ++i) {
+        lock_order[i]->mutex_.lock();
+      }
+    };
+    auto unlock_all = [lock_order, lock_count]() {
+      for (size_t i = lock_count; i-- > 0;) {
+        lock_order[i]->mutex_.unlock();
+      }
+    };
 
     // TODO(bwrsandman, Triang3l) This is controversial, see issue #1677
-    // This will probably cause a deadlock on the next thread doing any waiting
-    // if the thread is suspended between locking and waiting
-    std::unique_lock<std::mutex> lock(PosixConditionBase::mutex_);
-
-    bool wait_success = true;
-    // If the timeout is infinite, wait without timeout.
-    // The predicate will be checked before beginning the wait
-    if (timeout == std::chrono::milliseconds::max()) {
-      PosixConditionBase::cond_.wait(lock, predicate);
-    } else {
-      // Wait with timeout.
-      wait_success =
-          PosixConditionBase::cond_.wait_for(lock, timeout, predicate);
-    }
-    if (wait_success) {
+    // This will probably cause a deadlock on the next thread waiting on these
+    // objects if the thread is suspended between locking and waiting
+    // Timeouts too long for a deadline to be represented never expire.
+    std::chrono::steady_clock::time_point deadline = DeadlineAfter(timeout);
+    bool infinite = deadline == std::chrono::steady_clock::time_point::max();
+    PosixWaiter waiter;
+    bool registered = false;
+    bool timed_out = false;
+    auto result = std::make_pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+    lock_all();
+    while (true) {
       auto first_signaled = std::numeric_limits<size_t>::max();
-      for (auto i = 0u; i < handles.size(); ++i) {
+      bool all_signaled = true;
+      for (size_t i = 0; i < handle_count; ++i) {
         if (handles[i]->signaled()) {
-          if (first_signaled > i) {
-            first_signaled = i;
+          first_signaled = std::min(first_signaled, i);
+          if (!wait_all) {
+            break;
+          }
+        } else {
+          all_signaled = false;
+          if (wait_all) {
+            break;
           }
-          handles[i]->post_execution();
-          if (!wait_all) break;
         }
       }
-      assert_true(std::numeric_limits<size_t>::max() != first_signaled);
-      return std::make_pair(WaitResult::kSuccess, first_signaled);
-    } else {
-      return std::make_pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+      if (wait_all ? all_signaled
+                   : first_signaled != std::numeric_limits<size_t>::max()) {
+        if (wait_all) {
+          for (size_t i = 0; i < handle_count; ++i) {
+            handles[i]->post_execution();
+          }
+        } else {
+          handles[first_signaled]->post_execution();
+        }
+        result = std::make_pair(WaitResult::kSuccess, first_signaled);
+        break;
+      }
+      if (timed_out) {
+        break;
+      }
+      if (!registered) {
+        for (size_t i = 0; i < lock_count; ++i) {
+          lock_order[i]->waiters_.push_back(&waiter);
+        }
+        registered = true;
+      }
+      // Signalers only touch the token with the object locked, so resetting
+      // it before unlocking can't lose a wakeup.
+      waiter.wake_token.store(0, std::memory_order_relaxed);
+      unlock_all();
+      timed_out = !waiter.Sleep(infinite ? nullptr : &deadline);
+      lock_all();
     }
+    if (registered) {
+      for (size_t i = 0; i < lock_count; ++i) {
+        auto& waiters = lock_order[i]->waiters_;
+        auto it = std::find(waiters.begin(), waiters.end(), &waiter);
+        assert_true(it != waiters.end());
+        *it = waiters.back();
+        waiters.pop_back();
+      }
+    }
+    unlock_all();
+    return result;
   }
 
-  virtual void* native_handle() const { return cond_.native_handle(); }
+  virtual void* native_handle() const { return mutex_.native_handle(); }
 
  protected:
   inline virtual bool signaled() const = 0;
   inline virtual void post_execution() = 0;
-  static std::condition_variable cond_;
-  static std::mutex mutex_;
-};
 
-std::condition_variable PosixConditionBase::cond_;
-std::mutex PosixConditionBase::mutex_;
+  // Must be called with mutex_ held whenever the object may have become
+  // signaled.
+  void WakeWaiters() {
+    for (PosixWaiter* waiter : waiters_) {
+      waiter->Wake();
+    }
+  }
+
+  // Guards the state of the object and waiters_.
+  mutable std::mutex mutex_;
+  std::vector<PosixWaiter*> waiters_;
+};
 
 // There really is no native POSIX handle for a single wait/signal construct
 // pthreads is at a lower level with more handles for such a mechanism.
@@ -296,7 +400,7 @@ class PosixCondition<Event> : public PosixConditionBase {
   bool Signal() override {
     auto lock = std::unique_lock<std::mutex>(mutex_);
     signal_ = true;
-    cond_.notify_all();
+    WakeWaiters();
     return true;
   }
 
@@ -325,11 +429,11 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
   bool Signal() override { return Release(1, nullptr); }
 
   bool Release(uint32_t release_count, int* out_previous_count) {
+    auto lock = std::unique_lock<std::mutex>(mutex_);
     if (maximum_count_ - count_ >= release_count) {
-      auto lock = std::unique_lock<std::mutex>(mutex_);
       if (out_previous_count) *out_previous_count = count_;
       count_ += release_count;
-      cond_.notify_all();
+      WakeWaiters();
       return true;
     }
     return false;
@@ -337,10 +441,7 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
 
  private:
   inline bool signaled() const override { return count_ > 0; }
-  inline void post_execution() override {
-    count_--;
-    cond_.notify_all();
-  }
+  inline void post_execution() override { count_--; }
   uint32_t count_;
   const uint32_t maximum_count_;
 };
@@ -363,15 +464,13 @@ class PosixCondition<Mutant> : public PosixConditionBase {
       --count_;
       // Free to be acquired by another thread
       if (count_ == 0) {
-        cond_.notify_all();
+        WakeWaiters();
       }
       return true;
     }
     return false;
   }
 
-  void* native_handle() const override { return mutex_.native_handle(); }
-
  private:
   inline bool signaled() const override {
     return count_ == 0 || owner_ == std::this_thread::get_id();
@@ -395,7 +494,7 @@ class PosixCondition<Timer> : public PosixConditionBase {
   bool Signal() override {
     std::lock_guard<std::mutex> lock(mutex_);
     signal_ = true;
-    cond_.notify_all();
+    WakeWaiters();
     return true;
   }
 
@@ -411,7 +510,7 @@ class PosixCondition<Timer> : public PosixConditionBase {
   }
 
   void SetRepeating(std::chrono::steady_clock::time_point due_time,
-                    std::chrono::milliseconds period,
+                    std::chrono::nanoseconds period,
                     std::function<void()> opt_callback) {
     Cancel();
 
@@ -739,7 +838,7 @@ class PosixCondition<Thread> : public PosixConditionBase {
 
       exit_code_ = exit_code;
       signaled_ = true;
-      cond_.notify_all();
+      WakeWaiters();
     }
     if (is_current_thread) {
       pthread_exit(reinterpret_cast<void*>(exit_code));
@@ -847,7 +946,7 @@ PosixConditionHandle<Thread>::PosixConditionHandle(pthread_t thread)
     : handle_(thread) {}
 
 WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
-                std::chrono::milliseconds timeout) {
+                std::chrono::nanoseconds timeout) {
   auto posix_wait_handle = dynamic_cast<PosixWaitHandle*>(wait_handle);
   if (posix_wait_handle == nullptr) {
     return WaitResult::kFailed;
@@ -860,7 +959,7 @@ WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
 
 WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
                          WaitHandle* wait_handle_to_wait_on, bool is_alertable,
-                         std::chrono::milliseconds timeout) {
+                         std::chrono::nanoseconds timeout) {
   auto result = WaitResult::kFailed;
   auto posix_wait_handle_to_signal =
       dynamic_cast<PosixWaitHandle*>(wait_handle_to_signal);
@@ -881,7 +980,7 @@ WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
 std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
                                            size_t wait_handle_count,
                                            bool wait_all, bool is_alertable,
-                                           std::chrono::milliseconds timeout) {
+                                           std::chrono::nanoseconds timeout) {
   std::vector<PosixConditionBase*> conditions;
   conditions.reserve(wait_handle_count);
   for (size_t i = 0u; i < wait_handle_count; ++i) {
@@ -982,19 +1081,19 @@ class PosixTimer : public PosixConditionHandle<Timer> {
   }
 
   bool SetRepeatingAfter(
-      xe::chrono::hundrednanoseconds rel_time, std::chrono::milliseconds period,
+      xe::chrono::hundrednanoseconds rel_time, std::chrono::nanoseconds period,
       std::function<void()> opt_callback = nullptr) override {
     return SetRepeatingAt(GClock_::now() + rel_time, period,
                           std::move(opt_callback));
   }
   bool SetRepeatingAt(WClock_::time_point due_time,
-                      std::chrono::milliseconds period,
+                      std::chrono::nanoseconds period,
                       std::function<void()> opt_callback = nullptr) override {
     return SetRepeatingAt(date::clock_cast<GClock_>(due_time), period,
                           std::move(opt_callback));
   }
   bool SetRepeatingAt(GClock_::time_point due_time,
-                      std::chrono::milliseconds period,
+                      std::chrono::nanoseconds period,
                       std::function<void()> opt_callback = nullptr) override {
     handle_.SetRepeating(due_time, period, std::move(opt_callback));
     return true;
@@ -1105,10 +1204,10 @@ void* PosixCondition<Thread>::ThreadStartRoutine(void* parameter) {
     thread->handle_.state_ = State::kFinished;
   }
 
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<std::mutex> lock(thread->handle_.mutex_);
   thread->handle_.exit_code_ = 0;
   thread->handle_.signaled_ = true;
-  cond_.notify_all();
+  thread->handle_.WakeWaiters();
 
   current_thread_ = nullptr;
   return nullptr;
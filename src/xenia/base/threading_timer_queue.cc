@@ -8,19 +8,19 @@
  */
 
 #include <algorithm>
+#include <condition_variable>
 #include <forward_list>
-
-#include "third_party/disruptorplus/include/disruptorplus/multi_threaded_claim_strategy.hpp"
-#include "third_party/disruptorplus/include/disruptorplus/ring_buffer.hpp"
-#include "third_party/disruptorplus/include/disruptorplus/sequence_barrier.hpp"
-#include "third_party/disruptorplus/include/disruptorplus/spin_wait.hpp"
-#include "third_party/disruptorplus/include/disruptorplus/spin_wait_strategy.hpp"
+#include <mutex>
+#include <vector>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/platform.h"
 #include "xenia/base/threading.h"
 #include "xenia/base/threading_timer_queue.h"
 
-namespace dp = disruptorplus;
+#if XE_PLATFORM_LINUX
+#include <sys/prctl.h>
+#endif
 
 namespace xe {
 namespace threading {
@@ -33,58 +33,65 @@ class TimerQueue {
   static_assert(clock::is_steady);
 
  public:
-  TimerQueue()
-      : buffer_(kWaitCount),
-        wait_strategy_(),
-        claim_strategy_(kWaitCount, wait_strategy_),
-        consumed_(wait_strategy_),
-        shutdown_(false) {
-    claim_strategy_.add_claim_barrier(consumed_);
+  TimerQueue() : shutdown_(false) {
     dispatch_thread_ = std::thread(&TimerQueue::TimerThreadMain, this);
   }
 
   ~TimerQueue() {
-    shutdown_.store(true, std::memory_order_release);
-
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+    }
     // Kick dispatch thread to check shutdown flag
-    auto wait_item = std::make_shared<WaitItem>(nullptr, nullptr, this,
-                                                clock::time_point::min(),
-                                                clock::duration::zero());
-    wait_item->Disarm();
-    QueueTimer(std::move(wait_item));
-
+    queued_cv_.notify_one();
     dispatch_thread_.join();
   }
 
   void TimerThreadMain() {
-    dp::sequence_t next_sequence = 0;
     const auto comp = [](const std::shared_ptr<WaitItem>& left,
                          const std::shared_ptr<WaitItem>& right) {
       return left->due_ < right->due_;
     };
 
     xe::threading::set_name("xe::threading::TimerQueue");
-
-    while (!shutdown_.load(std::memory_order_relaxed)) {
-      {
-        // Consume new wait items and add them to sorted wait queue
-        dp::sequence_t available = claim_strategy_.wait_until_published(
-            next_sequence, next_sequence - 1,
-            wait_queue_.empty() ? clock::time_point::max()
-                                : wait_queue_.front()->due_);
-
-        // Check for timeout
-        if (available != next_sequence - 1) {
-          std::forward_list<std::shared_ptr<WaitItem>> wait_items;
-          do {
-            wait_items.push_front(std::move(buffer_[next_sequence]));
-          } while (next_sequence++ != available);
-
-          consumed_.publish(available);
-
-          wait_items.sort(comp);
-          wait_queue_.merge(wait_items, comp);
+#if XE_PLATFORM_LINUX
+    // The default slack of 50us would be added to every deadline.
+    prctl(PR_SET_TIMERSLACK, 1);
+#endif
+
+    std::vector<std::shared_ptr<WaitItem>> queued;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!shutdown_) {
+      if (queued_.empty()) {
+        if (wait_queue_.empty()) {
+          queued_cv_.wait(lock);
+        } else {
+          // Sleep on an absolute deadline, leaving the last part to
+          // SpinUntil if sleep_spin_us is set.
+          auto due = wait_queue_.front()->due_;
+          if (!queued_cv_.wait_until(lock, SpinStartTime(due), [this]() {
+                return shutdown_ || !queued_.empty();
+              })) {
+            lock.unlock();
+            SpinUntil(due);
+            lock.lock();
+          }
         }
+        if (shutdown_) {
+          break;
+        }
+      }
+
+      // Consume new wait items and add them to sorted wait queue
+      queued.swap(queued_);
+      lock.unlock();
+      if (!queued.empty()) {
+        std::forward_list<std::shared_ptr<WaitItem>> wait_items(
+            std::make_move_iterator(queued.begin()),
+            std::make_move_iterator(queued.end()));
+        queued.clear();
+        wait_items.sort(comp);
+        wait_queue_.merge(wait_items, comp);
       }
 
       {
@@ -124,6 +131,7 @@ class TimerQueue {
         wait_items.sort(comp);
         wait_queue_.merge(wait_items, comp);
       }
+      lock.lock();
     }
   }
 
@@ -134,9 +142,11 @@ class TimerQueue {
     wait_item->due_ =
         std::max(clock::now() - wait_item->interval_, wait_item->due_);
 
-    auto sequence = claim_strategy_.claim_one();
-    buffer_[sequence] = std::move(wait_item);
-    claim_strategy_.publish(sequence);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_.push_back(std::move(wait_item));
+    }
+    queued_cv_.notify_one();
 
     return wait_item_weak;
   }
@@ -144,17 +154,18 @@ class TimerQueue {
   const std::thread& dispatch_thread() const { return dispatch_thread_; }
 
  private:
-  // This ring buffer will be used to introduce timers queued by the public API
-  static constexpr size_t kWaitCount = 512;
-  dp::ring_buffer<std::shared_ptr<WaitItem>> buffer_;
-  dp::spin_wait_strategy wait_strategy_;
-  dp::multi_threaded_claim_strategy<dp::spin_wait_strategy> claim_strategy_;
-  dp::sequence_barrier<dp::spin_wait_strategy> consumed_;
+  // Timers queued by the public API, waiting to be picked up by the dispatch
+  // thread. The dispatch thread sleeps on queued_cv_ until either the earliest
+  // due time or a new timer, so it wakes up directly on the deadline rather
+  // than polling.
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::vector<std::shared_ptr<WaitItem>> queued_;
+  bool shutdown_;
 
   // This is a _sorted_ (ascending due_) list of active timers managed by a
   // dedicated thread
   std::forward_list<std::shared_ptr<WaitItem>> wait_queue_;
-  std::atomic_bool shutdown_;
   std::thread dispatch_thread_;
 };
 
@@ -175,7 +186,6 @@ void TimerQueueWaitItem::Disarm() {
     // Normal case can handle the rest
   }
 
-  dp::spin_wait spinner;
   state = State::kIdle;
   // Classes which hold WaitItems will often call Disarm() to cancel them during
   // destruction. This may lead to race conditions when the dispatch thread
@@ -190,7 +200,7 @@ void TimerQueueWaitItem::Disarm() {
       break;
     }
     state = State::kIdle;
-    spinner.spin_once();
+    MaybeYield();
   }
 }
 
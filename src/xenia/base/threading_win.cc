@@ -7,6 +7,8 @@
  ******************************************************************************
  */
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/chrono_steady_cast.h"
 #include "xenia/base/logging.h"
@@ -86,17 +88,43 @@ void MaybeYield() {
 
 void SyncMemory() { MemoryBarrier(); }
 
-void Sleep(std::chrono::microseconds duration) {
-  if (duration.count() < 100) {
+// Converts a timeout to the millisecond granularity of the Win32 waits,
+// rounding up so that the wait doesn't end before the timeout.
+static DWORD TimeoutToMilliseconds(std::chrono::nanoseconds timeout) {
+  if (timeout == std::chrono::nanoseconds::max()) {
+    return INFINITE;
+  }
+  if (timeout <= std::chrono::nanoseconds::zero()) {
+    return 0;
+  }
+  auto milliseconds =
+      std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+  return DWORD(std::min(milliseconds, decltype(milliseconds)(INFINITE - 1)));
+}
+
+void Sleep(std::chrono::nanoseconds duration) {
+  if (duration <= std::chrono::nanoseconds::zero()) {
     MaybeYield();
-  } else {
-    ::Sleep(static_cast<DWORD>(duration.count() / 1000));
+    return;
+  }
+  auto deadline = DeadlineAfter(duration);
+  auto spin_start = SpinStartTime(deadline);
+  if (spin_start == deadline) {
+    ::Sleep(TimeoutToMilliseconds(duration));
+    return;
+  }
+  // Sleep through the whole milliseconds before the spin start, and spin the
+  // rest.
+  auto sleep_duration = std::chrono::floor<std::chrono::milliseconds>(
+      spin_start - std::chrono::steady_clock::now());
+  if (sleep_duration.count() > 0) {
+    ::Sleep(DWORD(sleep_duration.count()));
   }
+  SpinUntil(deadline);
 }
 
-SleepResult AlertableSleep(std::chrono::microseconds duration) {
-  if (SleepEx(static_cast<DWORD>(duration.count() / 1000), TRUE) ==
-      WAIT_IO_COMPLETION) {
+SleepResult AlertableSleep(std::chrono::nanoseconds duration) {
+  if (SleepEx(TimeoutToMilliseconds(duration), TRUE) == WAIT_IO_COMPLETION) {
     return SleepResult::kAlerted;
   }
   return SleepResult::kSuccess;
@@ -132,9 +160,9 @@ class Win32Handle : public T {
 };
 
 WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
-                std::chrono::milliseconds timeout) {
+                std::chrono::nanoseconds timeout) {
   HANDLE handle = wait_handle->native_handle();
-  DWORD result = WaitForSingleObjectEx(handle, DWORD(timeout.count()),
+  DWORD result = WaitForSingleObjectEx(handle, TimeoutToMilliseconds(timeout),
                                        is_alertable ? TRUE : FALSE);
   switch (result) {
     case WAIT_OBJECT_0:
@@ -153,12 +181,12 @@ WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
 
 WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
                          WaitHandle* wait_handle_to_wait_on, bool is_alertable,
-                         std::chrono::milliseconds timeout) {
+                         std::chrono::nanoseconds timeout) {
   HANDLE handle_to_signal = wait_handle_to_signal->native_handle();
   HANDLE handle_to_wait_on = wait_handle_to_wait_on->native_handle();
-  DWORD result =
-      SignalObjectAndWait(handle_to_signal, handle_to_wait_on,
-                          DWORD(timeout.count()), is_alertable ? TRUE : FALSE);
+  DWORD result = SignalObjectAndWait(handle_to_signal, handle_to_wait_on,
+                                     TimeoutToMilliseconds(timeout),
+                                     is_alertable ? TRUE : FALSE);
   switch (result) {
     case WAIT_OBJECT_0:
       return WaitResult::kSuccess;
@@ -177,14 +205,14 @@ WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
 std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
                                            size_t wait_handle_count,
                                            bool wait_all, bool is_alertable,
-                                           std::chrono::milliseconds timeout) {
+                                           std::chrono::nanoseconds timeout) {
   std::vector<HANDLE> handles(wait_handle_count);
   for (size_t i = 0; i < wait_handle_count; ++i) {
     handles[i] = wait_handles[i]->native_handle();
   }
   DWORD result = WaitForMultipleObjectsEx(
       DWORD(handles.size()), handles.data(), wait_all ? TRUE : FALSE,
-      DWORD(timeout.count()), is_alertable ? TRUE : FALSE);
+      TimeoutToMilliseconds(timeout), is_alertable ? TRUE : FALSE);
   if (result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + handles.size()) {
     return std::pair<WaitResult, size_t>(WaitResult::kSuccess,
                                          result - WAIT_OBJECT_0);
@@ -309,19 +337,19 @@ class Win32Timer : public Win32Handle<Timer> {
   }
 
   bool SetRepeatingAfter(
-      xe::chrono::hundrednanoseconds rel_time, std::chrono::milliseconds period,
+      xe::chrono::hundrednanoseconds rel_time, std::chrono::nanoseconds period,
       std::function<void()> opt_callback = nullptr) override {
     return SetRepeatingAt(WClock_::now() + rel_time, period,
                           std::move(opt_callback));
   }
   bool SetRepeatingAt(GClock_::time_point due_time,
-                      std::chrono::milliseconds period,
+                      std::chrono::nanoseconds period,
                       std::function<void()> opt_callback = nullptr) {
     return SetRepeatingAt(date::clock_cast<WClock_>(due_time), period,
                           std::move(opt_callback));
   }
   bool SetRepeatingAt(WClock_::time_point due_time,
-                      std::chrono::milliseconds period,
+                      std::chrono::nanoseconds period,
                       std::function<void()> opt_callback) override {
     std::lock_guard<std::mutex> lock(mutex_);
     callback_ = std::move(opt_callback);
@@ -330,7 +358,10 @@ class Win32Timer : public Win32Handle<Timer> {
     auto completion_routine =
         callback_ ? reinterpret_cast<PTIMERAPCROUTINE>(CompletionRoutine)
                   : NULL;
-    return SetWaitableTimer(handle_, &due_time_li, int32_t(period.count()),
+    // The period of waitable timers is in milliseconds.
+    auto period_ms =
+        std::chrono::ceil<std::chrono::milliseconds>(period).count();
+    return SetWaitableTimer(handle_, &due_time_li, int32_t(period_ms),
                             completion_routine, this, FALSE)
                ? true
                : false;
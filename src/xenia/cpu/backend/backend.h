@@ -54,6 +54,19 @@ class Backend {
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
       Module* module, uint32_t address) = 0;
 
+  // Called once the code of a module has been loaded into guest memory, before
+  // any of its functions are defined.
+  virtual void OnModuleCodeLoaded(Module* module, uint32_t guest_low,
+                                  uint32_t guest_high) {}
+
+  // Defines the function from code generated by a previous run, if the backend
+  // persists any, skipping translation. Returns false if the function must be
+  // translated as usual.
+  virtual bool DefineStoredFunction(GuestFunction* function,
+                                    uint32_t debug_info_flags) {
+    return false;
+  }
+
   // Calculates the next host instruction based on the current thread state and
   // current PC. This will look for branches and other control flow
   // instructions.
@@ -13,6 +13,7 @@
 
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
+#include "xenia/base/mutex.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
 #include "xenia/base/string.h"
@@ -76,24 +77,33 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   xe::make_reset_scope(this);
 
   // Lower HIR -> x64.
+  // The function may be running its previous code when it is recompiled, so
+  // its source map is only replaced once the new code is ready.
   void* machine_code = nullptr;
   size_t code_size = 0;
+  std::vector<SourceMapEntry> source_map;
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size, &source_map)) {
     return false;
   }
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
-                    &string_buffer_);
+    DumpMachineCode(machine_code, code_size, source_map, &string_buffer_);
     debug_info->set_machine_code_disasm(xe_strdup(string_buffer_.buffer()));
     string_buffer_.Reset();
   }
 
+  {
+    // Host PCs are mapped back to guest addresses under the global critical
+    // region (by the profiler, for instance), so publish the new code and its
+    // source map together under it.
+    auto global_lock = xe::global_critical_region::AcquireDirect();
+    function->source_map() = std::move(source_map);
+    static_cast<X64Function*>(function)->Setup(
+        reinterpret_cast<uint8_t*>(machine_code), code_size);
+  }
   function->set_debug_info(std::move(debug_info));
-  static_cast<X64Function*>(function)->Setup(
-      reinterpret_cast<uint8_t*>(machine_code), code_size);
 
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
@@ -14,8 +14,10 @@
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
 
+#include "build/version.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -23,6 +25,7 @@
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
 
@@ -46,6 +49,9 @@ DEFINE_int32(x64_extension_mask, -1,
              "   -1 = Detect and utilize all possible processor features\n",
              "x64");
 
+DECLARE_bool(emit_source_annotations);
+DECLARE_bool(store_all_context_values);
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -58,6 +64,7 @@ class X64ThunkEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+  void* EmitCallIndirectionThunk();
 
  private:
   // The following four functions provide save/load functionality for registers.
@@ -138,12 +145,51 @@ bool X64Backend::Initialize(Processor* processor) {
   code_cache_->set_indirection_default(
       uint32_t(uint64_t(resolve_function_thunk_)));
 
+  // Patchable guest call sites go through this until their callee is placed.
+  void* call_indirection_thunk = thunk_emitter.EmitCallIndirectionThunk();
+  assert_zero(uint64_t(call_indirection_thunk) & 0xFFFFFFFF00000000ull);
+  code_cache_->set_call_indirection_thunk(
+      uint32_t(uint64_t(call_indirection_thunk)));
+
   // Allocate some special indirections.
   code_cache_->CommitExecutableRange(0x9FFF0000, 0x9FFFFFFF);
 
   // Allocate emitter constant data.
   emitter_data_ = X64Emitter::PlaceConstData();
 
+  // Stored code references the thunks and constants by absolute address and
+  // bakes in the host features and code generation options, so all of them
+  // must match for it to be reusable.
+  struct {
+    char build[64];
+    uint64_t host_to_guest_thunk;
+    uint64_t guest_to_host_thunk;
+    uint64_t resolve_function_thunk;
+    uint64_t emitter_data;
+    uint64_t pvr;
+    uint32_t feature_flags;
+    uint32_t disable_global_lock;
+    uint32_t store_all_context_values;
+    uint32_t emit_source_annotations;
+  } code_storage_key_data = {};
+  std::strncpy(code_storage_key_data.build,
+               XE_BUILD_COMMIT " " XE_BUILD_DATE " " __TIME__,
+               sizeof(code_storage_key_data.build) - 1);
+  code_storage_key_data.host_to_guest_thunk = uint64_t(host_to_guest_thunk_);
+  code_storage_key_data.guest_to_host_thunk = uint64_t(guest_to_host_thunk_);
+  code_storage_key_data.resolve_function_thunk =
+      uint64_t(resolve_function_thunk_);
+  code_storage_key_data.emitter_data = emitter_data_;
+  code_storage_key_data.pvr = cvars::pvr;
+  code_storage_key_data.feature_flags = thunk_emitter.feature_flags();
+  code_storage_key_data.disable_global_lock = cvars::disable_global_lock;
+  code_storage_key_data.store_all_context_values =
+      cvars::store_all_context_values;
+  code_storage_key_data.emit_source_annotations =
+      cvars::emit_source_annotations;
+  code_storage_key_ =
+      XXH3_64bits(&code_storage_key_data, sizeof(code_storage_key_data));
+
   // Setup exception callback
   ExceptionHandler::Install(&ExceptionCallbackThunk, this);
 
@@ -164,6 +210,45 @@ std::unique_ptr<GuestFunction> X64Backend::CreateGuestFunction(
   return std::make_unique<X64Function>(module, address);
 }
 
+void X64Backend::OnModuleCodeLoaded(Module* module, uint32_t guest_low,
+                                    uint32_t guest_high) {
+  if (!code_cache_->persistent_storage_enabled() || guest_low >= guest_high) {
+    return;
+  }
+  uint64_t module_hash =
+      XXH3_64bits(processor_->memory()->TranslateVirtual(guest_low),
+                  guest_high - guest_low);
+  code_cache_->InitializeModuleStorage(module, module_hash, code_storage_key_);
+}
+
+bool X64Backend::DefineStoredFunction(GuestFunction* function,
+                                      uint32_t debug_info_flags) {
+  if (!code_cache_->persistent_storage_enabled()) {
+    return false;
+  }
+  // Stored code never contains tracing or debugging instrumentation.
+  if (debug_info_flags || cvars::disassemble_functions ||
+      cvars::trace_functions || cvars::trace_function_coverage ||
+      cvars::trace_function_references || cvars::trace_function_data ||
+      cvars::break_on_instruction) {
+    return false;
+  }
+  size_t code_size = 0;
+  void* machine_code = code_cache_->PlaceStoredFunction(function, code_size);
+  if (!machine_code) {
+    return false;
+  }
+  static_cast<X64Function*>(function)->Setup(
+      reinterpret_cast<uint8_t*>(machine_code), code_size);
+
+  // Install into indirection table, as X64Assembler does for new code.
+  uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
+  assert_true((host_address >> 32) == 0);
+  code_cache_->AddIndirection(function->address(),
+                              static_cast<uint32_t>(host_address));
+  return true;
+}
+
 uint64_t ReadCapstoneReg(HostThreadContext* context, x86_reg reg) {
   switch (reg) {
     case X86_REG_RAX:
@@ -590,6 +675,19 @@ ResolveFunctionThunk X64ThunkEmitter::EmitResolveFunctionThunk() {
   return (ResolveFunctionThunk)fn;
 }
 
+void* X64ThunkEmitter::EmitCallIndirectionThunk() {
+  // ebx = target PPC address
+  // rsp + 0 = return address of the call site, left as is for the target
+
+  mov(eax, dword[ebx]);
+  jmp(rax);
+
+  EmitFunctionInfo func_info = {};
+  func_info.code_size.total = getSize();
+  func_info.code_size.body = getSize();
+  return Emplace(func_info);
+}
+
 void X64ThunkEmitter::EmitSaveVolatileRegs() {
   // Save off volatile registers.
   // mov(qword[rsp + offsetof(StackLayout::Thunk, r[0])], rax);
@@ -59,6 +59,11 @@ class X64Backend : public Backend {
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
+  void OnModuleCodeLoaded(Module* module, uint32_t guest_low,
+                          uint32_t guest_high) override;
+  bool DefineStoredFunction(GuestFunction* function,
+                            uint32_t debug_info_flags) override;
+
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
@@ -78,6 +83,9 @@ class X64Backend : public Backend {
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+
+  // Identifies everything stored code depends on besides the guest module.
+  uint64_t code_storage_key_ = 0;
 };
 
 }  // namespace x64
@@ -19,14 +19,25 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
+#include "xenia/base/byte_order.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 
+DEFINE_path(
+    x64_code_storage_root, "",
+    "Directory to persist generated guest code in. Code stored by a previous "
+    "run of the same build on the same CPU is reused instead of being "
+    "translated again. Empty to disable.",
+    "x64");
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -37,6 +48,19 @@ using namespace xe::literals;
 X64CodeCache::X64CodeCache() = default;
 
 X64CodeCache::~X64CodeCache() {
+  if (call_site_count_) {
+    XELOGI("Guest call sites: {} patched to direct calls, {} unpatched",
+           patched_call_site_count_,
+           call_site_count_ - patched_call_site_count_);
+  }
+
+  for (auto& it : module_storages_) {
+    if (it.second->file) {
+      fclose(it.second->file);
+    }
+  }
+  module_storages_.clear();
+
   if (indirection_table_base_) {
     xe::memory::DeallocFixed(indirection_table_base_, 0,
                              xe::memory::DeallocationType::kRelease);
@@ -136,9 +160,65 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
     return;
   }
 
-  uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
-      indirection_table_base_ + (guest_address - kIndirectionTableBase));
-  *indirection_slot = host_address;
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  *indirection_slot(guest_address) = host_address;
+
+  // The slot may already have been written by PlaceGuestCode, so whether the
+  // call sites were patched before is tracked separately.
+  CalleeCallSites& callee = call_sites_[guest_address];
+  if (!callee.host_address) {
+    patched_call_site_count_ += callee.site_offsets.size();
+  }
+  callee.host_address = host_address;
+  for (uint32_t site_offset : callee.site_offsets) {
+    PatchCallSite(site_offset, host_address);
+  }
+}
+
+void X64CodeCache::AddCallSites(const void* code_execute_address,
+                                const std::vector<CallSite>& call_sites) {
+  assert_not_zero(call_indirection_thunk_);
+  uint32_t code_offset = uint32_t(
+      reinterpret_cast<const uint8_t*>(code_execute_address) -
+      generated_code_execute_base_);
+
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  for (const CallSite& call_site : call_sites) {
+    uint32_t site_offset = code_offset + call_site.code_offset;
+    assert_zero(site_offset & 0x3);
+    CalleeCallSites& callee = call_sites_[call_site.guest_address];
+    callee.site_offsets.push_back(site_offset);
+    ++call_site_count_;
+
+    // Callees that are already installed can be called directly right away.
+    if (callee.host_address) {
+      PatchCallSite(site_offset, callee.host_address);
+      ++patched_call_site_count_;
+    } else {
+      PatchCallSite(site_offset, call_indirection_thunk_);
+    }
+  }
+}
+
+X64CodeCache::CallSiteStats X64CodeCache::call_site_stats() {
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  CallSiteStats stats;
+  stats.patched = patched_call_site_count_;
+  stats.unpatched = call_site_count_ - patched_call_site_count_;
+  return stats;
+}
+
+void X64CodeCache::PatchCallSite(uint32_t site_offset, uint32_t host_address) {
+  // Relative to the end of the rel32 operand, which ends the instruction.
+  int64_t displacement = int64_t(host_address) -
+                         int64_t(kGeneratedCodeExecuteBase + site_offset + 4);
+  assert_true(displacement == int32_t(displacement));
+  // The operand is aligned, so a thread executing the call concurrently sees
+  // either the old or the new target, both of which are valid.
+  xe::atomic_exchange(
+      int32_t(displacement),
+      reinterpret_cast<volatile int32_t*>(generated_code_write_base_ +
+                                          site_offset));
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -174,7 +254,8 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
                                   const EmitFunctionInfo& func_info,
                                   GuestFunction* function_info,
                                   void*& code_execute_address_out,
-                                  void*& code_write_address_out) {
+                                  void*& code_write_address_out,
+                                  const std::vector<CallSite>* call_sites) {
   // Hold a lock while we bump the pointers up. This is important as the
   // unwind table requires entries AND code to be sorted in order.
   size_t low_mark;
@@ -279,6 +360,12 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   }
 #endif
 
+  // The rel32 operands of the calls are placeholders until patched, so this
+  // must be done before other threads can enter the code.
+  if (call_sites && !call_sites->empty()) {
+    AddCallSites(code_execute_address, *call_sites);
+  }
+
   // Now that everything is ready, fix up the indirection table.
   // Note that we do support code that doesn't have an indirection fixup, so
   // ignore those when we see them.
@@ -362,6 +449,251 @@ GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
   }
 }
 
+namespace {
+// 'XECC'.
+const uint32_t kStorageMagic = 0x43434558;
+const uint32_t kStorageVersion = 1;
+struct StorageFileHeader {
+  uint32_t magic;
+  uint32_t version_swapped;
+  uint64_t module_hash;
+  uint64_t storage_key;
+};
+struct StoredFunctionHeader {
+  uint32_t address;
+  uint32_t end_address;
+  uint32_t code_size;
+  uint32_t relocation_count;
+  uint32_t source_map_count;
+  uint32_t reserved;
+  uint64_t prolog_size;
+  uint64_t body_size;
+  uint64_t epilog_size;
+  uint64_t tail_size;
+  uint64_t prolog_stack_alloc_offset;
+  uint64_t stack_size;
+  // XXH3 of the payload following the header: code, relocations, source map.
+  uint64_t payload_hash;
+};
+struct StoredRelocation {
+  uint32_t code_offset;
+  uint32_t type;
+  uint64_t value;
+};
+}  // namespace
+
+uintptr_t X64CodeCache::host_image_anchor() {
+  // Any symbol in the executable image works, as the whole image is moved as
+  // one unit.
+  return reinterpret_cast<uintptr_t>(&X64CodeCache::Create);
+}
+
+void X64CodeCache::InitializeModuleStorage(const Module* module,
+                                           uint64_t module_hash,
+                                           uint64_t storage_key) {
+  if (!persistent_storage_enabled()) {
+    return;
+  }
+  auto storage_root = cvars::x64_code_storage_root;
+  if (!std::filesystem::exists(storage_root) &&
+      !std::filesystem::create_directories(storage_root)) {
+    XELOGE(
+        "Failed to create the code storage directory, persistent code storage "
+        "will be disabled: {}",
+        xe::path_to_utf8(storage_root));
+    return;
+  }
+
+  auto storage_file_path =
+      storage_root / fmt::format("{:016X}.x64.xcode", module_hash);
+  FILE* file = xe::filesystem::OpenFile(storage_file_path, "a+b");
+  if (!file) {
+    XELOGE(
+        "Failed to open the code storage file for writing, persistent code "
+        "storage will be disabled for {}: {}",
+        module->name(), xe::path_to_utf8(storage_file_path));
+    return;
+  }
+
+  auto storage = std::make_unique<ModuleStorage>();
+  storage->file = file;
+
+  uint64_t load_start = Clock::QueryHostTickCount();
+  StorageFileHeader file_header;
+  if (fread(&file_header, sizeof(file_header), 1, file) &&
+      file_header.magic == kStorageMagic &&
+      xe::byte_swap(file_header.version_swapped) == kStorageVersion &&
+      file_header.module_hash == module_hash &&
+      file_header.storage_key == storage_key) {
+    // Load functions until the end of the file or until a corrupted one is
+    // found, which most likely is a partial write from a crashed run.
+    uint64_t valid_bytes = sizeof(file_header);
+    std::vector<uint8_t> payload;
+    StoredFunctionHeader function_header;
+    while (fread(&function_header, sizeof(function_header), 1, file)) {
+      size_t relocations_size =
+          sizeof(StoredRelocation) * function_header.relocation_count;
+      size_t source_map_size =
+          sizeof(SourceMapEntry) * function_header.source_map_count;
+      size_t payload_size =
+          function_header.code_size + relocations_size + source_map_size;
+      payload.resize(payload_size);
+      if (!function_header.code_size ||
+          fread(payload.data(), 1, payload_size, file) != payload_size ||
+          XXH3_64bits(payload.data(), payload_size) !=
+              function_header.payload_hash) {
+        break;
+      }
+      valid_bytes += sizeof(function_header) + payload_size;
+
+      StoredFunction& stored = storage->functions[function_header.address];
+      stored.end_address = function_header.end_address;
+      stored.func_info.code_size.prolog = size_t(function_header.prolog_size);
+      stored.func_info.code_size.body = size_t(function_header.body_size);
+      stored.func_info.code_size.epilog = size_t(function_header.epilog_size);
+      stored.func_info.code_size.tail = size_t(function_header.tail_size);
+      stored.func_info.code_size.total = function_header.code_size;
+      stored.func_info.prolog_stack_alloc_offset =
+          size_t(function_header.prolog_stack_alloc_offset);
+      stored.func_info.stack_size = size_t(function_header.stack_size);
+      const uint8_t* payload_ptr = payload.data();
+      stored.machine_code.assign(payload_ptr,
+                                 payload_ptr + function_header.code_size);
+      payload_ptr += function_header.code_size;
+      stored.relocations.resize(function_header.relocation_count);
+      for (auto& relocation : stored.relocations) {
+        StoredRelocation stored_relocation;
+        std::memcpy(&stored_relocation, payload_ptr, sizeof(stored_relocation));
+        payload_ptr += sizeof(stored_relocation);
+        relocation.code_offset = stored_relocation.code_offset;
+        relocation.type = CodeRelocation::Type(stored_relocation.type);
+        relocation.value = stored_relocation.value;
+      }
+      stored.source_map.resize(function_header.source_map_count);
+      std::memcpy(stored.source_map.data(), payload_ptr, source_map_size);
+    }
+    xe::filesystem::TruncateStdioFile(file, valid_bytes);
+    XELOGI("Loaded {} stored functions for {} in {} milliseconds",
+           storage->functions.size(), module->name(),
+           (Clock::QueryHostTickCount() - load_start) * 1000 /
+               Clock::QueryHostTickFrequency());
+  } else {
+    // Missing, stale or from a different build or host - start over.
+    xe::filesystem::TruncateStdioFile(file, 0);
+    file_header.magic = kStorageMagic;
+    file_header.version_swapped = xe::byte_swap(kStorageVersion);
+    file_header.module_hash = module_hash;
+    file_header.storage_key = storage_key;
+    fwrite(&file_header, sizeof(file_header), 1, file);
+    fflush(file);
+  }
+
+  std::lock_guard<std::mutex> storage_lock(storage_mutex_);
+  auto& storage_slot = module_storages_[module];
+  if (storage_slot && storage_slot->file) {
+    fclose(storage_slot->file);
+  }
+  storage_slot = std::move(storage);
+}
+
+void X64CodeCache::StoreFunction(
+    GuestFunction* function, const void* machine_code,
+    const EmitFunctionInfo& func_info,
+    const std::vector<CodeRelocation>& relocations,
+    const std::vector<SourceMapEntry>& source_map) {
+  std::lock_guard<std::mutex> storage_lock(storage_mutex_);
+  auto it = module_storages_.find(function->module());
+  if (it == module_storages_.end() || !it->second->file) {
+    return;
+  }
+  FILE* file = it->second->file;
+
+  size_t code_size = func_info.code_size.total;
+  std::vector<uint8_t> payload(code_size +
+                               sizeof(StoredRelocation) * relocations.size() +
+                               sizeof(SourceMapEntry) * source_map.size());
+  uint8_t* payload_ptr = payload.data();
+  std::memcpy(payload_ptr, machine_code, code_size);
+  payload_ptr += code_size;
+  uintptr_t anchor = host_image_anchor();
+  for (const CodeRelocation& relocation : relocations) {
+    StoredRelocation stored_relocation;
+    stored_relocation.code_offset = relocation.code_offset;
+    stored_relocation.type = uint32_t(relocation.type);
+    stored_relocation.value = relocation.value - anchor;
+    std::memcpy(payload_ptr, &stored_relocation, sizeof(stored_relocation));
+    payload_ptr += sizeof(stored_relocation);
+  }
+  if (!source_map.empty()) {
+    std::memcpy(payload_ptr, source_map.data(),
+                sizeof(SourceMapEntry) * source_map.size());
+  }
+
+  StoredFunctionHeader function_header = {};
+  function_header.address = function->address();
+  function_header.end_address = function->end_address();
+  function_header.code_size = uint32_t(code_size);
+  function_header.relocation_count = uint32_t(relocations.size());
+  function_header.source_map_count = uint32_t(source_map.size());
+  function_header.prolog_size = func_info.code_size.prolog;
+  function_header.body_size = func_info.code_size.body;
+  function_header.epilog_size = func_info.code_size.epilog;
+  function_header.tail_size = func_info.code_size.tail;
+  function_header.prolog_stack_alloc_offset =
+      func_info.prolog_stack_alloc_offset;
+  function_header.stack_size = func_info.stack_size;
+  function_header.payload_hash = XXH3_64bits(payload.data(), payload.size());
+  fwrite(&function_header, sizeof(function_header), 1, file);
+  fwrite(payload.data(), 1, payload.size(), file);
+}
+
+void* X64CodeCache::PlaceStoredFunction(GuestFunction* function,
+                                        size_t& code_size_out) {
+  StoredFunction stored;
+  {
+    std::lock_guard<std::mutex> storage_lock(storage_mutex_);
+    auto storage_it = module_storages_.find(function->module());
+    if (storage_it == module_storages_.end()) {
+      return nullptr;
+    }
+    auto& functions = storage_it->second->functions;
+    auto function_it = functions.find(function->address());
+    if (function_it == functions.end()) {
+      return nullptr;
+    }
+    stored = std::move(function_it->second);
+    functions.erase(function_it);
+  }
+
+  uintptr_t anchor = host_image_anchor();
+  for (const CodeRelocation& relocation : stored.relocations) {
+    switch (relocation.type) {
+      case CodeRelocation::Type::kHostImageAbsolute64:
+        if (relocation.code_offset + sizeof(uint64_t) >
+            stored.machine_code.size()) {
+          return nullptr;
+        }
+        xe::store<uint64_t>(stored.machine_code.data() + relocation.code_offset,
+                            relocation.value + anchor);
+        break;
+      default:
+        // Unknown relocation - can't use this code.
+        return nullptr;
+    }
+  }
+
+  function->set_end_address(stored.end_address);
+  function->source_map() = std::move(stored.source_map);
+
+  void* code_execute_address;
+  void* code_write_address;
+  PlaceGuestCode(function->address(), stored.machine_code.data(),
+                 stored.func_info, function, code_execute_address,
+                 code_write_address);
+  code_size_out = stored.func_info.code_size.total;
+  return code_execute_address;
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
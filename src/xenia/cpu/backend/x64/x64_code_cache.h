@@ -13,14 +13,21 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/cvar.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+
+DECLARE_path(x64_code_storage_root);
 
 namespace xe {
 namespace cpu {
@@ -39,6 +46,28 @@ struct EmitFunctionInfo {
   size_t stack_size;
 };
 
+// A host pointer embedded in emitted code that must be fixed up when the code
+// is loaded from persistent storage by another process.
+struct CodeRelocation {
+  enum class Type : uint32_t {
+    // 64-bit immediate holding the address of code or data in the host
+    // executable image. Persisted relative to the image anchor, as the image
+    // base may differ between runs.
+    kHostImageAbsolute64,
+  };
+  uint32_t code_offset;
+  Type type;
+  uint64_t value;
+};
+
+// A direct rel32 call or jump in emitted code to another guest function.
+struct CallSite {
+  // Offset of the rel32 operand from the start of the function code. Must be
+  // 4-byte aligned so that it can be rewritten atomically.
+  uint32_t code_offset;
+  uint32_t guest_address;
+};
+
 class X64CodeCache : public CodeCache {
  public:
   ~X64CodeCache() override;
@@ -53,7 +82,6 @@ class X64CodeCache : public CodeCache {
   }
   size_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
@@ -61,21 +89,59 @@ class X64CodeCache : public CodeCache {
   void set_indirection_default(uint32_t default_value);
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
 
+  // Direct call patching.
+  // Call sites registered here initially target the call indirection thunk,
+  // which loads the callee from the indirection table. Once the callee is
+  // installed with AddIndirection they are rewritten to call its code
+  // directly, and they follow it if it is replaced later on.
+  struct CallSiteStats {
+    size_t patched;
+    size_t unpatched;
+  };
+  void set_call_indirection_thunk(uint32_t thunk_address) {
+    call_indirection_thunk_ = thunk_address;
+  }
+  CallSiteStats call_site_stats();
+
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
   void PlaceHostCode(uint32_t guest_address, void* machine_code,
                      const EmitFunctionInfo& func_info,
                      void*& code_execute_address_out,
                      void*& code_write_address_out);
+  // call_sites in the code, if any, are registered and patched before the
+  // code is installed in the indirection table.
   void PlaceGuestCode(uint32_t guest_address, void* machine_code,
                       const EmitFunctionInfo& func_info,
                       GuestFunction* function_info,
                       void*& code_execute_address_out,
-                      void*& code_write_address_out);
+                      void*& code_write_address_out,
+                      const std::vector<CallSite>* call_sites = nullptr);
   uint32_t PlaceData(const void* data, size_t length);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Persistent code storage.
+  // Generated code for guest functions is appended to a file per module, keyed
+  // by the hash of the module code and storage_key, which must identify
+  // everything else the emitted code depends on (host build, CPU features,
+  // fixed thunk and constant addresses). On the next run stored functions are
+  // placed directly instead of being translated again.
+  bool persistent_storage_enabled() const {
+    return !cvars::x64_code_storage_root.empty();
+  }
+  void InitializeModuleStorage(const Module* module, uint64_t module_hash,
+                               uint64_t storage_key);
+  // Appends the final (placed) code of a function to its module storage.
+  // relocations hold absolute values as emitted.
+  void StoreFunction(GuestFunction* function, const void* machine_code,
+                     const EmitFunctionInfo& func_info,
+                     const std::vector<CodeRelocation>& relocations,
+                     const std::vector<SourceMapEntry>& source_map);
+  // Places the stored code for the function, if any, and returns its execute
+  // address, or nullptr if it needs to be translated.
+  void* PlaceStoredFunction(GuestFunction* function, size_t& code_size_out);
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -141,6 +207,49 @@ class X64CodeCache : public CodeCache {
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
   std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+
+  uint32_t* indirection_slot(uint32_t guest_address) const {
+    return reinterpret_cast<uint32_t*>(
+        indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  }
+  // Points the call sites of newly placed code at their callees, or at the
+  // call indirection thunk if they are not installed yet.
+  void AddCallSites(const void* code_execute_address,
+                    const std::vector<CallSite>& call_sites);
+  // Points the rel32 operand at site_offset from the execute base at the
+  // given host address. call_sites_mutex_ must be held.
+  void PatchCallSite(uint32_t site_offset, uint32_t host_address);
+
+  std::mutex call_sites_mutex_;
+  uint32_t call_indirection_thunk_ = 0;
+  struct CalleeCallSites {
+    // Offsets of the rel32 operands from the execute base.
+    std::vector<uint32_t> site_offsets;
+    // The code installed with AddIndirection, 0 if not installed yet.
+    uint32_t host_address = 0;
+  };
+  // By callee guest address.
+  std::unordered_map<uint32_t, CalleeCallSites> call_sites_;
+  size_t call_site_count_ = 0;
+  size_t patched_call_site_count_ = 0;
+
+  struct StoredFunction {
+    uint32_t end_address;
+    EmitFunctionInfo func_info;
+    std::vector<uint8_t> machine_code;
+    std::vector<CodeRelocation> relocations;
+    std::vector<SourceMapEntry> source_map;
+  };
+  struct ModuleStorage {
+    FILE* file = nullptr;
+    // Functions loaded from the file, removed once placed.
+    std::unordered_map<uint32_t, StoredFunction> functions;
+  };
+  static uintptr_t host_image_anchor();
+  // Guards module_storages_ and writes to the storage files.
+  std::mutex storage_mutex_;
+  std::unordered_map<const Module*, std::unique_ptr<ModuleStorage>>
+      module_storages_;
 };
 
 }  // namespace x64
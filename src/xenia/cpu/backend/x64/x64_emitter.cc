@@ -116,6 +116,11 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  relocations_.clear();
+  call_sites_.clear();
+  persistable_ = true;
+  tier_up_function_ =
+      function->tier() == CompilationTier::kBaseline ? function : nullptr;
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
@@ -130,6 +135,14 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
+  // Persist the final code so that the next run can skip translating it.
+  // Tracing and debugging code references per-run data, so skip it.
+  if (persistable_ && !debug_info_flags_ &&
+      code_cache_->persistent_storage_enabled()) {
+    code_cache_->StoreFunction(function, *out_code_address, func_info,
+                               relocations_, *out_source_map);
+  }
+
   return true;
 }
 
@@ -149,7 +162,8 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   assert_true(func_info.code_size.total == size_);
   if (function) {
     code_cache_->PlaceGuestCode(function->address(), top_, func_info, function,
-                                new_execute_address, new_write_address);
+                                new_execute_address, new_write_address,
+                                &call_sites_);
   } else {
     code_cache_->PlaceHostCode(0, top_, func_info, new_execute_address,
                                new_write_address);
@@ -161,6 +175,14 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   return new_execute_address;
 }
 
+// Called by baseline code when its entry counter runs out.
+uint64_t RequestTierUp(void* raw_context, uint64_t function) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  thread_state->processor()->RequestTierUp(
+      reinterpret_cast<GuestFunction*>(function));
+  return 0;
+}
+
 bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
@@ -242,6 +264,20 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
 
+  // Baseline code counts down its entries and has the function recompiled
+  // with all optimizations once it reaches zero. The counter lives in the
+  // function object, so the code can't be persisted - which is fine, as only
+  // optimized code is worth storing.
+  if (tier_up_function_) {
+    MarkNotPersistable();
+    Xbyak::Label skip_tier_up;
+    mov(rax, reinterpret_cast<uint64_t>(tier_up_function_->tier_up_counter()));
+    dec(dword[rax]);
+    jnz(skip_tier_up, CodeGenerator::T_NEAR);
+    CallNative(RequestTierUp, reinterpret_cast<uint64_t>(tier_up_function_));
+    L(skip_tier_up);
+  }
+
   // Load membase.
   mov(GetMembaseReg(),
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
@@ -415,7 +451,18 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
   auto fn = static_cast<X64Function*>(function);
   // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
+  // Stored code may be placed at a different address on the next run, so
+  // don't bake in callee addresses when persisting.
+  bool patchable = false;
+  if (code_cache_->has_indirection_table() &&
+      !code_cache_->persistent_storage_enabled()) {
+    // Call directly, initially through a thunk loading the target from the
+    // indirection table, until the code cache patches in the callee's code.
+    // The resolve thunk expects the target address in ebx.
+    mov(ebx, function->address());
+    patchable = true;
+  } else if (fn->machine_code() &&
+             !code_cache_->persistent_storage_enabled()) {
     // TODO(benvanik): is it worth it to do this? It removes the need for
     // a ResolveFunction call, but makes the table less useful.
     assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
@@ -442,13 +489,33 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
     mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
 
     add(rsp, static_cast<uint32_t>(stack_size()));
-    jmp(rax);
+    if (patchable) {
+      CallPatchable(function->address(), true);
+    } else {
+      jmp(rax);
+    }
   } else {
     // Return address is from the previous SET_RETURN_ADDRESS.
     mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
 
-    call(rax);
+    if (patchable) {
+      CallPatchable(function->address(), false);
+    } else {
+      call(rax);
+    }
+  }
+}
+
+void X64Emitter::CallPatchable(uint32_t guest_address, bool tail) {
+  // Pad so that the rel32 operand is aligned and can be patched atomically.
+  // Functions are placed at 16 byte alignment, so offsets are enough here.
+  while ((getSize() + 1) & 0x3) {
+    nop();
   }
+  db(tail ? 0xE9 : 0xE8);
+  call_sites_.push_back({uint32_t(getSize()), guest_address});
+  // Filled in by the code cache when the code is placed.
+  dd(0);
 }
 
 void X64Emitter::CallIndirect(const hir::Instr* instr,
@@ -471,7 +538,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostImageAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -517,7 +584,10 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<void*>(builtin_function->handler()));
+      // Builtin arguments are usually heap objects.
+      MarkNotPersistable();
       mov(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()));
       mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()));
       call(rax);
@@ -533,7 +603,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(rax);
@@ -541,6 +612,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNotPersistable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -568,11 +640,23 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // r9  = arg2
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostImageAddress(rcx, fn);
   call(rax);
   // rax = host return
 }
 
+void X64Emitter::MovHostImageAddress(const Xbyak::Reg64& reg,
+                                     const void* address) {
+  // Always use the full mov r64, imm64 encoding so the immediate is at a
+  // known offset and can hold any relocated address.
+  db(0x48 | (reg.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (reg.getIdx() & 7));
+  relocations_.push_back({uint32_t(getSize()),
+                          CodeRelocation::Type::kHostImageAbsolute64,
+                          reinterpret_cast<uint64_t>(address)});
+  dq(reinterpret_cast<uint64_t>(address));
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -38,6 +38,8 @@ namespace x64 {
 class X64Backend;
 class X64CodeCache;
 
+struct CallSite;
+struct CodeRelocation;
 struct EmitFunctionInfo;
 
 enum RegisterFlags {
@@ -201,6 +203,10 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void UnimplementedInstr(const hir::Instr* i);
 
   void Call(const hir::Instr* instr, GuestFunction* function);
+  // Emits a direct call (or tail jump) to a guest function, patched by
+  // X64CodeCache to target its code once available. ebx must hold the guest
+  // address.
+  void CallPatchable(uint32_t guest_address, bool tail);
   void CallIndirect(const hir::Instr* instr, const Xbyak::Reg64& reg);
   void CallExtern(const hir::Instr* instr, const Function* function);
   void CallNative(void* fn);
@@ -211,6 +217,14 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
 
+  // Moves the address of code or data in the host executable image (not the
+  // heap or the code cache) into a register as a relocatable immediate.
+  void MovHostImageAddress(const Xbyak::Reg64& reg, const void* address);
+  // Marks the function being emitted as depending on state only valid in this
+  // process (heap pointers, runtime-derived constants), so it must not be put
+  // into persistent code storage.
+  void MarkNotPersistable() { persistable_ = false; }
+
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
   Xbyak::Reg64 GetContextReg();
@@ -233,6 +247,7 @@ class X64Emitter : public Xbyak::CodeGenerator {
   Xbyak::Address StashConstantXmm(int index, double v);
   Xbyak::Address StashConstantXmm(int index, const vec128_t& v);
 
+  uint32_t feature_flags() const { return feature_flags_; }
   bool IsFeatureEnabled(uint32_t feature_flag) const {
     return (feature_flags_ & feature_flag) == feature_flag;
   }
@@ -263,8 +278,15 @@ class X64Emitter : public Xbyak::CodeGenerator {
   FunctionDebugInfo* debug_info_ = nullptr;
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
+  // Set when emitting baseline code that counts its entries.
+  GuestFunction* tier_up_function_ = nullptr;
   Arena source_map_arena_;
 
+  // Relocations and persistability of the function being emitted.
+  std::vector<CodeRelocation> relocations_;
+  std::vector<CallSite> call_sites_;
+  bool persistable_ = true;
+
   size_t stack_size_ = 0;
 
   static const uint32_t gpr_reg_map_[GPR_COUNT];
@@ -556,6 +556,8 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkNotPersistable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -581,6 +583,8 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkNotPersistable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
@@ -603,6 +607,112 @@ struct STORE_MMIO_I32
 };
 EMITTER_OPCODE_TABLE(OPCODE_STORE_MMIO, STORE_MMIO_I32);
 
+// ============================================================================
+// OPCODE_LOAD_MMIO_CHECKED
+// ============================================================================
+// Emitted at guest instructions that have faulted into an MMIO range before.
+// Addresses within the range call it, others access memory as usual.
+template <typename T>
+void EmitMMIOCheckedAddress(X64Emitter& e, const T& guest,
+                            const Xbyak::Reg32& dest) {
+  if (guest.is_constant) {
+    e.mov(dest, uint32_t(guest.constant()));
+  } else {
+    e.mov(dest, guest.reg().cvt32());
+  }
+}
+template <typename T>
+void EmitMMIORangeCheck(X64Emitter& e, const T& guest,
+                        const MMIORange* mmio_range, Xbyak::Label& mmio) {
+  EmitMMIOCheckedAddress(e, guest, e.eax);
+  e.and_(e.eax, mmio_range->mask);
+  e.cmp(e.eax, mmio_range->address);
+  e.je(mmio, CodeGenerator::T_NEAR);
+}
+struct LOAD_MMIO_CHECKED_I32
+    : Sequence<LOAD_MMIO_CHECKED_I32,
+               I<OPCODE_LOAD_MMIO_CHECKED, I32Op, I64Op, OffsetOp>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    auto mmio_range = reinterpret_cast<MMIORange*>(i.src2.value);
+    // The range is a heap object.
+    e.MarkNotPersistable();
+    Xbyak::Label mmio, done;
+    EmitMMIORangeCheck(e, i.src1, mmio_range, mmio);
+    auto addr = ComputeMemoryAddress(e, i.src1);
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+      if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(i.dest, e.dword[addr]);
+      } else {
+        e.mov(i.dest, e.dword[addr]);
+        e.bswap(i.dest);
+      }
+    } else {
+      e.mov(i.dest, e.dword[addr]);
+    }
+    e.jmp(done, CodeGenerator::T_NEAR);
+    // uint32_t (context, range, addr)
+    e.L(mmio);
+    e.mov(e.GetNativeParam(0), uint64_t(mmio_range));
+    EmitMMIOCheckedAddress(e, i.src1, e.GetNativeParam(1).cvt32());
+    e.CallNativeSafe(reinterpret_cast<void*>(MMIOHandler::ReadAtLearnedSite));
+    if (!(i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+      e.bswap(e.eax);
+    }
+    e.mov(i.dest, e.eax);
+    e.L(done);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_LOAD_MMIO_CHECKED, LOAD_MMIO_CHECKED_I32);
+
+// ============================================================================
+// OPCODE_STORE_MMIO_CHECKED
+// ============================================================================
+struct STORE_MMIO_CHECKED_I32
+    : Sequence<STORE_MMIO_CHECKED_I32,
+               I<OPCODE_STORE_MMIO_CHECKED, VoidOp, I64Op, OffsetOp, I32Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    auto mmio_range = reinterpret_cast<MMIORange*>(i.src2.value);
+    bool byte_swap = i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP;
+    // The range is a heap object.
+    e.MarkNotPersistable();
+    Xbyak::Label mmio, done;
+    EmitMMIORangeCheck(e, i.src1, mmio_range, mmio);
+    auto addr = ComputeMemoryAddress(e, i.src1);
+    if (byte_swap) {
+      assert_false(i.src3.is_constant);
+      if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(e.dword[addr], i.src3);
+      } else {
+        assert_always("not implemented");
+      }
+    } else {
+      if (i.src3.is_constant) {
+        e.mov(e.dword[addr], i.src3.constant());
+      } else {
+        e.mov(e.dword[addr], i.src3);
+      }
+    }
+    e.jmp(done, CodeGenerator::T_NEAR);
+    // void (context, range, addr, value)
+    e.L(mmio);
+    e.mov(e.GetNativeParam(0), uint64_t(mmio_range));
+    EmitMMIOCheckedAddress(e, i.src1, e.GetNativeParam(1).cvt32());
+    if (i.src3.is_constant) {
+      e.mov(e.GetNativeParam(2).cvt32(),
+            byte_swap ? uint32_t(i.src3.constant())
+                      : xe::byte_swap(uint32_t(i.src3.constant())));
+    } else {
+      e.mov(e.GetNativeParam(2).cvt32(), i.src3);
+      if (!byte_swap) {
+        e.bswap(e.GetNativeParam(2).cvt32());
+      }
+    }
+    e.CallNativeSafe(reinterpret_cast<void*>(MMIOHandler::WriteAtLearnedSite));
+    e.L(done);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_STORE_MMIO_CHECKED, STORE_MMIO_CHECKED_I32);
+
 // ============================================================================
 // OPCODE_LOAD_OFFSET
 // ============================================================================
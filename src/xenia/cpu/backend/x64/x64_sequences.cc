@@ -65,6 +65,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = xe_strdup(str);
+      e.MarkNotPersistable();
       e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
@@ -441,13 +442,20 @@ EMITTER_OPCODE_TABLE(OPCODE_ROUND, ROUND_F32, ROUND_F64, ROUND_V128);
 // ============================================================================
 struct LOAD_CLOCK : Sequence<LOAD_CLOCK, I<OPCODE_LOAD_CLOCK, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // When scaling is disabled and the raw clock source is selected, the code
-    // in the Clock class is actually just forwarding tick counts after one
-    // simple multiply and division. In that case we rather bake the scaling in
-    // here to cut extra function calls with CPU cache misses and stack frame
-    // overhead.
-    if (cvars::clock_no_scaling && cvars::clock_source_raw) {
-      auto ratio = Clock::guest_tick_ratio();
+    // With the raw clock source, the whole conversion done by the Clock class
+    // is baked in here to avoid a function call, as games busy-poll mftb. The
+    // conversion parameters are read under their sequence lock, so this never
+    // blocks, and any clock scaling changes are picked up.
+    if (cvars::clock_source_raw) {
+      // The parameters are referenced by their host address.
+      e.MarkNotPersistable();
+      using Params = Clock::GuestTickParameters;
+      e.mov(e.rcx, reinterpret_cast<uint64_t>(&Clock::guest_tick_parameters()));
+      Xbyak::Label retry;
+      e.L(retry);
+      e.mov(e.r8, e.qword[e.rcx + offsetof(Params, sequence)]);
+      e.test(e.r8b, 1);
+      e.jnz(retry);
       // The 360 CPU is an in-order CPU, AMD64 usually isn't. Without
       // mfence/lfence magic the rdtsc instruction can be executed sooner or
       // later in the cache window. Since it's resolution however is much higher
@@ -458,13 +466,26 @@ struct LOAD_CLOCK : Sequence<LOAD_CLOCK, I<OPCODE_LOAD_CLOCK, I64Op>> {
       // Make it a 64 bit number in rax.
       e.shl(e.rdx, 32);
       e.or_(e.rax, e.rdx);
-      // Apply tick frequency scaling.
-      e.mov(e.rcx, ratio.first);
-      e.mul(e.rcx);
-      // We actually now have a 128 bit number in rdx:rax.
-      e.mov(e.rcx, ratio.second);
-      e.div(e.rcx);
-      e.mov(i.dest, e.rax);
+      if (!cvars::clock_no_scaling) {
+        // Ticks since the base, clamped to 0 if the base is newer.
+        e.xor_(e.r9d, e.r9d);
+        e.sub(e.rax, e.qword[e.rcx + offsetof(Params, host_tick_base)]);
+        e.cmovb(e.rax, e.r9);
+      }
+      // Apply the ratio: the integer part, plus the high 64 bits of the
+      // product with the fraction.
+      e.mov(e.r9, e.rax);
+      e.mul(e.qword[e.rcx + offsetof(Params, ratio_fraction)]);
+      e.imul(e.r9, e.qword[e.rcx + offsetof(Params, ratio_integer)]);
+      e.add(e.r9, e.rdx);
+      if (!cvars::clock_no_scaling) {
+        e.add(e.r9, e.qword[e.rcx + offsetof(Params, guest_tick_base)]);
+      }
+      // Loads are not reordered with other loads on x86, so the parameters
+      // were consistent if the sequence is unchanged.
+      e.cmp(e.r8, e.qword[e.rcx + offsetof(Params, sequence)]);
+      e.jne(retry);
+      e.mov(i.dest, e.r9);
     } else {
       e.CallNative(LoadClock);
       e.mov(i.dest, e.rax);
@@ -3327,7 +3348,7 @@ struct SET_ROUNDING_MODE_I32
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.mov(e.rcx, i.src1);
     e.and_(e.rcx, 0x7);
-    e.mov(e.rax, uintptr_t(mxcsr_table));
+    e.MovHostImageAddress(e.rax, mxcsr_table);
     e.vldmxcsr(e.ptr[e.rax + e.rcx * 4]);
   }
 };
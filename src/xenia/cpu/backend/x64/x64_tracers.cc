@@ -36,9 +36,10 @@ bool trace_enabled = true;
   if (trace_enabled && THREAD_MATCH) \
   xe::logging::AppendLogLine(xe::LogLevel::Debug, 't', s)
 #define DFLUSH()
+// Data traces are emitted for every access, leave formatting to the logger.
 #define DPRINT(...)                  \
   if (trace_enabled && THREAD_MATCH) \
-  xe::logging::AppendLogLineFormat(xe::LogLevel::Debug, 't', __VA_ARGS__)
+  xe::logging::AppendLogLineDeferred(xe::LogLevel::Debug, 't', __VA_ARGS__)
 
 uint32_t GetTracingMode() {
   uint32_t mode = 0;
@@ -9,18 +9,14 @@
 
 #include "xenia/cpu/compiler/passes/context_promotion_pass.h"
 
-#include "xenia/apu/apu_flags.h"
-#include "xenia/base/cvar.h"
+#include <algorithm>
+
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/processor.h"
 
-DECLARE_bool(debug);
-
-DEFINE_bool(store_all_context_values, false,
-            "Don't strip dead context stores to aid in debugging.", "CPU");
-
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -34,7 +30,8 @@ using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::Value;
 
-ContextPromotionPass::ContextPromotionPass() : CompilerPass() {}
+ContextPromotionPass::ContextPromotionPass(bool cross_block)
+    : CompilerPass(), cross_block_(cross_block) {}
 
 ContextPromotionPass::~ContextPromotionPass() {}
 
@@ -43,13 +40,21 @@ bool ContextPromotionPass::Initialize(Compiler* compiler) {
     return false;
   }
 
-  // This is a terrible implementation.
-  context_values_.resize(sizeof(ppc::PPCContext));
-  context_validity_.resize(static_cast<uint32_t>(sizeof(ppc::PPCContext)));
+  // Flat lookup, only the offsets touched by a function are reset after it.
+  offset_slots_.resize(sizeof(ppc::PPCContext), kNoSlot);
 
   return true;
 }
 
+// Whether the instruction may observe or modify the context behind our back.
+// Conditional branches are flagged volatile but only transfer control within
+// the function, which the CFG already accounts for.
+static bool IsContextBarrier(const Instr* i) {
+  return (i->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+         i->opcode != &OPCODE_BRANCH_TRUE_info &&
+         i->opcode != &OPCODE_BRANCH_FALSE_info;
+}
+
 bool ContextPromotionPass::Run(HIRBuilder* builder) {
   // Like mem2reg, but because context memory is unaliasable it's easier to
   // check and convert LoadContext/StoreContext into value operations.
@@ -59,94 +64,162 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   //   v1 = load_context +100  <-- replace with v1 = v0
   //   store_context +200, v1
   //
-  // It'd be possible in this stage to also remove redundant context stores:
-  // Example of dead store elimination:
-  //   store_context +100, v0  <-- removed due to following store
-  //   store_context +100, v1
-  // This is more generally done by DSE, however if it could be done here
-  // instead as it may be faster (at least on the block-level).
+  // With cross_block_ the values in each slot are tracked across blocks as
+  // well: a slot holds a known value at the start of a block only if it is
+  // the same value at the end of all predecessors. As HIR values are SSA that
+  // value's definition then dominates the block, so it can be used directly.
+  GatherSlots(builder);
+  if (slot_offsets_.empty()) {
+    return true;
+  }
 
-  // Promote loads to values.
-  // Process each block independently, for now.
-  auto block = builder->first_block();
-  while (block) {
-    PromoteBlock(block);
-    block = block->next;
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_count++;
+  }
+  block_values_.resize(block_count);
+  for (auto& block_values : block_values_) {
+    block_values.in.assign(slot_offsets_.size(), nullptr);
+    block_values.out.assign(slot_offsets_.size(), nullptr);
+    block_values.visited = false;
   }
 
-  // Remove all dead stores.
-  // This will break debugging as we can't recover this information when
-  // trying to extract stack traces/register values, so we don't do that.
-  if (!cvars::debug && !cvars::store_all_context_values) {
-    block = builder->first_block();
-    while (block) {
-      RemoveDeadStoresBlock(block);
-      block = block->next;
+  // Iterate to a fixed point. Predecessors not yet visited are ignored so
+  // that loops can carry values, and slot values only ever get dropped from
+  // the block inputs, so this terminates. Otherwise every block starts out
+  // knowing nothing.
+  std::vector<Value*> values;
+  bool changed = cross_block_;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->first_block(); block; block = block->next) {
+      auto& block_values = block_values_[block->ordinal];
+      MergeIncomingValues(block, block == builder->first_block());
+      values = block_values.in;
+      PromoteBlock(block, values, false);
+      if (!block_values.visited || values != block_values.out) {
+        block_values.out.swap(values);
+        block_values.visited = true;
+        changed = true;
+      }
     }
   }
 
+  // Promote loads to values.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    values = block_values_[block->ordinal].in;
+    PromoteBlock(block, values, true);
+  }
+
+  for (uint32_t offset : slot_offsets_) {
+    offset_slots_[offset] = kNoSlot;
+  }
+  slot_offsets_.clear();
+  slot_sizes_.clear();
+  block_values_.clear();
   return true;
 }
 
-void ContextPromotionPass::PromoteBlock(Block* block) {
-  auto& validity = context_validity_;
-  validity.reset();
+void ContextPromotionPass::GatherSlots(HIRBuilder* builder) {
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      uint32_t size;
+      if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+        size = uint32_t(GetTypeSize(i->dest->type));
+      } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        size = uint32_t(GetTypeSize(i->src2.value->type));
+      } else {
+        continue;
+      }
+      uint32_t offset = uint32_t(i->src1.offset);
+      assert_true(offset + size <= offset_slots_.size());
+      uint32_t& slot = offset_slots_[offset];
+      if (slot == kNoSlot) {
+        slot = uint32_t(slot_offsets_.size());
+        slot_offsets_.push_back(offset);
+        slot_sizes_.push_back(size);
+      } else {
+        slot_sizes_[slot] = std::max(slot_sizes_[slot], size);
+      }
+    }
+  }
+}
+
+void ContextPromotionPass::MergeIncomingValues(Block* block, bool is_entry) {
+  auto& block_values = block_values_[block->ordinal];
+  auto& in = block_values.in;
+  if (is_entry) {
+    // Anything may be in the context when the function is entered.
+    return;
+  }
+  // Once visited, merge with the previous input so that slots never regain
+  // a value after losing it.
+  bool has_in = block_values.visited;
+  for (auto edge = block->incoming_edge_head; edge;
+       edge = edge->incoming_next) {
+    const auto& src_values = block_values_[edge->src->ordinal];
+    if (!src_values.visited) {
+      continue;
+    }
+    if (!has_in) {
+      in = src_values.out;
+      has_in = true;
+      continue;
+    }
+    for (size_t n = 0; n < in.size(); ++n) {
+      if (in[n] != src_values.out[n]) {
+        in[n] = nullptr;
+      }
+    }
+  }
+  if (!has_in) {
+    std::fill(in.begin(), in.end(), nullptr);
+  }
+}
 
+void ContextPromotionPass::PromoteBlock(Block* block,
+                                        std::vector<Value*>& values,
+                                        bool rewrite) {
   Instr* i = block->instr_head;
   while (i) {
     auto next = i->next;
-    if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
+    if (IsContextBarrier(i)) {
       // Volatile instruction - requires all context values be flushed.
-      validity.reset();
+      std::fill(values.begin(), values.end(), nullptr);
     } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
-      size_t offset = i->src1.offset;
-      if (validity.test(static_cast<uint32_t>(offset))) {
+      uint32_t slot = offset_slots_[i->src1.offset];
+      Value* previous_value = values[slot];
+      if (previous_value && previous_value->type == i->dest->type) {
         // Legit previous value, reuse.
-        Value* previous_value = context_values_[offset];
-        i->opcode = &hir::OPCODE_ASSIGN_info;
-        i->set_src1(previous_value);
+        if (rewrite) {
+          i->opcode = &hir::OPCODE_ASSIGN_info;
+          i->set_src1(previous_value);
+        }
       } else {
         // Store the loaded value into the table.
-        context_values_[offset] = i->dest;
-        validity.set(static_cast<uint32_t>(offset));
+        values[slot] = i->dest;
       }
     } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
-      size_t offset = i->src1.offset;
+      uint32_t offset = uint32_t(i->src1.offset);
       Value* value = i->src2.value;
+      uint32_t size = uint32_t(GetTypeSize(value->type));
+      // Drop any other slot partially overwritten by the store.
+      uint32_t first_offset = offset >= 15 ? offset - 15 : 0;
+      for (uint32_t other_offset = first_offset;
+           other_offset < offset + size; ++other_offset) {
+        uint32_t other_slot = offset_slots_[other_offset];
+        if (other_slot != kNoSlot && other_offset != offset &&
+            other_offset + slot_sizes_[other_slot] > offset) {
+          values[other_slot] = nullptr;
+        }
+      }
       // Store value into the table for later.
-      context_values_[offset] = value;
-      validity.set(static_cast<uint32_t>(offset));
+      values[offset_slots_[offset]] = value;
     }
     i = next;
   }
 }
 
-void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
-  auto& validity = context_validity_;
-  validity.reset();
-
-  // Walk backwards and mark offsets that are written to.
-  // If the offset was written to earlier, ignore the store.
-  Instr* i = block->instr_tail;
-  while (i) {
-    Instr* prev = i->prev;
-    if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
-      // Volatile instruction - requires all context values be flushed.
-      validity.reset();
-    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
-      size_t offset = i->src1.offset;
-      if (!validity.test(static_cast<uint32_t>(offset))) {
-        // Offset not yet written, mark and continue.
-        validity.set(static_cast<uint32_t>(offset));
-      } else {
-        // Already written to. Remove this store.
-        i->Remove();
-      }
-    }
-    i = prev;
-  }
-}
-
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
@@ -10,30 +10,22 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_CONTEXT_PROMOTION_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_CONTEXT_PROMOTION_PASS_H_
 
-#include <cmath>
 #include <vector>
 
-#include "xenia/base/platform.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
 
-#if XE_COMPILER_MSVC
-#pragma warning(push)
-#pragma warning(disable : 4244)
-#pragma warning(disable : 4267)
-#include <llvm/ADT/BitVector.h>
-#pragma warning(pop)
-#else
-#include <llvm/ADT/BitVector.h>
-#endif  // XE_COMPILER_MSVC
-
 namespace xe {
 namespace cpu {
 namespace compiler {
 namespace passes {
 
+// Forwards context stores and loads to later loads of the same context slot.
+// With cross_block set this works across the whole function, leaving values
+// live across blocks, and requires the CFG from ControlFlowAnalysisPass.
+// Dead context stores are left to DeadStoreEliminationPass.
 class ContextPromotionPass : public CompilerPass {
  public:
-  ContextPromotionPass();
+  explicit ContextPromotionPass(bool cross_block = false);
   virtual ~ContextPromotionPass() override;
 
   bool Initialize(Compiler* compiler) override;
@@ -41,12 +33,29 @@ class ContextPromotionPass : public CompilerPass {
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
-  void PromoteBlock(hir::Block* block);
-  void RemoveDeadStoresBlock(hir::Block* block);
+  struct BlockValues {
+    // Context values known to be in each slot at the block boundaries.
+    std::vector<hir::Value*> in;
+    std::vector<hir::Value*> out;
+    bool visited;
+  };
 
- private:
-  std::vector<hir::Value*> context_values_;
-  llvm::BitVector context_validity_;
+  void GatherSlots(hir::HIRBuilder* builder);
+  void MergeIncomingValues(hir::Block* block, bool is_entry);
+  void PromoteBlock(hir::Block* block, std::vector<hir::Value*>& values,
+                    bool rewrite);
+
+  static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+  bool cross_block_;
+
+  // Slot index of every context offset accessed by the function.
+  std::vector<uint32_t> offset_slots_;
+  std::vector<uint32_t> slot_offsets_;
+  // Largest access size of each slot.
+  std::vector<uint32_t> slot_sizes_;
+  // Indexed by block ordinal.
+  std::vector<BlockValues> block_values_;
 };
 
 }  // namespace passes
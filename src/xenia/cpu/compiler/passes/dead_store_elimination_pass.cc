@@ -0,0 +1,171 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/processor.h"
+
+DECLARE_bool(debug);
+
+DEFINE_bool(store_all_context_values, false,
+            "Don't strip dead context stores to aid in debugging.", "CPU");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+// Whether the context must be fully up to date when the instruction executes.
+// Conditional branches are flagged volatile but stay within the function.
+static bool IsContextBarrier(const Instr* i) {
+  if (i->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+    return true;
+  }
+  return (i->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+         i->opcode != &OPCODE_BRANCH_TRUE_info &&
+         i->opcode != &OPCODE_BRANCH_FALSE_info;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  // Removing stores breaks debugging as we can't recover this information when
+  // trying to extract stack traces/register values, so we don't do that.
+  if (cvars::debug || cvars::store_all_context_values) {
+    return true;
+  }
+
+  // Example of dead store elimination:
+  //   store_context +100, v0  <-- removed due to following store
+  //   branch_true v1, label
+  //   ...
+  //   store_context +100, v2  (in both successors)
+  // Calls, returns, traps and context barriers read the whole context.
+  first_offset_ = UINT32_MAX;
+  end_offset_ = 0;
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_count++;
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        uint32_t offset = uint32_t(i->src1.offset);
+        first_offset_ = std::min(first_offset_, offset);
+        end_offset_ = std::max(
+            end_offset_, offset + uint32_t(GetTypeSize(i->src2.value->type)));
+      }
+    }
+  }
+  if (first_offset_ >= end_offset_) {
+    return true;
+  }
+  size_t word_count = (end_offset_ - first_offset_ + 63) / 64;
+
+  // Compute the liveness at the start of every block, walking backwards as
+  // liveness flows up. Liveness only ever grows, so this terminates.
+  block_live_in_.resize(block_count);
+  for (auto& live_in : block_live_in_) {
+    live_in.assign(word_count, 0);
+  }
+  std::vector<uint64_t> live;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->last_block(); block; block = block->prev) {
+      GetOutgoingLiveness(block, live);
+      RemoveDeadStoresBlock(block, live, false);
+      auto& live_in = block_live_in_[block->ordinal];
+      if (live != live_in) {
+        live_in.swap(live);
+        changed = true;
+      }
+    }
+  }
+
+  // Remove all dead stores.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    GetOutgoingLiveness(block, live);
+    RemoveDeadStoresBlock(block, live, true);
+  }
+
+  block_live_in_.clear();
+  return true;
+}
+
+void DeadStoreEliminationPass::GetOutgoingLiveness(
+    Block* block, std::vector<uint64_t>& live) {
+  if (!block->outgoing_edge_head) {
+    // Leaving the function (or lost track of where to) - everything is read.
+    live.assign(block_live_in_[0].size(), UINT64_MAX);
+    return;
+  }
+  live.assign(block_live_in_[0].size(), 0);
+  for (auto edge = block->outgoing_edge_head; edge;
+       edge = edge->outgoing_next) {
+    const auto& dest_live_in = block_live_in_[edge->dest->ordinal];
+    for (size_t n = 0; n < live.size(); ++n) {
+      live[n] |= dest_live_in[n];
+    }
+  }
+}
+
+void DeadStoreEliminationPass::RemoveDeadStoresBlock(
+    Block* block, std::vector<uint64_t>& live, bool remove) {
+  // Walk backwards and track the context bytes read before being written.
+  Instr* i = block->instr_tail;
+  while (i) {
+    Instr* prev = i->prev;
+    if (IsContextBarrier(i)) {
+      // Volatile instruction - requires all context values be flushed.
+      std::fill(live.begin(), live.end(), UINT64_MAX);
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = uint32_t(i->src1.offset);
+      uint32_t end = offset + uint32_t(GetTypeSize(i->dest->type));
+      // Bytes outside of the stored range can't keep any store alive.
+      for (uint32_t n = std::max(offset, first_offset_);
+           n < std::min(end, end_offset_); ++n) {
+        uint32_t bit = n - first_offset_;
+        live[bit / 64] |= uint64_t(1) << (bit % 64);
+      }
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = uint32_t(i->src1.offset);
+      uint32_t end = offset + uint32_t(GetTypeSize(i->src2.value->type));
+      bool any_live = false;
+      for (uint32_t n = offset; n < end; ++n) {
+        uint32_t bit = n - first_offset_;
+        uint64_t mask = uint64_t(1) << (bit % 64);
+        any_live |= (live[bit / 64] & mask) != 0;
+        live[bit / 64] &= ~mask;
+      }
+      if (!any_live && remove) {
+        // Overwritten before anything reads it. Remove this store.
+        i->Remove();
+      }
+    }
+    i = prev;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,50 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context stores that are overwritten on every path before the
+// context is read again, including across blocks. Context liveness is
+// tracked per byte so that differently sized accesses are handled exactly.
+// Requires an up to date CFG from ControlFlowAnalysisPass.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  void GetOutgoingLiveness(hir::Block* block, std::vector<uint64_t>& live);
+  void RemoveDeadStoresBlock(hir::Block* block, std::vector<uint64_t>& live,
+                             bool remove);
+
+  // Range of context bytes accessed by the function.
+  uint32_t first_offset_;
+  uint32_t end_offset_;
+  // Bit per context byte that may be read later, indexed by block ordinal.
+  std::vector<std::vector<uint64_t>> block_live_in_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
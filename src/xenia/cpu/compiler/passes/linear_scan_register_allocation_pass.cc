@@ -0,0 +1,512 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/linear_scan_register_allocation_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+bool IsAllocatable(const Value* value) {
+  return value && value->def && !value->IsConstant();
+}
+
+bool IsCall(const Instr* instr) {
+  const OpcodeInfo* opcode = instr->opcode;
+  return opcode == &OPCODE_CALL_info || opcode == &OPCODE_CALL_TRUE_info ||
+         opcode == &OPCODE_CALL_INDIRECT_info ||
+         opcode == &OPCODE_CALL_INDIRECT_TRUE_info ||
+         opcode == &OPCODE_CALL_EXTERN_info;
+}
+
+template <typename F>
+void ForEachSourceValue(Instr* instr, F f) {
+  uint32_t signature = instr->opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+    f(instr->src1.value);
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+    f(instr->src2.value);
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+    f(instr->src3.value);
+  }
+}
+
+void ReplaceSourceValue(Instr* instr, Value* old_value, Value* new_value) {
+  uint32_t signature = instr->opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+      instr->src1.value == old_value) {
+    instr->set_src1(new_value);
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+      instr->src2.value == old_value) {
+    instr->set_src2(new_value);
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+      instr->src3.value == old_value) {
+    instr->set_src3(new_value);
+  }
+}
+
+// Instr::MoveBefore, but also able to move to the end of a block.
+void MoveAfter(Instr* instr, Instr* prev_instr) {
+  if (prev_instr->next == instr) {
+    return;
+  }
+  if (prev_instr->next) {
+    instr->MoveBefore(prev_instr->next);
+    return;
+  }
+  if (instr->prev) {
+    instr->prev->next = instr->next;
+  } else {
+    instr->block->instr_head = instr->next;
+  }
+  if (instr->next) {
+    instr->next->prev = instr->prev;
+  } else {
+    instr->block->instr_tail = instr->prev;
+  }
+  instr->block = prev_instr->block;
+  instr->prev = prev_instr;
+  instr->next = nullptr;
+  prev_instr->next = instr;
+  instr->block->instr_tail = instr;
+}
+
+// Returns the distinct instructions using the value, in use list order.
+std::vector<Instr*> GetUsingInstrs(const Value* value) {
+  std::vector<Instr*> instrs;
+  for (auto use = value->use_head; use; use = use->next) {
+    if (std::find(instrs.begin(), instrs.end(), use->instr) == instrs.end()) {
+      instrs.push_back(use->instr);
+    }
+  }
+  return instrs;
+}
+
+bool TestBit(const std::vector<uint64_t>& bits, uint32_t index) {
+  return (bits[index >> 6] >> (index & 63)) & 1;
+}
+
+void SetBit(std::vector<uint64_t>& bits, uint32_t index) {
+  bits[index >> 6] |= uint64_t(1) << (index & 63);
+}
+
+}  // namespace
+
+LinearScanRegisterAllocationPass::LinearScanRegisterAllocationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass() {
+  auto mi_sets = machine_info->register_sets;
+  for (uint32_t n = 0; n < xe::countof(machine_info->register_sets) &&
+                       mi_sets[n].count;
+       ++n) {
+    assert_true(mi_sets[n].count <= 32);
+    RegisterSetState state;
+    state.set = &mi_sets[n];
+    state.free_mask = 0;
+    register_sets_.push_back(std::move(state));
+  }
+}
+
+LinearScanRegisterAllocationPass::~LinearScanRegisterAllocationPass() = default;
+
+bool LinearScanRegisterAllocationPass::Run(HIRBuilder* builder) {
+  stats_ = RegisterAllocationStats();
+  unspillable_values_.clear();
+
+  NumberInstructions(builder);
+  ComputeLiveness(builder);
+  if (SplitAcrossCalls(builder)) {
+    NumberInstructions(builder);
+    ComputeLiveness(builder);
+  }
+
+  while (true) {
+    BuildIntervals();
+    std::vector<Value*> spills;
+    if (!Allocate(spills)) {
+      // Only reloads were live, which can't happen with sane register counts.
+      XELOGE("Linear scan register allocation failed");
+      assert_always();
+      return false;
+    }
+    if (spills.empty()) {
+      break;
+    }
+    // Spilled values are reloaded right before each use, so just redo the
+    // whole allocation with the much shorter intervals.
+    for (Value* value : spills) {
+      SpillValue(builder, value);
+    }
+    NumberInstructions(builder);
+    ComputeLiveness(builder);
+  }
+
+  blocks_.clear();
+  intervals_.clear();
+  values_.clear();
+  unspillable_values_.clear();
+  return true;
+}
+
+void LinearScanRegisterAllocationPass::NumberInstructions(
+    HIRBuilder* builder) {
+  blocks_.clear();
+  uint16_t block_ordinal = 0;
+  uint32_t instr_ordinal = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+    BlockInfo info;
+    info.block = block;
+    info.start = instr_ordinal * 2;
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      instr->ordinal = instr_ordinal++;
+    }
+    info.end = instr_ordinal * 2;
+    blocks_.push_back(std::move(info));
+  }
+
+  // Gather successors. Any branch to a label is an edge, and unless the block
+  // ends in an unconditional branch or return it may also fall through.
+  for (auto& info : blocks_) {
+    auto block = info.block;
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      uint32_t signature = instr->opcode->signature;
+      Label* label = nullptr;
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_L) {
+        label = instr->src1.label;
+      } else if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_L) {
+        label = instr->src2.label;
+      }
+      if (label && label->block) {
+        info.successors.push_back(label->block->ordinal);
+      }
+    }
+    auto tail = block->instr_tail;
+    if (block->next &&
+        !(tail && (tail->opcode == &OPCODE_BRANCH_info ||
+                   tail->opcode == &OPCODE_RETURN_info))) {
+      info.successors.push_back(block->next->ordinal);
+    }
+  }
+}
+
+void LinearScanRegisterAllocationPass::ComputeLiveness(HIRBuilder* builder) {
+  uint32_t value_count = builder->max_value_ordinal();
+  size_t word_count = (value_count + 63) / 64;
+  values_.assign(value_count, nullptr);
+
+  // Upward-exposed uses and definitions of each block.
+  std::vector<std::vector<uint64_t>> uses(blocks_.size());
+  std::vector<std::vector<uint64_t>> defs(blocks_.size());
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    auto& block_uses = uses[i];
+    auto& block_defs = defs[i];
+    block_uses.assign(word_count, 0);
+    block_defs.assign(word_count, 0);
+    for (auto instr = blocks_[i].block->instr_head; instr;
+         instr = instr->next) {
+      ForEachSourceValue(instr, [&](Value* value) {
+        if (IsAllocatable(value) && !TestBit(block_defs, value->ordinal)) {
+          SetBit(block_uses, value->ordinal);
+        }
+      });
+      if (IsAllocatable(instr->dest)) {
+        assert_true(instr->dest->ordinal < value_count);
+        SetBit(block_defs, instr->dest->ordinal);
+        values_[instr->dest->ordinal] = instr->dest;
+      }
+    }
+    blocks_[i].live_in.assign(word_count, 0);
+    blocks_[i].live_out.assign(word_count, 0);
+  }
+
+  // Iterate to a fixed point, walking backwards as liveness flows up.
+  bool changed = true;
+  std::vector<uint64_t> live_in(word_count);
+  while (changed) {
+    changed = false;
+    for (size_t i = blocks_.size(); i-- > 0;) {
+      auto& info = blocks_[i];
+      for (uint32_t successor : info.successors) {
+        const auto& successor_live_in = blocks_[successor].live_in;
+        for (size_t w = 0; w < word_count; ++w) {
+          info.live_out[w] |= successor_live_in[w];
+        }
+      }
+      for (size_t w = 0; w < word_count; ++w) {
+        live_in[w] = uses[i][w] | (info.live_out[w] & ~defs[i][w]);
+      }
+      if (live_in != info.live_in) {
+        info.live_in.swap(live_in);
+        changed = true;
+      }
+    }
+  }
+}
+
+bool LinearScanRegisterAllocationPass::SplitAcrossCalls(HIRBuilder* builder) {
+  // Calls always end their block, and the callee may use all allocatable
+  // registers, so anything live out of a calling block must go to memory.
+  std::vector<uint64_t> to_split(blocks_.empty() ? 0
+                                                 : blocks_[0].live_out.size());
+  bool any_calls = false;
+  for (auto& info : blocks_) {
+    for (auto instr = info.block->instr_head; instr; instr = instr->next) {
+      if (IsCall(instr)) {
+        for (size_t w = 0; w < to_split.size(); ++w) {
+          to_split[w] |= info.live_out[w];
+        }
+        any_calls = true;
+        break;
+      }
+    }
+  }
+  if (!any_calls) {
+    return false;
+  }
+
+  bool any_split = false;
+  for (uint32_t ordinal = 0; ordinal < values_.size(); ++ordinal) {
+    if (values_[ordinal] && TestBit(to_split, ordinal)) {
+      SplitValue(builder, values_[ordinal]);
+      any_split = true;
+    }
+  }
+  return any_split;
+}
+
+void LinearScanRegisterAllocationPass::BuildIntervals() {
+  intervals_.clear();
+  for (Value* value : values_) {
+    if (!value) {
+      continue;
+    }
+    Interval interval;
+    interval.value = value;
+    interval.start = value->def->ordinal * 2 + 1;
+    interval.end = interval.start;
+    interval.set_index = SetIndexForValue(value);
+    interval.spillable = !unspillable_values_.count(value);
+    for (auto use = value->use_head; use; use = use->next) {
+      interval.end = std::max(interval.end, use->instr->ordinal * 2);
+      // Paired instructions can't have a reload inserted between them.
+      if (use->instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+        interval.spillable = false;
+      }
+    }
+    for (const auto& info : blocks_) {
+      if (TestBit(info.live_in, value->ordinal)) {
+        interval.start = std::min(interval.start, info.start);
+      }
+      if (TestBit(info.live_out, value->ordinal)) {
+        interval.end = std::max(interval.end, info.end);
+      }
+    }
+    intervals_.push_back(interval);
+  }
+  std::stable_sort(intervals_.begin(), intervals_.end(),
+                   [](const Interval& a, const Interval& b) {
+                     return a.start < b.start;
+                   });
+}
+
+bool LinearScanRegisterAllocationPass::Allocate(
+    std::vector<Value*>& spills_out) {
+  for (auto& state : register_sets_) {
+    state.free_mask = state.set->count == 32
+                          ? UINT32_MAX
+                          : (uint32_t(1) << state.set->count) - 1;
+    state.active.clear();
+  }
+  for (auto& interval : intervals_) {
+    interval.value->reg.set = nullptr;
+    interval.value->reg.index = -1;
+  }
+
+  for (auto& interval : intervals_) {
+    auto& state = register_sets_[interval.set_index];
+    ExpireIntervals(state, interval.start);
+
+    // x64 (and most other targets) prefers dest == src1, so reuse the
+    // register of a src1 dying at the definition if possible.
+    int32_t index = -1;
+    Instr* def = interval.value->def;
+    if (GET_OPCODE_SIG_TYPE_SRC1(def->opcode->signature) ==
+        OPCODE_SIG_TYPE_V) {
+      const RegAssignment& src1_reg = def->src1.value->reg;
+      if (src1_reg.set == state.set &&
+          (state.free_mask & (uint32_t(1) << src1_reg.index))) {
+        index = src1_reg.index;
+      }
+    }
+    if (index < 0 && state.free_mask) {
+      uint32_t first_free;
+      xe::bit_scan_forward(state.free_mask, &first_free);
+      index = int32_t(first_free);
+    }
+
+    if (index < 0) {
+      // Nothing free - spill whatever is live the furthest, including this.
+      auto victim_it = state.active.end();
+      for (auto it = state.active.begin(); it != state.active.end(); ++it) {
+        if ((*it)->spillable && (victim_it == state.active.end() ||
+                                 (*it)->end > (*victim_it)->end)) {
+          victim_it = it;
+        }
+      }
+      if (interval.spillable && (victim_it == state.active.end() ||
+                                 interval.end >= (*victim_it)->end)) {
+        spills_out.push_back(interval.value);
+        continue;
+      }
+      if (victim_it == state.active.end()) {
+        return false;
+      }
+      Interval* victim = *victim_it;
+      index = victim->value->reg.index;
+      victim->value->reg.set = nullptr;
+      victim->value->reg.index = -1;
+      state.active.erase(victim_it);
+      spills_out.push_back(victim->value);
+      state.free_mask |= uint32_t(1) << index;
+    }
+
+    interval.value->reg.set = state.set;
+    interval.value->reg.index = index;
+    state.free_mask &= ~(uint32_t(1) << index);
+    state.active.push_back(&interval);
+  }
+  return true;
+}
+
+void LinearScanRegisterAllocationPass::ExpireIntervals(RegisterSetState& state,
+                                                       uint32_t position) {
+  for (size_t i = 0; i < state.active.size();) {
+    Interval* interval = state.active[i];
+    if (interval->end < position) {
+      state.free_mask |= uint32_t(1) << interval->value->reg.index;
+      state.active[i] = state.active.back();
+      state.active.pop_back();
+    } else {
+      ++i;
+    }
+  }
+}
+
+void LinearScanRegisterAllocationPass::StoreAfterDefinition(
+    HIRBuilder* builder, Value* value) {
+  if (value->local_slot) {
+    // Already stored by an earlier split or spill - SSA values never change.
+    return;
+  }
+  value->local_slot = builder->AllocLocal(value->type);
+  builder->StoreLocal(value->local_slot, value);
+  ++stats_.spill_store_count;
+  auto def_tail = value->def;
+  while (def_tail->next &&
+         def_tail->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    def_tail = def_tail->next;
+  }
+  MoveAfter(builder->last_instr(), def_tail);
+}
+
+void LinearScanRegisterAllocationPass::SplitValue(HIRBuilder* builder,
+                                                  Value* value) {
+  StoreAfterDefinition(builder, value);
+
+  // Reload once at the top of every other block using the value. The store
+  // right after the definition dominates all of them.
+  Block* def_block = value->def->block;
+  std::vector<Instr*> using_instrs = GetUsingInstrs(value);
+  std::vector<Block*> reloaded_blocks;
+  for (Instr* instr : using_instrs) {
+    Block* block = instr->block;
+    if (block == def_block || std::find(reloaded_blocks.begin(),
+                                        reloaded_blocks.end(),
+                                        block) != reloaded_blocks.end()) {
+      continue;
+    }
+    reloaded_blocks.push_back(block);
+    Value* reload = builder->LoadLocal(value->local_slot);
+    reload->local_slot = value->local_slot;
+    ++stats_.spill_load_count;
+    builder->last_instr()->MoveBefore(block->instr_head);
+    for (Instr* block_instr : using_instrs) {
+      if (block_instr->block == block) {
+        ReplaceSourceValue(block_instr, value, reload);
+      }
+    }
+  }
+}
+
+void LinearScanRegisterAllocationPass::SpillValue(HIRBuilder* builder,
+                                                  Value* value) {
+  StoreAfterDefinition(builder, value);
+  unspillable_values_.insert(value);
+
+  // Reload right before every other use.
+  for (Instr* instr : GetUsingInstrs(value)) {
+    if (instr->opcode == &OPCODE_STORE_LOCAL_info &&
+        instr->src1.value == value->local_slot) {
+      continue;
+    }
+    Value* reload = builder->LoadLocal(value->local_slot);
+    reload->local_slot = value->local_slot;
+    ++stats_.spill_load_count;
+    builder->last_instr()->MoveBefore(instr);
+    ReplaceSourceValue(instr, value, reload);
+    unspillable_values_.insert(reload);
+  }
+}
+
+uint32_t LinearScanRegisterAllocationPass::SetIndexForValue(
+    const Value* value) const {
+  uint32_t types;
+  if (value->type <= INT64_TYPE) {
+    types = MachineInfo::RegisterSet::INT_TYPES;
+  } else if (value->type <= FLOAT64_TYPE) {
+    types = MachineInfo::RegisterSet::FLOAT_TYPES;
+  } else {
+    types = MachineInfo::RegisterSet::VEC_TYPES;
+  }
+  for (uint32_t i = 0; i < register_sets_.size(); ++i) {
+    if (register_sets_[i].set->types & types) {
+      return i;
+    }
+  }
+  assert_always();
+  return 0;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/passes/register_allocation_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Function-wide linear scan register allocator (Poletto & Sarkar).
+// Unlike RegisterAllocationPass, values may live across blocks and stay in
+// the same host register for their whole lifetime. Live intervals are built
+// from block liveness, so they cover loops correctly but have no holes.
+// Calls clobber all allocatable registers, so values live across one are
+// split first: stored to a local after their definition and reloaded in each
+// block using them. When a register set runs out, the interval ending last is
+// spilled (stored once and reloaded before each use) and allocation is redone
+// until everything fits.
+class LinearScanRegisterAllocationPass : public CompilerPass {
+ public:
+  explicit LinearScanRegisterAllocationPass(
+      const backend::MachineInfo* machine_info);
+  ~LinearScanRegisterAllocationPass() override;
+
+  const RegisterAllocationStats& stats() const { return stats_; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct BlockInfo {
+    hir::Block* block;
+    // Instruction positions of the block boundaries. Each instruction uses
+    // its sources at 2 * ordinal and defines its dest at 2 * ordinal + 1.
+    uint32_t start;
+    uint32_t end;
+    // Indices of the successor blocks in blocks_.
+    std::vector<uint32_t> successors;
+    // Bit sets of the value ordinals live at the block boundaries.
+    std::vector<uint64_t> live_in;
+    std::vector<uint64_t> live_out;
+  };
+  struct Interval {
+    hir::Value* value;
+    uint32_t start;
+    uint32_t end;
+    uint32_t set_index;
+    bool spillable;
+  };
+  struct RegisterSetState {
+    const backend::MachineInfo::RegisterSet* set;
+    uint32_t free_mask;
+    std::vector<Interval*> active;
+  };
+
+  void NumberInstructions(hir::HIRBuilder* builder);
+  void ComputeLiveness(hir::HIRBuilder* builder);
+  bool SplitAcrossCalls(hir::HIRBuilder* builder);
+  void BuildIntervals();
+  bool Allocate(std::vector<hir::Value*>& spills_out);
+  void ExpireIntervals(RegisterSetState& state, uint32_t position);
+
+  void StoreAfterDefinition(hir::HIRBuilder* builder, hir::Value* value);
+  void SplitValue(hir::HIRBuilder* builder, hir::Value* value);
+  void SpillValue(hir::HIRBuilder* builder, hir::Value* value);
+
+  uint32_t SetIndexForValue(const hir::Value* value) const;
+
+  std::vector<RegisterSetState> register_sets_;
+  std::vector<BlockInfo> blocks_;
+  std::vector<Interval> intervals_;
+  // Indexed by value ordinal, valid only for non-constant defined values.
+  std::vector<hir::Value*> values_;
+  // Values that were already spilled or only exist to reload a spill.
+  std::unordered_set<hir::Value*> unspillable_values_;
+  RegisterAllocationStats stats_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
@@ -77,6 +77,8 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
   // Really, it'd just be nice to have someone who knew what they
   // were doing lower SSA and do this right.
 
+  stats_ = RegisterAllocationStats();
+
   uint16_t block_ordinal = 0;
   uint32_t instr_ordinal = 0;
   auto block = builder->first_block();
@@ -377,6 +379,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
 
     // Add store.
     builder->StoreLocal(spill_value->local_slot, spill_value);
+    ++stats_.spill_store_count;
     auto spill_store = builder->last_instr();
     auto spill_store_use = spill_store->src2_use;
     assert_null(spill_store_use->prev);
@@ -418,6 +421,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   // done allocation for that code yet and can let that be handled
   // automatically when we get to it.
   auto new_value = builder->LoadLocal(spill_value->local_slot);
+  ++stats_.spill_load_count;
   auto spill_load = builder->last_instr();
   spill_load->MoveBefore(next_use->instr);
   // Note: implicit first use added.
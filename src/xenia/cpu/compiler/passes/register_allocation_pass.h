@@ -23,11 +23,21 @@ namespace cpu {
 namespace compiler {
 namespace passes {
 
+// Spill code inserted by the last run of a register allocation pass. The
+// frontend and other passes may use locals too, so these can't be derived
+// from the local loads and stores in the final HIR.
+struct RegisterAllocationStats {
+  uint32_t spill_store_count = 0;
+  uint32_t spill_load_count = 0;
+};
+
 class RegisterAllocationPass : public CompilerPass {
  public:
   explicit RegisterAllocationPass(const backend::MachineInfo* machine_info);
   ~RegisterAllocationPass() override;
 
+  const RegisterAllocationStats& stats() const { return stats_; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -76,6 +86,7 @@ class RegisterAllocationPass : public CompilerPass {
     RegisterSetUsage* vec_set = nullptr;
     RegisterSetUsage* all_sets[3];
   } usage_sets_;
+  RegisterAllocationStats stats_;
 };
 
 }  // namespace passes
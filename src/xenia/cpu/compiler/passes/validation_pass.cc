@@ -74,12 +74,8 @@ bool ValidationPass::ValidateInstruction(Block* block, Instr* instr) {
   }
 
   if (instr->dest) {
+    // Uses may be in other blocks, as context promotion works across blocks.
     assert_true(instr->dest->def == instr);
-    auto use = instr->dest->use_head;
-    while (use) {
-      assert_true(use->instr->block == block);
-      use = use->next;
-    }
   }
 
   uint32_t signature = instr->opcode->signature;
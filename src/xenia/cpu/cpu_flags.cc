@@ -38,6 +38,41 @@ DEFINE_bool(
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.", "CPU");
 
+DEFINE_string(register_allocator, "greedy",
+              "Register allocator used for generated code.\n"
+              "  greedy: per-block allocation, spilling at block boundaries.\n"
+              "  linear_scan: function-wide linear scan allocation.",
+              "CPU");
+DEFINE_bool(log_register_allocation, false,
+            "Log spill/reload counts and code size of each compiled function "
+            "to compare register allocators.",
+            "CPU");
+DEFINE_bool(log_context_promotion, false,
+            "Log how many context loads and stores were removed from each "
+            "compiled function.",
+            "CPU");
+DEFINE_bool(context_promotion_cross_block, false,
+            "Forward context values across blocks rather than only within "
+            "them. Best with the linear_scan register_allocator, which can "
+            "keep them in registers, as greedy spills them at block "
+            "boundaries.",
+            "CPU");
+DEFINE_bool(tiered_compilation, false,
+            "Compile functions quickly with few optimizations first, and "
+            "recompile them with all optimizations in the background once they "
+            "have been entered tier_up_threshold times. Disabled when "
+            "debugging or tracing.",
+            "CPU");
+DEFINE_int32(tier_up_threshold, 1000,
+             "Number of entries after which a function compiled with "
+             "tiered_compilation is recompiled with all optimizations.",
+             "CPU");
+DEFINE_bool(learn_mmio_access_sites, true,
+            "Recompile functions with register-indexed loads and stores that "
+            "fault into MMIO ranges to check for the range and call it "
+            "directly. Disabled when debugging or tracing.",
+            "CPU");
+
 DEFINE_uint64(
     pvr, 0x710700,
     "Processor version and revision number.\nBits 0 to 15 are the version "
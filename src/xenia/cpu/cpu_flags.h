@@ -26,6 +26,15 @@ DECLARE_bool(disable_global_lock);
 
 DECLARE_bool(validate_hir);
 
+DECLARE_string(register_allocator);
+DECLARE_bool(log_register_allocation);
+DECLARE_bool(log_context_promotion);
+DECLARE_bool(context_promotion_cross_block);
+
+DECLARE_bool(tiered_compilation);
+DECLARE_int32(tier_up_threshold);
+DECLARE_bool(learn_mmio_access_sites);
+
 DECLARE_uint64(pvr);
 
 // Breakpoints:
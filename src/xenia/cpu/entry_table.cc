@@ -9,29 +9,59 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include <algorithm>
+
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
-#include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::Table::Table(uint32_t capacity_log2)
+    : shift(32 - capacity_log2),
+      mask((size_t(1) << capacity_log2) - 1),
+      slots(new std::atomic<Entry*>[size_t(1) << capacity_log2]) {
+  for (size_t i = 0; i <= mask; ++i) {
+    slots[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+EntryTable::EntryTable() {
+  tables_.push_back(std::make_unique<Table>(kInitialCapacityLog2));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
 
 EntryTable::~EntryTable() {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
-    delete entry;
+  std::lock_guard<std::mutex> insert_lock(insert_mutex_);
+  Table* table = table_.load(std::memory_order_acquire);
+  for (size_t i = 0; i <= table->mask; ++i) {
+    delete table->slots[i].load(std::memory_order_relaxed);
+  }
+}
+
+Entry* EntryTable::Find(const Table* table, uint32_t address) {
+  for (size_t i = Hash(table, address);; i = (i + 1) & table->mask) {
+    Entry* entry = table->slots[i].load(std::memory_order_acquire);
+    if (!entry || entry->address == address) {
+      return entry;
+    }
+  }
+}
+
+void EntryTable::Insert(Table* table, Entry* entry) {
+  for (size_t i = Hash(table, entry->address);; i = (i + 1) & table->mask) {
+    if (!table->slots[i].load(std::memory_order_relaxed)) {
+      table->slots[i].store(entry, std::memory_order_release);
+      return;
+    }
   }
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  Entry* entry = Find(table_.load(std::memory_order_acquire), address);
   if (entry) {
     // TODO(benvanik): wait if needed?
-    if (entry->status != Entry::STATUS_READY) {
+    if (entry->status.load(std::memory_order_acquire) != Entry::STATUS_READY) {
       entry = nullptr;
     }
   }
@@ -39,51 +69,152 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  Entry* entry = Find(table_.load(std::memory_order_acquire), address);
+  if (!entry) {
+    // Not found (or only present in a table published after we looked) -
+    // take the insert lock and check again against the current table.
+    std::lock_guard<std::mutex> insert_lock(insert_mutex_);
+    Table* table = table_.load(std::memory_order_relaxed);
+    entry = Find(table, address);
+    if (!entry) {
+      // Create and return for initialization.
+      entry = new Entry();
+      entry->address = address;
+      entry->end_address = 0;
+      entry->status.store(Entry::STATUS_COMPILING, std::memory_order_relaxed);
+      entry->function = nullptr;
 
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+      // Keep the load factor at or below 1/2 so probe sequences stay short.
+      if ((entry_count_ + 1) * 2 > table->mask + 1) {
+        auto new_table = std::make_unique<Table>(32 - table->shift + 1);
+        for (size_t i = 0; i <= table->mask; ++i) {
+          Entry* existing = table->slots[i].load(std::memory_order_relaxed);
+          if (existing) {
+            Insert(new_table.get(), existing);
+          }
+        }
+        table = new_table.get();
+        tables_.push_back(std::move(new_table));
+      }
+      Insert(table, entry);
+      ++entry_count_;
+      table_.store(table, std::memory_order_release);
+
+      *out_entry = entry;
+      return Entry::STATUS_NEW;
     }
-    status = entry->status;
-  } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
-    status = Entry::STATUS_NEW;
-  }
-  global_lock.unlock();
+  }
+
+  Entry::Status status = entry->status.load(std::memory_order_acquire);
+  if (status == Entry::STATUS_COMPILING) {
+    // Someone else is compiling it, so wait until they are done.
+    WaitForCompletion(entry);
+    status = entry->status.load(std::memory_order_acquire);
+  }
   *out_entry = entry;
   return status;
 }
 
-std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
-    if (address >= entry->address && address <= entry->end_address) {
-      if (entry->status == Entry::STATUS_READY) {
-        fns.push_back(entry->function);
-      }
+void EntryTable::Complete(Entry* entry, Entry::Status status) {
+  assert_true(status == Entry::STATUS_READY ||
+              status == Entry::STATUS_FAILED);
+  WaitSlot& slot = wait_slot(entry->address);
+  {
+    // Storing under the slot lock guarantees a waiter cannot observe
+    // STATUS_COMPILING and then miss the notification.
+    std::lock_guard<std::mutex> slot_lock(slot.mutex);
+    entry->status.store(status, std::memory_order_release);
+  }
+  slot.cond.notify_all();
+
+  if (status == Entry::STATUS_READY) {
+    auto node = std::make_unique<IntervalNode>();
+    node->entry = entry;
+    // Functions tend to be compiled in address order, so hash the address to
+    // keep the treap balanced.
+    node->priority = entry->address * 0x9E3779B1u;
+    node->max_end_address = entry->end_address;
+    node->left = nullptr;
+    node->right = nullptr;
+    std::lock_guard<std::mutex> interval_lock(interval_mutex_);
+    interval_root_ = InsertIntervalNode(interval_root_, node.get());
+    interval_nodes_.push_back(std::move(node));
+  }
+}
+
+void EntryTable::WaitForCompletion(Entry* entry) {
+  SCOPE_profile_cpu_f("cpu");
+  WaitSlot& slot = wait_slot(entry->address);
+  std::unique_lock<std::mutex> slot_lock(slot.mutex);
+  slot.cond.wait(slot_lock, [entry]() {
+    return entry->status.load(std::memory_order_acquire) !=
+           Entry::STATUS_COMPILING;
+  });
+}
+
+void EntryTable::UpdateIntervalNode(IntervalNode* node) {
+  node->max_end_address = node->entry->end_address;
+  if (node->left) {
+    node->max_end_address =
+        std::max(node->max_end_address, node->left->max_end_address);
+  }
+  if (node->right) {
+    node->max_end_address =
+        std::max(node->max_end_address, node->right->max_end_address);
+  }
+}
+
+EntryTable::IntervalNode* EntryTable::InsertIntervalNode(IntervalNode* root,
+                                                         IntervalNode* node) {
+  if (!root) {
+    return node;
+  }
+  if (node->entry->address < root->entry->address) {
+    root->left = InsertIntervalNode(root->left, node);
+    if (root->left->priority > root->priority) {
+      // Rotate right.
+      IntervalNode* pivot = root->left;
+      root->left = pivot->right;
+      pivot->right = root;
+      UpdateIntervalNode(root);
+      root = pivot;
     }
+  } else {
+    root->right = InsertIntervalNode(root->right, node);
+    if (root->right->priority > root->priority) {
+      // Rotate left.
+      IntervalNode* pivot = root->right;
+      root->right = pivot->left;
+      pivot->left = root;
+      UpdateIntervalNode(root);
+      root = pivot;
+    }
+  }
+  UpdateIntervalNode(root);
+  return root;
+}
+
+void EntryTable::FindIntervals(const IntervalNode* node, uint32_t address,
+                               std::vector<Function*>& out_functions) {
+  // Nothing in this subtree ends at or after the address.
+  if (!node || node->max_end_address < address) {
+    return;
+  }
+  FindIntervals(node->left, address, out_functions);
+  if (node->entry->address > address) {
+    // Everything to the right starts even later.
+    return;
   }
+  if (address <= node->entry->end_address) {
+    out_functions.push_back(node->entry->function);
+  }
+  FindIntervals(node->right, address, out_functions);
+}
+
+std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
+  std::vector<Function*> fns;
+  std::lock_guard<std::mutex> interval_lock(interval_mutex_);
+  FindIntervals(interval_root_, address, fns);
   return fns;
 }
 
@@ -10,11 +10,12 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
-#include <unordered_map>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <vector>
 
-#include "xenia/base/mutex.h"
-
 namespace xe {
 namespace cpu {
 
@@ -30,24 +31,99 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Written only by the thread that created the entry (through
+  // EntryTable::Complete) and read lock-free by everyone else. end_address and
+  // function must be set before the status leaves STATUS_COMPILING.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
+// Maps guest function addresses to their compilation entries.
+// Lookups are lock-free: the table is open-addressed with linear probing and
+// entries are never removed, so readers only need to load the current table
+// and probe until an empty slot. Inserts (one per function, ever) are
+// serialized on a local mutex and grow the table by publishing a new copy;
+// retired tables are kept alive until destruction as readers may still be
+// probing them.
 class EntryTable {
  public:
   EntryTable();
   ~EntryTable();
 
+  // Returns the entry for the given address if it is ready for use.
   Entry* Get(uint32_t address);
+  // Returns the entry for the given address, creating it if needed.
+  // If STATUS_NEW is returned the caller owns the entry and must call Complete
+  // once it has been compiled (or has failed). If another thread is currently
+  // compiling the entry this blocks until it has finished.
   Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
+  // Publishes the final status of an entry returned as STATUS_NEW and wakes
+  // any threads waiting on it in GetOrCreate.
+  void Complete(Entry* entry, Entry::Status status);
 
+  // Returns the functions of all ready entries whose address range contains
+  // the given address, ordered by their start address.
   std::vector<Function*> FindWithAddress(uint32_t address);
 
  private:
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  std::unordered_map<uint32_t, Entry*> map_;
+  struct Table {
+    explicit Table(uint32_t capacity_log2);
+    uint32_t shift;
+    size_t mask;
+    std::unique_ptr<std::atomic<Entry*>[]> slots;
+  };
+
+  // Waiters for in-progress compiles are striped by address so that a finished
+  // compile only wakes threads that may be waiting on it.
+  struct WaitSlot {
+    std::mutex mutex;
+    std::condition_variable cond;
+  };
+  static constexpr size_t kWaitSlotCount = 64;
+  static constexpr uint32_t kInitialCapacityLog2 = 12;
+
+  static size_t Hash(const Table* table, uint32_t address) {
+    // Fibonacci hashing: take the high bits as guest function addresses are
+    // aligned and clustered, leaving the low bits poorly distributed.
+    return size_t(uint32_t(address * 0x9E3779B1u) >> table->shift);
+  }
+  static Entry* Find(const Table* table, uint32_t address);
+  static void Insert(Table* table, Entry* entry);
+  WaitSlot& wait_slot(uint32_t address) {
+    return wait_slots_[(address >> 2) % kWaitSlotCount];
+  }
+  void WaitForCompletion(Entry* entry);
+
+  // Ready entries are also kept in an interval tree for FindWithAddress: a
+  // treap ordered by start address where each node tracks the largest end
+  // address in its subtree, so subtrees ending before the address are
+  // skipped. Entries are never removed, so only insertion is needed.
+  struct IntervalNode {
+    Entry* entry;
+    uint32_t priority;
+    uint32_t max_end_address;
+    IntervalNode* left;
+    IntervalNode* right;
+  };
+  static void UpdateIntervalNode(IntervalNode* node);
+  static IntervalNode* InsertIntervalNode(IntervalNode* root,
+                                          IntervalNode* node);
+  static void FindIntervals(const IntervalNode* node, uint32_t address,
+                            std::vector<Function*>& out_functions);
+
+  std::atomic<Table*> table_;
+
+  // Guards inserts and growth. Never taken by readers.
+  std::mutex insert_mutex_;
+  size_t entry_count_ = 0;
+  // All tables ever published, including retired ones.
+  std::vector<std::unique_ptr<Table>> tables_;
+
+  WaitSlot wait_slots_[kWaitSlotCount];
+
+  std::mutex interval_mutex_;
+  IntervalNode* interval_root_ = nullptr;
+  std::vector<std::unique_ptr<IntervalNode>> interval_nodes_;
 };
 
 }  // namespace cpu
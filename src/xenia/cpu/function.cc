@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/function.h"
 
+#include <algorithm>
+
 #include "xenia/base/logging.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -66,6 +68,19 @@ void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   export_data_ = export_data;
 }
 
+void GuestFunction::BeginTier(CompilationTier tier,
+                              int32_t tier_up_threshold) {
+  if (tier == CompilationTier::kBaseline) {
+    tier_up_counter_ = std::max(tier_up_threshold, 1);
+  }
+  tier_.store(tier, std::memory_order_release);
+}
+
+bool GuestFunction::MarkTierUpRequested() {
+  return tier() == CompilationTier::kBaseline &&
+         !tier_up_requested_.exchange(true, std::memory_order_acq_rel);
+}
+
 const SourceMapEntry* GuestFunction::LookupGuestAddress(
     uint32_t guest_address) const {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
@@ -116,8 +131,15 @@ uintptr_t GuestFunction::MapGuestAddressToMachineCode(
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
-      host_address - reinterpret_cast<uintptr_t>(machine_code())));
+  // The address may be in code replaced by a recompilation, which the source
+  // map doesn't describe anymore.
+  auto code_address = reinterpret_cast<uintptr_t>(machine_code());
+  if (host_address < code_address ||
+      host_address >= code_address + machine_code_length()) {
+    return address();
+  }
+  auto entry = LookupMachineCodeOffset(
+      static_cast<uint32_t>(host_address - code_address));
   return entry ? entry->guest_address : address();
 }
 
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -32,6 +33,14 @@ struct SourceMapEntry {
   uint32_t code_offset;    // Offset from emitted code start.
 };
 
+// With tiered compilation functions are first compiled at the baseline tier,
+// which is quick to compile and counts function entries, and recompiled at the
+// optimized tier once hot. Without it everything is compiled optimized.
+enum class CompilationTier : uint8_t {
+  kBaseline,
+  kOptimized,
+};
+
 class Function : public Symbol {
  public:
   enum class Behavior {
@@ -118,6 +127,20 @@ class GuestFunction : public Function {
   FunctionTraceData& trace_data() { return trace_data_; }
   std::vector<SourceMapEntry>& source_map() { return source_map_; }
 
+  // Changed by the recompilation thread while guest threads check it.
+  CompilationTier tier() const { return tier_.load(std::memory_order_acquire); }
+  // Sets the tier the function is about to be compiled at. Baseline code asks
+  // for a tier-up once entered tier_up_threshold times from now on.
+  void BeginTier(CompilationTier tier, int32_t tier_up_threshold);
+  // Entries left before baseline code asks for the function to be
+  // recompiled. Decremented by the generated code without synchronization, so
+  // this is only approximate and may reach zero more than once.
+  int32_t* tier_up_counter() { return &tier_up_counter_; }
+  // Returns true for the first caller at the baseline tier only, so the
+  // recompilation is only queued once. Not reset if it fails, as it would
+  // most likely fail again.
+  bool MarkTierUpRequested();
+
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
@@ -141,6 +164,9 @@ class GuestFunction : public Function {
   std::vector<SourceMapEntry> source_map_;
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  std::atomic<CompilationTier> tier_ = {CompilationTier::kOptimized};
+  int32_t tier_up_counter_ = 0;
+  std::atomic<bool> tier_up_requested_ = {false};
 };
 
 }  // namespace cpu
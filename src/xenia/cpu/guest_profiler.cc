@@ -0,0 +1,277 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/guest_profiler.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/stack_walker.h"
+#include "xenia/cpu/thread.h"
+#include "xenia/cpu/thread_debug_info.h"
+
+namespace xe {
+namespace cpu {
+
+GuestProfiler::GuestProfiler(Processor* processor,
+                             std::chrono::microseconds interval)
+    : processor_(processor), interval_(interval) {}
+
+GuestProfiler::~GuestProfiler() { Stop(); }
+
+bool GuestProfiler::Start() {
+  if (!processor_->stack_walker() || !processor_->backend()->code_cache()) {
+    XELOGW("Guest profiler unavailable: no stack walker on this platform");
+    return false;
+  }
+  shutdown_ = false;
+  thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+  if (!thread_) {
+    return false;
+  }
+  thread_->set_name("CPU Guest Profiler");
+  // Samples must be taken on time even when guest threads saturate the CPU.
+  thread_->set_priority(xe::threading::ThreadPriority::kHighest);
+  XELOGI("Guest profiler sampling every {}us", interval_.count());
+  return true;
+}
+
+void GuestProfiler::Stop() {
+  if (!thread_) {
+    return;
+  }
+  shutdown_ = true;
+  xe::threading::Wait(thread_.get(), false);
+  thread_.reset();
+}
+
+void GuestProfiler::ThreadMain() {
+  while (!shutdown_) {
+    if (processor_->execution_state() == ExecutionState::kRunning) {
+      SampleThreads();
+    }
+    xe::threading::Sleep(interval_);
+  }
+}
+
+void GuestProfiler::SampleThreads() {
+  auto stack_walker = processor_->stack_walker();
+  {
+    // Threads can't be created or destroyed while this is held. Keep the work
+    // done while a thread is suspended to a minimum - in particular nothing
+    // that may take a lock the thread could be holding.
+    auto global_lock = xe::global_critical_region::AcquireDirect();
+    auto thread_infos = processor_->QueryThreadDebugInfos();
+    captures_.resize(thread_infos.size());
+    size_t capture_count = 0;
+    for (auto thread_info : thread_infos) {
+      auto thread = thread_info->thread;
+      if (!thread || thread_info->state != ThreadDebugInfo::State::kAlive ||
+          thread_info->suspended || !thread->can_debugger_suspend()) {
+        continue;
+      }
+      auto host_thread = thread->thread();
+      if (!host_thread->Suspend()) {
+        continue;
+      }
+      auto& capture = captures_[capture_count];
+      capture.frame_count = stack_walker->CaptureStackTrace(
+          host_thread->native_handle(), capture.frame_host_pcs, 0,
+          kMaxFrameCount, nullptr, nullptr);
+      host_thread->Resume();
+      if (capture.frame_count) {
+        ++capture_count;
+      }
+    }
+    captures_.resize(capture_count);
+
+    // Resolved once the threads are running again, but still under the lock,
+    // as the code cache and source maps may change under it otherwise.
+    for (const auto& capture : captures_) {
+      AddSample(capture.frame_host_pcs, capture.frame_count);
+    }
+  }
+}
+
+void GuestProfiler::AddSample(const uint64_t* frame_host_pcs,
+                              size_t frame_count) {
+  ++sample_count_;
+  // FNV-1a.
+  uint64_t stack_hash = 0xCBF29CE484222325ull;
+  for (size_t i = 0; i < frame_count; ++i) {
+    stack_hash = (stack_hash ^ frame_host_pcs[i]) * 0x100000001B3ull;
+  }
+
+  std::lock_guard<std::mutex> lock(stacks_mutex_);
+  auto it = stacks_.find(stack_hash);
+  if (it != stacks_.end()) {
+    ++it->second.sample_count;
+    return;
+  }
+
+  // First time we see this stack, so resolve it.
+  stacks_.emplace(stack_hash,
+                  ResolveStack(processor_->backend()->code_cache(),
+                               frame_host_pcs, frame_count));
+}
+
+GuestProfiler::Stack GuestProfiler::ResolveStack(
+    backend::CodeCache* code_cache, const uint64_t* frame_host_pcs,
+    size_t frame_count) {
+  Stack stack;
+  stack.sample_count = 1;
+  bool found_guest = false;
+  for (size_t i = 0; i < frame_count; ++i) {
+    auto function = code_cache->LookupFunction(frame_host_pcs[i]);
+    if (!function) {
+      if (!found_guest) {
+        stack.in_host = true;
+      }
+      continue;
+    }
+    if (!found_guest) {
+      // Other than the innermost one, frames hold return addresses, so step
+      // back into the call instruction.
+      stack.guest_pc = function->MapMachineCodeToGuestAddress(
+          uintptr_t(frame_host_pcs[i] - (i ? 1 : 0)));
+      found_guest = true;
+    }
+    stack.functions.push_back(function);
+  }
+  std::reverse(stack.functions.begin(), stack.functions.end());
+  return stack;
+}
+
+static std::string GetFunctionName(const Function* function) {
+  if (!function->name().empty()) {
+    return function->name();
+  }
+  return fmt::format("sub_{:08X}", function->address());
+}
+
+bool GuestProfiler::Dump(const std::filesystem::path& folded_path) {
+  std::map<std::string, uint64_t> folded_stacks;
+  struct FunctionSamples {
+    uint64_t self_count = 0;
+    uint64_t total_count = 0;
+  };
+  std::unordered_map<Function*, FunctionSamples> function_samples;
+  std::unordered_map<uint32_t, std::pair<Function*, uint64_t>>
+      address_samples;
+  uint64_t total_count = 0;
+  {
+    std::lock_guard<std::mutex> lock(stacks_mutex_);
+    for (const auto& it : stacks_) {
+      const Stack& stack = it.second;
+      total_count += stack.sample_count;
+
+      std::string folded;
+      for (auto function : stack.functions) {
+        if (!folded.empty()) {
+          folded += ';';
+        }
+        folded += GetFunctionName(function);
+      }
+      if (stack.in_host) {
+        folded += folded.empty() ? "[host]" : ";[host]";
+      }
+      folded_stacks[folded] += stack.sample_count;
+
+      // Recursive functions only count once towards their total.
+      std::vector<Function*> counted_functions;
+      for (auto function : stack.functions) {
+        if (std::find(counted_functions.begin(), counted_functions.end(),
+                      function) == counted_functions.end()) {
+          function_samples[function].total_count += stack.sample_count;
+          counted_functions.push_back(function);
+        }
+      }
+      if (!stack.functions.empty() && !stack.in_host) {
+        function_samples[stack.functions.back()].self_count +=
+            stack.sample_count;
+        auto& address = address_samples[stack.guest_pc];
+        address.first = stack.functions.back();
+        address.second += stack.sample_count;
+      }
+    }
+  }
+
+  xe::filesystem::CreateParentFolder(folded_path);
+  FILE* file = xe::filesystem::OpenFile(folded_path, "w");
+  if (!file) {
+    XELOGE("Unable to write guest profile to {}",
+           xe::path_to_utf8(folded_path));
+    return false;
+  }
+  for (const auto& it : folded_stacks) {
+    fmt::print(file, "{} {}\n", it.first, it.second);
+  }
+  fclose(file);
+
+  auto summary_path = folded_path;
+  summary_path.replace_extension(".txt");
+  file = xe::filesystem::OpenFile(summary_path, "w");
+  if (!file) {
+    XELOGE("Unable to write guest profile to {}",
+           xe::path_to_utf8(summary_path));
+    return false;
+  }
+  fmt::print(file, "{} samples\n\n", total_count);
+
+  std::vector<std::pair<Function*, FunctionSamples>> sorted_functions(
+      function_samples.begin(), function_samples.end());
+  std::sort(sorted_functions.begin(), sorted_functions.end(),
+            [](const auto& a, const auto& b) {
+              return a.second.self_count != b.second.self_count
+                         ? a.second.self_count > b.second.self_count
+                         : a.second.total_count > b.second.total_count;
+            });
+  fmt::print(file, "{:>10} {:>7} {:>10} {:>7}  function\n", "self", "%",
+             "total", "%");
+  for (const auto& it : sorted_functions) {
+    fmt::print(file, "{:>10} {:>6.2f}% {:>10} {:>6.2f}%  {:08X} {}\n",
+               it.second.self_count,
+               100.0 * it.second.self_count / total_count,
+               it.second.total_count,
+               100.0 * it.second.total_count / total_count,
+               it.first->address(), GetFunctionName(it.first));
+  }
+
+  std::vector<std::pair<uint32_t, std::pair<Function*, uint64_t>>>
+      sorted_addresses(address_samples.begin(), address_samples.end());
+  std::sort(sorted_addresses.begin(), sorted_addresses.end(),
+            [](const auto& a, const auto& b) {
+              return a.second.second > b.second.second;
+            });
+  fmt::print(file, "\n{:>10} {:>7}  address\n", "samples", "%");
+  for (const auto& it : sorted_addresses) {
+    fmt::print(file, "{:>10} {:>6.2f}%  {:08X} {}\n", it.second.second,
+               100.0 * it.second.second / total_count, it.first,
+               GetFunctionName(it.second.first));
+  }
+  fclose(file);
+
+  XELOGI("Guest profile with {} samples written to {}", total_count,
+         xe::path_to_utf8(folded_path));
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_GUEST_PROFILER_H_
+#define XENIA_CPU_GUEST_PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class Function;
+class Processor;
+namespace backend {
+class CodeCache;
+}  // namespace backend
+
+// Low-overhead sampling profiler for guest code.
+// A background thread periodically suspends each running guest thread,
+// captures its host call stack with the StackWalker and maps the host PCs in
+// generated code back to guest functions and addresses. Nothing is
+// instrumented, so timing is left (mostly) untouched and no recompilation is
+// needed.
+// Threads blocked in a kernel wait are sampled like running ones, with the
+// stack ending in host code called from the guest, so waits show up in the
+// profile. Sampling needs a StackWalker, which only exists on Windows - Start
+// fails on other platforms.
+class GuestProfiler {
+ public:
+  struct Stack {
+    uint64_t sample_count = 0;
+    // Guest functions on the stack, outermost first.
+    std::vector<Function*> functions;
+    // Guest address executing in the innermost guest function.
+    uint32_t guest_pc = 0;
+    // Whether the thread was in host code called from the guest (a kernel
+    // export, the emulator, etc) rather than in the guest function itself.
+    bool in_host = false;
+  };
+
+  GuestProfiler(Processor* processor, std::chrono::microseconds interval);
+  ~GuestProfiler();
+
+  bool Start();
+  void Stop();
+
+  uint64_t sample_count() const { return sample_count_; }
+
+  // Writes the collected samples as folded stacks (one
+  // "outer;...;inner count" line per unique stack, as consumed by
+  // flamegraph.pl, speedscope, pprof and others) to the given path, and a
+  // per-function and per-guest-address histogram to the same path with a .txt
+  // extension.
+  bool Dump(const std::filesystem::path& folded_path);
+
+  // Maps host PCs captured from a guest thread, innermost first, to the guest
+  // functions on the stack. Code is placed and recompiled functions are
+  // published under the global critical region, which must be held.
+  static Stack ResolveStack(backend::CodeCache* code_cache,
+                            const uint64_t* frame_host_pcs,
+                            size_t frame_count);
+
+ private:
+  static constexpr size_t kMaxFrameCount = 64;
+
+  struct Capture {
+    uint64_t frame_host_pcs[kMaxFrameCount];
+    size_t frame_count;
+  };
+
+  void ThreadMain();
+  void SampleThreads();
+  void AddSample(const uint64_t* frame_host_pcs, size_t frame_count);
+
+  Processor* processor_;
+  std::chrono::microseconds interval_;
+
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::atomic<bool> shutdown_ = {false};
+  // Only used by the sampling thread.
+  std::vector<Capture> captures_;
+
+  // Guards the collected samples, only contended while dumping.
+  std::mutex stacks_mutex_;
+  // Keyed by a hash of the host PCs.
+  std::unordered_map<uint64_t, Stack> stacks_;
+  std::atomic<uint64_t> sample_count_ = {0};
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_GUEST_PROFILER_H_
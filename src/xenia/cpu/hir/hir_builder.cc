@@ -1227,6 +1227,26 @@ void HIRBuilder::StoreMmio(cpu::MMIORange* mmio_range, uint32_t address,
   i->set_src3(value);
 }
 
+Value* HIRBuilder::LoadMmioChecked(Value* address, cpu::MMIORange* mmio_range,
+                                   TypeName type, uint32_t load_flags) {
+  ASSERT_ADDRESS_TYPE(address);
+  Instr* i = AppendInstr(OPCODE_LOAD_MMIO_CHECKED_info, load_flags,
+                         AllocValue(type));
+  i->set_src1(address);
+  i->src2.offset = reinterpret_cast<uint64_t>(mmio_range);
+  i->src3.value = NULL;
+  return i->dest;
+}
+
+void HIRBuilder::StoreMmioChecked(Value* address, cpu::MMIORange* mmio_range,
+                                  Value* value, uint32_t store_flags) {
+  ASSERT_ADDRESS_TYPE(address);
+  Instr* i = AppendInstr(OPCODE_STORE_MMIO_CHECKED_info, store_flags);
+  i->set_src1(address);
+  i->src2.offset = reinterpret_cast<uint64_t>(mmio_range);
+  i->set_src3(value);
+}
+
 Value* HIRBuilder::LoadOffset(Value* address, Value* offset, TypeName type,
                               uint32_t load_flags) {
   ASSERT_ADDRESS_TYPE(address);
@@ -159,6 +159,11 @@ class HIRBuilder {
 
   Value* LoadMmio(cpu::MMIORange* mmio_range, uint32_t address, TypeName type);
   void StoreMmio(cpu::MMIORange* mmio_range, uint32_t address, Value* value);
+  // Accesses that may hit mmio_range, with the address checked at runtime.
+  Value* LoadMmioChecked(Value* address, cpu::MMIORange* mmio_range,
+                         TypeName type, uint32_t load_flags = 0);
+  void StoreMmioChecked(Value* address, cpu::MMIORange* mmio_range,
+                        Value* value, uint32_t store_flags = 0);
 
   Value* LoadOffset(Value* address, Value* offset, TypeName type,
                     uint32_t load_flags = 0);
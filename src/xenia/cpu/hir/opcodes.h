@@ -204,6 +204,8 @@ enum Opcode {
   OPCODE_CONTEXT_BARRIER,
   OPCODE_LOAD_MMIO,
   OPCODE_STORE_MMIO,
+  OPCODE_LOAD_MMIO_CHECKED,
+  OPCODE_STORE_MMIO_CHECKED,
   OPCODE_LOAD_OFFSET,
   OPCODE_STORE_OFFSET,
   OPCODE_LOAD,
@@ -320,6 +322,8 @@ enum OpcodeSignature {
                        (OPCODE_SIG_TYPE_L << 6) | (OPCODE_SIG_TYPE_L << 9),
   OPCODE_SIG_X_V_O =
       (OPCODE_SIG_TYPE_X) | (OPCODE_SIG_TYPE_V << 3) | (OPCODE_SIG_TYPE_O << 6),
+  OPCODE_SIG_X_V_O_V = (OPCODE_SIG_TYPE_X) | (OPCODE_SIG_TYPE_V << 3) |
+                       (OPCODE_SIG_TYPE_O << 6) | (OPCODE_SIG_TYPE_V << 9),
   OPCODE_SIG_X_V_S =
       (OPCODE_SIG_TYPE_X) | (OPCODE_SIG_TYPE_V << 3) | (OPCODE_SIG_TYPE_S << 6),
   OPCODE_SIG_X_V_V =
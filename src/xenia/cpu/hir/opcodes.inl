@@ -231,6 +231,18 @@ DEFINE_OPCODE(
     OPCODE_SIG_X_O_O_V,
     OPCODE_FLAG_MEMORY)
 
+DEFINE_OPCODE(
+    OPCODE_LOAD_MMIO_CHECKED,
+    "load_mmio_checked",
+    OPCODE_SIG_V_V_O,
+    OPCODE_FLAG_MEMORY)
+
+DEFINE_OPCODE(
+    OPCODE_STORE_MMIO_CHECKED,
+    "store_mmio_checked",
+    OPCODE_SIG_X_V_O_V,
+    OPCODE_FLAG_MEMORY)
+
 DEFINE_OPCODE(
     OPCODE_LOAD_OFFSET,
     "load_offset",
@@ -26,6 +26,8 @@ typedef struct mspack_memory_file_t {
   void* buffer;
   off_t buffer_size;
   off_t offset;
+  // For input that is still being produced, see lzx_decompress.
+  const std::function<size_t(size_t end)>* wait_for_data;
 } mspack_memory_file;
 
 mspack_memory_file* mspack_memory_open(mspack_system* sys, void* buffer,
@@ -52,6 +54,11 @@ void mspack_memory_close(mspack_memory_file* file) {
 
 int mspack_memory_read(mspack_file* file, void* buffer, int chars) {
   auto memfile = (mspack_memory_file*)file;
+  if (memfile->wait_for_data) {
+    memfile->buffer_size = (off_t)std::min(
+        (*memfile->wait_for_data)(size_t(memfile->offset + chars)),
+        size_t(INT_MAX));
+  }
   const off_t remaining = memfile->buffer_size - memfile->offset;
   const off_t total = std::min(static_cast<off_t>(chars), remaining);
   std::memcpy(buffer, (uint8_t*)memfile->buffer + memfile->offset, total);
@@ -93,9 +100,11 @@ mspack_system* mspack_memory_sys_create() {
 
 void mspack_memory_sys_destroy(struct mspack_system* sys) { free(sys); }
 
-int lzx_decompress(const void* lzx_data, size_t lzx_len, void* dest,
-                   size_t dest_len, uint32_t window_size, void* window_data,
-                   size_t window_data_len) {
+static int lzx_decompress(
+    const void* lzx_data, size_t lzx_len,
+    const std::function<size_t(size_t end)>* wait_for_data, void* dest,
+    size_t dest_len, uint32_t window_size, void* window_data,
+    size_t window_data_len) {
   int result_code = 1;
 
   uint32_t window_bits;
@@ -106,6 +115,9 @@ int lzx_decompress(const void* lzx_data, size_t lzx_len, void* dest,
   mspack_system* sys = mspack_memory_sys_create();
   mspack_memory_file* lzxsrc =
       mspack_memory_open(sys, (void*)lzx_data, lzx_len);
+  if (lzxsrc) {
+    lzxsrc->wait_for_data = wait_for_data;
+  }
   mspack_memory_file* lzxdst = mspack_memory_open(sys, dest, dest_len);
   lzxd_stream* lzxd = lzxd_init(sys, (mspack_file*)lzxsrc, (mspack_file*)lzxdst,
                                 window_bits, 0, 0x8000, (off_t)dest_len, 0);
@@ -145,6 +157,20 @@ int lzx_decompress(const void* lzx_data, size_t lzx_len, void* dest,
   return result_code;
 }
 
+int lzx_decompress(const void* lzx_data, size_t lzx_len, void* dest,
+                   size_t dest_len, uint32_t window_size, void* window_data,
+                   size_t window_data_len) {
+  return lzx_decompress(lzx_data, lzx_len, nullptr, dest, dest_len,
+                        window_size, window_data, window_data_len);
+}
+
+int lzx_decompress(const void* lzx_data,
+                   const std::function<size_t(size_t end)>& wait_for_data,
+                   void* dest, size_t dest_len, uint32_t window_size) {
+  return lzx_decompress(lzx_data, 0, &wait_for_data, dest, dest_len,
+                        window_size, nullptr, 0);
+}
+
 int lzxdelta_apply_patch(xe::xex2_delta_patch* patch, size_t patch_len,
                          uint32_t window_size, void* dest) {
   void* patch_end = (char*)patch + patch_len;
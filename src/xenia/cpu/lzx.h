@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_LZX_H_
 #define XENIA_CPU_LZX_H_
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -23,6 +24,14 @@ int lzx_decompress(const void* lzx_data, size_t lzx_len, void* dest,
                    size_t dest_len, uint32_t window_size, void* window_data,
                    size_t window_data_len);
 
+// Decompresses data that another thread is still producing. wait_for_data is
+// called before reading from lzx_data, and must block until lzx_data is valid
+// up to the requested end, returning the valid length, which is smaller only
+// if the data ends earlier.
+int lzx_decompress(const void* lzx_data,
+                   const std::function<size_t(size_t end)>& wait_for_data,
+                   void* dest, size_t dest_len, uint32_t window_size);
+
 int lzxdelta_apply_patch(xe::xex2_delta_patch* patch, size_t patch_len,
                          uint32_t window_size, void* dest);
 
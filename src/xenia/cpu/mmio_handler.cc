@@ -115,6 +115,27 @@ bool MMIOHandler::CheckStore(uint32_t virtual_address, uint32_t value) {
   return false;
 }
 
+void MMIOHandler::SetAccessSiteCallback(AccessSiteCallback callback,
+                                        void* context) {
+  access_site_callback_ = callback;
+  access_site_callback_context_ = context;
+}
+
+uint32_t MMIOHandler::ReadAtLearnedSite(void* ppc_context, MMIORange* range,
+                                        uint32_t virtual_address) {
+  global_handler_->learned_site_access_count_.fetch_add(
+      1, std::memory_order_relaxed);
+  return range->read(ppc_context, range->callback_context, virtual_address);
+}
+
+void MMIOHandler::WriteAtLearnedSite(void* ppc_context, MMIORange* range,
+                                     uint32_t virtual_address,
+                                     uint32_t value) {
+  global_handler_->learned_site_access_count_.fetch_add(
+      1, std::memory_order_relaxed);
+  range->write(ppc_context, range->callback_context, virtual_address, value);
+}
+
 bool MMIOHandler::TryDecodeLoadStore(const uint8_t* p,
                                      DecodedLoadStore& decoded_out) {
   std::memset(&decoded_out, 0, sizeof(decoded_out));
@@ -561,6 +582,13 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   }
 #endif  // XE_ARCH_ARM64
 
+  fault_access_count_.fetch_add(1, std::memory_order_relaxed);
+  if (access_site_callback_) {
+    access_site_callback_(access_site_callback_context_,
+                          reinterpret_cast<void*>(rip),
+                          const_cast<MMIORange*>(range));
+  }
+
   // Advance RIP to the next instruction so that we resume properly.
   ex->set_resume_pc(rip + decoded_load_store.length);
 
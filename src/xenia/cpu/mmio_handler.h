@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_MMIO_HANDLER_H_
 #define XENIA_CPU_MMIO_HANDLER_H_
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -49,6 +50,10 @@ class MMIOHandler {
   typedef bool (*AccessViolationCallback)(
       std::unique_lock<std::recursive_mutex> global_lock_locked_once,
       void* context, void* host_address, bool is_write);
+  // Called with the host instruction that faulted into range, after the
+  // access has been emulated.
+  typedef void (*AccessSiteCallback)(void* context, void* host_pc,
+                                     MMIORange* range);
 
   // access_violation_callback is called with global_critical_region locked once
   // on the thread, so if multiple threads trigger an access violation in the
@@ -69,6 +74,25 @@ class MMIOHandler {
   bool CheckLoad(uint32_t virtual_address, uint32_t* out_value);
   bool CheckStore(uint32_t virtual_address, uint32_t value);
 
+  // Reports every access that had to be emulated by decoding the faulting
+  // host instruction, so that the code can be regenerated to call the range
+  // directly. Must be set before guest code runs.
+  void SetAccessSiteCallback(AccessSiteCallback callback, void* context);
+
+  // Entry points for generated code at learned access sites, called with the
+  // guest context like the range callbacks.
+  static uint32_t ReadAtLearnedSite(void* ppc_context, MMIORange* range,
+                                    uint32_t virtual_address);
+  static void WriteAtLearnedSite(void* ppc_context, MMIORange* range,
+                                 uint32_t virtual_address, uint32_t value);
+
+  // Accesses emulated after a fault, and ones that reached a range through
+  // the check at a learned access site instead.
+  uint64_t fault_access_count() const { return fault_access_count_; }
+  uint64_t learned_site_access_count() const {
+    return learned_site_access_count_;
+  }
+
  protected:
   MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
               uint8_t* membase_end, HostToGuestVirtual host_to_guest_virtual,
@@ -91,6 +115,12 @@ class MMIOHandler {
   AccessViolationCallback access_violation_callback_;
   void* access_violation_callback_context_;
 
+  AccessSiteCallback access_site_callback_ = nullptr;
+  void* access_site_callback_context_ = nullptr;
+
+  std::atomic<uint64_t> fault_access_count_{0};
+  std::atomic<uint64_t> learned_site_access_count_{0};
+
   static MMIOHandler* global_handler_;
 
   xe::global_critical_region global_critical_region_;
@@ -37,6 +37,11 @@ class Module {
   virtual bool is_executable() const = 0;
 
   virtual bool ContainsAddress(uint32_t address);
+  // Returns the [low, high) range ContainsAddress tests against, if it is a
+  // single fixed range, so lookups can use the processor module index.
+  virtual bool GetAddressRange(uint32_t* out_low, uint32_t* out_high) const {
+    return false;
+  }
 
   Symbol* LookupSymbol(uint32_t address, bool wait = true);
   virtual Symbol::Status DeclareFunction(uint32_t address,
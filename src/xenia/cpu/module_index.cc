@@ -0,0 +1,102 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/module_index.h"
+
+#include <algorithm>
+
+#include "xenia/cpu/module.h"
+
+namespace xe {
+namespace cpu {
+
+ModuleIndex::ModuleIndex() {
+  snapshots_.push_back(std::make_unique<Snapshot>());
+  snapshot_.store(snapshots_.back().get(), std::memory_order_release);
+}
+
+ModuleIndex::~ModuleIndex() = default;
+
+void ModuleIndex::Rebuild(const std::vector<Module*>& modules) {
+  auto snapshot = std::make_unique<Snapshot>();
+
+  std::vector<Segment> ranges;
+  std::vector<uint32_t> bounds;
+  for (uint32_t priority = 0; priority < uint32_t(modules.size());
+       ++priority) {
+    Module* module = modules[priority];
+    uint32_t low, high;
+    if (!module->GetAddressRange(&low, &high)) {
+      snapshot->unranged_modules.push_back({priority, module});
+      continue;
+    }
+    if (low >= high) {
+      // Not loaded yet.
+      continue;
+    }
+    ranges.push_back({low, high, priority, module});
+    bounds.push_back(low);
+    bounds.push_back(high);
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+  // Split overlapping ranges at every bound and give each piece to the
+  // highest priority module covering it. There are only a handful of modules,
+  // so quadratic is fine.
+  for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+    const Segment* owner = nullptr;
+    for (const Segment& range : ranges) {
+      if (range.low <= bounds[i] && range.high >= bounds[i + 1] &&
+          (!owner || range.priority < owner->priority)) {
+        owner = &range;
+      }
+    }
+    if (!owner) {
+      continue;
+    }
+    auto& segments = snapshot->segments;
+    if (!segments.empty() && segments.back().module == owner->module &&
+        segments.back().high == bounds[i]) {
+      segments.back().high = bounds[i + 1];
+    } else {
+      segments.push_back({bounds[i], bounds[i + 1], owner->priority,
+                          owner->module});
+    }
+  }
+
+  snapshot_.store(snapshot.get(), std::memory_order_release);
+  snapshots_.push_back(std::move(snapshot));
+}
+
+Module* ModuleIndex::Lookup(uint32_t address) const {
+  const Snapshot* snapshot = snapshot_.load(std::memory_order_acquire);
+
+  const Segment* segment = nullptr;
+  auto it = std::upper_bound(
+      snapshot->segments.begin(), snapshot->segments.end(), address,
+      [](uint32_t value, const Segment& s) { return value < s.low; });
+  if (it != snapshot->segments.begin() && address < (it - 1)->high) {
+    segment = &*(it - 1);
+  }
+
+  // Modules without a range that come first in the list take precedence.
+  for (const UnrangedModule& unranged : snapshot->unranged_modules) {
+    if (segment && unranged.priority > segment->priority) {
+      break;
+    }
+    if (unranged.module->ContainsAddress(address)) {
+      return unranged.module;
+    }
+  }
+  return segment ? segment->module : nullptr;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_MODULE_INDEX_H_
+#define XENIA_CPU_MODULE_INDEX_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace xe {
+namespace cpu {
+
+class Module;
+
+// Maps guest addresses to the module containing them.
+// The index is an immutable snapshot of the module address ranges, flattened
+// into sorted disjoint segments, so lookups are a lock-free binary search.
+// Rebuild publishes a new snapshot. Lookups take no lock, so a retired
+// snapshot may still be searched by any thread resolving an address; they are
+// only freed on destruction. Rebuilds happen only when a module is added, so
+// few snapshots are ever retired.
+class ModuleIndex {
+ public:
+  ModuleIndex();
+  ~ModuleIndex();
+
+  // Replaces the index with the given modules, in lookup priority order: if
+  // several modules contain an address the first one wins, like a linear
+  // scan over the list would. Modules without a fixed address range are
+  // tested with ContainsAddress on lookup. Callers must serialize rebuilds.
+  void Rebuild(const std::vector<Module*>& modules);
+
+  // Returns the module containing the address, or nullptr.
+  Module* Lookup(uint32_t address) const;
+
+ private:
+  struct Segment {
+    uint32_t low;
+    // Exclusive.
+    uint32_t high;
+    uint32_t priority;
+    Module* module;
+  };
+  struct UnrangedModule {
+    uint32_t priority;
+    Module* module;
+  };
+  struct Snapshot {
+    // Sorted by address and non-overlapping.
+    std::vector<Segment> segments;
+    // Sorted by priority.
+    std::vector<UnrangedModule> unranged_modules;
+  };
+
+  std::atomic<const Snapshot*> snapshot_;
+  // All snapshots ever published, including retired ones.
+  std::vector<std::unique_ptr<Snapshot>> snapshots_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_MODULE_INDEX_H_
@@ -79,6 +79,7 @@ void PPCHIRBuilder::Reset() {
   instr_offset_list_ = NULL;
   label_list_ = NULL;
   with_debug_info_ = false;
+  mmio_access_site_range_ = nullptr;
   HIRBuilder::Reset();
 }
 
@@ -86,6 +87,7 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   SCOPE_profile_cpu_f("cpu");
 
   Memory* memory = frontend_->memory();
+  Processor* processor = frontend_->processor();
 
   function_ = function;
   start_address_ = function_->address();
@@ -170,6 +172,8 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
 
     MaybeBreakOnInstruction(address);
 
+    mmio_access_site_range_ = processor->LookupMMIOAccessSite(address);
+
     InstrData i;
     i.address = address;
     i.code = code;
@@ -188,6 +192,8 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
     }
   }
 
+  mmio_access_site_range_ = nullptr;
+
   if (false) {
     DumpAllOpcodeCounts();
   }
@@ -568,6 +574,40 @@ Value* PPCHIRBuilder::LoadReserved() {
   return LoadContext(offsetof(PPCContext, reserved_val), INT64_TYPE);
 }
 
+Value* PPCHIRBuilder::LoadOffset(Value* address, Value* offset, TypeName type,
+                                 uint32_t load_flags) {
+  if (mmio_access_site_range_ && type == INT32_TYPE) {
+    return LoadMmioChecked(Add(address, offset), mmio_access_site_range_, type,
+                           load_flags);
+  }
+  return HIRBuilder::LoadOffset(address, offset, type, load_flags);
+}
+
+void PPCHIRBuilder::StoreOffset(Value* address, Value* offset, Value* value,
+                                uint32_t store_flags) {
+  if (mmio_access_site_range_ && value->type == INT32_TYPE) {
+    StoreMmioChecked(Add(address, offset), mmio_access_site_range_, value,
+                     store_flags);
+    return;
+  }
+  HIRBuilder::StoreOffset(address, offset, value, store_flags);
+}
+
+Value* PPCHIRBuilder::Load(Value* address, TypeName type, uint32_t load_flags) {
+  if (mmio_access_site_range_ && type == INT32_TYPE) {
+    return LoadMmioChecked(address, mmio_access_site_range_, type, load_flags);
+  }
+  return HIRBuilder::Load(address, type, load_flags);
+}
+
+void PPCHIRBuilder::Store(Value* address, Value* value, uint32_t store_flags) {
+  if (mmio_access_site_range_ && value->type == INT32_TYPE) {
+    StoreMmioChecked(address, mmio_access_site_range_, value, store_flags);
+    return;
+  }
+  HIRBuilder::Store(address, value, store_flags);
+}
+
 }  // namespace ppc
 }  // namespace cpu
 }  // namespace xe
@@ -81,6 +81,16 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   void StoreReserved(Value* val);
   Value* LoadReserved();
 
+  // Hide the HIRBuilder memory accesses so that 32-bit ones in instructions
+  // that have faulted into an MMIO range check for it instead, see
+  // Processor::LookupMMIOAccessSite.
+  Value* LoadOffset(Value* address, Value* offset, hir::TypeName type,
+                    uint32_t load_flags = 0);
+  void StoreOffset(Value* address, Value* offset, Value* value,
+                   uint32_t store_flags = 0);
+  Value* Load(Value* address, hir::TypeName type, uint32_t load_flags = 0);
+  void Store(Value* address, Value* value, uint32_t store_flags = 0);
+
  private:
   void MaybeBreakOnInstruction(uint32_t address);
   void AnnotateLabel(uint32_t address, Label* label);
@@ -99,6 +109,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   Label** label_list_;
 
   // Reset each instruction.
+  MMIORange* mmio_access_site_range_;
   struct {
     uint32_t dest_count;
     struct {
@@ -11,6 +11,7 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
@@ -37,11 +38,30 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   scanner_.reset(new PPCScanner(frontend));
   builder_.reset(new PPCHIRBuilder(frontend));
   compiler_.reset(new Compiler(frontend->processor()));
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
   assembler_ = backend->CreateAssembler();
   assembler_->Initialize();
 
   bool validate = cvars::validate_hir;
 
+  // Baseline tier for tiered compilation: only the cheap passes that have the
+  // biggest impact on the generated code.
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::ContextPromotionPass>(false));
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  auto baseline_regalloc_pass =
+      std::make_unique<passes::RegisterAllocationPass>(backend->machine_info());
+  baseline_regalloc_stats_ = &baseline_regalloc_pass->stats();
+  baseline_compiler_->AddPass(std::move(baseline_regalloc_pass));
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Optimized tier, and everything when tiered compilation is disabled.
+
   // Merge blocks early. This will let us use more context in other passes.
   // The CFG is required for simplification and dirtied by it.
   compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
@@ -50,7 +70,8 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Passes are executed in the order they are added. Multiple of the same
   // pass type may be used.
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>(
+      cvars::context_promotion_cross_block));
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Grouped simplification + constant propagation.
@@ -72,13 +93,16 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  // Simplification may have folded branches, so refresh the CFG first.
+  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   //// Removes all unneeded variables. Try not to add new ones after this.
+  //// Renumbers values per block, so it can't be used with the linear scan
+  //// allocator, which identifies values function-wide by their ordinals.
   // compiler_->AddPass(new passes::ValueReductionPass());
   // if (validate) compiler_->AddPass(new passes::ValidationPass());
 
@@ -86,8 +110,22 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  // Compile time matters less for hot functions recompiled in the background,
+  // so they always get the better allocator.
+  if (cvars::register_allocator == "linear_scan" ||
+      frontend->processor()->tiered_compilation_enabled()) {
+    register_allocator_ = "linear_scan";
+    auto regalloc_pass =
+        std::make_unique<passes::LinearScanRegisterAllocationPass>(
+            backend->machine_info());
+    regalloc_stats_ = &regalloc_pass->stats();
+    compiler_->AddPass(std::move(regalloc_pass));
+  } else {
+    auto regalloc_pass = std::make_unique<passes::RegisterAllocationPass>(
+        backend->machine_info());
+    regalloc_stats_ = &regalloc_pass->stats();
+    compiler_->AddPass(std::move(regalloc_pass));
+  }
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
@@ -96,6 +134,20 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
 
 PPCTranslator::~PPCTranslator() = default;
 
+// Returns the number of instructions with the given opcode in the function.
+static uint32_t CountInstrs(hir::HIRBuilder* builder,
+                            const hir::OpcodeInfo& opcode) {
+  uint32_t count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      if (instr->opcode == &opcode) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
 bool PPCTranslator::Translate(GuestFunction* function,
                               uint32_t debug_info_flags) {
   SCOPE_profile_cpu_f("cpu");
@@ -103,6 +155,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -176,11 +229,35 @@ bool PPCTranslator::Translate(GuestFunction* function,
     string_buffer_.Reset();
   }
 
+  uint32_t context_load_count = 0;
+  uint32_t context_store_count = 0;
+  if (cvars::log_context_promotion) {
+    context_load_count =
+        CountInstrs(builder_.get(), hir::OPCODE_LOAD_CONTEXT_info);
+    context_store_count =
+        CountInstrs(builder_.get(), hir::OPCODE_STORE_CONTEXT_info);
+  }
+
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  auto compiler = function->tier() == CompilationTier::kBaseline
+                      ? baseline_compiler_.get()
+                      : compiler_.get();
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
 
+  if (cvars::log_context_promotion) {
+    uint32_t removed_load_count =
+        context_load_count -
+        CountInstrs(builder_.get(), hir::OPCODE_LOAD_CONTEXT_info);
+    uint32_t removed_store_count =
+        context_store_count -
+        CountInstrs(builder_.get(), hir::OPCODE_STORE_CONTEXT_info);
+    XELOGI("Context promotion: {:08X} removed {}/{} loads, {}/{} stores",
+           function->address(), removed_load_count, context_load_count,
+           removed_store_count, context_store_count);
+  }
+
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
     builder_->Dump(&string_buffer_);
@@ -194,6 +271,18 @@ bool PPCTranslator::Translate(GuestFunction* function,
     return false;
   }
 
+  if (cvars::log_register_allocation) {
+    const compiler::passes::RegisterAllocationStats& regalloc_stats =
+        compiler == baseline_compiler_.get() ? *baseline_regalloc_stats_
+                                             : *regalloc_stats_;
+    const char* register_allocator =
+        compiler == baseline_compiler_.get() ? "greedy" : register_allocator_;
+    XELOGI("regalloc {}: {:08X} {} spill stores, {} reloads, {} code bytes",
+           register_allocator, function->address(),
+           regalloc_stats.spill_store_count, regalloc_stats.spill_load_count,
+           function->machine_code_length());
+  }
+
   return true;
 }
 
@@ -15,6 +15,7 @@
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/backend/assembler.h"
 #include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/register_allocation_pass.h"
 #include "xenia/cpu/function.h"
 
 namespace xe {
@@ -39,6 +40,14 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Used for functions compiled at CompilationTier::kBaseline.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
+  // Owned by the register allocation passes of the compilers above.
+  const compiler::passes::RegisterAllocationStats* regalloc_stats_ = nullptr;
+  const compiler::passes::RegisterAllocationStats* baseline_regalloc_stats_ =
+      nullptr;
+  // Of compiler_, for logging.
+  const char* register_allocator_ = "greedy";
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
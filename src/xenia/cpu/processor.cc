@@ -13,6 +13,7 @@
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
@@ -22,9 +23,11 @@
 #include "xenia/base/platform.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/backend/code_cache.h"
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
+#include "xenia/cpu/mmio_handler.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
@@ -48,6 +51,24 @@ DEFINE_path(trace_function_data_path, "", "File to write trace data to.",
             "CPU");
 DEFINE_bool(break_on_start, false, "Break into the debugger on startup.",
             "CPU");
+DEFINE_int32(
+    precompile_threads, 0,
+    "Number of threads used to compile the functions of loaded modules ahead "
+    "of their first call. -1 to calculate automatically (50% of logical CPU "
+    "cores), a positive number to specify the number of threads explicitly "
+    "(up to the number of logical CPU cores), 0 to only compile functions "
+    "when they are first called.",
+    "CPU");
+DEFINE_int32(guest_profile_interval_us, 0,
+             "Interval in microseconds at which running guest threads are "
+             "sampled by the guest profiler, 0 to disable it. The profile is "
+             "written to guest_profile_path on exit.",
+             "CPU");
+DEFINE_path(guest_profile_path, "guest_profile.folded",
+            "File to write guest profiler samples to as folded stacks. A "
+            "per-function and per-address summary is written next to it with "
+            "a .txt extension.",
+            "CPU");
 
 namespace xe {
 namespace kernel {
@@ -83,11 +104,27 @@ class BuiltinModule : public Module {
 };
 
 Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
-    : memory_(memory), export_resolver_(export_resolver) {}
+    : memory_(memory), export_resolver_(export_resolver) {
+  for (uint32_t i = 0; i < kMMIOAccessSiteFaultRingSize; ++i) {
+    mmio_access_site_faults_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
 
 Processor::~Processor() {
+  // The precompile threads use the frontend and backend, stop them first.
+  ShutdownPrecompileThreads();
+  ShutdownRecompileThread();
+
+  // Functions referenced by the samples are owned by the modules.
+  if (guest_profiler_) {
+    guest_profiler_->Stop();
+    guest_profiler_->Dump(cvars::guest_profile_path);
+    guest_profiler_.reset();
+  }
+
   {
     auto global_lock = global_critical_region_.Acquire();
+    module_index_.Rebuild({});
     modules_.clear();
   }
 
@@ -113,6 +150,7 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
   std::unique_ptr<Module> builtin_module(new BuiltinModule(this));
   builtin_module_ = builtin_module.get();
   modules_.push_back(std::move(builtin_module));
+  RebuildModuleIndex();
 
   if (frontend_ || backend_) {
     return false;
@@ -147,6 +185,13 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
     }
   }
 
+  // Recompiling functions would lose breakpoints and per-function trace data.
+  // Must be known before anything is translated, as the translators are
+  // set up for it.
+  bool can_recompile =
+      !cvars::debug && !cvars::trace_functions && !cvars::disassemble_functions;
+  tiered_compilation_enabled_ = cvars::tiered_compilation && can_recompile;
+
   // Open the trace data path, if requested.
   functions_trace_path_ = cvars::trace_function_data_path;
   if (!functions_trace_path_.empty()) {
@@ -154,6 +199,57 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
         ChunkedMappedMemoryWriter::Open(functions_trace_path_, 32_MiB, true);
   }
 
+  if (cvars::precompile_threads != 0) {
+    uint32_t logical_processor_count = xe::threading::logical_processor_count();
+    size_t precompile_thread_count;
+    if (cvars::precompile_threads < 0) {
+      precompile_thread_count =
+          std::max(logical_processor_count / 2, uint32_t(1));
+    } else {
+      precompile_thread_count = std::min(
+          uint32_t(cvars::precompile_threads), logical_processor_count);
+    }
+    for (size_t i = 0; i < precompile_thread_count; ++i) {
+      std::unique_ptr<xe::threading::Thread> precompile_thread =
+          xe::threading::Thread::Create(
+              {}, [this, i]() { PrecompileThread(i); });
+      assert_not_null(precompile_thread);
+      precompile_thread->set_name("CPU Precompile");
+      // Guest threads compiling on demand must take priority.
+      precompile_thread->set_priority(
+          xe::threading::ThreadPriority::kBelowNormal);
+      precompile_threads_.push_back(std::move(precompile_thread));
+    }
+  }
+
+  bool learn_mmio_access_sites = cvars::learn_mmio_access_sites &&
+                                 can_recompile &&
+                                 MMIOHandler::global_handler();
+  if (learn_mmio_access_sites) {
+    // Also tells the recompile thread to look for faults.
+    mmio_access_site_start_ticks_ = Clock::QueryHostTickCount();
+  }
+  if (tiered_compilation_enabled_ || learn_mmio_access_sites) {
+    recompile_thread_ =
+        xe::threading::Thread::Create({}, [this]() { RecompileThread(); });
+    assert_not_null(recompile_thread_);
+    recompile_thread_->set_name("CPU Recompile");
+    recompile_thread_->set_priority(
+        xe::threading::ThreadPriority::kBelowNormal);
+  }
+  if (learn_mmio_access_sites) {
+    MMIOHandler::global_handler()->SetAccessSiteCallback(
+        MMIOAccessSiteThunk, this);
+  }
+
+  if (cvars::guest_profile_interval_us > 0) {
+    guest_profiler_ = std::make_unique<GuestProfiler>(
+        this, std::chrono::microseconds(cvars::guest_profile_interval_us));
+    if (!guest_profiler_->Start()) {
+      guest_profiler_.reset();
+    }
+  }
+
   return true;
 }
 
@@ -172,6 +268,7 @@ void Processor::PreLaunch() {
 bool Processor::AddModule(std::unique_ptr<Module> module) {
   auto global_lock = global_critical_region_.Acquire();
   modules_.push_back(std::move(module));
+  RebuildModuleIndex();
   return true;
 }
 
@@ -185,6 +282,16 @@ Module* Processor::GetModule(const std::string_view name) {
   return nullptr;
 }
 
+void Processor::RebuildModuleIndex() {
+  auto global_lock = global_critical_region_.Acquire();
+  std::vector<Module*> modules;
+  modules.reserve(modules_.size());
+  for (const auto& module : modules_) {
+    modules.push_back(module.get());
+  }
+  module_index_.Rebuild(modules);
+}
+
 std::vector<Module*> Processor::GetModules() {
   auto global_lock = global_critical_region_.Acquire();
   std::vector<Module*> clone(modules_.size());
@@ -225,6 +332,10 @@ std::vector<Function*> Processor::FindFunctionsWithAddress(uint32_t address) {
 }
 
 Function* Processor::ResolveFunction(uint32_t address) {
+  return ResolveFunction(address, false);
+}
+
+Function* Processor::ResolveFunction(uint32_t address, bool is_precompile) {
   Entry* entry;
   Entry::Status status = entry_table_.GetOrCreate(address, &entry);
   if (status == Entry::STATUS_NEW) {
@@ -233,17 +344,24 @@ Function* Processor::ResolveFunction(uint32_t address) {
     // Grab symbol declaration.
     auto function = LookupFunction(address);
     if (!function) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.Complete(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
 
     if (!DemandFunction(function)) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.Complete(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
     entry->function = function;
     entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+    status = Entry::STATUS_READY;
+    entry_table_.Complete(entry, status);
+
+    if (is_precompile) {
+      ++precompiled_function_count_;
+    } else if (precompile_enabled()) {
+      ++demand_compiled_function_count_;
+    }
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
@@ -258,18 +376,7 @@ Function* Processor::LookupFunction(uint32_t address) {
   // TODO(benvanik): fast reject invalid addresses/log errors.
 
   // Find the module that contains the address.
-  Module* code_module = nullptr;
-  {
-    auto global_lock = global_critical_region_.Acquire();
-    // TODO(benvanik): sort by code address (if contiguous) so can bsearch.
-    // TODO(benvanik): cache last module low/high, as likely to be in there.
-    for (const auto& module : modules_) {
-      if (module->ContainsAddress(address)) {
-        code_module = module.get();
-        break;
-      }
-    }
-  }
+  Module* code_module = module_index_.Lookup(address);
   if (!code_module) {
     // No module found that could contain the address.
     return nullptr;
@@ -301,10 +408,15 @@ bool Processor::DemandFunction(Function* function) {
   auto module = function->module();
   auto symbol_status = module->DefineFunction(function);
   if (symbol_status == Symbol::Status::kNew) {
-    // Symbol is undefined, so define now.
+    // Symbol is undefined, so define now, reusing code stored by a previous
+    // run if the backend has it.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
+    auto guest_function = static_cast<GuestFunction*>(function);
+    if (!backend_->DefineStoredFunction(guest_function, debug_info_flags_) &&
+        !DefineGuestFunction(guest_function,
+                             tiered_compilation_enabled()
+                                 ? CompilationTier::kBaseline
+                                 : CompilationTier::kOptimized)) {
       function->set_status(Symbol::Status::kFailed);
       return false;
     }
@@ -324,6 +436,357 @@ bool Processor::DemandFunction(Function* function) {
   return true;
 }
 
+bool Processor::DefineGuestFunction(GuestFunction* function,
+                                    CompilationTier tier) {
+  function->BeginTier(tier, cvars::tier_up_threshold);
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  if (!frontend_->DefineFunction(function, debug_info_flags_)) {
+    return false;
+  }
+  if (tiered_compilation_enabled()) {
+    ++tier_compile_counts_[size_t(tier)];
+    tier_compile_ticks_[size_t(tier)] +=
+        Clock::QueryHostTickCount() - start_ticks;
+  }
+  return true;
+}
+
+void Processor::RequestTierUp(GuestFunction* function) {
+  if (!function->MarkTierUpRequested()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(recompile_request_lock_);
+    if (recompile_thread_shutdown_) {
+      return;
+    }
+    recompile_queue_.push_back({function, true});
+  }
+  recompile_request_cond_.notify_one();
+}
+
+void Processor::RecompileThread() {
+  while (true) {
+    if (mmio_access_site_start_ticks_) {
+      QueueMMIOAccessSiteRecompiles();
+    }
+    RecompileRequest request;
+    {
+      std::unique_lock<std::mutex> lock(recompile_request_lock_);
+      if (recompile_thread_shutdown_) {
+        return;
+      }
+      if (recompile_queue_.empty()) {
+        if (mmio_access_site_start_ticks_) {
+          // The exception handler can't wake the thread up.
+          recompile_request_cond_.wait_for(lock,
+                                           std::chrono::milliseconds(10));
+        } else {
+          recompile_request_cond_.wait(lock);
+        }
+        continue;
+      }
+      request = recompile_queue_.front();
+      recompile_queue_.pop_front();
+    }
+    GuestFunction* function = request.function;
+
+    // Guest threads keep running the old code until the assembler installs
+    // the new code in the indirection table, which also re-targets every
+    // patched call site. Old code stays allocated, so threads still inside it
+    // return normally.
+    if (request.tier_up) {
+      if (DefineGuestFunction(function, CompilationTier::kOptimized)) {
+        ++tier_up_count_;
+      } else {
+        XELOGW(
+            "Failed to recompile hot function {:08X}, keeping baseline code",
+            function->address());
+        function->BeginTier(CompilationTier::kBaseline,
+                            cvars::tier_up_threshold);
+      }
+    } else {
+      if (DefineGuestFunction(function, function->tier())) {
+        ++mmio_access_site_recompile_count_;
+      } else {
+        XELOGW("Failed to recompile function {:08X} for MMIO access sites",
+               function->address());
+      }
+    }
+  }
+}
+
+void Processor::ShutdownRecompileThread() {
+  if (!recompile_thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(recompile_request_lock_);
+    recompile_thread_shutdown_ = true;
+    recompile_queue_.clear();
+  }
+  recompile_request_cond_.notify_all();
+  xe::threading::Wait(recompile_thread_.get(), false);
+  if (tiered_compilation_enabled_) {
+    LogTieredCompilationStats();
+  }
+  if (mmio_access_site_start_ticks_) {
+    MMIOHandler::global_handler()->SetAccessSiteCallback(nullptr,
+                                                              nullptr);
+    LogMMIOAccessSiteStats();
+  }
+  recompile_thread_.reset();
+}
+
+Processor::TieredCompilationStats Processor::tiered_compilation_stats() const {
+  TieredCompilationStats stats;
+  for (size_t i = 0; i < 2; ++i) {
+    stats.compile_counts[i] = tier_compile_counts_[i];
+    stats.compile_ticks[i] = tier_compile_ticks_[i];
+  }
+  stats.promotion_count = tier_up_count_;
+  return stats;
+}
+
+void Processor::LogTieredCompilationStats() {
+  TieredCompilationStats stats = tiered_compilation_stats();
+  double tick_frequency = double(Clock::QueryHostTickFrequency());
+  auto baseline = size_t(CompilationTier::kBaseline);
+  auto optimized = size_t(CompilationTier::kOptimized);
+  XELOGI(
+      "Tiered compilation: {} baseline compiles in {:.3f}s, {} optimized "
+      "compiles in {:.3f}s, {} functions promoted",
+      stats.compile_counts[baseline],
+      stats.compile_ticks[baseline] / tick_frequency,
+      stats.compile_counts[optimized],
+      stats.compile_ticks[optimized] / tick_frequency, stats.promotion_count);
+}
+
+MMIORange* Processor::LookupMMIOAccessSite(uint32_t guest_address) {
+  if (!has_mmio_access_sites_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(mmio_access_sites_lock_);
+  auto it = mmio_access_sites_.find(guest_address);
+  return it != mmio_access_sites_.end() ? it->second : nullptr;
+}
+
+void Processor::MMIOAccessSiteThunk(void* context, void* host_pc,
+                                    MMIORange* range) {
+  reinterpret_cast<Processor*>(context)->RecordMMIOAccessSite(host_pc, range);
+}
+
+void Processor::RecordMMIOAccessSite(void* host_pc, MMIORange* range) {
+  // Called from the exception handler after the access has been emulated, so
+  // only claims a slot in the ring, without locking or allocating.
+  uint64_t position =
+      mmio_access_site_fault_write_position_.load(std::memory_order_relaxed);
+  MMIOAccessSiteFault* fault;
+  while (true) {
+    fault = &mmio_access_site_faults_[position % kMMIOAccessSiteFaultRingSize];
+    uint64_t sequence = fault->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (mmio_access_site_fault_write_position_.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // Full.
+      return;
+    } else {
+      position = mmio_access_site_fault_write_position_.load(
+          std::memory_order_relaxed);
+    }
+  }
+  fault->host_pc = host_pc;
+  fault->range = range;
+  fault->sequence.store(position + 1, std::memory_order_release);
+}
+
+void Processor::QueueMMIOAccessSiteRecompiles() {
+  struct AccessSite {
+    uint32_t guest_address;
+    MMIORange* range;
+    GuestFunction* function;
+  };
+  std::vector<AccessSite> sites;
+  {
+    // The code cache places code and maps host code to functions under the
+    // global lock, and source maps are published under it too.
+    auto global_lock = global_critical_region_.Acquire();
+    while (true) {
+      uint64_t position = mmio_access_site_fault_read_position_;
+      MMIOAccessSiteFault& fault =
+          mmio_access_site_faults_[position % kMMIOAccessSiteFaultRingSize];
+      if (fault.sequence.load(std::memory_order_acquire) != position + 1) {
+        break;
+      }
+      uint64_t host_pc = uint64_t(fault.host_pc);
+      MMIORange* range = fault.range;
+      fault.sequence.store(position + kMMIOAccessSiteFaultRingSize,
+                           std::memory_order_release);
+      ++mmio_access_site_fault_read_position_;
+      GuestFunction* function = backend_->code_cache()->LookupFunction(host_pc);
+      if (!function) {
+        continue;
+      }
+      // Threads may still be running code that has been replaced already,
+      // which can't be mapped with the source map of the current code.
+      uint64_t machine_code = uint64_t(function->machine_code());
+      if (host_pc < machine_code ||
+          host_pc >= machine_code + function->machine_code_length()) {
+        continue;
+      }
+      sites.push_back(
+          {function->MapMachineCodeToGuestAddress(uintptr_t(host_pc)), range,
+           function});
+    }
+  }
+  if (sites.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mmio_access_sites_lock_);
+    for (AccessSite& site : sites) {
+      if (!mmio_access_sites_.emplace(site.guest_address, site.range).second) {
+        // Already learned, and the function is queued for recompilation.
+        site.function = nullptr;
+      }
+    }
+    has_mmio_access_sites_.store(!mmio_access_sites_.empty(),
+                                 std::memory_order_release);
+  }
+  std::lock_guard<std::mutex> lock(recompile_request_lock_);
+  for (const AccessSite& site : sites) {
+    if (!site.function) {
+      continue;
+    }
+    // Sites in one function are often learned together, recompile once.
+    bool queued = false;
+    for (const RecompileRequest& request : recompile_queue_) {
+      if (request.function == site.function && !request.tier_up) {
+        queued = true;
+        break;
+      }
+    }
+    if (!queued) {
+      recompile_queue_.push_back({site.function, false});
+    }
+  }
+}
+
+void Processor::LogMMIOAccessSiteStats() {
+  double seconds =
+      double(Clock::QueryHostTickCount() - mmio_access_site_start_ticks_) /
+      double(Clock::QueryHostTickFrequency());
+  auto handler = MMIOHandler::global_handler();
+  uint64_t fault_count = handler->fault_access_count();
+  uint64_t learned_count = handler->learned_site_access_count();
+  size_t site_count;
+  {
+    std::lock_guard<std::mutex> lock(mmio_access_sites_lock_);
+    site_count = mmio_access_sites_.size();
+  }
+  XELOGI(
+      "MMIO access sites: {} learned, {} functions recompiled, {} accesses "
+      "through faults, {} through learned sites ({:.0f} faults/s avoided)",
+      site_count, uint64_t(mmio_access_site_recompile_count_), fault_count,
+      learned_count, seconds > 0.0 ? learned_count / seconds : 0.0);
+}
+
+void Processor::QueuePrecompile(const std::vector<uint32_t>& addresses) {
+  if (!precompile_enabled() || addresses.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(precompile_request_lock_);
+    if (precompile_queue_.empty() && !precompile_threads_busy_) {
+      precompile_batch_start_ticks_ = Clock::QueryHostTickCount();
+    }
+    precompile_queue_.insert(precompile_queue_.end(), addresses.begin(),
+                             addresses.end());
+  }
+  precompile_request_cond_.notify_all();
+}
+
+void Processor::PrecompileThread(size_t thread_index) {
+  while (true) {
+    uint32_t address;
+    {
+      std::unique_lock<std::mutex> lock(precompile_request_lock_);
+      if (precompile_threads_shutdown_) {
+        return;
+      }
+      if (precompile_queue_.empty()) {
+        precompile_request_cond_.wait(lock);
+        continue;
+      }
+      address = precompile_queue_.front();
+      precompile_queue_.pop_front();
+      ++precompile_threads_busy_;
+    }
+
+    // Skip functions that guest threads have already compiled on demand.
+    if (!entry_table_.Get(address)) {
+      ResolveFunction(address, true);
+    }
+
+    bool batch_done;
+    {
+      std::lock_guard<std::mutex> lock(precompile_request_lock_);
+      --precompile_threads_busy_;
+      batch_done = precompile_queue_.empty() && !precompile_threads_busy_;
+      if (batch_done) {
+        precompile_ticks_ +=
+            Clock::QueryHostTickCount() - precompile_batch_start_ticks_;
+      }
+    }
+    if (batch_done) {
+      LogPrecompileStats();
+    }
+  }
+}
+
+void Processor::ShutdownPrecompileThreads() {
+  if (precompile_threads_.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(precompile_request_lock_);
+    precompile_threads_shutdown_ = true;
+    precompile_queue_.clear();
+  }
+  precompile_request_cond_.notify_all();
+  for (size_t i = 0; i < precompile_threads_.size(); ++i) {
+    xe::threading::Wait(precompile_threads_[i].get(), false);
+  }
+  precompile_threads_.clear();
+  LogPrecompileStats();
+}
+
+void Processor::LogPrecompileStats() {
+  uint32_t precompiled_count = precompiled_function_count_;
+  uint32_t demand_compiled_count = demand_compiled_function_count_;
+  uint64_t precompile_ticks;
+  {
+    std::lock_guard<std::mutex> lock(precompile_request_lock_);
+    precompile_ticks = precompile_ticks_;
+  }
+  double precompile_seconds =
+      double(precompile_ticks) / double(Clock::QueryHostTickFrequency());
+  // Calls going straight through the indirection table are not observable, so
+  // every precompiled function is assumed to have been ready at its first
+  // call, and every function compiled by a guest thread counts as a miss.
+  uint32_t compiled_count = precompiled_count + demand_compiled_count;
+  XELOGI(
+      "Precompiled {} functions in {:.3f}s ({:.0f}/s), {} compiled on first "
+      "call ({:.1f}% of first calls hit precompiled code)",
+      precompiled_count, precompile_seconds,
+      precompile_seconds > 0.0 ? precompiled_count / precompile_seconds : 0.0,
+      demand_compiled_count,
+      compiled_count ? 100.0 * precompiled_count / compiled_count : 0.0);
+}
+
 bool Processor::Execute(ThreadState* thread_state, uint32_t address) {
   SCOPE_profile_cpu_f("cpu");
 
@@ -10,20 +10,28 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/cvar.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/function.h"
+#include "xenia/cpu/guest_profiler.h"
 #include "xenia/cpu/module.h"
+#include "xenia/cpu/module_index.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/thread_debug_info.h"
 #include "xenia/cpu/thread_state.h"
@@ -70,6 +78,8 @@ class Processor {
   StackWalker* stack_walker() const { return stack_walker_.get(); }
   ppc::PPCFrontend* frontend() const { return frontend_.get(); }
   backend::Backend* backend() const { return backend_.get(); }
+  // Null unless sampling is enabled with --guest_profile_interval_us.
+  GuestProfiler* guest_profiler() const { return guest_profiler_.get(); }
   ExportResolver* export_resolver() const { return export_resolver_; }
 
   bool Setup(std::unique_ptr<backend::Backend> backend);
@@ -103,6 +113,8 @@ class Processor {
   bool AddModule(std::unique_ptr<Module> module);
   Module* GetModule(const std::string_view name);
   std::vector<Module*> GetModules();
+  // Must be called when the address range of an added module changes.
+  void RebuildModuleIndex();
 
   Module* builtin_module() const { return builtin_module_; }
   Function* DefineBuiltin(const std::string_view name,
@@ -112,10 +124,41 @@ class Processor {
   Function* QueryFunction(uint32_t address);
   std::vector<Function*> FindFunctionsWithAddress(uint32_t address);
 
+  // Lock-free as far as finding the module goes.
   Function* LookupFunction(uint32_t address);
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
 
+  // True if background ahead-of-time compilation threads are running.
+  bool precompile_enabled() const { return !precompile_threads_.empty(); }
+  // Queues guest functions to be compiled on the background threads so they
+  // are ready before they are first called. No-op if precompilation is
+  // disabled.
+  void QueuePrecompile(const std::vector<uint32_t>& addresses);
+
+  // True if functions are first compiled at the baseline tier, see
+  // --tiered_compilation.
+  bool tiered_compilation_enabled() const {
+    return tiered_compilation_enabled_;
+  }
+  // Queues a hot baseline function to be recompiled with all optimizations on
+  // the tier-up thread. The new code replaces the old one in the indirection
+  // table and at patched call sites once ready.
+  void RequestTierUp(GuestFunction* function);
+
+  struct TieredCompilationStats {
+    // Functions compiled at each CompilationTier, and the host ticks spent.
+    uint64_t compile_counts[2];
+    uint64_t compile_ticks[2];
+    // Baseline functions recompiled at the optimized tier.
+    uint64_t promotion_count;
+  };
+  TieredCompilationStats tiered_compilation_stats() const;
+
+  // Returns the MMIO range a guest instruction has faulted into before, if
+  // its accesses should check for the range, see --learn_mmio_access_sites.
+  MMIORange* LookupMMIOAccessSite(uint32_t guest_address);
+
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
   uint64_t Execute(ThreadState* thread_state, uint32_t address, uint64_t args[],
@@ -236,10 +279,27 @@ class Processor {
   uint32_t CalculateNextGuestInstruction(ThreadDebugInfo* thread_info,
                                          uint32_t current_pc);
 
+  Function* ResolveFunction(uint32_t address, bool is_precompile);
   bool DemandFunction(Function* function);
 
+  void PrecompileThread(size_t thread_index);
+  void ShutdownPrecompileThreads();
+  void LogPrecompileStats();
+
+  bool DefineGuestFunction(GuestFunction* function, CompilationTier tier);
+  void RecompileThread();
+  void ShutdownRecompileThread();
+  void LogTieredCompilationStats();
+
+  static void MMIOAccessSiteThunk(void* context, void* host_pc,
+                                  MMIORange* range);
+  void RecordMMIOAccessSite(void* host_pc, MMIORange* range);
+  void QueueMMIOAccessSiteRecompiles();
+  void LogMMIOAccessSiteStats();
+
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
+  std::unique_ptr<GuestProfiler> guest_profiler_;
 
   std::function<DebugListener*(Processor*)> debug_listener_handler_;
   DebugListener* debug_listener_ = nullptr;
@@ -255,6 +315,62 @@ class Processor {
   ExportResolver* export_resolver_ = nullptr;
 
   EntryTable entry_table_;
+  // Module address ranges for LookupFunction, rebuilt under the global lock.
+  ModuleIndex module_index_;
+
+  // Background ahead-of-time compilation, see QueuePrecompile.
+  std::vector<std::unique_ptr<xe::threading::Thread>> precompile_threads_;
+  std::mutex precompile_request_lock_;
+  std::condition_variable precompile_request_cond_;
+  std::deque<uint32_t> precompile_queue_;
+  size_t precompile_threads_busy_ = 0;
+  bool precompile_threads_shutdown_ = false;
+  // Host ticks spent with work queued or being compiled, for the rate stat.
+  uint64_t precompile_batch_start_ticks_ = 0;
+  uint64_t precompile_ticks_ = 0;
+  // Functions compiled by the precompile threads, and functions that guest
+  // threads had to compile themselves on their first call.
+  std::atomic<uint32_t> precompiled_function_count_{0};
+  std::atomic<uint32_t> demand_compiled_function_count_{0};
+
+  // Background recompilation of hot functions, see RequestTierUp, and of
+  // functions with new MMIO access sites, at their current tier.
+  struct RecompileRequest {
+    GuestFunction* function;
+    bool tier_up;
+  };
+  std::unique_ptr<xe::threading::Thread> recompile_thread_;
+  std::mutex recompile_request_lock_;
+  std::condition_variable recompile_request_cond_;
+  std::deque<RecompileRequest> recompile_queue_;
+  bool recompile_thread_shutdown_ = false;
+  bool tiered_compilation_enabled_ = false;
+  std::atomic<uint64_t> tier_compile_counts_[2] = {};
+  std::atomic<uint64_t> tier_compile_ticks_[2] = {};
+  std::atomic<uint64_t> tier_up_count_{0};
+
+  // Guest instructions that faulted into MMIO ranges, see
+  // LookupMMIOAccessSite.
+  // The exception handler must not lock or allocate, so it only puts the
+  // faulting host instructions into this ring, and the recompile thread maps
+  // them to guest addresses. Faults that don't fit are dropped, the
+  // instruction faults again on its next access anyway.
+  struct MMIOAccessSiteFault {
+    // Position + 1 once written, position + ring size once read.
+    std::atomic<uint64_t> sequence;
+    void* host_pc;
+    MMIORange* range;
+  };
+  static constexpr uint32_t kMMIOAccessSiteFaultRingSize = 256;
+  MMIOAccessSiteFault mmio_access_site_faults_[kMMIOAccessSiteFaultRingSize];
+  std::atomic<uint64_t> mmio_access_site_fault_write_position_{0};
+  uint64_t mmio_access_site_fault_read_position_ = 0;
+  std::mutex mmio_access_sites_lock_;
+  std::unordered_map<uint32_t, MMIORange*> mmio_access_sites_;
+  std::atomic<bool> has_mmio_access_sites_{false};
+  std::atomic<uint64_t> mmio_access_site_recompile_count_{0};
+  uint64_t mmio_access_site_start_ticks_ = 0;
+
   xe::global_critical_region global_critical_region_;
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
@@ -34,6 +34,12 @@ class RawModule : public Module {
   void set_executable(bool is_executable) { is_executable_ = is_executable; }
 
   bool ContainsAddress(uint32_t address) override;
+  bool GetAddressRange(uint32_t* out_low,
+                       uint32_t* out_high) const override {
+    *out_low = low_address_;
+    *out_high = high_address_;
+    return true;
+  }
 
  protected:
   std::unique_ptr<Function> CreateFunction(uint32_t address) override;
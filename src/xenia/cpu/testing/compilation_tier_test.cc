@@ -0,0 +1,86 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/function.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+class TieredGuestFunction : public GuestFunction {
+ public:
+  TieredGuestFunction() : GuestFunction(nullptr, 0x82000000) {}
+
+  uint8_t* machine_code() const override { return nullptr; }
+  size_t machine_code_length() const override { return 0; }
+
+  // What the baseline code does on entry, returns whether it asks for a
+  // tier-up.
+  bool Enter() { return !--*tier_up_counter() && MarkTierUpRequested(); }
+
+ protected:
+  bool CallImpl(ThreadState* thread_state, uint32_t return_address) override {
+    return false;
+  }
+};
+
+TEST_CASE("Tier-up promotion", "[compilation_tier]") {
+  TieredGuestFunction function;
+  function.BeginTier(CompilationTier::kBaseline, 3);
+  REQUIRE(function.tier() == CompilationTier::kBaseline);
+  REQUIRE(*function.tier_up_counter() == 3);
+
+  REQUIRE_FALSE(function.Enter());
+  REQUIRE_FALSE(function.Enter());
+  REQUIRE(function.Enter());
+  // Only requested once, even if the counter reaches zero again.
+  *function.tier_up_counter() = 1;
+  REQUIRE_FALSE(function.Enter());
+
+  function.BeginTier(CompilationTier::kOptimized, 3);
+  REQUIRE(function.tier() == CompilationTier::kOptimized);
+  REQUIRE_FALSE(function.MarkTierUpRequested());
+}
+
+TEST_CASE("Tier-up counter reset", "[compilation_tier]") {
+  TieredGuestFunction function;
+  function.BeginTier(CompilationTier::kBaseline, 3);
+  REQUIRE_FALSE(function.Enter());
+  REQUIRE_FALSE(function.Enter());
+
+  // Recompiled at the baseline tier (for new MMIO access sites, for
+  // instance) - counting starts over.
+  function.BeginTier(CompilationTier::kBaseline, 3);
+  REQUIRE(*function.tier_up_counter() == 3);
+  REQUIRE_FALSE(function.Enter());
+  REQUIRE_FALSE(function.Enter());
+  REQUIRE(function.Enter());
+
+  // The optimized recompilation failed, so it stays at the baseline tier
+  // without asking again.
+  function.BeginTier(CompilationTier::kOptimized, 3);
+  function.BeginTier(CompilationTier::kBaseline, 3);
+  REQUIRE(function.tier() == CompilationTier::kBaseline);
+  REQUIRE(*function.tier_up_counter() == 3);
+  REQUIRE_FALSE(function.Enter());
+  REQUIRE_FALSE(function.Enter());
+  REQUIRE_FALSE(function.Enter());
+
+  // At least one entry is always counted.
+  TieredGuestFunction other_function;
+  other_function.BeginTier(CompilationTier::kBaseline, 0);
+  REQUIRE(*other_function.tier_up_counter() == 1);
+  REQUIRE(other_function.Enter());
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,199 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "xenia/cpu/entry_table.h"
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+// Entries only carry the function pointer around, so any unique value works.
+static Function* FakeFunction(uint32_t address) {
+  return reinterpret_cast<Function*>(uintptr_t(address) << 4);
+}
+
+static void Populate(EntryTable& table, uint32_t base, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    Entry* entry;
+    REQUIRE(table.GetOrCreate(base + i * 16, &entry) == Entry::STATUS_NEW);
+    entry->function = FakeFunction(base + i * 16);
+    entry->end_address = base + i * 16 + 12;
+    table.Complete(entry, Entry::STATUS_READY);
+  }
+}
+
+TEST_CASE("EntryTable lookup", "[entry_table]") {
+  EntryTable table;
+
+  REQUIRE(table.Get(0x82000000) == nullptr);
+
+  Entry* entry;
+  REQUIRE(table.GetOrCreate(0x82000000, &entry) == Entry::STATUS_NEW);
+  REQUIRE(entry->address == 0x82000000);
+  // Not ready until completed.
+  REQUIRE(table.Get(0x82000000) == nullptr);
+  entry->function = FakeFunction(0x82000000);
+  entry->end_address = 0x82000010;
+  table.Complete(entry, Entry::STATUS_READY);
+  REQUIRE(table.Get(0x82000000) == entry);
+
+  Entry* same_entry;
+  REQUIRE(table.GetOrCreate(0x82000000, &same_entry) == Entry::STATUS_READY);
+  REQUIRE(same_entry == entry);
+
+  Entry* failed_entry;
+  REQUIRE(table.GetOrCreate(0x82000100, &failed_entry) == Entry::STATUS_NEW);
+  table.Complete(failed_entry, Entry::STATUS_FAILED);
+  REQUIRE(table.Get(0x82000100) == nullptr);
+  REQUIRE(table.GetOrCreate(0x82000100, &failed_entry) ==
+          Entry::STATUS_FAILED);
+
+  auto fns = table.FindWithAddress(0x82000008);
+  REQUIRE(fns.size() == 1);
+  REQUIRE(fns[0] == FakeFunction(0x82000000));
+  REQUIRE(table.FindWithAddress(0x82000020).empty());
+}
+
+TEST_CASE("EntryTable growth", "[entry_table]") {
+  EntryTable table;
+  // Well past the initial capacity to force several table swaps.
+  const uint32_t count = 100000;
+  Populate(table, 0x82000000, count);
+  for (uint32_t i = 0; i < count; ++i) {
+    Entry* entry = table.Get(0x82000000 + i * 16);
+    REQUIRE(entry);
+    REQUIRE(entry->function == FakeFunction(0x82000000 + i * 16));
+  }
+  REQUIRE(table.Get(0x82000004) == nullptr);
+}
+
+TEST_CASE("EntryTable find with address", "[entry_table]") {
+  EntryTable table;
+  Populate(table, 0x82000000, 10000);
+  // A function overlapping a few thousand others, as nested functions and
+  // split function chunks produce.
+  const uint32_t outer_start = 0x82010008;
+  const uint32_t outer_end = 0x82020008;
+  Entry* outer_entry;
+  REQUIRE(table.GetOrCreate(outer_start, &outer_entry) == Entry::STATUS_NEW);
+  outer_entry->function = FakeFunction(outer_start);
+  outer_entry->end_address = outer_end;
+  table.Complete(outer_entry, Entry::STATUS_READY);
+  auto in_outer = [&](uint32_t address) {
+    return address >= outer_start && address <= outer_end;
+  };
+
+  for (uint32_t i = 0; i < 10000; ++i) {
+    uint32_t address = 0x82000000 + i * 16;
+    // Ordered by start address.
+    std::vector<Function*> expected_fns;
+    if (in_outer(address + 4)) {
+      expected_fns.push_back(FakeFunction(outer_start));
+    }
+    expected_fns.push_back(FakeFunction(address));
+    REQUIRE(table.FindWithAddress(address + 4) == expected_fns);
+    // Gap between functions.
+    REQUIRE(table.FindWithAddress(address + 14).size() ==
+            (in_outer(address + 14) ? 1 : 0));
+  }
+  REQUIRE(table.FindWithAddress(0x81FFFFFC).empty());
+}
+
+TEST_CASE("EntryTable concurrent create", "[entry_table]") {
+  EntryTable table;
+  const uint32_t thread_count = 8;
+  const uint32_t count = 20000;
+  std::atomic<uint32_t> new_count(0);
+  std::atomic<uint32_t> bad_count(0);
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t]() {
+      for (uint32_t n = 0; n < count; ++n) {
+        // Each thread walks the addresses in a different order.
+        uint32_t i = (n * (2 * t + 1)) % count;
+        uint32_t address = 0x82000000 + i * 4;
+        Entry* entry;
+        auto status = table.GetOrCreate(address, &entry);
+        if (status == Entry::STATUS_NEW) {
+          ++new_count;
+          entry->function = FakeFunction(address);
+          entry->end_address = address;
+          table.Complete(entry, Entry::STATUS_READY);
+        } else if (status != Entry::STATUS_READY ||
+                   entry->function != FakeFunction(address)) {
+          // Waiters must only ever see completed entries.
+          ++bad_count;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(new_count == count);
+  REQUIRE(bad_count == 0);
+}
+
+TEST_CASE("EntryTable lookup throughput", "[.benchmark][entry_table]") {
+  EntryTable table;
+  const uint32_t function_count = 50000;
+  const uint32_t lookups_per_thread = 10000000;
+  Populate(table, 0x82000000, function_count);
+
+  uint32_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (uint32_t thread_count = 1; thread_count <= max_threads;
+       thread_count *= 2) {
+    std::atomic<bool> start(false);
+    std::atomic<uint64_t> misses(0);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t]() {
+        while (!start.load(std::memory_order_acquire)) {
+        }
+        uint64_t local_misses = 0;
+        uint32_t i = t * 7919;
+        for (uint32_t n = 0; n < lookups_per_thread; ++n) {
+          i = (i + 12345) % function_count;
+          Entry* entry;
+          if (table.GetOrCreate(0x82000000 + i * 16, &entry) !=
+              Entry::STATUS_READY) {
+            ++local_misses;
+          }
+        }
+        misses += local_misses;
+      });
+    }
+    auto start_time = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_time);
+    REQUIRE(misses == 0);
+
+    double lookups = double(lookups_per_thread) * thread_count;
+    fmt::print("EntryTable: {:3} thread(s): {:8.2f} Mlookups/s\n",
+               thread_count, lookups / elapsed.count() / 1000000.0);
+  }
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
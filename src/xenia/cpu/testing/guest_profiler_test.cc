@@ -0,0 +1,130 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <vector>
+
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/guest_profiler.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+class TestGuestFunction : public GuestFunction {
+ public:
+  TestGuestFunction(uint32_t address, uint8_t* machine_code,
+                    size_t machine_code_length)
+      : GuestFunction(nullptr, address),
+        machine_code_(machine_code),
+        machine_code_length_(machine_code_length) {}
+
+  uint8_t* machine_code() const override { return machine_code_; }
+  size_t machine_code_length() const override { return machine_code_length_; }
+  void set_machine_code(uint8_t* machine_code) { machine_code_ = machine_code; }
+
+ protected:
+  bool CallImpl(ThreadState* thread_state, uint32_t return_address) override {
+    return false;
+  }
+
+ private:
+  uint8_t* machine_code_;
+  size_t machine_code_length_;
+};
+
+// Looks functions up in a list of host code ranges, which may include code
+// replaced by a recompilation.
+class TestCodeCache : public backend::CodeCache {
+ public:
+  void AddCode(const uint8_t* code, size_t length, GuestFunction* function) {
+    ranges_.push_back({code, length, function});
+  }
+
+  const std::filesystem::path& file_name() const override {
+    return file_name_;
+  }
+  uintptr_t execute_base_address() const override { return 0; }
+  size_t total_size() const override { return 0; }
+  GuestFunction* LookupFunction(uint64_t host_pc) override {
+    for (const Range& range : ranges_) {
+      if (host_pc >= uint64_t(range.code) &&
+          host_pc < uint64_t(range.code + range.length)) {
+        return range.function;
+      }
+    }
+    return nullptr;
+  }
+  void* LookupUnwindInfo(uint64_t host_pc) override { return nullptr; }
+
+ private:
+  struct Range {
+    const uint8_t* code;
+    size_t length;
+    GuestFunction* function;
+  };
+  std::filesystem::path file_name_;
+  std::vector<Range> ranges_;
+};
+
+TEST_CASE("Guest profiler sample attribution", "[guest_profiler]") {
+  // outer calls inner at 0x82000008, and inner executes 0x82001004.
+  uint8_t outer_code[64];
+  uint8_t inner_code[64];
+  uint8_t host_code[64];
+  TestGuestFunction outer(0x82000000, outer_code, sizeof(outer_code));
+  outer.source_map() = {{0x82000000, 0, 0}, {0x82000004, 0, 8},
+                        {0x82000008, 0, 16}, {0x8200000C, 0, 24}};
+  TestGuestFunction inner(0x82001000, inner_code, sizeof(inner_code));
+  inner.source_map() = {{0x82001000, 0, 0}, {0x82001004, 0, 32}};
+  TestCodeCache code_cache;
+  code_cache.AddCode(outer_code, sizeof(outer_code), &outer);
+  code_cache.AddCode(inner_code, sizeof(inner_code), &inner);
+
+  SECTION("In guest code") {
+    // Innermost first, the outer frame holds the return address.
+    const uint64_t frames[] = {uint64_t(inner_code + 40),
+                               uint64_t(outer_code + 24),
+                               uint64_t(host_code)};
+    auto stack =
+        GuestProfiler::ResolveStack(&code_cache, frames, xe::countof(frames));
+    REQUIRE(stack.sample_count == 1);
+    REQUIRE(stack.functions == std::vector<Function*>{&outer, &inner});
+    REQUIRE(stack.guest_pc == 0x82001004);
+    REQUIRE_FALSE(stack.in_host);
+  }
+
+  SECTION("In a call to host code") {
+    const uint64_t frames[] = {uint64_t(host_code),
+                               uint64_t(outer_code + 24)};
+    auto stack =
+        GuestProfiler::ResolveStack(&code_cache, frames, xe::countof(frames));
+    REQUIRE(stack.functions == std::vector<Function*>{&outer});
+    // The call instruction before the return address.
+    REQUIRE(stack.guest_pc == 0x82000008);
+    REQUIRE(stack.in_host);
+  }
+
+  SECTION("In code replaced by a recompilation") {
+    // The old code is still running, but the source map is for the new one.
+    uint8_t new_inner_code[64];
+    inner.set_machine_code(new_inner_code);
+    code_cache.AddCode(new_inner_code, sizeof(new_inner_code), &inner);
+    const uint64_t frames[] = {uint64_t(inner_code + 40)};
+    auto stack =
+        GuestProfiler::ResolveStack(&code_cache, frames, xe::countof(frames));
+    REQUIRE(stack.functions == std::vector<Function*>{&inner});
+    REQUIRE(stack.guest_pc == 0x82001000);
+  }
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,187 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "xenia/base/byte_stream.h"
+#include "xenia/memory.h"
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+// Fills memory with pages like those of a game: some untouched, some holding
+// structures of small values, some holding noise like compressed assets.
+static void FillSynthetic(uint8_t* data, size_t size, std::mt19937& random) {
+  const size_t page_size = 4096;
+  for (size_t offset = 0; offset < size; offset += page_size) {
+    uint8_t* page = data + offset;
+    uint32_t kind = random() % 10;
+    if (kind < 4) {
+      std::memset(page, 0, page_size);
+    } else if (kind < 8) {
+      uint32_t value = random() % 256;
+      for (size_t i = 0; i < page_size; i += 16) {
+        uint32_t structure[] = {value, uint32_t(i), 0x3F800000, 0};
+        std::memcpy(page + i, structure, sizeof(structure));
+        value += random() % 4;
+      }
+    } else {
+      for (size_t i = 0; i < page_size; i += 4) {
+        uint32_t value = random();
+        std::memcpy(page + i, &value, sizeof(value));
+      }
+    }
+  }
+}
+
+// Overwrites a few words in count random pages.
+static void WriteRandomPages(uint8_t* data, size_t size, uint32_t count,
+                             std::mt19937& random) {
+  const size_t page_size = 4096;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint8_t* page = data + (random() % (size / page_size)) * page_size;
+    for (uint32_t j = 0; j < 16; ++j) {
+      uint32_t value = random();
+      std::memcpy(page + (random() % (page_size / 4)) * 4, &value,
+                  sizeof(value));
+    }
+  }
+}
+
+TEST_CASE("Memory save state restores contents", "[memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  std::mt19937 random(0x5A7E);
+
+  const uint32_t size = 16 * 1024 * 1024;
+  BaseHeap* heap = memory.LookupHeap(0x40000000);
+  uint32_t address;
+  REQUIRE(heap->Alloc(size, 64 * 1024,
+                      kMemoryAllocationReserve | kMemoryAllocationCommit,
+                      kMemoryProtectRead | kMemoryProtectWrite, false,
+                      &address));
+  uint8_t* data = memory.TranslateVirtual(address);
+  FillSynthetic(data, size, random);
+
+  // Pages that aren't accessible and chunks that aren't fully committed.
+  BaseHeap* small_page_heap = memory.LookupHeap(0x10000000);
+  uint32_t small_address;
+  REQUIRE(small_page_heap->Alloc(
+      3 * 4096, 4096, kMemoryAllocationReserve | kMemoryAllocationCommit,
+      kMemoryProtectRead | kMemoryProtectWrite, false, &small_address));
+  uint8_t* small_data = memory.TranslateVirtual(small_address);
+  FillSynthetic(small_data, 3 * 4096, random);
+  std::vector<uint8_t> small_expected(small_data, small_data + 3 * 4096);
+  REQUIRE(small_page_heap->Protect(small_address + 4096, 4096,
+                                   kMemoryProtectNoAccess));
+
+  std::vector<uint8_t> full_save(64 * 1024 * 1024);
+  ByteStream full_stream(full_save.data(), full_save.size());
+  REQUIRE(memory.Save(&full_stream));
+  std::vector<uint8_t> full_expected(data, data + size);
+
+  REQUIRE(memory.CanSaveIncremental());
+  WriteRandomPages(data, size, 8, random);
+  std::vector<uint8_t> incremental_save(full_save.size());
+  ByteStream incremental_stream(incremental_save.data(),
+                                incremental_save.size());
+  REQUIRE(memory.Save(&incremental_stream, true));
+  std::vector<uint8_t> incremental_expected(data, data + size);
+  // At most a chunk per written page.
+  REQUIRE(incremental_stream.offset() < full_stream.offset() / 4);
+
+  std::memset(data, 0xCD, size);
+  full_stream.set_offset(0);
+  incremental_stream.set_offset(0);
+  REQUIRE(memory.Restore({&full_stream, &incremental_stream}));
+  REQUIRE(std::memcmp(data, incremental_expected.data(), size) == 0);
+
+  full_stream.set_offset(0);
+  REQUIRE(memory.Restore({&full_stream}));
+  REQUIRE(std::memcmp(data, full_expected.data(), size) == 0);
+
+  uint32_t protect;
+  REQUIRE(small_page_heap->QueryProtect(small_address + 4096, &protect));
+  REQUIRE(protect == kMemoryProtectNoAccess);
+  REQUIRE(small_page_heap->Protect(small_address + 4096, 4096,
+                                   kMemoryProtectRead | kMemoryProtectWrite));
+  REQUIRE(std::memcmp(small_data, small_expected.data(), 3 * 4096) == 0);
+}
+
+TEST_CASE("Memory save state 512 MB", "[.benchmark][memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  std::mt19937 random(0x5A7E);
+
+  const uint32_t size = 512 * 1024 * 1024;
+  BaseHeap* heap = memory.LookupHeap(0x40000000);
+  uint32_t address;
+  REQUIRE(heap->Alloc(size, 64 * 1024,
+                      kMemoryAllocationReserve | kMemoryAllocationCommit,
+                      kMemoryProtectRead | kMemoryProtectWrite, false,
+                      &address));
+  uint8_t* data = memory.TranslateVirtual(address);
+  FillSynthetic(data, size, random);
+
+  using Clock = std::chrono::steady_clock;
+  auto milliseconds = [](Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  };
+  auto mebibytes = [](size_t bytes) { return double(bytes) / (1024 * 1024); };
+
+  std::vector<uint8_t> full_save(size + size / 4);
+  ByteStream full_stream(full_save.data(), full_save.size());
+  auto start_time = Clock::now();
+  REQUIRE(memory.Save(&full_stream));
+  auto full_save_time = Clock::now() - start_time;
+
+  // About 1% of the pages written between the saves.
+  WriteRandomPages(data, size, size / 4096 / 100, random);
+  std::vector<uint8_t> incremental_save(size / 2);
+  ByteStream incremental_stream(incremental_save.data(),
+                                incremental_save.size());
+  start_time = Clock::now();
+  REQUIRE(memory.Save(&incremental_stream, true));
+  auto incremental_save_time = Clock::now() - start_time;
+  std::vector<uint8_t> expected(data, data + size);
+
+  full_stream.set_offset(0);
+  start_time = Clock::now();
+  REQUIRE(memory.Restore({&full_stream}));
+  auto full_restore_time = Clock::now() - start_time;
+
+  full_stream.set_offset(0);
+  incremental_stream.set_offset(0);
+  start_time = Clock::now();
+  REQUIRE(memory.Restore({&full_stream, &incremental_stream}));
+  auto incremental_restore_time = Clock::now() - start_time;
+  REQUIRE(std::memcmp(data, expected.data(), size) == 0);
+
+  fmt::print(
+      "512 MiB heap, uncompressed save {:.1f} MiB\n"
+      "full save: {:.1f} MiB in {:.1f} ms, restore in {:.1f} ms\n"
+      "incremental save after writing 1% of the pages: {:.1f} MiB in {:.1f} "
+      "ms, restore with the full save in {:.1f} ms\n",
+      mebibytes(size), mebibytes(full_stream.offset()),
+      milliseconds(full_save_time), milliseconds(full_restore_time),
+      mebibytes(incremental_stream.offset()),
+      milliseconds(incremental_save_time),
+      milliseconds(incremental_restore_time));
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,113 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/byte_order.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+const uint32_t kRangeAddress = 0x7FC80000;
+
+struct TestRegisters {
+  uint32_t last_address;
+  uint32_t last_value;
+};
+
+uint32_t ReadTestRegister(void* ppc_context, void* callback_context,
+                          uint32_t address) {
+  auto registers = reinterpret_cast<TestRegisters*>(callback_context);
+  registers->last_address = address;
+  return 0x12345678 + (address & 0xFFFF);
+}
+
+void WriteTestRegister(void* ppc_context, void* callback_context,
+                       uint32_t address, uint32_t value) {
+  auto registers = reinterpret_cast<TestRegisters*>(callback_context);
+  registers->last_address = address;
+  registers->last_value = value;
+}
+
+// Maps the range in the memory of the test, the function is generated on the
+// first Run.
+MMIORange* AddTestRange(TestFunction& test, TestRegisters* registers,
+                        uint32_t* out_memory_address) {
+  REQUIRE(test.memory->AddVirtualMappedRange(
+      kRangeAddress, 0xFFFF0000, 0xFFFF, registers, ReadTestRegister,
+      WriteTestRegister));
+  REQUIRE(test.memory->LookupHeap(0x40000000)->Alloc(
+      4096, 4096, kMemoryAllocationReserve | kMemoryAllocationCommit,
+      kMemoryProtectRead | kMemoryProtectWrite, false, out_memory_address));
+  return test.memory->LookupVirtualMappedRange(kRangeAddress);
+}
+
+MMIORange* test_range = nullptr;
+
+}  // namespace
+
+TEST_CASE("LOAD_MMIO_CHECKED_I32", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreGPR(b, 3,
+             b.ZeroExtend(b.LoadMmioChecked(LoadGPR(b, 4), test_range,
+                                            INT32_TYPE),
+                          INT64_TYPE));
+    b.Return();
+  });
+  TestRegisters registers = {};
+  uint32_t memory_address;
+  test_range = AddTestRange(test, &registers, &memory_address);
+  xe::store_and_swap<uint32_t>(test.memory->TranslateVirtual(memory_address),
+                               0xCAFEF00D);
+
+  // Results are in memory order, like those of LOAD.
+  test.Run([](PPCContext* ctx) { ctx->r[4] = kRangeAddress + 0x10; },
+           [&](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == xe::byte_swap(uint32_t(0x12345688)));
+             REQUIRE(registers.last_address == kRangeAddress + 0x10);
+           });
+  test.Run([&](PPCContext* ctx) { ctx->r[4] = memory_address; },
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == xe::byte_swap(uint32_t(0xCAFEF00D)));
+           });
+}
+
+TEST_CASE("STORE_MMIO_CHECKED_I32", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    b.StoreMmioChecked(LoadGPR(b, 4), test_range,
+                       b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    b.Return();
+  });
+  TestRegisters registers = {};
+  uint32_t memory_address;
+  test_range = AddTestRange(test, &registers, &memory_address);
+
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = kRangeAddress + 0x20;
+        ctx->r[5] = xe::byte_swap(uint32_t(0xDEADBEEF));
+      },
+      [&](PPCContext* ctx) {
+        REQUIRE(registers.last_address == kRangeAddress + 0x20);
+        REQUIRE(registers.last_value == 0xDEADBEEF);
+      });
+  test.Run(
+      [&](PPCContext* ctx) {
+        ctx->r[4] = memory_address;
+        ctx->r[5] = xe::byte_swap(uint32_t(0xDEADBEEF));
+      },
+      [&](PPCContext* ctx) {
+        REQUIRE(xe::load_and_swap<uint32_t>(test.memory->TranslateVirtual(
+                    memory_address)) == 0xDEADBEEF);
+      });
+}
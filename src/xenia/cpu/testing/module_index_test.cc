@@ -0,0 +1,115 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/module_index.h"
+#include "xenia/cpu/processor.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+class RangeModule : public Module {
+ public:
+  RangeModule(Processor* processor, uint32_t low_address,
+              uint32_t high_address, bool has_range = true)
+      : Module(processor),
+        name_("range"),
+        low_address_(low_address),
+        high_address_(high_address),
+        has_range_(has_range) {}
+
+  const std::string& name() const override { return name_; }
+  bool is_executable() const override { return true; }
+
+  bool ContainsAddress(uint32_t address) override {
+    return address >= low_address_ && address < high_address_;
+  }
+  bool GetAddressRange(uint32_t* out_low,
+                       uint32_t* out_high) const override {
+    *out_low = low_address_;
+    *out_high = high_address_;
+    return has_range_;
+  }
+
+ protected:
+  std::unique_ptr<Function> CreateFunction(uint32_t address) override {
+    return nullptr;
+  }
+
+ private:
+  std::string name_;
+  uint32_t low_address_;
+  uint32_t high_address_;
+  bool has_range_;
+};
+
+// Reference implementation: the linear scan the index replaces.
+static Module* LinearLookup(const std::vector<Module*>& modules,
+                            uint32_t address) {
+  for (Module* module : modules) {
+    if (module->ContainsAddress(address)) {
+      return module;
+    }
+  }
+  return nullptr;
+}
+
+TEST_CASE("ModuleIndex lookup", "[module_index]") {
+  Processor processor(nullptr, nullptr);
+  RangeModule xex(&processor, 0x82000000, 0x82400000);
+  RangeModule trampoline(&processor, 0x80040000, 0x80050000);
+  // Not loaded yet.
+  RangeModule empty(&processor, 0, 0);
+  std::vector<Module*> modules = {&xex, &trampoline, &empty};
+
+  ModuleIndex index;
+  REQUIRE(index.Lookup(0x82000000) == nullptr);
+  index.Rebuild(modules);
+  REQUIRE(index.Lookup(0x82000000) == &xex);
+  REQUIRE(index.Lookup(0x823FFFFC) == &xex);
+  REQUIRE(index.Lookup(0x82400000) == nullptr);
+  REQUIRE(index.Lookup(0x80048000) == &trampoline);
+  REQUIRE(index.Lookup(0x8003FFFC) == nullptr);
+  REQUIRE(index.Lookup(0) == nullptr);
+  REQUIRE(index.Lookup(0xFFFFFFFC) == nullptr);
+}
+
+TEST_CASE("ModuleIndex priority", "[module_index]") {
+  Processor processor(nullptr, nullptr);
+  RangeModule a(&processor, 0x82000000, 0x82400000);
+  // Overlaps the end of a and is only found past it.
+  RangeModule b(&processor, 0x82300000, 0x82600000);
+  // Overlaps b and takes precedence over it.
+  RangeModule c(&processor, 0x82500000, 0x82580000);
+  // Unranged modules are tested in order too.
+  RangeModule unranged(&processor, 0x82100000, 0x82110000, false);
+  RangeModule d(&processor, 0x82000000, 0x83000000);
+
+  std::vector<Module*> modules = {&a, &unranged, &b, &c, &d};
+  std::vector<Module*> reordered_modules = {&unranged, &d, &c, &b, &a};
+  for (const auto& module_list : {modules, reordered_modules}) {
+    ModuleIndex index;
+    index.Rebuild(module_list);
+    for (uint32_t address = 0x81F00000; address < 0x83100000;
+         address += 0x1000) {
+      REQUIRE(index.Lookup(address) == LinearLookup(module_list, address));
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
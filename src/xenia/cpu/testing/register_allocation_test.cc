@@ -0,0 +1,113 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstring>
+#include <memory>
+
+#include "xenia/cpu/compiler/passes/linear_scan_register_allocation_pass.h"
+#include "xenia/cpu/compiler/passes/register_allocation_pass.h"
+#include "xenia/cpu/hir/hir_builder.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::compiler::CompilerPass;
+using xe::cpu::compiler::passes::LinearScanRegisterAllocationPass;
+using xe::cpu::compiler::passes::RegisterAllocationPass;
+using xe::cpu::compiler::passes::RegisterAllocationStats;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::OpcodeInfo;
+using xe::cpu::hir::Value;
+
+// Only a few registers, so that spills are needed.
+MachineInfo CreateMachineInfo() {
+  MachineInfo machine_info;
+  std::memset(&machine_info, 0, sizeof(machine_info));
+  auto& gpr_set = machine_info.register_sets[0];
+  gpr_set.id = 0;
+  std::strcpy(gpr_set.name, "gpr");
+  gpr_set.types = MachineInfo::RegisterSet::INT_TYPES;
+  gpr_set.count = 3;
+  auto& xmm_set = machine_info.register_sets[1];
+  xmm_set.id = 1;
+  std::strcpy(xmm_set.name, "xmm");
+  xmm_set.types = MachineInfo::RegisterSet::FLOAT_TYPES |
+                  MachineInfo::RegisterSet::VEC_TYPES;
+  xmm_set.count = 3;
+  return machine_info;
+}
+
+// Sums 6 context values twice, so that they are all live at once. Also uses a
+// local like the frontend does, which is not a spill.
+void EmitSpillingFunction(HIRBuilder& b) {
+  Value* slot = b.AllocLocal(hir::INT64_TYPE);
+  b.StoreLocal(slot, b.LoadContext(64, hir::INT64_TYPE));
+  Value* values[6];
+  for (size_t i = 0; i < xe::countof(values); ++i) {
+    values[i] = b.LoadContext(i * 8, hir::INT64_TYPE);
+  }
+  Value* sum = values[0];
+  for (size_t i = 1; i < xe::countof(values); ++i) {
+    sum = b.Add(sum, values[i]);
+  }
+  for (size_t i = 0; i < xe::countof(values); ++i) {
+    sum = b.Add(sum, values[i]);
+  }
+  sum = b.Add(sum, b.LoadLocal(slot));
+  b.StoreContext(0, sum);
+  b.Return();
+}
+
+uint32_t CountInstrs(HIRBuilder& b, const OpcodeInfo& opcode) {
+  uint32_t count = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      if (instr->opcode == &opcode) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+template <typename T>
+void TestSpillCounts() {
+  MachineInfo machine_info = CreateMachineInfo();
+  T pass(&machine_info);
+  for (int run = 0; run < 2; ++run) {
+    HIRBuilder b;
+    EmitSpillingFunction(b);
+    REQUIRE(pass.Run(&b));
+    const RegisterAllocationStats& stats = pass.stats();
+    REQUIRE(stats.spill_store_count > 0);
+    REQUIRE(stats.spill_load_count >= stats.spill_store_count);
+    // Everything else is the local of the function itself.
+    REQUIRE(stats.spill_store_count ==
+            CountInstrs(b, hir::OPCODE_STORE_LOCAL_info) - 1);
+    REQUIRE(stats.spill_load_count ==
+            CountInstrs(b, hir::OPCODE_LOAD_LOCAL_info) - 1);
+  }
+}
+
+TEST_CASE("Greedy register allocation spill counts", "[register_allocation]") {
+  TestSpillCounts<RegisterAllocationPass>();
+}
+
+TEST_CASE("Linear scan register allocation spill counts",
+          "[register_allocation]") {
+  TestSpillCounts<LinearScanRegisterAllocationPass>();
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -10,13 +10,23 @@
 #include "xenia/cpu/xex_module.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "third_party/fmt/include/fmt/format.h"
 
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/lzx.h"
@@ -29,6 +39,13 @@
 #include "third_party/crypto/rijndael-alg-fst.h"
 #include "third_party/pe/pe_image.h"
 
+DEFINE_path(
+    xex_image_cache_root, "",
+    "Directory to cache decompressed XEX images in. Images cached by a "
+    "previous run are mapped and copied into memory instead of being "
+    "decrypted and decompressed again. Empty to disable.",
+    "CPU");
+
 static const uint8_t xe_xex2_retail_key[16] = {
     0x20, 0xB1, 0x85, 0xA5, 0x9D, 0x28, 0xFD, 0xC3,
     0x40, 0x58, 0x3F, 0xBB, 0x08, 0x96, 0xBF, 0x91};
@@ -56,11 +73,158 @@ void aes_decrypt_buffer(const uint8_t* session_key, const uint8_t* input_buffer,
   }
 }
 
+// Decrypts size bytes of an AES-CBC buffer starting at offset. A block only
+// depends on the preceding block of ciphertext, so parts of a buffer can be
+// decrypted independently.
+static void aes_decrypt_buffer_part(const uint32_t* rk, int32_t Nr,
+                                    const uint8_t* input_buffer,
+                                    uint8_t* output_buffer, size_t offset,
+                                    size_t size) {
+  uint8_t ivec[16] = {0};
+  if (offset) {
+    std::memcpy(ivec, input_buffer + offset - 16, 16);
+  }
+  const uint8_t* ct = input_buffer + offset;
+  uint8_t* pt = output_buffer + offset;
+  for (size_t n = 0; n < size; n += 16, ct += 16, pt += 16) {
+    rijndaelDecrypt(rk, Nr, ct, pt);
+    for (size_t i = 0; i < 16; i++) {
+      pt[i] ^= ivec[i];
+      ivec[i] = ct[i];
+    }
+  }
+}
+
 namespace xe {
 namespace cpu {
 
 using xe::kernel::KernelState;
 
+// Decrypts an AES-CBC buffer on a pool of threads. Segments are claimed front
+// to back, so the beginning of the output can be consumed while the rest is
+// still being decrypted.
+class ParallelAesDecryptor {
+ public:
+  static constexpr size_t kSegmentSize = 256 * 1024;
+
+  ParallelAesDecryptor(const uint8_t* session_key, const uint8_t* input_buffer,
+                       uint8_t* output_buffer, size_t size)
+      : input_buffer_(input_buffer),
+        output_buffer_(output_buffer),
+        size_(size),
+        segment_count_((size + kSegmentSize - 1) / kSegmentSize),
+        segments_done_(segment_count_, false),
+        start_tick_(Clock::QueryHostTickCount()),
+        finish_tick_(start_tick_) {
+    Nr_ = rijndaelKeySetupDec(rk_, session_key, 128);
+    // Leave a thread for each of the stages consuming the output.
+    size_t thread_count = std::min(
+        size_t(std::max(xe::threading::logical_processor_count(), 3u) - 2),
+        segment_count_);
+    for (size_t i = 0; i < thread_count; ++i) {
+      threads_.emplace_back(&ParallelAesDecryptor::WorkerMain, this);
+    }
+  }
+
+  ~ParallelAesDecryptor() {
+    Cancel();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Waits until the output is decrypted up to end or decryption is cancelled,
+  // and returns the length of the decrypted output.
+  size_t WaitFor(size_t end) {
+    end = std::min(end, size_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    decrypted_cv_.wait(lock,
+                       [&]() { return decrypted_end_ >= end || cancelled_; });
+    return decrypted_end_;
+  }
+
+  // Skips the segments that are not being decrypted yet.
+  void Cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    decrypted_cv_.notify_all();
+  }
+
+  // Time taken to decrypt the whole buffer, valid after WaitFor(size).
+  uint64_t elapsed_ticks() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finish_tick_ - start_tick_;
+  }
+
+ private:
+  void WorkerMain() {
+    while (true) {
+      size_t segment = next_segment_++;
+      if (segment >= segment_count_) {
+        break;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_) {
+          break;
+        }
+      }
+      size_t offset = segment * kSegmentSize;
+      aes_decrypt_buffer_part(rk_, Nr_, input_buffer_, output_buffer_, offset,
+                              std::min(kSegmentSize, size_ - offset));
+      std::lock_guard<std::mutex> lock(mutex_);
+      segments_done_[segment] = true;
+      if (segment != first_pending_segment_) {
+        continue;
+      }
+      while (first_pending_segment_ < segment_count_ &&
+             segments_done_[first_pending_segment_]) {
+        ++first_pending_segment_;
+      }
+      decrypted_end_ = std::min(first_pending_segment_ * kSegmentSize, size_);
+      if (decrypted_end_ == size_) {
+        finish_tick_ = Clock::QueryHostTickCount();
+      }
+      decrypted_cv_.notify_all();
+    }
+  }
+
+  uint32_t rk_[4 * (MAXNR + 1)];
+  int32_t Nr_;
+  const uint8_t* input_buffer_;
+  uint8_t* output_buffer_;
+  size_t size_;
+  size_t segment_count_;
+  std::atomic<size_t> next_segment_ = {0};
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable decrypted_cv_;
+  std::vector<bool> segments_done_;
+  size_t first_pending_segment_ = 0;
+  size_t decrypted_end_ = 0;
+  bool cancelled_ = false;
+  uint64_t start_tick_;
+  uint64_t finish_tick_;
+};
+
+static double TicksToMilliseconds(uint64_t ticks) {
+  return double(ticks) * 1000.0 / double(Clock::QueryHostTickFrequency());
+}
+
+// Header of an image in xex_image_cache_root, followed by the image.
+struct CachedImageHeader {
+  static constexpr fourcc_t kMagic = make_fourcc("XIMG");
+  static constexpr uint32_t kVersion = 1;
+
+  fourcc_t magic;
+  uint32_t version;
+  uint64_t cache_key;
+  uint64_t image_hash;
+  uint32_t image_size;
+  uint32_t reserved;
+};
+
 XexModule::XexModule(Processor* processor, KernelState* kernel_state)
     : Module(processor), processor_(processor), kernel_state_(kernel_state) {}
 
@@ -491,6 +655,22 @@ int XexModule::ReadImage(const void* xex_addr, size_t xex_length,
       reinterpret_cast<const uint8_t*>(xex_security_info()->aes_key), 16,
       session_key_, 16);
 
+  // Only decompression is slow enough to be worth caching.
+  bool use_cache = !cvars::xex_image_cache_root.empty() &&
+                   opt_file_format_info()->compression_type ==
+                       XEX_COMPRESSION_NORMAL;
+  uint64_t cache_key = 0;
+  if (use_cache) {
+    cache_key = XXH3_64bits_withSeed(xex_header_mem_.data(),
+                                     xex_header_mem_.size(), use_dev_key);
+    if (ReadCachedImage(cache_key)) {
+      if (is_valid_executable()) {
+        return 0;
+      }
+      memory()->LookupHeap(base_address_)->Reset();
+    }
+  }
+
   int result_code = 0;
   switch (opt_file_format_info()->compression_type) {
     case XEX_COMPRESSION_NONE:
@@ -512,6 +692,9 @@ int XexModule::ReadImage(const void* xex_addr, size_t xex_length,
   }
 
   if (is_patch() || is_valid_executable()) {
+    if (use_cache) {
+      WriteCachedImage(cache_key);
+    }
     return 0;
   }
 
@@ -550,8 +733,8 @@ int XexModule::ReadImageUncompressed(const void* xex_addr, size_t xex_length) {
       memcpy(buffer, p, exe_length);
       return 0;
     case XEX_ENCRYPTION_NORMAL:
-      aes_decrypt_buffer(session_key_, p, exe_length, buffer,
-                         uncompressed_size);
+      ParallelAesDecryptor(session_key_, p, buffer, exe_length)
+          .WaitFor(exe_length);
       return 0;
     default:
       assert_always();
@@ -609,9 +792,16 @@ int XexModule::ReadImageBasicCompressed(const void* xex_addr,
   std::memset(buffer, 0, total_size);  // Quickly zero the contents.
   uint8_t* d = buffer;
 
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key_, 128);
+  // The blocks are encrypted as one stream, decrypt all of them before
+  // scattering them.
+  std::unique_ptr<uint8_t[]> decrypted_buffer;
+  if (opt_file_format_info()->encryption_type == XEX_ENCRYPTION_NORMAL) {
+    decrypted_buffer.reset(new uint8_t[xe::round_up(exe_length, 16u)]);
+    ParallelAesDecryptor(session_key_, source_buffer, decrypted_buffer.get(),
+                         exe_length)
+        .WaitFor(exe_length);
+    p = decrypted_buffer.get();
+  }
 
   for (size_t n = 0; n < block_count; n++) {
     const uint32_t data_size = comp_info.blocks[n].data_size;
@@ -619,26 +809,13 @@ int XexModule::ReadImageBasicCompressed(const void* xex_addr,
 
     switch (opt_file_format_info()->encryption_type) {
       case XEX_ENCRYPTION_NONE:
+      case XEX_ENCRYPTION_NORMAL:
         if (data_size > uncompressed_size - (d - buffer)) {
           // Overflow.
           return 1;
         }
         memcpy(d, p, data_size);
         break;
-      case XEX_ENCRYPTION_NORMAL: {
-        const uint8_t* ct = p;
-        uint8_t* pt = d;
-        for (size_t m = 0; m < data_size; m += 16, ct += 16, pt += 16) {
-          // Decrypt 16 uint8_ts from input -> output.
-          rijndaelDecrypt(rk, Nr, ct, pt);
-          for (size_t i = 0; i < 16; i++) {
-            // XOR with previous.
-            pt[i] ^= ivec[i];
-            // Set previous.
-            ivec[i] = ct[i];
-          }
-        }
-      } break;
       default:
         assert_always();
         return 1;
@@ -664,27 +841,44 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   //   20b hash of entire next block (including size/hash)
   //    Nb block uint8_ts
   // - decompress block contents
+  // The steps are pipelined: decryption runs on a pool of threads, de-blocking
+  // on another thread as soon as blocks are decrypted, and decompression on
+  // this thread as soon as blocks are de-blocked.
 
-  uint8_t* compress_buffer = NULL;
-  const uint8_t* p = NULL;
-  uint8_t* d = NULL;
-  sha1::SHA1 s;
+  uint64_t start_tick = Clock::QueryHostTickCount();
+
+  uint32_t uncompressed_size = image_size();
+
+  // Allocate in-place the XEX memory.
+  bool alloc_result =
+      memory()
+          ->LookupHeap(base_address_)
+          ->AllocFixed(
+              base_address_, uncompressed_size, 4096,
+              xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
+              xe::kMemoryProtectRead | xe::kMemoryProtectWrite);
+  if (!alloc_result) {
+    XELOGE("Unable to allocate XEX memory at {:08X}-{:08X}.", base_address_,
+           uncompressed_size);
+    return 3;
+  }
+  uint8_t* buffer = memory()->TranslateVirtual(base_address_);
+  std::memset(buffer, 0, uncompressed_size);
 
   // Decrypt (if needed).
-  bool free_input = false;
+  std::unique_ptr<uint8_t[]> decrypted_buffer;
+  std::unique_ptr<ParallelAesDecryptor> decryptor;
   const uint8_t* input_buffer = exe_buffer;
-  size_t input_size = exe_length;
 
   switch (opt_file_format_info()->encryption_type) {
     case XEX_ENCRYPTION_NONE:
       // No-op.
       break;
     case XEX_ENCRYPTION_NORMAL:
-      // TODO: a way to do without a copy/alloc?
-      free_input = true;
-      input_buffer = (const uint8_t*)calloc(1, exe_length);
-      aes_decrypt_buffer(session_key_, exe_buffer, exe_length,
-                         (uint8_t*)input_buffer, exe_length);
+      decrypted_buffer.reset(new uint8_t[xe::round_up(exe_length, 16u)]);
+      decryptor = std::make_unique<ParallelAesDecryptor>(
+          session_key_, exe_buffer, decrypted_buffer.get(), exe_length);
+      input_buffer = decrypted_buffer.get();
       break;
     default:
       assert_always();
@@ -692,85 +886,188 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   }
 
   const auto* compression_info = &opt_file_format_info()->compression_info;
-  const xex2_compressed_block_info* cur_block =
-      &compression_info->normal.first_block;
-
-  compress_buffer = (uint8_t*)calloc(1, exe_length);
-
-  p = input_buffer;
-  d = compress_buffer;
+  std::unique_ptr<uint8_t[]> compress_buffer(new uint8_t[exe_length]);
 
   // De-block.
-  int result_code = 0;
-
-  uint8_t block_calced_digest[0x14];
-  while (cur_block->block_size) {
-    const uint8_t* pnext = p + cur_block->block_size;
-    const auto* next_block = (const xex2_compressed_block_info*)p;
-
-    // Compare block hash, if no match we probably used wrong decrypt key
-    s.reset();
-    s.processBytes(p, cur_block->block_size);
-    s.finalize(block_calced_digest);
-    if (memcmp(block_calced_digest, cur_block->block_hash, 0x14) != 0) {
-      result_code = 2;
-      break;
-    }
-
-    // skip block info
-    p += 4;
-    p += 20;
-
-    while (true) {
-      const size_t chunk_size = (p[0] << 8) | p[1];
-      p += 2;
-      if (!chunk_size) {
+  std::mutex deblock_mutex;
+  std::condition_variable deblock_cv;
+  size_t deblocked_length = 0;
+  bool deblock_done = false;
+  int deblock_result = 0;
+  uint64_t deblock_end_tick = 0;
+  std::thread deblock_thread([&]() {
+    const xex2_compressed_block_info* cur_block =
+        &compression_info->normal.first_block;
+    size_t offset = 0;
+    uint8_t* d = compress_buffer.get();
+    sha1::SHA1 s;
+    uint8_t block_calced_digest[0x14];
+    int result_code = 0;
+    while (cur_block->block_size) {
+      const size_t block_end = offset + cur_block->block_size;
+      if (block_end > exe_length ||
+          (decryptor && decryptor->WaitFor(block_end) < block_end)) {
+        result_code = 2;
+        break;
+      }
+      const uint8_t* p = input_buffer + offset;
+      const auto* next_block = (const xex2_compressed_block_info*)p;
+
+      // Compare block hash, if no match we probably used wrong decrypt key
+      s.reset();
+      s.processBytes(p, cur_block->block_size);
+      s.finalize(block_calced_digest);
+      if (memcmp(block_calced_digest, cur_block->block_hash, 0x14) != 0) {
+        result_code = 2;
         break;
       }
 
-      memcpy(d, p, chunk_size);
-      p += chunk_size;
-      d += chunk_size;
-    }
-
-    p = pnext;
-    cur_block = next_block;
-  }
+      // skip block info
+      p += 4;
+      p += 20;
 
-  if (!result_code) {
-    uint32_t uncompressed_size = image_size();
+      while (true) {
+        const size_t chunk_size = (p[0] << 8) | p[1];
+        p += 2;
+        if (!chunk_size) {
+          break;
+        }
 
-    // Allocate in-place the XEX memory.
-    bool alloc_result =
-        memory()
-            ->LookupHeap(base_address_)
-            ->AllocFixed(
-                base_address_, uncompressed_size, 4096,
-                xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
-                xe::kMemoryProtectRead | xe::kMemoryProtectWrite);
+        memcpy(d, p, chunk_size);
+        p += chunk_size;
+        d += chunk_size;
+      }
 
-    if (alloc_result) {
-      uint8_t* buffer = memory()->TranslateVirtual(base_address_);
-      std::memset(buffer, 0, uncompressed_size);
+      offset = block_end;
+      cur_block = next_block;
 
-      // Decompress into XEX base
-      result_code = lzx_decompress(
-          compress_buffer, d - compress_buffer, buffer, uncompressed_size,
-          compression_info->normal.window_size, nullptr, 0);
-    } else {
-      XELOGE("Unable to allocate XEX memory at {:08X}-{:08X}.", base_address_,
-             uncompressed_size);
-      result_code = 3;
+      std::lock_guard<std::mutex> lock(deblock_mutex);
+      deblocked_length = size_t(d - compress_buffer.get());
+      deblock_cv.notify_all();
     }
+    if (decryptor) {
+      // Nothing else is needed after an error.
+      decryptor->Cancel();
+    }
+    std::lock_guard<std::mutex> lock(deblock_mutex);
+    deblock_done = true;
+    deblock_result = result_code;
+    deblock_end_tick = Clock::QueryHostTickCount();
+    deblock_cv.notify_all();
+  });
+
+  // Decompress into XEX base
+  int result_code = lzx_decompress(
+      compress_buffer.get(),
+      [&](size_t end) {
+        std::unique_lock<std::mutex> lock(deblock_mutex);
+        deblock_cv.wait(
+            lock, [&]() { return deblocked_length >= end || deblock_done; });
+        return deblocked_length;
+      },
+      buffer, uncompressed_size, compression_info->normal.window_size);
+  deblock_thread.join();
+  if (deblock_result) {
+    return deblock_result;
+  }
+  if (result_code) {
+    return result_code;
   }
 
-  if (compress_buffer) {
-    free((void*)compress_buffer);
+  uint64_t end_tick = Clock::QueryHostTickCount();
+  XELOGI(
+      "Decompressed the XEX image of {} in {:.1f} ms, decryption took {:.1f} "
+      "ms, de-blocking finished after {:.1f} ms",
+      name_, TicksToMilliseconds(end_tick - start_tick),
+      decryptor ? TicksToMilliseconds(decryptor->elapsed_ticks()) : 0.0,
+      TicksToMilliseconds(deblock_end_tick - start_tick));
+  return 0;
+}
+
+bool XexModule::ReadCachedImage(uint64_t cache_key) {
+  auto path = cvars::xex_image_cache_root /
+              fmt::format("{:016X}.xeximage", cache_key);
+  if (!std::filesystem::exists(path)) {
+    return false;
   }
-  if (free_input) {
-    free((void*)input_buffer);
+  uint64_t start_tick = Clock::QueryHostTickCount();
+  auto mapping = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!mapping || mapping->size() < sizeof(CachedImageHeader)) {
+    return false;
   }
-  return result_code;
+  CachedImageHeader header;
+  std::memcpy(&header, mapping->data(), sizeof(header));
+  const uint8_t* image = mapping->data() + sizeof(header);
+  // Images written by crashed runs or for a different XEX are ignored, and
+  // replaced after decompressing again.
+  uint32_t uncompressed_size = image_size();
+  if (header.magic != CachedImageHeader::kMagic ||
+      header.version != CachedImageHeader::kVersion ||
+      header.cache_key != cache_key ||
+      header.image_size != uncompressed_size ||
+      mapping->size() - sizeof(header) < uncompressed_size ||
+      XXH3_64bits(image, uncompressed_size) != header.image_hash) {
+    XELOGW("Ignoring a stale cached XEX image: {}", xe::path_to_utf8(path));
+    return false;
+  }
+  if (!memory()
+           ->LookupHeap(base_address_)
+           ->AllocFixed(
+               base_address_, uncompressed_size, 4096,
+               xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
+               xe::kMemoryProtectRead | xe::kMemoryProtectWrite)) {
+    XELOGE("Unable to allocate XEX memory at {:08X}-{:08X}.", base_address_,
+           uncompressed_size);
+    return false;
+  }
+  std::memcpy(memory()->TranslateVirtual(base_address_), image,
+              uncompressed_size);
+  XELOGI("Loaded the XEX image of {} from the cache in {:.1f} ms", name_,
+         TicksToMilliseconds(Clock::QueryHostTickCount() - start_tick));
+  return true;
+}
+
+void XexModule::WriteCachedImage(uint64_t cache_key) {
+  auto cache_root = cvars::xex_image_cache_root;
+  if (!std::filesystem::exists(cache_root) &&
+      !std::filesystem::create_directories(cache_root)) {
+    XELOGE("Failed to create the XEX image cache directory: {}",
+           xe::path_to_utf8(cache_root));
+    return;
+  }
+  auto path = cache_root / fmt::format("{:016X}.xeximage", cache_key);
+  uint64_t start_tick = Clock::QueryHostTickCount();
+  CachedImageHeader header = {};
+  header.magic = CachedImageHeader::kMagic;
+  header.version = CachedImageHeader::kVersion;
+  header.cache_key = cache_key;
+  header.image_size = image_size();
+  const uint8_t* image = memory()->TranslateVirtual(base_address_);
+  header.image_hash = XXH3_64bits(image, header.image_size);
+
+  // Write to a temporary file first so that a partial image is never used.
+  auto temp_path = path;
+  temp_path += ".tmp";
+  FILE* file = xe::filesystem::OpenFile(temp_path, "wb");
+  if (!file) {
+    XELOGE("Failed to open the cached XEX image for writing: {}",
+           xe::path_to_utf8(temp_path));
+    return;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(image, 1, header.image_size, file) == header.image_size;
+  written = fclose(file) == 0 && written;
+  std::error_code error;
+  if (written) {
+    std::filesystem::rename(temp_path, path, error);
+  }
+  if (!written || error) {
+    XELOGE("Failed to write the cached XEX image: {}", xe::path_to_utf8(path));
+    std::filesystem::remove(temp_path, error);
+    return;
+  }
+  XELOGI("Cached the XEX image of {} in {:.1f} ms", name_,
+         TicksToMilliseconds(Clock::QueryHostTickCount() - start_tick));
 }
 
 int XexModule::ReadPEHeaders() {
@@ -1003,6 +1300,8 @@ bool XexModule::LoadContinue() {
 
   // Notify backend that we have an executable range.
   processor_->backend()->CommitExecutableRange(low_address_, high_address_);
+  // The module was added before its range was known.
+  processor_->RebuildModuleIndex();
 
   // Add all imports (variables/functions).
   xex2_opt_import_libraries* opt_import_libraries = nullptr;
@@ -1061,6 +1360,14 @@ bool XexModule::LoadContinue() {
     }
   }
 
+  // Code is final now (patches applied), so the backend may key off it.
+  processor_->backend()->OnModuleCodeLoaded(this, low_address_, high_address_);
+
+  // Start compiling the known functions in the background, if enabled.
+  if (processor_->precompile_enabled()) {
+    processor_->QueuePrecompile(FindFunctionStarts());
+  }
+
   // Setup memory protection.
   for (uint32_t i = 0, page = 0; i < sec_header->page_descriptor_count; i++) {
     // Byteswap the bitfield manually.
@@ -1620,5 +1927,31 @@ bool XexModule::FindSaveRest() {
   return true;
 }
 
+std::vector<uint32_t> XexModule::FindFunctionStarts() {
+  // The exception directory (.pdata) has an IMAGE_CE_RUNTIME_FUNCTION_ENTRY
+  // for almost every function in the image: the big-endian start address
+  // followed by a bitfield with the prolog length in the low 8 bits and the
+  // function length in instructions in the next 22.
+  std::vector<uint32_t> addresses;
+  const PESection* pdata = GetPESection(".pdata");
+  if (!pdata) {
+    return addresses;
+  }
+  auto entries =
+      memory()->TranslateVirtual<const xe::be<uint32_t>*>(pdata->address);
+  size_t entry_count = pdata->size / (2 * sizeof(uint32_t));
+  addresses.reserve(entry_count);
+  for (size_t i = 0; i < entry_count; ++i) {
+    uint32_t address = entries[i * 2];
+    uint32_t function_length = (entries[i * 2 + 1] >> 8) & 0x3FFFFF;
+    if (!function_length || (address & 0x3) || address < low_address_ ||
+        address >= high_address_) {
+      continue;
+    }
+    addresses.push_back(address);
+  }
+  return addresses;
+}
+
 }  // namespace cpu
 }  // namespace xe
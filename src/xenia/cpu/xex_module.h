@@ -149,6 +149,12 @@ class XexModule : public xe::cpu::Module {
   bool Unload();
 
   bool ContainsAddress(uint32_t address) override;
+  bool GetAddressRange(uint32_t* out_low,
+                       uint32_t* out_high) const override {
+    *out_low = low_address_;
+    *out_high = high_address_;
+    return true;
+  }
 
   const std::string& name() const override { return name_; }
   bool is_executable() const override {
@@ -184,12 +190,18 @@ class XexModule : public xe::cpu::Module {
   int ReadImageUncompressed(const void* xex_addr, size_t xex_length);
   int ReadImageBasicCompressed(const void* xex_addr, size_t xex_length);
   int ReadImageCompressed(const void* xex_addr, size_t xex_length);
+  // Load and store decompressed images in xex_image_cache_root.
+  bool ReadCachedImage(uint64_t cache_key);
+  void WriteCachedImage(uint64_t cache_key);
 
   int ReadPEHeaders();
 
   bool SetupLibraryImports(const std::string_view name,
                            const xex2_import_library* library);
   bool FindSaveRest();
+  // Returns the start addresses of the functions listed in the image's
+  // exception directory.
+  std::vector<uint32_t> FindFunctionStarts();
 
   Processor* processor_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <random>
 
 #include "config.h"
 #include "third_party/fmt/include/fmt/format.h"
@@ -21,6 +22,7 @@
 #include "xenia/base/cvar.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mapped_memory.h"
@@ -60,6 +62,11 @@ DECLARE_int32(user_language);
 DEFINE_double(time_scalar, 1.0,
               "Scalar used to speed or slow time (1x, 2x, 1/2x, etc).",
               "General");
+DEFINE_bool(save_state_incremental, false,
+            "Save only the memory changed since the last save state or "
+            "restore, on top of it. Restoring needs all the earlier save "
+            "states.",
+            "General");
 DEFINE_string(
     launch_module, "",
     "Executable to launch from the .iso or the package instead of default.xex "
@@ -110,6 +117,11 @@ Emulator::Emulator(const std::filesystem::path& command_line,
 Emulator::~Emulator() {
   // Note that we delete things in the reverse order they were initialized.
 
+  // File reads in flight may write to memory watched by the graphics system.
+  if (kernel_state_) {
+    kernel_state_->ShutdownFileIOWorkers();
+  }
+
   // Give the systems time to shutdown before we delete them.
   if (graphics_system_) {
     graphics_system_->Shutdown();
@@ -428,22 +440,88 @@ void Emulator::Resume() {
   }
 }
 
+// Incremental save states may be layered on top of each other up to this
+// depth, which also stops cycles.
+constexpr size_t kMaxSaveStateChainLength = 256;
+
+struct SaveStateHeader {
+  std::optional<uint32_t> title_id;
+  // Random, identifies the save in the saves based on it, so a file replaced
+  // since then is not used as their base.
+  uint64_t snapshot_id;
+  bool incremental;
+  // The save this one is based on if incremental.
+  std::filesystem::path parent_path;
+  uint64_t parent_snapshot_id;
+  // Where the memory is in the file, so it can be restored from all the saves
+  // without parsing the rest of the state.
+  uint64_t memory_offset;
+};
+
+static bool ReadSaveStateHeader(ByteStream& stream, SaveStateHeader& header) {
+  if (stream.data_length() < sizeof(uint32_t) * 2 ||
+      stream.Read<uint32_t>() != kEmulatorSaveSignature ||
+      stream.Read<uint32_t>() != kEmulatorSaveVersion) {
+    return false;
+  }
+  header.title_id = {};
+  if (stream.Read<bool>()) {
+    header.title_id = stream.Read<uint32_t>();
+  }
+  header.snapshot_id = stream.Read<uint64_t>();
+  header.incremental = stream.Read<bool>();
+  header.parent_path.clear();
+  header.parent_snapshot_id = 0;
+  if (header.incremental) {
+    header.parent_path = xe::to_path(stream.Read<std::string>());
+    header.parent_snapshot_id = stream.Read<uint64_t>();
+  }
+  header.memory_offset = stream.Read<uint64_t>();
+  return header.memory_offset <= stream.data_length();
+}
+
 bool Emulator::SaveToFile(const std::filesystem::path& path) {
   Pause();
+  // Asynchronous file I/O in flight writes to guest memory and objects.
+  kernel_state_->DrainFileIO();
+  uint64_t start_time = Clock::QueryHostUptimeMillis();
+
+  // Saving on top of a save that the last save is based on would corrupt the
+  // chain, so do a full save then.
+  std::filesystem::path save_path = std::filesystem::absolute(path);
+  bool incremental =
+      cvars::save_state_incremental && memory_->CanSaveIncremental() &&
+      !save_state_chain_.empty() &&
+      save_state_chain_.size() < kMaxSaveStateChainLength &&
+      std::find(save_state_chain_.cbegin(), save_state_chain_.cend(),
+                save_path) == save_state_chain_.cend();
 
   filesystem::CreateEmptyFile(path);
   auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0, 2_GiB);
   if (!map) {
+    Resume();
     return false;
   }
 
   // Save the emulator state to a file
   ByteStream stream(map->data(), map->size());
   stream.Write(kEmulatorSaveSignature);
+  stream.Write(kEmulatorSaveVersion);
   stream.Write(title_id_.has_value());
   if (title_id_.has_value()) {
     stream.Write(title_id_.value());
   }
+  std::random_device random_device;
+  uint64_t snapshot_id =
+      (uint64_t(random_device()) << 32) | uint32_t(random_device());
+  stream.Write(snapshot_id);
+  stream.Write(incremental);
+  if (incremental) {
+    stream.Write(std::string_view(xe::path_to_utf8(save_state_chain_.back())));
+    stream.Write(save_state_snapshot_id_);
+  }
+  size_t memory_offset_offset = stream.offset();
+  stream.Write(uint64_t(0));
 
   // It's important we don't hold the global lock here! XThreads need to step
   // forward (possibly through guarded regions) without worry!
@@ -451,39 +529,87 @@ bool Emulator::SaveToFile(const std::filesystem::path& path) {
   graphics_system_->Save(&stream);
   audio_system_->Save(&stream);
   kernel_state_->Save(&stream);
-  memory_->Save(&stream);
-  map->Close(stream.offset());
+  uint64_t memory_offset = stream.offset();
+  if (!memory_->Save(&stream, incremental)) {
+    map->Close(0);
+    save_state_chain_.clear();
+    Resume();
+    return false;
+  }
+  size_t size = stream.offset();
+  stream.set_offset(memory_offset_offset);
+  stream.Write(memory_offset);
+  map->Close(size);
+
+  if (!incremental) {
+    save_state_chain_.clear();
+  }
+  save_state_chain_.push_back(save_path);
+  save_state_snapshot_id_ = snapshot_id;
+  XELOGI("Saved {} state to {}: {:.1f} MiB in {} ms",
+         incremental ? "incremental" : "full", xe::path_to_utf8(path),
+         double(size) / (1024 * 1024),
+         Clock::QueryHostUptimeMillis() - start_time);
 
   Resume();
   return true;
 }
 
 bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
-  // Restore the emulator state from a file
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
-  if (!map) {
-    return false;
+  uint64_t start_time = Clock::QueryHostUptimeMillis();
+
+  // Restore the emulator state from a file, and the memory from the saves it
+  // is based on too, oldest first.
+  std::vector<std::filesystem::path> save_state_chain;
+  std::vector<std::unique_ptr<MappedMemory>> maps;
+  std::vector<SaveStateHeader> headers;
+  for (std::filesystem::path save_path = std::filesystem::absolute(path);;) {
+    if (maps.size() >= kMaxSaveStateChainLength) {
+      XELOGE("Too many incremental save states based on each other");
+      return false;
+    }
+    auto map = MappedMemory::Open(save_path, MappedMemory::Mode::kRead);
+    if (!map) {
+      XELOGE("Could not open save state {}", xe::path_to_utf8(save_path));
+      return false;
+    }
+    ByteStream header_stream(map->data(), map->size());
+    SaveStateHeader header;
+    if (!ReadSaveStateHeader(header_stream, header) ||
+        (!headers.empty() && header.title_id != headers.front().title_id)) {
+      XELOGE("Save state {} is invalid", xe::path_to_utf8(save_path));
+      return false;
+    }
+    // headers.front() is the save based on this one.
+    if (!headers.empty() &&
+        header.snapshot_id != headers.front().parent_snapshot_id) {
+      XELOGE("Save state {} has been replaced since {} was based on it",
+             xe::path_to_utf8(save_path),
+             xe::path_to_utf8(save_state_chain.front()));
+      return false;
+    }
+    save_state_chain.insert(save_state_chain.cbegin(), save_path);
+    maps.insert(maps.begin(), std::move(map));
+    headers.insert(headers.begin(), header);
+    if (!header.incremental) {
+      break;
+    }
+    save_path = header.parent_path;
   }
+  const std::unique_ptr<MappedMemory>& map = maps.back();
 
   restoring_ = true;
 
   // Terminate any loaded titles.
   Pause();
+  kernel_state_->DrainFileIO();
   kernel_state_->TerminateTitle();
 
   auto lock = global_critical_region::AcquireDirect();
   ByteStream stream(map->data(), map->size());
-  if (stream.Read<uint32_t>() != kEmulatorSaveSignature) {
-    return false;
-  }
-
-  auto has_title_id = stream.Read<bool>();
-  std::optional<uint32_t> title_id;
-  if (!has_title_id) {
-    title_id = {};
-  } else {
-    title_id = stream.Read<uint32_t>();
-  }
+  SaveStateHeader header;
+  ReadSaveStateHeader(stream, header);
+  const std::optional<uint32_t>& title_id = header.title_id;
   if (title_id_.has_value() != title_id.has_value() ||
       title_id_.value() != title_id.value()) {
     // Swapping between titles is unsupported at the moment.
@@ -507,10 +633,21 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
     XELOGE("Could not restore kernel state!");
     return false;
   }
-  if (!memory_->Restore(&stream)) {
+  std::vector<ByteStream> memory_streams;
+  std::vector<ByteStream*> memory_stream_pointers;
+  memory_streams.reserve(maps.size());
+  for (size_t i = 0; i < maps.size(); ++i) {
+    memory_streams.emplace_back(maps[i]->data(), maps[i]->size(),
+                                size_t(headers[i].memory_offset));
+    memory_stream_pointers.push_back(&memory_streams.back());
+  }
+  if (!memory_->Restore(memory_stream_pointers)) {
     XELOGE("Could not restore memory!");
+    save_state_chain_.clear();
     return false;
   }
+  save_state_chain_ = std::move(save_state_chain);
+  save_state_snapshot_id_ = headers.back().snapshot_id;
 
   // Update the main thread.
   auto threads =
@@ -522,6 +659,9 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
     }
   }
 
+  XELOGI("Restored state from {} in {} ms", xe::path_to_utf8(path),
+         Clock::QueryHostUptimeMillis() - start_time);
+
   Resume();
 
   restore_fence_.Signal();
@@ -49,6 +49,9 @@ class Window;
 namespace xe {
 
 constexpr fourcc_t kEmulatorSaveSignature = make_fourcc("XSAV");
+// Save states of other versions are rejected, so any change to the layout of
+// the saved state, including the records of the kernel objects, must bump it.
+constexpr uint32_t kEmulatorSaveVersion = 2;
 
 // The main type that runs the whole emulator.
 // This is responsible for initializing and managing all the various subsystems.
@@ -191,6 +194,9 @@ class Emulator {
   void Resume();
   bool is_paused() const { return paused_; }
 
+  // Saves the emulator state. With --save_state_incremental, only the memory
+  // changed since the last save or restore is written, and restoring needs
+  // the files of the earlier saves.
   bool SaveToFile(const std::filesystem::path& path);
   bool RestoreFromFile(const std::filesystem::path& path);
 
@@ -256,6 +262,11 @@ class Emulator {
   bool paused_;
   bool restoring_;
   threading::Fence restore_fence_;  // Fired on restore finish.
+  // Absolute paths of the last save or restored save and the saves it is
+  // based on, oldest first.
+  std::vector<std::filesystem::path> save_state_chain_;
+  // Snapshot ID of the last save in save_state_chain_.
+  uint64_t save_state_snapshot_id_ = 0;
 };
 
 }  // namespace xe
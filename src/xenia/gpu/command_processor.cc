@@ -15,9 +15,12 @@
 #include <cstring>
 
 #include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/bit_range.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/ring_buffer.h"
 #include "xenia/gpu/gpu_flags.h"
@@ -42,8 +45,27 @@ CommandProcessor::CommandProcessor(GraphicsSystem* graphics_system,
       trace_writer_(graphics_system->memory()->physical_membase()),
       worker_running_(true),
       write_ptr_index_event_(xe::threading::Event::CreateAutoResetEvent(false)),
-      write_ptr_index_(0) {
+      write_ptr_index_(0),
+      wait_reg_mem_event_(xe::threading::Event::CreateAutoResetEvent(false)) {
   assert_not_null(write_ptr_index_event_);
+  assert_not_null(wait_reg_mem_event_);
+
+  // Registers which must be written through WriteRegister by any
+  // implementation - unknown ones for the warning, and those with side effects
+  // handled in the CommandProcessor.
+  for (uint32_t i = 0; i < RegisterFile::kRegisterCount; ++i) {
+    if (!RegisterFile::GetRegisterInfo(i)) {
+      SetRegisterWriteSideEffects(i, 1);
+    }
+  }
+  SetRegisterWriteSideEffects(
+      XE_GPU_REG_SCRATCH_REG0,
+      XE_GPU_REG_SCRATCH_REG7 - XE_GPU_REG_SCRATCH_REG0 + 1);
+  SetRegisterWriteSideEffects(XE_GPU_REG_COHER_STATUS_HOST, 1);
+  SetRegisterWriteSideEffects(XE_GPU_REG_DC_LUT_RW_INDEX, 1);
+  SetRegisterWriteSideEffects(XE_GPU_REG_DC_LUT_SEQ_COLOR, 1);
+  SetRegisterWriteSideEffects(XE_GPU_REG_DC_LUT_PWL_DATA, 1);
+  SetRegisterWriteSideEffects(XE_GPU_REG_DC_LUT_30_COLOR, 1);
 }
 
 CommandProcessor::~CommandProcessor() = default;
@@ -68,6 +90,10 @@ bool CommandProcessor::Initialize() {
     }
   }
 
+  wait_reg_mem_invalidation_callback_handle_ =
+      memory_->RegisterPhysicalMemoryInvalidationCallback(
+          WaitRegMemInvalidationCallbackThunk, this);
+
   worker_running_ = true;
   worker_thread_ = kernel::object_ref<kernel::XHostThread>(
       new kernel::XHostThread(kernel_state_, 128 * 1024, 0, [this]() {
@@ -85,8 +111,16 @@ void CommandProcessor::Shutdown() {
 
   worker_running_ = false;
   write_ptr_index_event_->Set();
+  wait_reg_mem_event_->Set();
   worker_thread_->Wait(0, 0, 0, nullptr);
   worker_thread_.reset();
+
+  if (wait_reg_mem_invalidation_callback_handle_) {
+    memory_->UnregisterPhysicalMemoryInvalidationCallback(
+        wait_reg_mem_invalidation_callback_handle_);
+    wait_reg_mem_invalidation_callback_handle_ = nullptr;
+  }
+  LogWaitRegMemStats();
 }
 
 void CommandProcessor::InitializeShaderStorage(
@@ -154,6 +188,7 @@ void CommandProcessor::RestoreRegisters(uint32_t first_register,
   } else {
     std::memcpy(register_file_->values + first_register, register_values,
                 sizeof(uint32_t) * register_count);
+    xe::bit_range::SetRange(register_dirty_, first_register, register_count);
   }
 }
 
@@ -327,6 +362,15 @@ void CommandProcessor::UpdateWritePointer(uint32_t value) {
   write_ptr_index_event_->Set();
 }
 
+void CommandProcessor::OnRegisterWrittenByGuest(uint32_t index) {
+  // Ordered with the store of the polled value by the command processor
+  // thread, after the store of the register value here.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (wait_reg_mem_register_.load(std::memory_order_relaxed) == index) {
+    wait_reg_mem_event_->Set();
+  }
+}
+
 void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   RegisterFile& regs = *register_file_;
   if (index >= RegisterFile::kRegisterCount) {
@@ -335,6 +379,7 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 
   regs.values[index].u32 = value;
+  register_dirty_[index >> 6] |= uint64_t(1) << (index & 63);
   if (!regs.GetRegisterInfo(index)) {
     XELOGW("GPU: Write to unknown register ({:04X} = {:08X})", index, value);
   }
@@ -467,6 +512,105 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 }
 
+void CommandProcessor::WriteRegistersFromMem(uint32_t first_index,
+                                             const uint32_t* values,
+                                             uint32_t count) {
+  uint32_t in_bounds_count =
+      first_index < RegisterFile::kRegisterCount
+          ? std::min(count,
+                     uint32_t(RegisterFile::kRegisterCount) - first_index)
+          : 0;
+  uint32_t offset = 0;
+  while (offset < in_bounds_count) {
+    std::pair<size_t, size_t> fast_range = xe::bit_range::NextUnsetRange(
+        register_write_side_effects_, first_index + offset,
+        in_bounds_count - offset);
+    uint32_t fast_offset = uint32_t(fast_range.first) - first_index;
+    for (; offset < fast_offset; ++offset) {
+      WriteRegister(first_index + offset,
+                    xe::load_and_swap<uint32_t>(values + offset));
+    }
+    if (!fast_range.second) {
+      break;
+    }
+    xe::copy_and_swap_32_unaligned(register_file_->values + fast_range.first,
+                                   values + offset, fast_range.second);
+    xe::bit_range::SetRange(register_dirty_, fast_range.first,
+                            fast_range.second);
+    offset += uint32_t(fast_range.second);
+  }
+  // Out of bounds - let WriteRegister report it.
+  for (; offset < count; ++offset) {
+    WriteRegister(first_index + offset,
+                  xe::load_and_swap<uint32_t>(values + offset));
+  }
+}
+
+void CommandProcessor::WriteRegistersFromRing(RingBuffer* reader,
+                                              uint32_t first_index,
+                                              uint32_t count) {
+  RingBuffer::ReadRange range = reader->BeginRead(sizeof(uint32_t) * count);
+  uint32_t first_count = uint32_t(range.first_length / sizeof(uint32_t));
+  WriteRegistersFromMem(first_index,
+                        reinterpret_cast<const uint32_t*>(range.first),
+                        first_count);
+  if (range.second_length) {
+    WriteRegistersFromMem(first_index + first_count,
+                          reinterpret_cast<const uint32_t*>(range.second),
+                          uint32_t(range.second_length / sizeof(uint32_t)));
+  }
+  reader->EndRead(range);
+}
+
+void CommandProcessor::SetRegisterWriteSideEffects(uint32_t first_index,
+                                                   uint32_t count) {
+  assert_true(first_index <= RegisterFile::kRegisterCount &&
+              RegisterFile::kRegisterCount - first_index >= count);
+  xe::bit_range::SetRange(register_write_side_effects_, first_index, count);
+}
+
+bool CommandProcessor::ConsumeDirtyRegisters(uint32_t first_index,
+                                             uint32_t count) {
+  if (!count) {
+    return false;
+  }
+  uint32_t last_index = first_index + count - 1;
+  uint64_t any_dirty = 0;
+  for (uint32_t i = first_index >> 6; i <= last_index >> 6; ++i) {
+    uint64_t mask = GetRegisterBitmapBlockMask(i, first_index, last_index);
+    any_dirty |= register_dirty_[i] & mask;
+    register_dirty_[i] &= ~mask;
+  }
+  return any_dirty != 0;
+}
+
+void CommandProcessor::ConsumeDirtyFloatConstants(uint64_t dirty_vertex_out[4],
+                                                  uint64_t dirty_pixel_out[4]) {
+  // 4 registers per constant, 16 constants per dirty bitmap block, the vertex
+  // shader constants are followed by the pixel shader ones.
+  static_assert(!(XE_GPU_REG_SHADER_CONSTANT_000_X & 63),
+                "Float constants must start at a dirty bitmap block boundary");
+  const uint32_t first_block = XE_GPU_REG_SHADER_CONSTANT_000_X >> 6;
+  std::memset(dirty_vertex_out, 0, sizeof(uint64_t) * 4);
+  std::memset(dirty_pixel_out, 0, sizeof(uint64_t) * 4);
+  for (uint32_t i = 0; i < 32; ++i) {
+    uint64_t block = register_dirty_[first_block + i];
+    if (!block) {
+      continue;
+    }
+    register_dirty_[first_block + i] = 0;
+    // Merge the 4 bits of each constant into the lowest one.
+    block |= block >> 1;
+    block |= block >> 2;
+    uint64_t constants = 0;
+    for (uint32_t j = 0; j < 16; ++j) {
+      constants |= ((block >> (j * 4)) & 1) << j;
+    }
+    uint64_t* dirty_out = i < 16 ? dirty_vertex_out : dirty_pixel_out;
+    dirty_out[(i & 15) >> 2] |= constants << ((i & 3) * 16);
+  }
+}
+
 void CommandProcessor::MakeCoherent() {
   SCOPE_profile_cpu_f("gpu");
 
@@ -632,10 +776,12 @@ bool CommandProcessor::ExecutePacketType0(RingBuffer* reader, uint32_t packet) {
 
   uint32_t base_index = (packet & 0x7FFF);
   uint32_t write_one_reg = (packet >> 15) & 0x1;
-  for (uint32_t m = 0; m < count; m++) {
-    uint32_t reg_data = reader->ReadAndSwap<uint32_t>();
-    uint32_t target_index = write_one_reg ? base_index : base_index + m;
-    WriteRegister(target_index, reg_data);
+  if (write_one_reg) {
+    for (uint32_t m = 0; m < count; m++) {
+      WriteRegisterFromPacket(base_index, reader->ReadAndSwap<uint32_t>());
+    }
+  } else {
+    WriteRegistersFromRing(reader, base_index, count);
   }
 
   trace_writer_.WritePacketEnd();
@@ -650,8 +796,8 @@ bool CommandProcessor::ExecutePacketType1(RingBuffer* reader, uint32_t packet) {
   uint32_t reg_index_2 = (packet >> 11) & 0x7FF;
   uint32_t reg_data_1 = reader->ReadAndSwap<uint32_t>();
   uint32_t reg_data_2 = reader->ReadAndSwap<uint32_t>();
-  WriteRegister(reg_index_1, reg_data_1);
-  WriteRegister(reg_index_2, reg_data_2);
+  WriteRegisterFromPacket(reg_index_1, reg_data_1);
+  WriteRegisterFromPacket(reg_index_2, reg_data_2);
   trace_writer_.WritePacketEnd();
   return true;
 }
@@ -917,6 +1063,7 @@ bool CommandProcessor::ExecutePacketType3_XE_SWAP(RingBuffer* reader,
   reader->AdvanceRead((count - 4) * sizeof(uint32_t));
 
   IssueSwap(frontbuffer_ptr, frontbuffer_width, frontbuffer_height);
+  EndWaitRegMemFrame();
 
   ++counter_;
   return true;
@@ -945,13 +1092,19 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingBuffer* reader,
   uint32_t ref = reader->ReadAndSwap<uint32_t>();
   uint32_t mask = reader->ReadAndSwap<uint32_t>();
   uint32_t wait = reader->ReadAndSwap<uint32_t>();
+  bool is_memory = (wait_info & 0x10) != 0;
+  auto endianness = xenos::Endian::kNone;
+  if (is_memory) {
+    endianness = static_cast<xenos::Endian>(poll_reg_addr & 0x3);
+    poll_reg_addr &= ~0x3;
+  }
+  uint64_t wait_start_ticks = 0;
+  bool watching = false;
   bool matched = false;
   do {
     uint32_t value;
-    if (wait_info & 0x10) {
+    if (is_memory) {
       // Memory.
-      auto endianness = static_cast<xenos::Endian>(poll_reg_addr & 0x3);
-      poll_reg_addr &= ~0x3;
       value = xe::load<uint32_t>(memory_->TranslatePhysical(poll_reg_addr));
       value = GpuSwap(value, endianness);
       trace_writer_.WriteMemoryRead(CpuToGpu(poll_reg_addr), 4);
@@ -991,20 +1144,41 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingBuffer* reader,
         break;
     }
     if (!matched) {
+      if (!wait_start_ticks) {
+        wait_start_ticks = Clock::QueryHostTickCount();
+        ++wait_reg_mem_count_;
+      }
       // Wait.
       if (wait >= 0x100) {
-        PrepareForWait();
+        if (!watching) {
+          // Check the value once more after starting to watch it, so a write
+          // done in between isn't missed.
+          WatchWaitRegMemLocation(is_memory, poll_reg_addr);
+          watching = true;
+          continue;
+        }
+        // Guest writes wake up the wait, the timeout (the guest's polling
+        // interval in 1/256 ms) is only a fallback for writes not done by the
+        // guest CPU, like by the host directly to guest memory. Without vsync,
+        // don't let those stall for whole milliseconds.
+        std::chrono::nanoseconds timeout = std::chrono::milliseconds(wait >> 8);
         if (!cvars::vsync) {
-          // User wants it fast and dangerous.
-          xe::threading::MaybeYield();
-        } else {
-          xe::threading::Sleep(std::chrono::milliseconds(wait / 0x100));
+          timeout = std::min<std::chrono::nanoseconds>(
+              timeout, std::chrono::microseconds(100));
+        }
+        PrepareForWait();
+        if (xe::threading::Wait(wait_reg_mem_event_.get(), false, timeout) ==
+            xe::threading::WaitResult::kTimeout) {
+          ++wait_reg_mem_timeout_count_;
         }
         xe::threading::SyncMemory();
         ReturnFromWait();
+        // Physical memory watches are one-shot.
+        watching = !is_memory;
 
         if (!worker_running_) {
           // Short-circuited exit.
+          UnwatchWaitRegMemLocation();
           return false;
         }
       } else {
@@ -1013,9 +1187,84 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingBuffer* reader,
     }
   } while (!matched);
 
+  if (wait_start_ticks) {
+    UnwatchWaitRegMemLocation();
+    wait_reg_mem_frame_ticks_ += Clock::QueryHostTickCount() - wait_start_ticks;
+  }
   return true;
 }
 
+void CommandProcessor::WatchWaitRegMemLocation(bool is_memory,
+                                               uint32_t address) {
+  if (is_memory) {
+    wait_reg_mem_physical_address_.store(address, std::memory_order_relaxed);
+    // Write-protects the page, the callback is invoked on the first write.
+    memory_->EnablePhysicalMemoryAccessCallbacks(address, 4, true, false);
+  } else {
+    wait_reg_mem_register_.store(address, std::memory_order_relaxed);
+    // Ordered with the load of the polled register value after this, see
+    // OnRegisterWrittenByGuest.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+}
+
+void CommandProcessor::UnwatchWaitRegMemLocation() {
+  // The page stays write-protected until the next write, which will only
+  // invoke the callback once more.
+  wait_reg_mem_physical_address_.store(UINT32_MAX, std::memory_order_relaxed);
+  wait_reg_mem_register_.store(UINT32_MAX, std::memory_order_relaxed);
+}
+
+std::pair<uint32_t, uint32_t>
+CommandProcessor::WaitRegMemInvalidationCallbackThunk(
+    void* context_ptr, uint32_t physical_address_start, uint32_t length,
+    bool exact_range) {
+  auto command_processor = reinterpret_cast<CommandProcessor*>(context_ptr);
+  uint32_t address = command_processor->wait_reg_mem_physical_address_.load(
+      std::memory_order_relaxed);
+  if (address == UINT32_MAX) {
+    return std::make_pair(uint32_t(0), UINT32_MAX);
+  }
+  if (address - physical_address_start < length) {
+    command_processor->wait_reg_mem_event_->Set();
+    return std::make_pair(uint32_t(0), UINT32_MAX);
+  }
+  // The heap may unprotect more than the written pages - keep the polled page
+  // protected so a write to it still wakes the waiter.
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  uint32_t page_start = address & ~(page_size - 1);
+  if (page_start < physical_address_start) {
+    uint32_t page_end = page_start + page_size;
+    return std::make_pair(page_end, uint32_t(0) - page_end);
+  }
+  return std::make_pair(uint32_t(0), page_start);
+}
+
+void CommandProcessor::EndWaitRegMemFrame() {
+  uint64_t frame_ticks = wait_reg_mem_frame_ticks_;
+  wait_reg_mem_frame_ticks_ = 0;
+  COUNT_profile_set("gpu/wait_reg_mem_us",
+                    frame_ticks * 1000000 / Clock::QueryHostTickFrequency());
+  wait_reg_mem_total_ticks_ += frame_ticks;
+  wait_reg_mem_max_frame_ticks_ =
+      std::max(wait_reg_mem_max_frame_ticks_, frame_ticks);
+  ++wait_reg_mem_frame_count_;
+}
+
+void CommandProcessor::LogWaitRegMemStats() {
+  if (!wait_reg_mem_count_ || !wait_reg_mem_frame_count_) {
+    return;
+  }
+  double ms_per_tick = 1000.0 / double(Clock::QueryHostTickFrequency());
+  XELOGI(
+      "WAIT_REG_MEM: {} waits ({} timed out) over {} frames, {:.3f}ms per "
+      "frame on average, {:.3f}ms at most",
+      wait_reg_mem_count_, wait_reg_mem_timeout_count_,
+      wait_reg_mem_frame_count_,
+      wait_reg_mem_total_ticks_ * ms_per_tick / wait_reg_mem_frame_count_,
+      wait_reg_mem_max_frame_ticks_ * ms_per_tick);
+}
+
 bool CommandProcessor::ExecutePacketType3_REG_RMW(RingBuffer* reader,
                                                   uint32_t packet,
                                                   uint32_t count) {
@@ -1432,10 +1681,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT(RingBuffer* reader,
       reader->AdvanceRead((count - 1) * sizeof(uint32_t));
       return true;
   }
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->ReadAndSwap<uint32_t>();
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -1444,10 +1690,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT2(RingBuffer* reader,
                                                         uint32_t count) {
   uint32_t offset_type = reader->ReadAndSwap<uint32_t>();
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->ReadAndSwap<uint32_t>();
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -1483,11 +1726,10 @@ bool CommandProcessor::ExecutePacketType3_LOAD_ALU_CONSTANT(RingBuffer* reader,
       return true;
   }
   trace_writer_.WriteMemoryRead(CpuToGpu(address), size_dwords * 4);
-  for (uint32_t n = 0; n < size_dwords; n++, index++) {
-    uint32_t data = xe::load_and_swap<uint32_t>(
-        memory_->TranslatePhysical(address + n * 4));
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromMem(
+      index,
+      reinterpret_cast<const uint32_t*>(memory_->TranslatePhysical(address)),
+      size_dwords);
   return true;
 }
 
@@ -1495,10 +1737,7 @@ bool CommandProcessor::ExecutePacketType3_SET_SHADER_CONSTANTS(
     RingBuffer* reader, uint32_t packet, uint32_t count) {
   uint32_t offset_type = reader->ReadAndSwap<uint32_t>();
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->ReadAndSwap<uint32_t>();
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -11,14 +11,17 @@
 #define XENIA_GPU_COMMAND_PROCESSOR_H_
 
 #include <atomic>
+#include <chrono>
 #include <cstring>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "xenia/base/math.h"
 #include "xenia/base/ring_buffer.h"
 #include "xenia/base/threading.h"
 #include "xenia/gpu/register_file.h"
@@ -128,6 +131,9 @@ class CommandProcessor {
   void EnableReadPointerWriteBack(uint32_t ptr, uint32_t block_size_log2);
 
   void UpdateWritePointer(uint32_t value);
+  // Called when the guest CPU writes a register, to wake up WAIT_REG_MEM
+  // polling it.
+  void OnRegisterWrittenByGuest(uint32_t index);
 
   void ExecutePacket(uint32_t ptr, uint32_t count);
 
@@ -151,7 +157,64 @@ class CommandProcessor {
   virtual bool SetupContext() = 0;
   virtual void ShutdownContext() = 0;
 
+  // The slow path of register writes, for registers with side effects (see
+  // SetRegisterWriteSideEffects).
   virtual void WriteRegister(uint32_t index, uint32_t value);
+  // Writes a register from a packet, going through WriteRegister only if
+  // writing it has side effects.
+  void WriteRegisterFromPacket(uint32_t index, uint32_t value) {
+    if (index < RegisterFile::kRegisterCount &&
+        !(register_write_side_effects_[index >> 6] &
+          (uint64_t(1) << (index & 63)))) {
+      register_file_->values[index].u32 = value;
+      register_dirty_[index >> 6] |= uint64_t(1) << (index & 63);
+      return;
+    }
+    WriteRegister(index, value);
+  }
+  // Writes consecutive registers from big-endian guest data. Runs of registers
+  // without side effects are byte-swapped and copied directly to the register
+  // file, the rest go through WriteRegister.
+  void WriteRegistersFromMem(uint32_t first_index, const uint32_t* values,
+                             uint32_t count);
+  void WriteRegistersFromRing(RingBuffer* reader, uint32_t first_index,
+                              uint32_t count);
+  // Makes writes to the registers go through WriteRegister, for
+  // implementations overriding it. Unknown registers and registers with side
+  // effects in the CommandProcessor itself are always included.
+  void SetRegisterWriteSideEffects(uint32_t first_index, uint32_t count);
+
+  // Registers written since their dirty bits were last consumed, by both the
+  // bulk path and WriteRegister, so implementations can update the state
+  // derived from them when they need it rather than on every write or by
+  // comparing the values. Returns whether any register in the range was
+  // written, and clears their dirty bits.
+  bool ConsumeDirtyRegisters(uint32_t first_index, uint32_t count);
+  // Calls the function for each dirty register in the range, and clears their
+  // dirty bits.
+  template <typename Function>
+  void ConsumeDirtyRegisters(uint32_t first_index, uint32_t count,
+                             Function&& function) {
+    if (!count) {
+      return;
+    }
+    uint32_t last_index = first_index + count - 1;
+    for (uint32_t i = first_index >> 6; i <= last_index >> 6; ++i) {
+      uint64_t block = register_dirty_[i] &
+                       GetRegisterBitmapBlockMask(i, first_index, last_index);
+      register_dirty_[i] &= ~block;
+      uint32_t block_bit;
+      while (xe::bit_scan_forward(block, &block_bit)) {
+        block &= block - 1;
+        function(i * 64 + block_bit);
+      }
+    }
+  }
+  // Consumes the dirty bits of the float constants, returning a bit for each
+  // written constant (the 256 vertex shader constants and the 256 pixel shader
+  // ones), in the layout of Shader::ConstantRegisterMap::float_bitmap.
+  void ConsumeDirtyFloatConstants(uint64_t dirty_vertex_out[4],
+                                  uint64_t dirty_pixel_out[4]);
 
   const reg::DC_LUT_30_COLOR* gamma_ramp_256_entry_table() const {
     return gamma_ramp_256_entry_table_;
@@ -246,6 +309,17 @@ class CommandProcessor {
 
   virtual void InitializeTrace();
 
+  // Makes guest writes to the location polled by WAIT_REG_MEM set
+  // wait_reg_mem_event_. Physical memory is watched only until the first write
+  // to its page, so this needs to be done again before every wait.
+  void WatchWaitRegMemLocation(bool is_memory, uint32_t address);
+  void UnwatchWaitRegMemLocation();
+  static std::pair<uint32_t, uint32_t> WaitRegMemInvalidationCallbackThunk(
+      void* context_ptr, uint32_t physical_address_start, uint32_t length,
+      bool exact_range);
+  void EndWaitRegMemFrame();
+  void LogWaitRegMemStats();
+
   Memory* memory_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
   GraphicsSystem* graphics_system_ = nullptr;
@@ -281,6 +355,24 @@ class CommandProcessor {
   std::unique_ptr<xe::threading::Event> write_ptr_index_event_;
   std::atomic<uint32_t> write_ptr_index_;
 
+  // WAIT_REG_MEM blocks on this event rather than sleeping between polls. It's
+  // set when the guest writes the polled register, or the system page
+  // containing the polled physical address, which is watched through the
+  // physical memory invalidation callbacks. Only one of the locations is
+  // polled at a time, the other is UINT32_MAX.
+  std::unique_ptr<xe::threading::Event> wait_reg_mem_event_;
+  std::atomic<uint32_t> wait_reg_mem_register_{UINT32_MAX};
+  std::atomic<uint32_t> wait_reg_mem_physical_address_{UINT32_MAX};
+  void* wait_reg_mem_invalidation_callback_handle_ = nullptr;
+  // Host ticks spent in WAIT_REG_MEM during the current frame, and statistics
+  // for the whole session.
+  uint64_t wait_reg_mem_frame_ticks_ = 0;
+  uint64_t wait_reg_mem_total_ticks_ = 0;
+  uint64_t wait_reg_mem_max_frame_ticks_ = 0;
+  uint64_t wait_reg_mem_frame_count_ = 0;
+  uint64_t wait_reg_mem_count_ = 0;
+  uint64_t wait_reg_mem_timeout_count_ = 0;
+
   uint64_t bin_select_ = 0xFFFFFFFFull;
   uint64_t bin_mask_ = 0xFFFFFFFFull;
 
@@ -295,6 +387,26 @@ class CommandProcessor {
   SwapPostEffect swap_post_effect_actual_ = SwapPostEffect::kNone;
 
  private:
+  static constexpr uint32_t kRegisterBitmapBlockCount =
+      uint32_t((RegisterFile::kRegisterCount + 63) / 64);
+  // The bits of the registers in [first_index, last_index] within a block.
+  static uint64_t GetRegisterBitmapBlockMask(uint32_t block_index,
+                                             uint32_t first_index,
+                                             uint32_t last_index) {
+    uint64_t mask = ~uint64_t(0);
+    if (block_index == first_index >> 6) {
+      mask &= ~uint64_t(0) << (first_index & 63);
+    }
+    if (block_index == last_index >> 6) {
+      mask &= ~uint64_t(0) >> (63 - (last_index & 63));
+    }
+    return mask;
+  }
+
+  // Registers which must be written through WriteRegister.
+  uint64_t register_write_side_effects_[kRegisterBitmapBlockCount] = {};
+  uint64_t register_dirty_[kRegisterBitmapBlockCount] = {};
+
   reg::DC_LUT_30_COLOR gamma_ramp_256_entry_table_[256] = {};
   reg::DC_LUT_PWL_DATA gamma_ramp_pwl_rgb_[128][3] = {};
   uint32_t gamma_ramp_rw_component_ = 0;
@@ -1689,37 +1689,46 @@ void D3D12CommandProcessor::ShutdownContext() {
   CommandProcessor::ShutdownContext();
 }
 
-void D3D12CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
-  CommandProcessor::WriteRegister(index, value);
-
-  if (index >= XE_GPU_REG_SHADER_CONSTANT_000_X &&
-      index <= XE_GPU_REG_SHADER_CONSTANT_511_W) {
-    if (frame_open_) {
-      uint32_t float_constant_index =
-          (index - XE_GPU_REG_SHADER_CONSTANT_000_X) >> 2;
-      if (float_constant_index >= 256) {
-        float_constant_index -= 256;
-        if (current_float_constant_map_pixel_[float_constant_index >> 6] &
-            (1ull << (float_constant_index & 63))) {
-          cbuffer_binding_float_pixel_.up_to_date = false;
-        }
-      } else {
-        if (current_float_constant_map_vertex_[float_constant_index >> 6] &
-            (1ull << (float_constant_index & 63))) {
-          cbuffer_binding_float_vertex_.up_to_date = false;
-        }
-      }
+void D3D12CommandProcessor::ConsumeDirtyShaderConstants() {
+  uint64_t float_constants_dirty_vertex[4], float_constants_dirty_pixel[4];
+  ConsumeDirtyFloatConstants(float_constants_dirty_vertex,
+                             float_constants_dirty_pixel);
+  if (frame_open_) {
+    uint64_t float_constants_used_dirty_vertex = 0;
+    uint64_t float_constants_used_dirty_pixel = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+      float_constants_used_dirty_vertex |=
+          float_constants_dirty_vertex[i] &
+          current_float_constant_map_vertex_[i];
+      float_constants_used_dirty_pixel |= float_constants_dirty_pixel[i] &
+                                          current_float_constant_map_pixel_[i];
+    }
+    if (float_constants_used_dirty_vertex) {
+      cbuffer_binding_float_vertex_.up_to_date = false;
     }
-  } else if (index >= XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031 &&
-             index <= XE_GPU_REG_SHADER_CONSTANT_LOOP_31) {
+    if (float_constants_used_dirty_pixel) {
+      cbuffer_binding_float_pixel_.up_to_date = false;
+    }
+  }
+  if (ConsumeDirtyRegisters(XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031,
+                            XE_GPU_REG_SHADER_CONSTANT_LOOP_31 -
+                                XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031 + 1)) {
     cbuffer_binding_bool_loop_.up_to_date = false;
-  } else if (index >= XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0 &&
-             index <= XE_GPU_REG_SHADER_CONSTANT_FETCH_31_5) {
+  }
+  bool fetch_constants_dirty = false;
+  ConsumeDirtyRegisters(
+      XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0,
+      XE_GPU_REG_SHADER_CONSTANT_FETCH_31_5 -
+          XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0 + 1,
+      [&](uint32_t index) {
+        fetch_constants_dirty = true;
+        if (texture_cache_ != nullptr) {
+          texture_cache_->TextureFetchConstantWritten(
+              (index - XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0) / 6);
+        }
+      });
+  if (fetch_constants_dirty) {
     cbuffer_binding_fetch_.up_to_date = false;
-    if (texture_cache_ != nullptr) {
-      texture_cache_->TextureFetchConstantWritten(
-          (index - XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0) / 6);
-    }
   }
 }
 
@@ -2111,6 +2120,8 @@ bool D3D12CommandProcessor::IssueDraw(xenos::PrimitiveType primitive_type,
     return IssueCopy();
   }
 
+  ConsumeDirtyShaderConstants();
+
   if (regs.Get<reg::RB_SURFACE_INFO>().surface_pitch == 0) {
     // Doesn't actually draw.
     // TODO(Triang3l): Do something so memexport still works in this case maybe?
@@ -0,0 +1,44 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/console_app_main.h"
+#include "xenia/base/logging.h"
+#include "xenia/gpu/null/null_graphics_system.h"
+#include "xenia/gpu/trace_dump.h"
+
+namespace xe {
+namespace gpu {
+namespace null {
+
+// Plays traces without drawing anything, for measuring the overhead of the
+// command processor itself (with --trace_dump_replay_count).
+class NullTraceDump : public TraceDump {
+ public:
+  std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() override {
+    return std::unique_ptr<gpu::GraphicsSystem>(new NullGraphicsSystem());
+  }
+
+  void BeginHostCapture() override {}
+  void EndHostCapture() override {}
+
+  bool HasGuestOutput() const override { return false; }
+};
+
+int trace_dump_main(const std::vector<std::string>& args) {
+  NullTraceDump trace_dump;
+  return trace_dump.Main(args);
+}
+
+}  // namespace null
+}  // namespace gpu
+}  // namespace xe
+
+XE_DEFINE_CONSOLE_APP("xenia-gpu-null-trace-dump",
+                      xe::gpu::null::trace_dump_main, "some.trace",
+                      "target_trace_file");
@@ -0,0 +1,15 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+test_suite("xenia-gpu-tests", project_root, ".", {
+  links = {
+    "dxbc",
+    "fmt",
+    "glslang-spirv",
+    "snappy",
+    "xenia-base",
+    "xenia-gpu",
+    "xenia-ui",
+    "xxhash",
+  },
+})
@@ -0,0 +1,324 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "xenia/gpu/texture_conversion.h"
+#include "xenia/gpu/texture_info.h"
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace gpu {
+namespace test {
+
+using namespace texture_conversion;
+
+// A format to describe blocks of the size to Untile.
+const FormatInfo* GetFormatInfoForBlockSize(uint32_t bytes_per_block) {
+  switch (bytes_per_block) {
+    case 1:
+      return FormatInfo::Get(xenos::TextureFormat::k_8);
+    case 2:
+      return FormatInfo::Get(xenos::TextureFormat::k_8_8);
+    case 4:
+      return FormatInfo::Get(xenos::TextureFormat::k_8_8_8_8);
+    case 8:
+      return FormatInfo::Get(xenos::TextureFormat::k_16_16_16_16);
+    default:
+      return FormatInfo::Get(xenos::TextureFormat::k_32_32_32_32_FLOAT);
+  }
+}
+
+std::vector<uint8_t> CreateTiledInput(uint32_t pitch, uint32_t height,
+                                      uint32_t bytes_per_block) {
+  std::vector<uint8_t> input(size_t(pitch) * xe::round_up(height, 32u) *
+                             bytes_per_block);
+  std::mt19937 random(bytes_per_block);
+  for (uint8_t& byte : input) {
+    byte = uint8_t(random());
+  }
+  return input;
+}
+
+// Untiles with the scalar per-block path.
+std::vector<uint8_t> UntileScalar(const std::vector<uint8_t>& input,
+                                  const UntileBlocksInfo& untile_info) {
+  const FormatInfo* format_info =
+      GetFormatInfoForBlockSize(untile_info.input_bytes_per_block);
+  std::vector<uint8_t> output(size_t(untile_info.width) * untile_info.height *
+                              untile_info.input_bytes_per_block);
+  UntileInfo scalar_info = {};
+  scalar_info.offset_x = untile_info.offset_x;
+  scalar_info.offset_y = untile_info.offset_y;
+  scalar_info.width = untile_info.width;
+  scalar_info.height = untile_info.height;
+  scalar_info.input_pitch = untile_info.input_pitch;
+  scalar_info.output_pitch = untile_info.width;
+  scalar_info.input_format_info = format_info;
+  scalar_info.output_format_info = format_info;
+  xenos::Endian endian = untile_info.endian;
+  scalar_info.copy_callback = [endian](void* output, const void* input,
+                                       size_t length) {
+    CopySwapBlock(endian, output, input, length);
+  };
+  Untile(output.data(), input.data(), &scalar_info);
+  return output;
+}
+
+TEST_CASE("Untile blocks", "[texture_conversion]") {
+  const uint32_t pitch = 96;
+  const uint32_t height = 80;
+  struct Region {
+    uint32_t offset_x, offset_y, width, height;
+  };
+  const Region regions[] = {
+      {0, 0, pitch, height},
+      {0, 0, 1, 1},
+      {3, 5, 61, 70},
+      {33, 31, 40, 2},
+      {17, 40, 79, 40},
+  };
+  for (uint32_t bytes_per_block : {1, 2, 4, 8, 16}) {
+    std::vector<uint8_t> input =
+        CreateTiledInput(pitch, height, bytes_per_block);
+    for (xenos::Endian endian :
+         {xenos::Endian::kNone, xenos::Endian::k8in16, xenos::Endian::k8in32,
+          xenos::Endian::k16in32}) {
+      // Swapping must be within blocks.
+      if ((endian == xenos::Endian::k8in16 && bytes_per_block < 2) ||
+          ((endian == xenos::Endian::k8in32 ||
+            endian == xenos::Endian::k16in32) &&
+           bytes_per_block < 4)) {
+        continue;
+      }
+      for (const Region& region : regions) {
+        for (uint32_t thread_count : {1, 3}) {
+          UntileBlocksInfo untile_info = {};
+          untile_info.offset_x = region.offset_x;
+          untile_info.offset_y = region.offset_y;
+          untile_info.width = region.width;
+          untile_info.height = region.height;
+          untile_info.input_pitch = pitch;
+          untile_info.input_bytes_per_block = bytes_per_block;
+          untile_info.output_pitch = region.width * bytes_per_block;
+          untile_info.endian = endian;
+          untile_info.conversion = UntileConversion::kNone;
+          untile_info.thread_count = thread_count;
+          std::vector<uint8_t> output(size_t(untile_info.output_pitch) *
+                                      region.height);
+          UntileBlocks(output.data(), input.data(), untile_info);
+          INFO("Bytes per block " << bytes_per_block << ", endian "
+                                  << uint32_t(endian) << ", region "
+                                  << region.offset_x << ", "
+                                  << region.offset_y << ", " << region.width
+                                  << "x" << region.height << ", threads "
+                                  << thread_count);
+          REQUIRE(output == UntileScalar(input, untile_info));
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Tile blocks", "[texture_conversion]") {
+  const uint32_t pitch = 96;
+  const uint32_t height = 80;
+  struct Region {
+    uint32_t offset_x, offset_y, width, height;
+  };
+  const Region regions[] = {
+      {0, 0, pitch, height},
+      {3, 5, 61, 70},
+      {17, 40, 79, 40},
+  };
+  for (uint32_t bytes_per_block : {1, 2, 4, 8, 16}) {
+    std::vector<uint8_t> background =
+        CreateTiledInput(pitch, height, bytes_per_block);
+    for (xenos::Endian endian : {xenos::Endian::kNone, xenos::Endian::k8in16,
+                                 xenos::Endian::k8in32}) {
+      // Swapping must be within blocks.
+      if ((endian == xenos::Endian::k8in16 && bytes_per_block < 2) ||
+          (endian == xenos::Endian::k8in32 && bytes_per_block < 4)) {
+        continue;
+      }
+      for (const Region& region : regions) {
+        UntileBlocksInfo untile_info = {};
+        untile_info.offset_x = region.offset_x;
+        untile_info.offset_y = region.offset_y;
+        untile_info.width = region.width;
+        untile_info.height = region.height;
+        untile_info.input_pitch = pitch;
+        untile_info.input_bytes_per_block = bytes_per_block;
+        untile_info.output_pitch = region.width * bytes_per_block;
+        untile_info.endian = endian;
+        untile_info.conversion = UntileConversion::kNone;
+        TileBlocksInfo tile_info = {};
+        tile_info.offset_x = region.offset_x;
+        tile_info.offset_y = region.offset_y;
+        tile_info.width = region.width;
+        tile_info.height = region.height;
+        tile_info.input_pitch = region.width * bytes_per_block;
+        tile_info.output_pitch = pitch;
+        tile_info.bytes_per_block = bytes_per_block;
+        tile_info.endian = endian;
+        tile_info.thread_count = 3;
+        INFO("Bytes per block " << bytes_per_block << ", endian "
+                                << uint32_t(endian) << ", region "
+                                << region.offset_x << ", " << region.offset_y
+                                << ", " << region.width << "x"
+                                << region.height);
+
+        // Tiling the untiled region back must not change anything around it.
+        std::vector<uint8_t> tiled = background;
+        TileBlocks(tiled.data(), UntileScalar(background, untile_info).data(),
+                   tile_info);
+        REQUIRE(tiled == background);
+
+        std::vector<uint8_t> linear(size_t(tile_info.input_pitch) *
+                                    region.height);
+        std::mt19937 random(region.width);
+        for (uint8_t& byte : linear) {
+          byte = uint8_t(random());
+        }
+        TileBlocks(tiled.data(), linear.data(), tile_info);
+        REQUIRE(UntileScalar(tiled, untile_info) == linear);
+      }
+    }
+  }
+}
+
+TEST_CASE("Untile blocks with conversion", "[texture_conversion]") {
+  const uint32_t pitch = 64;
+  const uint32_t height = 64;
+  struct Conversion {
+    UntileConversion conversion;
+    uint32_t input_bytes_per_block;
+    // Bytes per block in each output row, and output rows per block.
+    uint32_t output_bytes_per_block;
+    uint32_t output_rows_per_block;
+    void (*convert_block)(xenos::Endian endian, void* output,
+                          const void* input, size_t length);
+  };
+  const Conversion conversions[] = {
+      {UntileConversion::kCTX1ToR8G8, 8, 4 * 2, 4, ConvertTexelCTX1ToR8G8},
+      {UntileConversion::kDXT3AToDXT3, 8, 16, 1, ConvertTexelDXT3AToDXT3},
+      {UntileConversion::kDXNToR8G8, 16, 4 * 2, 4, ConvertTexelDXNToR8G8},
+  };
+  for (const Conversion& conversion : conversions) {
+    std::vector<uint8_t> input =
+        CreateTiledInput(pitch, height, conversion.input_bytes_per_block);
+    for (xenos::Endian endian : {xenos::Endian::kNone, xenos::Endian::k8in16,
+                                 xenos::Endian::k8in32}) {
+      UntileBlocksInfo untile_info = {};
+      untile_info.offset_x = 7;
+      untile_info.offset_y = 9;
+      untile_info.width = 50;
+      untile_info.height = 40;
+      untile_info.input_pitch = pitch;
+      untile_info.input_bytes_per_block = conversion.input_bytes_per_block;
+      untile_info.output_pitch =
+          untile_info.width * conversion.output_bytes_per_block;
+      uint32_t output_block_row_pitch =
+          untile_info.output_pitch * conversion.output_rows_per_block;
+      untile_info.endian = endian;
+      untile_info.conversion = conversion.conversion;
+      untile_info.thread_count = 2;
+      std::vector<uint8_t> output(size_t(output_block_row_pitch) *
+                                  untile_info.height);
+      UntileBlocks(output.data(), input.data(), untile_info);
+
+      // Untile with the scalar path, then convert block by block.
+      std::vector<uint8_t> untiled = UntileScalar(input, untile_info);
+      std::vector<uint8_t> reference(output.size());
+      for (uint32_t y = 0; y < untile_info.height; ++y) {
+        for (uint32_t x = 0; x < untile_info.width; ++x) {
+          conversion.convert_block(
+              xenos::Endian::kNone,
+              &reference[size_t(y) * output_block_row_pitch +
+                         x * conversion.output_bytes_per_block],
+              &untiled[(size_t(y) * untile_info.width + x) *
+                       conversion.input_bytes_per_block],
+              untile_info.output_pitch);
+        }
+      }
+      INFO("Conversion " << uint32_t(conversion.conversion) << ", endian "
+                         << uint32_t(endian));
+      REQUIRE(output == reference);
+    }
+  }
+}
+
+TEST_CASE("Convert DXN to R8G8", "[texture_conversion]") {
+  // R - 8-step mode, from 0xFF to 0x00, all texels with the code 2 (6:1).
+  // G - 6-step mode, from 0x00 to 0xFF, codes 0, 1, 2, ..., 7, 0, 1, ....
+  const uint8_t block[16] = {
+      0xFF, 0x00, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49,
+      0x00, 0xFF, 0x88, 0xC6, 0xFA, 0x88, 0xC6, 0xFA,
+  };
+  const uint8_t green[8] = {0x00, 0xFF, 0x33, 0x66, 0x99, 0xCC, 0x00, 0xFF};
+  uint8_t texels[4][4 * 2];
+  ConvertTexelDXNToR8G8(xenos::Endian::kNone, texels, block, sizeof(texels[0]));
+  for (uint32_t i = 0; i < 16; ++i) {
+    REQUIRE(texels[i >> 2][(i & 3) * 2] == 0xFF * 6 / 7);
+    REQUIRE(texels[i >> 2][(i & 3) * 2 + 1] == green[i & 7]);
+  }
+}
+
+TEST_CASE("Untile blocks throughput", "[.benchmark][texture_conversion]") {
+  const uint32_t pitch = 2048;
+  const uint32_t height = 2048;
+  const uint32_t bytes_per_block = 4;
+  const uint32_t iterations = 16;
+  std::vector<uint8_t> input =
+      CreateTiledInput(pitch, height, bytes_per_block);
+  std::vector<uint8_t> output(input.size());
+  double gigabytes = double(input.size()) * iterations / 1e9;
+
+  UntileBlocksInfo untile_info = {};
+  untile_info.width = pitch;
+  untile_info.height = height;
+  untile_info.input_pitch = pitch;
+  untile_info.input_bytes_per_block = bytes_per_block;
+  untile_info.output_pitch = pitch * bytes_per_block;
+  untile_info.endian = xenos::Endian::k8in32;
+  untile_info.conversion = UntileConversion::kNone;
+
+  using Clock = std::chrono::steady_clock;
+  {
+    auto start_time = Clock::now();
+    for (uint32_t i = 0; i < iterations; ++i) {
+      REQUIRE(UntileScalar(input, untile_info).size() == output.size());
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start_time;
+    fmt::print("Untile (scalar): {:.2f} GB/s\n", gigabytes / elapsed.count());
+  }
+  for (uint32_t thread_count :
+       {uint32_t(1), std::max(uint32_t(1),
+                              uint32_t(std::thread::hardware_concurrency()))}) {
+    untile_info.thread_count = thread_count;
+    auto start_time = Clock::now();
+    for (uint32_t i = 0; i < iterations; ++i) {
+      UntileBlocks(output.data(), input.data(), untile_info);
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start_time;
+    fmt::print("UntileBlocks, {} thread(s): {:.2f} GB/s\n", thread_count,
+               gigabytes / elapsed.count());
+  }
+}
+
+}  // namespace test
+}  // namespace gpu
+}  // namespace xe
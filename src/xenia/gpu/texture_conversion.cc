@@ -13,13 +13,20 @@
 #include <cmath>
 #include <cstring>
 #include <functional>
+#include <thread>
+#include <vector>
 
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/platform.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/xxhash.h"
 
+#if XE_ARCH_ARM64
+#include <arm_neon.h>
+#endif
+
 namespace xe {
 namespace gpu {
 namespace texture_conversion {
@@ -37,7 +44,7 @@ void CopySwapBlock(xenos::Endian endian, void* output, const void* input,
       break;
     case xenos::Endian::k16in32:  // Swap high and low 16 bits within a 32 bit
                                   // word
-      xe::copy_and_swap_16_in_32_unaligned(output, input, length);
+      xe::copy_and_swap_16_in_32_unaligned(output, input, length / 4);
       break;
     default:
     case xenos::Endian::kNone:
@@ -46,8 +53,9 @@ void CopySwapBlock(xenos::Endian endian, void* output, const void* input,
   }
 }
 
-void ConvertTexelCTX1ToR8G8(xenos::Endian endian, void* output,
-                            const void* input, size_t length) {
+// Decompresses a CTX1 block, already endian-swapped, to 4x4 R8G8 texels.
+static void DecompressCTX1Block(const uint8_t* input, uint8_t* output,
+                                size_t output_pitch) {
   // https://fileadmin.cs.lth.se/cs/Personal/Michael_Doggett/talks/unc-xenos-doggett.pdf
   // (R is in the higher bits, according to how this format is used in
   //  4D5307E6).
@@ -59,9 +67,7 @@ void ConvertTexelCTX1ToR8G8(xenos::Endian endian, void* output,
     };
   } block;
   static_assert(sizeof(block) == 8, "CTX1 block mismatch");
-
-  const uint32_t bytes_per_block = 8;
-  CopySwapBlock(endian, block.data, input, bytes_per_block);
+  std::memcpy(block.data, input, sizeof(block));
 
   uint8_t cr[4] = {
       block.r0, block.r1,
@@ -72,16 +78,55 @@ void ConvertTexelCTX1ToR8G8(xenos::Endian endian, void* output,
       static_cast<uint8_t>(2.f / 3.f * block.g0 + 1.f / 3.f * block.g1),
       static_cast<uint8_t>(1.f / 3.f * block.g0 + 2.f / 3.f * block.g1)};
 
-  auto output_bytes = static_cast<uint8_t*>(output);
   for (uint32_t oy = 0; oy < 4; ++oy) {
     for (uint32_t ox = 0; ox < 4; ++ox) {
       uint8_t xx = (block.xx >> (((ox + (oy * 4)) * 2))) & 3;
-      output_bytes[(oy * length) + (ox * 2) + 0] = cr[xx];
-      output_bytes[(oy * length) + (ox * 2) + 1] = cg[xx];
+      output[(oy * output_pitch) + (ox * 2) + 0] = cr[xx];
+      output[(oy * output_pitch) + (ox * 2) + 1] = cg[xx];
+    }
+  }
+}
+
+// Decompresses a DXT5A-like half of a DXN block, already endian-swapped, to
+// every second byte of 4x4 R8G8 texels, like XeDXT5RowToA8In16 in the texture
+// load shaders.
+static void DecompressDXNHalfBlock(const uint8_t* input, uint8_t* output,
+                                   size_t output_pitch) {
+  uint32_t end_0 = input[0];
+  uint32_t end_1 = input[1];
+  uint8_t palette[8];
+  palette[0] = uint8_t(end_0);
+  palette[1] = uint8_t(end_1);
+  if (end_0 > end_1) {
+    for (uint32_t i = 2; i < 8; ++i) {
+      palette[i] = uint8_t(((8 - i) * end_0 + (i - 1) * end_1) / 7);
+    }
+  } else {
+    for (uint32_t i = 2; i < 6; ++i) {
+      palette[i] = uint8_t(((6 - i) * end_0 + (i - 1) * end_1) / 5);
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+  uint64_t codes = 0;
+  for (uint32_t i = 0; i < 6; ++i) {
+    codes |= uint64_t(input[2 + i]) << (i * 8);
+  }
+  for (uint32_t oy = 0; oy < 4; ++oy) {
+    for (uint32_t ox = 0; ox < 4; ++ox) {
+      output[(oy * output_pitch) + (ox * 2)] =
+          palette[(codes >> ((ox + (oy * 4)) * 3)) & 7];
     }
   }
 }
 
+void ConvertTexelCTX1ToR8G8(xenos::Endian endian, void* output,
+                            const void* input, size_t length) {
+  uint8_t block[8];
+  CopySwapBlock(endian, block, input, sizeof(block));
+  DecompressCTX1Block(block, static_cast<uint8_t*>(output), length);
+}
+
 void ConvertTexelDXT3AToDXT3(xenos::Endian endian, void* output,
                              const void* input, size_t length) {
   const uint32_t bytes_per_block = 16;
@@ -90,6 +135,16 @@ void ConvertTexelDXT3AToDXT3(xenos::Endian endian, void* output,
   std::memset(&output_bytes[8], 0, 8);
 }
 
+void ConvertTexelDXNToR8G8(xenos::Endian endian, void* output,
+                           const void* input, size_t length) {
+  // The first half is R, the second is G.
+  uint8_t block[16];
+  CopySwapBlock(endian, block, input, sizeof(block));
+  auto output_bytes = static_cast<uint8_t*>(output);
+  DecompressDXNHalfBlock(&block[0], &output_bytes[0], length);
+  DecompressDXNHalfBlock(&block[8], &output_bytes[1], length);
+}
+
 // https://github.com/BinomialLLC/crunch/blob/ea9b8d8c00c8329791256adafa8cf11e4e7942a2/inc/crn_decomp.h#L4108
 static uint32_t TiledOffset2DRow(uint32_t y, uint32_t width,
                                  uint32_t log2_bpp) {
@@ -153,6 +208,360 @@ void Untile(uint8_t* output_buffer, const uint8_t* input_buffer,
   }
 }
 
+// Copies 16 bytes with the endian swap.
+template <xenos::Endian endian>
+static inline void CopySwap16(uint8_t* output, const uint8_t* input) {
+#if XE_ARCH_AMD64
+  __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+  switch (endian) {
+    case xenos::Endian::k8in16:
+      data = _mm_shuffle_epi8(data, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8,
+                                                  11, 10, 13, 12, 15, 14));
+      break;
+    case xenos::Endian::k8in32:
+      data = _mm_shuffle_epi8(data, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11,
+                                                  10, 9, 8, 15, 14, 13, 12));
+      break;
+    case xenos::Endian::k16in32:
+      data = _mm_shuffle_epi8(data, _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10,
+                                                  11, 8, 9, 14, 15, 12, 13));
+      break;
+    default:
+      break;
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(output), data);
+#elif XE_ARCH_ARM64
+  uint8x16_t data = vld1q_u8(input);
+  switch (endian) {
+    case xenos::Endian::k8in16:
+      data = vqtbl1q_u8(data,
+                        vcombine_u8(vcreate_u8(UINT64_C(0x0607040502030001)),
+                                    vcreate_u8(UINT64_C(0x0E0F0C0D0A0B0809))));
+      break;
+    case xenos::Endian::k8in32:
+      data = vqtbl1q_u8(data,
+                        vcombine_u8(vcreate_u8(UINT64_C(0x0405060700010203)),
+                                    vcreate_u8(UINT64_C(0x0C0D0E0F08090A0B))));
+      break;
+    case xenos::Endian::k16in32:
+      data = vqtbl1q_u8(data,
+                        vcombine_u8(vcreate_u8(UINT64_C(0x0504070601000302)),
+                                    vcreate_u8(UINT64_C(0x0D0C0F0E09080B0A))));
+      break;
+    default:
+      break;
+  }
+  vst1q_u8(output, data);
+#else
+  CopySwapBlock(endian, output, input, 16);
+#endif
+}
+
+// Copies 8 bytes with the endian swap.
+template <xenos::Endian endian>
+static inline void CopySwap8(uint8_t* output, const uint8_t* input) {
+  uint64_t data;
+  std::memcpy(&data, input, sizeof(data));
+  switch (endian) {
+    case xenos::Endian::k8in16:
+      data = ((data & UINT64_C(0x00FF00FF00FF00FF)) << 8) |
+             ((data >> 8) & UINT64_C(0x00FF00FF00FF00FF));
+      break;
+    case xenos::Endian::k8in32:
+      data = xe::byte_swap(data);
+      data = (data << 32) | (data >> 32);
+      break;
+    case xenos::Endian::k16in32:
+      data = ((data & UINT64_C(0x0000FFFF0000FFFF)) << 16) |
+             ((data >> 16) & UINT64_C(0x0000FFFF0000FFFF));
+      break;
+    default:
+      break;
+  }
+  std::memcpy(output, &data, sizeof(data));
+}
+
+// Converts blocks contiguous in the tiled input. Runs are at most 16 bytes
+// long, and only shorter at the edges of the region or for 8bpb formats.
+template <xenos::Endian endian, UntileConversion conversion>
+static inline void UntileRun(uint8_t* output, const uint8_t* input,
+                             uint32_t block_count, uint32_t bytes_per_block,
+                             uint32_t output_pitch) {
+  uint32_t length = block_count * bytes_per_block;
+  uint8_t swapped[16];
+  uint8_t* swap_output =
+      conversion == UntileConversion::kNone ? output : swapped;
+  if (length == 16) {
+    CopySwap16<endian>(swap_output, input);
+  } else if (length == 8) {
+    CopySwap8<endian>(swap_output, input);
+  } else {
+    CopySwapBlock(endian, swap_output, input, length);
+  }
+  if (conversion == UntileConversion::kNone) {
+    return;
+  }
+  for (uint32_t i = 0; i < block_count; ++i) {
+    const uint8_t* block = swapped + i * bytes_per_block;
+    switch (conversion) {
+      case UntileConversion::kCTX1ToR8G8:
+        DecompressCTX1Block(block, output + i * 8, output_pitch);
+        break;
+      case UntileConversion::kDXT3AToDXT3:
+        std::memcpy(output + i * 16, block, 8);
+        std::memset(output + i * 16 + 8, 0, 8);
+        break;
+      case UntileConversion::kDXNToR8G8:
+        DecompressDXNHalfBlock(block, output + i * 8, output_pitch);
+        DecompressDXNHalfBlock(block + 8, output + i * 8 + 1, output_pitch);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Untiles the rows [row_begin, row_end) of the region.
+template <xenos::Endian endian, UntileConversion conversion>
+static void UntileBlockRows(uint8_t* output_buffer,
+                            const uint8_t* input_buffer,
+                            const UntileBlocksInfo& untile_info,
+                            uint32_t row_begin, uint32_t row_end) {
+  uint32_t bytes_per_block = untile_info.input_bytes_per_block;
+  uint32_t log2_bpp = (bytes_per_block / 4) +
+                      ((bytes_per_block / 2) >> (bytes_per_block / 4));
+  // Blocks are stored in runs of 16 bytes, or 8 for 8bpb.
+  uint32_t run_length = std::min(uint32_t(8), uint32_t(16) >> log2_bpp);
+  uint32_t output_block_size;
+  uint32_t output_row_pitch;
+  switch (conversion) {
+    case UntileConversion::kCTX1ToR8G8:
+    case UntileConversion::kDXNToR8G8:
+      output_block_size = 4 * 2;
+      output_row_pitch = untile_info.output_pitch * 4;
+      break;
+    case UntileConversion::kDXT3AToDXT3:
+      output_block_size = 16;
+      output_row_pitch = untile_info.output_pitch;
+      break;
+    default:
+      output_block_size = bytes_per_block;
+      output_row_pitch = untile_info.output_pitch;
+      break;
+  }
+
+  uint32_t x_begin = untile_info.offset_x;
+  uint32_t x_end = untile_info.offset_x + untile_info.width;
+  uint32_t y_begin = untile_info.offset_y + row_begin;
+  uint32_t y_end = untile_info.offset_y + row_end;
+  // Go through the input macro tile by macro tile, so all of its rows are
+  // copied while it's in the cache.
+  uint32_t row_offsets[32];
+  for (uint32_t band_y = y_begin & ~uint32_t(31); band_y < y_end;
+       band_y += 32) {
+    uint32_t band_y_begin = std::max(band_y, y_begin);
+    uint32_t band_y_end = std::min(band_y + 32, y_end);
+    for (uint32_t y = band_y_begin; y < band_y_end; ++y) {
+      row_offsets[y & 31] =
+          TiledOffset2DRow(y, untile_info.input_pitch, log2_bpp);
+    }
+    for (uint32_t tile_x = x_begin & ~uint32_t(31); tile_x < x_end;
+         tile_x += 32) {
+      uint32_t tile_x_begin = std::max(tile_x, x_begin);
+      uint32_t tile_x_end = std::min(tile_x + 32, x_end);
+      for (uint32_t y = band_y_begin; y < band_y_end; ++y) {
+        uint8_t* output_row =
+            output_buffer + size_t(y - untile_info.offset_y) * output_row_pitch;
+        uint32_t row_offset = row_offsets[y & 31];
+        for (uint32_t x = tile_x_begin; x < tile_x_end;) {
+          uint32_t block_count = std::min(
+              run_length - (x & (run_length - 1)), tile_x_end - x);
+          UntileRun<endian, conversion>(
+              output_row + size_t(x - x_begin) * output_block_size,
+              input_buffer + TiledOffset2DColumn(x, y, log2_bpp, row_offset),
+              block_count, bytes_per_block, untile_info.output_pitch);
+          x += block_count;
+        }
+      }
+    }
+  }
+}
+
+// Splits the rows [0, height) of a region starting at offset_y between the
+// threads at macro tile boundaries, and calls rows_function(row_begin,
+// row_end) for each part.
+template <typename RowsFunction>
+static void SplitBlockRows(uint32_t offset_y, uint32_t height,
+                           uint32_t thread_count,
+                           const RowsFunction& rows_function) {
+  uint32_t band_count = ((offset_y + height + 31) >> 5) - (offset_y >> 5);
+  thread_count = std::max(uint32_t(1), std::min(thread_count, band_count));
+  std::vector<std::thread> threads;
+  threads.reserve(thread_count - 1);
+  uint32_t row_begin = 0;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    uint32_t row_end = height;
+    if (i + 1 < thread_count) {
+      uint32_t band_end =
+          (offset_y >> 5) + band_count * (i + 1) / thread_count;
+      row_end = (band_end << 5) - offset_y;
+      threads.emplace_back(rows_function, row_begin, row_end);
+    } else {
+      rows_function(row_begin, row_end);
+    }
+    row_begin = row_end;
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+typedef void (*UntileBlockRowsFunction)(uint8_t* output_buffer,
+                                        const uint8_t* input_buffer,
+                                        const UntileBlocksInfo& untile_info,
+                                        uint32_t row_begin, uint32_t row_end);
+
+template <xenos::Endian endian>
+static UntileBlockRowsFunction GetUntileBlockRowsFunction(
+    UntileConversion conversion) {
+  switch (conversion) {
+    case UntileConversion::kCTX1ToR8G8:
+      return UntileBlockRows<endian, UntileConversion::kCTX1ToR8G8>;
+    case UntileConversion::kDXT3AToDXT3:
+      return UntileBlockRows<endian, UntileConversion::kDXT3AToDXT3>;
+    case UntileConversion::kDXNToR8G8:
+      return UntileBlockRows<endian, UntileConversion::kDXNToR8G8>;
+    default:
+      return UntileBlockRows<endian, UntileConversion::kNone>;
+  }
+}
+
+void UntileBlocks(uint8_t* output_buffer, const uint8_t* input_buffer,
+                  const UntileBlocksInfo& untile_info) {
+  SCOPE_profile_cpu_f("gpu");
+  assert_true(untile_info.input_bytes_per_block >= 1 &&
+              untile_info.input_bytes_per_block <= 16 &&
+              xe::is_pow2(untile_info.input_bytes_per_block));
+  assert_true(untile_info.conversion == UntileConversion::kNone ||
+              untile_info.input_bytes_per_block ==
+                  (untile_info.conversion == UntileConversion::kDXNToR8G8
+                       ? 16
+                       : 8));
+  if (!untile_info.width || !untile_info.height) {
+    return;
+  }
+
+  UntileBlockRowsFunction untile_block_rows;
+  switch (untile_info.endian) {
+    case xenos::Endian::k8in16:
+      untile_block_rows = GetUntileBlockRowsFunction<xenos::Endian::k8in16>(
+          untile_info.conversion);
+      break;
+    case xenos::Endian::k8in32:
+      untile_block_rows = GetUntileBlockRowsFunction<xenos::Endian::k8in32>(
+          untile_info.conversion);
+      break;
+    case xenos::Endian::k16in32:
+      untile_block_rows = GetUntileBlockRowsFunction<xenos::Endian::k16in32>(
+          untile_info.conversion);
+      break;
+    default:
+      untile_block_rows = GetUntileBlockRowsFunction<xenos::Endian::kNone>(
+          untile_info.conversion);
+      break;
+  }
+
+  SplitBlockRows(untile_info.offset_y, untile_info.height,
+                 untile_info.thread_count,
+                 [&](uint32_t row_begin, uint32_t row_end) {
+                   untile_block_rows(output_buffer, input_buffer, untile_info,
+                                     row_begin, row_end);
+                 });
+}
+
+// Tiles the rows [row_begin, row_end) of the region.
+template <xenos::Endian endian>
+static void TileBlockRows(uint8_t* output_buffer, const uint8_t* input_buffer,
+                          const TileBlocksInfo& tile_info, uint32_t row_begin,
+                          uint32_t row_end) {
+  uint32_t bytes_per_block = tile_info.bytes_per_block;
+  uint32_t log2_bpp = (bytes_per_block / 4) +
+                      ((bytes_per_block / 2) >> (bytes_per_block / 4));
+  uint32_t run_length = std::min(uint32_t(8), uint32_t(16) >> log2_bpp);
+
+  uint32_t x_begin = tile_info.offset_x;
+  uint32_t x_end = tile_info.offset_x + tile_info.width;
+  uint32_t y_begin = tile_info.offset_y + row_begin;
+  uint32_t y_end = tile_info.offset_y + row_end;
+  // Fill the output macro tile by macro tile, like UntileBlockRows reads it.
+  uint32_t row_offsets[32];
+  for (uint32_t band_y = y_begin & ~uint32_t(31); band_y < y_end;
+       band_y += 32) {
+    uint32_t band_y_begin = std::max(band_y, y_begin);
+    uint32_t band_y_end = std::min(band_y + 32, y_end);
+    for (uint32_t y = band_y_begin; y < band_y_end; ++y) {
+      row_offsets[y & 31] =
+          TiledOffset2DRow(y, tile_info.output_pitch, log2_bpp);
+    }
+    for (uint32_t tile_x = x_begin & ~uint32_t(31); tile_x < x_end;
+         tile_x += 32) {
+      uint32_t tile_x_begin = std::max(tile_x, x_begin);
+      uint32_t tile_x_end = std::min(tile_x + 32, x_end);
+      for (uint32_t y = band_y_begin; y < band_y_end; ++y) {
+        const uint8_t* input_row =
+            input_buffer +
+            size_t(y - tile_info.offset_y) * tile_info.input_pitch;
+        uint32_t row_offset = row_offsets[y & 31];
+        for (uint32_t x = tile_x_begin; x < tile_x_end;) {
+          uint32_t block_count = std::min(
+              run_length - (x & (run_length - 1)), tile_x_end - x);
+          // The endian swap is its own inverse.
+          UntileRun<endian, UntileConversion::kNone>(
+              output_buffer + TiledOffset2DColumn(x, y, log2_bpp, row_offset),
+              input_row + size_t(x - x_begin) * bytes_per_block, block_count,
+              bytes_per_block, 0);
+          x += block_count;
+        }
+      }
+    }
+  }
+}
+
+void TileBlocks(uint8_t* output_buffer, const uint8_t* input_buffer,
+                const TileBlocksInfo& tile_info) {
+  SCOPE_profile_cpu_f("gpu");
+  assert_true(tile_info.bytes_per_block >= 1 &&
+              tile_info.bytes_per_block <= 16 &&
+              xe::is_pow2(tile_info.bytes_per_block));
+  if (!tile_info.width || !tile_info.height) {
+    return;
+  }
+
+  void (*tile_block_rows)(uint8_t* output_buffer, const uint8_t* input_buffer,
+                          const TileBlocksInfo& tile_info, uint32_t row_begin,
+                          uint32_t row_end);
+  switch (tile_info.endian) {
+    case xenos::Endian::k8in16:
+      tile_block_rows = TileBlockRows<xenos::Endian::k8in16>;
+      break;
+    case xenos::Endian::k8in32:
+      tile_block_rows = TileBlockRows<xenos::Endian::k8in32>;
+      break;
+    case xenos::Endian::k16in32:
+      tile_block_rows = TileBlockRows<xenos::Endian::k16in32>;
+      break;
+    default:
+      tile_block_rows = TileBlockRows<xenos::Endian::kNone>;
+      break;
+  }
+
+  SplitBlockRows(tile_info.offset_y, tile_info.height, tile_info.thread_count,
+                 [&](uint32_t row_begin, uint32_t row_end) {
+                   tile_block_rows(output_buffer, input_buffer, tile_info,
+                                   row_begin, row_end);
+                 });
+}
+
 }  //  namespace texture_conversion
 }  //  namespace gpu
 }  //  namespace xe
@@ -31,6 +31,8 @@ void ConvertTexelCTX1ToR8G8(xenos::Endian endian, void* output,
                             const void* input, size_t length);
 void ConvertTexelDXT3AToDXT3(xenos::Endian endian, void* output,
                              const void* input, size_t length);
+void ConvertTexelDXNToR8G8(xenos::Endian endian, void* output,
+                           const void* input, size_t length);
 
 typedef std::function<void(void*, const void*, size_t)> UntileCopyBlockCallback;
 
@@ -49,6 +51,66 @@ typedef struct UntileInfo {
 void Untile(uint8_t* output_buffer, const uint8_t* input_buffer,
             const UntileInfo* untile_info);
 
+// Conversions which UntileBlocks can do while copying, matching the texture
+// load shaders.
+enum class UntileConversion {
+  // Only the endian swap, like CopySwapBlock.
+  kNone,
+  // 8-byte blocks to 4x4 R8G8 texels, like ConvertTexelCTX1ToR8G8.
+  kCTX1ToR8G8,
+  // 8-byte blocks to 16-byte blocks, like ConvertTexelDXT3AToDXT3.
+  kDXT3AToDXT3,
+  // 16-byte blocks to 4x4 R8G8 texels, like ConvertTexelDXNToR8G8.
+  kDXNToR8G8,
+};
+
+struct UntileBlocksInfo {
+  // In blocks.
+  uint32_t offset_x;
+  uint32_t offset_y;
+  uint32_t width;
+  uint32_t height;
+  // Width of the tiled input in blocks.
+  uint32_t input_pitch;
+  // 1, 2, 4, 8 or 16 - 8 for CTX1 and DXT3A, 16 for DXN.
+  uint32_t input_bytes_per_block;
+  // Bytes between rows of output blocks, or between rows of output texels for
+  // conversions to 4x4 texels.
+  uint32_t output_pitch;
+  xenos::Endian endian;
+  UntileConversion conversion;
+  // Number of threads to split the rows between, including the calling one.
+  uint32_t thread_count;
+};
+
+// Produces the same result as Untile with the respective copy callback, but
+// walks the input macro tile by macro tile and copies whole runs of blocks that
+// are contiguous in the tiled layout, with SIMD endian swapping.
+void UntileBlocks(uint8_t* output_buffer, const uint8_t* input_buffer,
+                  const UntileBlocksInfo& untile_info);
+
+struct TileBlocksInfo {
+  // In blocks, in the tiled output.
+  uint32_t offset_x;
+  uint32_t offset_y;
+  uint32_t width;
+  uint32_t height;
+  // Bytes between rows of input blocks.
+  uint32_t input_pitch;
+  // Width of the tiled output in blocks.
+  uint32_t output_pitch;
+  // 1, 2, 4, 8 or 16.
+  uint32_t bytes_per_block;
+  xenos::Endian endian;
+  // Number of threads to split the rows between, including the calling one.
+  uint32_t thread_count;
+};
+
+// The reverse of UntileBlocks without a conversion - writes linear blocks to
+// the region of the tiled output, in runs of blocks contiguous there.
+void TileBlocks(uint8_t* output_buffer, const uint8_t* input_buffer,
+                const TileBlocksInfo& tile_info);
+
 }  // namespace texture_conversion
 }  // namespace gpu
 }  // namespace xe
@@ -9,6 +9,8 @@
 
 #include "xenia/gpu/trace_dump.h"
 
+#include <chrono>
+
 #include "third_party/stb/stb_image_write.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
@@ -30,6 +32,10 @@
 
 DEFINE_path(target_trace_file, "", "Specifies the trace file to load.", "GPU");
 DEFINE_path(trace_dump_path, "", "Output path for dumped files.", "GPU");
+DEFINE_uint32(trace_dump_replay_count, 0,
+              "Number of times to replay the frame after dumping it, logging "
+              "the time taken by command processing, for benchmarking.",
+              "GPU");
 
 namespace xe {
 namespace gpu {
@@ -126,6 +132,29 @@ int TraceDump::Run() {
   player_->WaitOnPlayback();
   EndHostCapture();
 
+  if (cvars::trace_dump_replay_count) {
+    int last_command =
+        static_cast<int>(player_->current_frame()->commands.size() - 1);
+    auto replay_start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < cvars::trace_dump_replay_count; ++i) {
+      // Full playback from the frame start.
+      player_->SeekCommand(-1);
+      player_->SeekCommand(last_command);
+      player_->WaitOnPlayback();
+    }
+    std::chrono::duration<double, std::micro> replay_time =
+        std::chrono::steady_clock::now() - replay_start;
+    XELOGI("Replayed the frame {} times, {:.1f} us per replay",
+           cvars::trace_dump_replay_count,
+           replay_time.count() / cvars::trace_dump_replay_count);
+  }
+
+  if (!HasGuestOutput()) {
+    player_.reset();
+    emulator_.reset();
+    return 0;
+  }
+
   // Capture.
   int result = 0;
   ui::Presenter* presenter = graphics_system_->presenter();
@@ -39,6 +39,10 @@ class TraceDump {
   virtual void BeginHostCapture() = 0;
   virtual void EndHostCapture() = 0;
 
+  // Whether the graphics system draws the guest output to be saved as an
+  // image, false for the null one used for benchmarking the command processor.
+  virtual bool HasGuestOutput() const { return true; }
+
   std::unique_ptr<Emulator> emulator_;
   GraphicsSystem* graphics_system_ = nullptr;
   std::unique_ptr<TracePlayer> player_;
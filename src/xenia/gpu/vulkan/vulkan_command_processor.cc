@@ -1190,41 +1190,50 @@ void VulkanCommandProcessor::ShutdownContext() {
   CommandProcessor::ShutdownContext();
 }
 
-void VulkanCommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
-  CommandProcessor::WriteRegister(index, value);
-
-  if (index >= XE_GPU_REG_SHADER_CONSTANT_000_X &&
-      index <= XE_GPU_REG_SHADER_CONSTANT_511_W) {
-    if (frame_open_) {
-      uint32_t float_constant_index =
-          (index - XE_GPU_REG_SHADER_CONSTANT_000_X) >> 2;
-      if (float_constant_index >= 256) {
-        float_constant_index -= 256;
-        if (current_float_constant_map_pixel_[float_constant_index >> 6] &
-            (1ull << (float_constant_index & 63))) {
-          current_constant_buffers_up_to_date_ &= ~(
-              UINT32_C(1) << SpirvShaderTranslator::kConstantBufferFloatPixel);
-        }
-      } else {
-        if (current_float_constant_map_vertex_[float_constant_index >> 6] &
-            (1ull << (float_constant_index & 63))) {
-          current_constant_buffers_up_to_date_ &= ~(
-              UINT32_C(1) << SpirvShaderTranslator::kConstantBufferFloatVertex);
-        }
-      }
+void VulkanCommandProcessor::ConsumeDirtyShaderConstants() {
+  uint64_t float_constants_dirty_vertex[4], float_constants_dirty_pixel[4];
+  ConsumeDirtyFloatConstants(float_constants_dirty_vertex,
+                             float_constants_dirty_pixel);
+  if (frame_open_) {
+    uint64_t float_constants_used_dirty_vertex = 0;
+    uint64_t float_constants_used_dirty_pixel = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+      float_constants_used_dirty_vertex |=
+          float_constants_dirty_vertex[i] &
+          current_float_constant_map_vertex_[i];
+      float_constants_used_dirty_pixel |= float_constants_dirty_pixel[i] &
+                                          current_float_constant_map_pixel_[i];
     }
-  } else if (index >= XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031 &&
-             index <= XE_GPU_REG_SHADER_CONSTANT_LOOP_31) {
+    if (float_constants_used_dirty_vertex) {
+      current_constant_buffers_up_to_date_ &= ~(
+          UINT32_C(1) << SpirvShaderTranslator::kConstantBufferFloatVertex);
+    }
+    if (float_constants_used_dirty_pixel) {
+      current_constant_buffers_up_to_date_ &= ~(
+          UINT32_C(1) << SpirvShaderTranslator::kConstantBufferFloatPixel);
+    }
+  }
+  if (ConsumeDirtyRegisters(XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031,
+                            XE_GPU_REG_SHADER_CONSTANT_LOOP_31 -
+                                XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031 + 1)) {
     current_constant_buffers_up_to_date_ &=
         ~(UINT32_C(1) << SpirvShaderTranslator::kConstantBufferBoolLoop);
-  } else if (index >= XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0 &&
-             index <= XE_GPU_REG_SHADER_CONSTANT_FETCH_31_5) {
+  }
+  bool fetch_constants_dirty = false;
+  ConsumeDirtyRegisters(
+      XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0,
+      XE_GPU_REG_SHADER_CONSTANT_FETCH_31_5 -
+          XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0 + 1,
+      [&](uint32_t index) {
+        fetch_constants_dirty = true;
+        if (texture_cache_) {
+          texture_cache_->TextureFetchConstantWritten(
+              (index - XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0) / 6);
+        }
+      });
+  if (fetch_constants_dirty) {
     current_constant_buffers_up_to_date_ &=
         ~(UINT32_C(1) << SpirvShaderTranslator::kConstantBufferFetch);
-    if (texture_cache_) {
-      texture_cache_->TextureFetchConstantWritten(
-          (index - XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0) / 6);
-    }
   }
 }
 
@@ -2168,6 +2177,8 @@ bool VulkanCommandProcessor::IssueDraw(xenos::PrimitiveType prim_type,
     return IssueCopy();
   }
 
+  ConsumeDirtyShaderConstants();
+
   // Vertex shader analysis.
   auto vertex_shader = static_cast<VulkanShader*>(active_vertex_shader());
   if (!vertex_shader) {
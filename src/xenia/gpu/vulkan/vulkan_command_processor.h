@@ -264,8 +264,6 @@ class VulkanCommandProcessor : public CommandProcessor {
   bool SetupContext() override;
   void ShutdownContext() override;
 
-  void WriteRegister(uint32_t index, uint32_t value) override;
-
   void OnGammaRamp256EntryTableValueWritten() override;
   void OnGammaRampPWLValueWritten() override;
 
@@ -437,6 +435,9 @@ class VulkanCommandProcessor : public CommandProcessor {
   void UpdateDynamicState(const draw_util::ViewportInfo& viewport_info,
                           bool primitive_polygonal,
                           reg::RB_DEPTHCONTROL normalized_depth_control);
+  // Invalidates the constant buffers and the texture bindings depending on
+  // the registers written since the last draw.
+  void ConsumeDirtyShaderConstants();
   void UpdateSystemConstantValues(
       bool primitive_polygonal,
       const PrimitiveProcessor::ProcessingResult& primitive_processing_result,
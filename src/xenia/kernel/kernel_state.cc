@@ -9,11 +9,13 @@
 
 #include "xenia/kernel/kernel_state.h"
 
+#include <algorithm>
 #include <string>
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
 #include "xenia/cpu/processor.h"
@@ -28,6 +30,13 @@
 #include "xenia/kernel/xobject.h"
 #include "xenia/kernel/xthread.h"
 
+DEFINE_bool(async_file_io, true,
+            "Complete reads and writes of files opened for asynchronous I/O "
+            "on host worker threads instead of the calling guest thread.",
+            "Kernel");
+DEFINE_int32(async_file_io_threads, 2,
+             "Number of host threads doing asynchronous file I/O.", "Kernel");
+
 namespace xe {
 namespace kernel {
 
@@ -75,6 +84,9 @@ KernelState::~KernelState() {
     dispatch_thread_->Wait(0, 0, 0, nullptr);
   }
 
+  // Requests in flight write to guest memory and objects, finish them first.
+  ShutdownFileIOWorkers();
+
   executable_module_.reset();
   user_modules_.clear();
   kernel_modules_.clear();
@@ -390,6 +402,117 @@ void KernelState::SetExecutableModule(object_ref<UserModule> module) {
     dispatch_thread_->set_name("Kernel Dispatch");
     dispatch_thread_->Create();
   }
+
+  if (cvars::async_file_io && file_io_threads_.empty()) {
+    {
+      auto global_lock = global_critical_region_.Acquire();
+      file_io_running_ = true;
+    }
+    uint32_t thread_count =
+        uint32_t(std::max(cvars::async_file_io_threads, int32_t(1)));
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      auto thread = object_ref<XHostThread>(
+          new XHostThread(this, 128 * 1024, 0, [this]() {
+            FileIOWorkerMain();
+            return 0;
+          }));
+      thread->set_name(fmt::format("Kernel File I/O {}", i));
+      // Keep running while paused, so requests in flight can be drained
+      // before saving the state.
+      thread->set_can_debugger_suspend(false);
+      thread->Create();
+      file_io_threads_.push_back(std::move(thread));
+    }
+  }
+}
+
+bool KernelState::QueueFileIO(std::function<void()> io_callback) {
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    if (!file_io_running_) {
+      return false;
+    }
+    file_io_queue_.push_back(
+        {std::move(io_callback), Clock::QueryHostTickCount()});
+    file_io_max_queue_depth_ = std::max(file_io_max_queue_depth_,
+                                        uint32_t(file_io_queue_.size()));
+  }
+  file_io_cond_.notify_one();
+  return true;
+}
+
+void KernelState::FileIOWorkerMain() {
+  auto global_lock = global_critical_region_.Acquire();
+  while (true) {
+    file_io_cond_.wait(global_lock, [this]() {
+      return !file_io_running_ || !file_io_queue_.empty();
+    });
+    // Drain the queue on shutdown, guest threads may be waiting on events
+    // the requests signal.
+    if (file_io_queue_.empty()) {
+      return;
+    }
+    FileIORequest request = std::move(file_io_queue_.front());
+    file_io_queue_.pop_front();
+    ++file_io_busy_count_;
+    global_lock.unlock();
+
+    request.io_callback();
+
+    uint64_t latency = Clock::QueryHostTickCount() - request.queued_ticks;
+    ++file_io_completed_count_;
+    file_io_total_latency_ += latency;
+    uint64_t max_latency = file_io_max_latency_;
+    while (latency > max_latency &&
+           !file_io_max_latency_.compare_exchange_weak(max_latency, latency)) {
+    }
+
+    global_lock.lock();
+    if (!--file_io_busy_count_ && file_io_queue_.empty()) {
+      file_io_idle_cond_.notify_all();
+    }
+  }
+}
+
+void KernelState::DrainFileIO() {
+  auto global_lock = global_critical_region_.Acquire();
+  file_io_idle_cond_.wait(global_lock, [this]() {
+    return file_io_queue_.empty() && !file_io_busy_count_;
+  });
+}
+
+void KernelState::ShutdownFileIOWorkers() {
+  if (file_io_threads_.empty()) {
+    return;
+  }
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    file_io_running_ = false;
+  }
+  file_io_cond_.notify_all();
+  for (auto& thread : file_io_threads_) {
+    xe::threading::Wait(thread->thread(), false);
+  }
+  file_io_threads_.clear();
+  LogFileIOStats();
+}
+
+void KernelState::LogFileIOStats() {
+  uint64_t completed_count = file_io_completed_count_;
+  uint32_t max_queue_depth;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    max_queue_depth = file_io_max_queue_depth_;
+  }
+  double ticks_per_ms = double(Clock::QueryHostTickFrequency()) / 1000.0;
+  XELOGI(
+      "Asynchronous file I/O: {} requests, queue depth up to {}, latency "
+      "{:.3f} ms average, {:.3f} ms max",
+      completed_count, max_queue_depth,
+      completed_count
+          ? double(file_io_total_latency_) / ticks_per_ms / completed_count
+          : 0.0,
+      double(file_io_max_latency_) / ticks_per_ms);
 }
 
 void KernelState::LoadKernelModule(object_ref<KernelModule> kernel_module) {
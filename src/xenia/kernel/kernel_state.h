@@ -12,9 +12,11 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "xenia/base/bit_map.h"
@@ -196,10 +198,31 @@ class KernelState {
       uint32_t overlapped_ptr, std::function<void()> pre_callback = nullptr,
       std::function<void()> post_callback = nullptr);
 
+  // Runs file I/O for handles opened without FILE_SYNCHRONOUS_IO_* on a host
+  // worker, so the calling guest thread continues while it's in progress.
+  // The callback completes the request itself. Returns false, without taking
+  // the callback, if asynchronous file I/O is disabled or not running yet.
+  bool QueueFileIO(std::function<void()> io_callback);
+  // Waits for the queued file I/O to complete. Guest threads must be paused,
+  // so they don't queue more, and the global critical region must not be
+  // held.
+  void DrainFileIO();
+  // Completes the queued file I/O and stops the workers, file I/O is done
+  // synchronously afterwards.
+  void ShutdownFileIOWorkers();
+  void LogFileIOStats();
+
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
  private:
+  struct FileIORequest {
+    std::function<void()> io_callback;
+    uint64_t queued_ticks;
+  };
+
+  void FileIOWorkerMain();
+
   void LoadKernelModule(object_ref<KernelModule> kernel_module);
 
   Emulator* emulator_;
@@ -234,6 +257,21 @@ class KernelState {
   std::condition_variable_any dispatch_cond_;
   std::list<std::function<void()>> dispatch_queue_;
 
+  std::vector<object_ref<XHostThread>> file_io_threads_;
+  // Guarded by the global critical region, so that pausing doesn't suspend
+  // guest threads while they are holding the queue.
+  std::condition_variable_any file_io_cond_;
+  std::condition_variable_any file_io_idle_cond_;
+  bool file_io_running_ = false;
+  std::deque<FileIORequest> file_io_queue_;
+  // Requests taken from the queue but not completed yet.
+  uint32_t file_io_busy_count_ = 0;
+  uint32_t file_io_max_queue_depth_ = 0;
+  std::atomic<uint64_t> file_io_completed_count_ = {0};
+  // From queueing to completion, in host ticks.
+  std::atomic<uint64_t> file_io_total_latency_ = {0};
+  std::atomic<uint64_t> file_io_max_latency_ = {0};
+
   BitMap tls_bitmap_;
 
   friend class XObject;
@@ -0,0 +1,341 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/util/guest_lock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/atomic.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/threading.h"
+
+DEFINE_bool(guest_lock_stats, false,
+            "Collect contention statistics for guest spinlocks and critical "
+            "sections, logged on shutdown.",
+            "Kernel");
+DEFINE_path(guest_lock_stats_path, "",
+            "File to write the full guest lock contention table to on "
+            "shutdown.",
+            "Kernel");
+
+namespace xe {
+namespace kernel {
+namespace util {
+
+static inline void SpinPause() {
+#if XE_ARCH_AMD64
+  _mm_pause();
+#elif XE_ARCH_ARM64 && XE_COMPILER_MSVC
+  __yield();
+#elif XE_ARCH_ARM64
+  __asm__ volatile("yield");
+#endif
+}
+
+bool GuestLockBackoff::Wait() {
+  if (spin_count_ < spin_limit_) {
+    uint32_t batch = std::min(spin_batch_, spin_limit_ - spin_count_);
+    for (uint32_t i = 0; i < batch; ++i) {
+      SpinPause();
+    }
+    spin_count_ += batch;
+    spin_batch_ = std::min(spin_batch_ * 2, uint32_t(64));
+    return true;
+  }
+  if (yield_count_ < yield_limit_) {
+    ++yield_count_;
+    xe::threading::MaybeYield();
+    return true;
+  }
+  return false;
+}
+
+// Spinlocks share a fixed set of wait queues, hashed by guest address. Each
+// one also tracks how long acquisitions of its locks usually spin for, to
+// scale the spin limit of the next waiters.
+struct ParkingBucket {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::atomic<uint32_t> waiter_count = {0};
+  std::atomic<uint32_t> spin_estimate = {0};
+};
+constexpr uint32_t kParkingBucketCountLog2 = 8;
+static ParkingBucket parking_buckets_[1 << kParkingBucketCountLog2];
+
+static uint32_t HashGuestAddress(uint32_t guest_address, uint32_t bits) {
+  // Fibonacci hashing, locks are at least 4 byte aligned.
+  return (guest_address * 0x9E3779B1u) >> (32 - bits);
+}
+
+static ParkingBucket& GetParkingBucket(uint32_t guest_address) {
+  return parking_buckets_[HashGuestAddress(guest_address,
+                                           kParkingBucketCountLog2)];
+}
+
+// Spinning longer than this is likely waiting for a preempted holder.
+constexpr uint32_t kMaxSpinLockSpins = 4096;
+constexpr uint32_t kSpinLockYields = 8;
+// Titles may release inline without going through the kernel, in which case
+// nobody wakes the parked waiters, so they recheck periodically.
+constexpr auto kSpinLockParkTimeout = std::chrono::milliseconds(1);
+
+void AcquireGuestSpinLock(uint32_t guest_address, uint32_t* lock) {
+  if (xe::atomic_cas(0, 1, lock)) {
+    RecordGuestLockAcquired(GuestLockType::kSpinLock, guest_address);
+    return;
+  }
+
+  ParkingBucket& bucket = GetParkingBucket(guest_address);
+  uint32_t spin_estimate = bucket.spin_estimate.load(std::memory_order_relaxed);
+  GuestLockBackoff backoff(
+      std::min(std::max(spin_estimate * 2, uint32_t(64)), kMaxSpinLockSpins),
+      kSpinLockYields);
+  bool parked = false;
+  while (true) {
+    if (!backoff.Wait()) {
+      // Out of patience, park until the holder releases. The waiter count is
+      // published before the last attempt, and releases check it after
+      // unlocking, so either the attempt succeeds or the release wakes us.
+      std::unique_lock<std::mutex> lock_guard(bucket.mutex);
+      bucket.waiter_count.fetch_add(1, std::memory_order_seq_cst);
+      while (!xe::atomic_cas(0, 1, lock)) {
+        parked = true;
+        bucket.cond.wait_for(lock_guard, kSpinLockParkTimeout);
+      }
+      bucket.waiter_count.fetch_sub(1, std::memory_order_relaxed);
+      break;
+    }
+    if (*reinterpret_cast<volatile uint32_t*>(lock) == 0 &&
+        xe::atomic_cas(0, 1, lock)) {
+      break;
+    }
+  }
+
+  // Exponential moving average of the spins needed, with parking counting
+  // as running out of spins.
+  uint32_t spins = parked ? kMaxSpinLockSpins : backoff.spin_count();
+  bucket.spin_estimate.store(spin_estimate - spin_estimate / 8 + spins / 8,
+                             std::memory_order_relaxed);
+  RecordGuestLockAcquired(GuestLockType::kSpinLock, guest_address, &backoff,
+                          parked);
+}
+
+bool TryAcquireGuestSpinLock(uint32_t guest_address, uint32_t* lock) {
+  if (!xe::atomic_cas(0, 1, lock)) {
+    return false;
+  }
+  RecordGuestLockAcquired(GuestLockType::kSpinLock, guest_address);
+  return true;
+}
+
+void ReleaseGuestSpinLock(uint32_t guest_address, uint32_t* lock) {
+  RecordGuestLockReleased(guest_address);
+  // Full barrier, ordered before the waiter count check.
+  xe::atomic_dec(lock);
+  ParkingBucket& bucket = GetParkingBucket(guest_address);
+  if (bucket.waiter_count.load(std::memory_order_seq_cst)) {
+    // Other locks may share the bucket, so wake everyone.
+    { std::lock_guard<std::mutex> lock_guard(bucket.mutex); }
+    bucket.cond.notify_all();
+  }
+}
+
+// Statistics are kept in a fixed open addressing table so recording never
+// allocates or locks. Locks beyond its capacity are not tracked.
+struct GuestLockStatsEntry {
+  std::atomic<uint32_t> guest_address = {0};
+  std::atomic<GuestLockType> type = {GuestLockType::kSpinLock};
+  std::atomic<uint64_t> acquire_count = {0};
+  std::atomic<uint64_t> contended_count = {0};
+  std::atomic<uint64_t> spin_count = {0};
+  std::atomic<uint64_t> yield_count = {0};
+  std::atomic<uint64_t> park_count = {0};
+  std::atomic<uint64_t> hold_ticks = {0};
+  std::atomic<uint64_t> max_hold_ticks = {0};
+  // Only written by the holder.
+  std::atomic<uint64_t> acquire_tick = {0};
+};
+constexpr uint32_t kStatsEntryCountLog2 = 12;
+constexpr uint32_t kStatsMaxProbeCount = 32;
+static GuestLockStatsEntry stats_entries_[1 << kStatsEntryCountLog2];
+static std::atomic<uint64_t> stats_dropped_count_ = {0};
+
+static GuestLockStatsEntry* GetStatsEntry(uint32_t guest_address,
+                                          bool create) {
+  if (!guest_address) {
+    return nullptr;
+  }
+  uint32_t mask = (1 << kStatsEntryCountLog2) - 1;
+  uint32_t index = HashGuestAddress(guest_address, kStatsEntryCountLog2);
+  for (uint32_t i = 0; i < kStatsMaxProbeCount; ++i) {
+    auto& entry = stats_entries_[(index + i) & mask];
+    uint32_t entry_address =
+        entry.guest_address.load(std::memory_order_acquire);
+    if (entry_address == guest_address) {
+      return &entry;
+    }
+    if (!entry_address) {
+      if (!create) {
+        return nullptr;
+      }
+      if (entry.guest_address.compare_exchange_strong(
+              entry_address, guest_address, std::memory_order_acq_rel)) {
+        return &entry;
+      }
+      if (entry_address == guest_address) {
+        return &entry;
+      }
+    }
+  }
+  if (create) {
+    stats_dropped_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return nullptr;
+}
+
+bool IsGuestLockStatsEnabled() { return cvars::guest_lock_stats; }
+
+void RecordGuestLockAcquired(GuestLockType type, uint32_t guest_address,
+                             const GuestLockBackoff* backoff, bool parked) {
+  if (!cvars::guest_lock_stats) {
+    return;
+  }
+  GuestLockStatsEntry* entry = GetStatsEntry(guest_address, true);
+  if (!entry) {
+    return;
+  }
+  entry->type.store(type, std::memory_order_relaxed);
+  entry->acquire_count.fetch_add(1, std::memory_order_relaxed);
+  if (backoff || parked) {
+    entry->contended_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (backoff) {
+    entry->spin_count.fetch_add(backoff->spin_count(),
+                                std::memory_order_relaxed);
+    entry->yield_count.fetch_add(backoff->yield_count(),
+                                 std::memory_order_relaxed);
+  }
+  if (parked) {
+    entry->park_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  entry->acquire_tick.store(Clock::QueryHostTickCount(),
+                            std::memory_order_relaxed);
+}
+
+void RecordGuestLockReleased(uint32_t guest_address) {
+  if (!cvars::guest_lock_stats) {
+    return;
+  }
+  GuestLockStatsEntry* entry = GetStatsEntry(guest_address, false);
+  if (!entry) {
+    return;
+  }
+  uint64_t acquire_tick = entry->acquire_tick.load(std::memory_order_relaxed);
+  if (!acquire_tick) {
+    // Acquired before stats were enabled, or inline by the title.
+    return;
+  }
+  uint64_t hold_ticks = Clock::QueryHostTickCount() - acquire_tick;
+  entry->hold_ticks.fetch_add(hold_ticks, std::memory_order_relaxed);
+  uint64_t max_hold_ticks =
+      entry->max_hold_ticks.load(std::memory_order_relaxed);
+  while (hold_ticks > max_hold_ticks &&
+         !entry->max_hold_ticks.compare_exchange_weak(
+             max_hold_ticks, hold_ticks, std::memory_order_relaxed)) {
+  }
+}
+
+void DumpGuestLockStats() {
+  if (!cvars::guest_lock_stats) {
+    return;
+  }
+  std::vector<const GuestLockStatsEntry*> entries;
+  for (const auto& entry : stats_entries_) {
+    if (entry.guest_address.load(std::memory_order_relaxed)) {
+      entries.push_back(&entry);
+    }
+  }
+  // Most contended first.
+  std::sort(entries.begin(), entries.end(), [](auto a, auto b) {
+    uint64_t a_contended = a->contended_count.load(std::memory_order_relaxed);
+    uint64_t b_contended = b->contended_count.load(std::memory_order_relaxed);
+    if (a_contended != b_contended) {
+      return a_contended > b_contended;
+    }
+    return a->acquire_count.load(std::memory_order_relaxed) >
+           b->acquire_count.load(std::memory_order_relaxed);
+  });
+
+  double us_per_tick = 1000000.0 / double(Clock::QueryHostTickFrequency());
+  auto format_header = []() {
+    return fmt::format("{:>8} {:>4} {:>10} {:>10} {:>12} {:>8} {:>8} {:>10} "
+                       "{:>10}",
+                       "address", "type", "acquires", "contended", "spins",
+                       "yields", "parks", "avg hold", "max hold");
+  };
+  auto format_entry = [us_per_tick](const GuestLockStatsEntry& entry) {
+    uint64_t acquire_count =
+        entry.acquire_count.load(std::memory_order_relaxed);
+    double hold_us =
+        entry.hold_ticks.load(std::memory_order_relaxed) * us_per_tick;
+    return fmt::format(
+        "{:08X} {:>4} {:>10} {:>10} {:>12} {:>8} {:>8} {:>8.2f}us "
+        "{:>8.2f}us",
+        entry.guest_address.load(std::memory_order_relaxed),
+        entry.type.load(std::memory_order_relaxed) == GuestLockType::kSpinLock
+            ? "spin"
+            : "cs",
+        acquire_count, entry.contended_count.load(std::memory_order_relaxed),
+        entry.spin_count.load(std::memory_order_relaxed),
+        entry.yield_count.load(std::memory_order_relaxed),
+        entry.park_count.load(std::memory_order_relaxed),
+        acquire_count ? hold_us / acquire_count : 0.0,
+        entry.max_hold_ticks.load(std::memory_order_relaxed) * us_per_tick);
+  };
+
+  uint64_t dropped_count = stats_dropped_count_.load(std::memory_order_relaxed);
+  XELOGI("Guest locks: {} tracked, {} acquisitions untracked", entries.size(),
+         dropped_count);
+  constexpr size_t kLoggedEntryCount = 32;
+  if (!entries.empty()) {
+    XELOGI("{}", format_header());
+    for (size_t i = 0; i < std::min(entries.size(), kLoggedEntryCount); ++i) {
+      XELOGI("{}", format_entry(*entries[i]));
+    }
+  }
+
+  if (!cvars::guest_lock_stats_path.empty()) {
+    xe::filesystem::CreateParentFolder(cvars::guest_lock_stats_path);
+    FILE* file = xe::filesystem::OpenFile(cvars::guest_lock_stats_path, "w");
+    if (!file) {
+      XELOGE("Unable to write guest lock stats to {}",
+             xe::path_to_utf8(cvars::guest_lock_stats_path));
+      return;
+    }
+    fmt::print(file, "{}\n", format_header());
+    for (auto entry : entries) {
+      fmt::print(file, "{}\n", format_entry(*entry));
+    }
+    fclose(file);
+  }
+}
+
+}  // namespace util
+}  // namespace kernel
+}  // namespace xe
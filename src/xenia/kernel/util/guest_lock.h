@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_UTIL_GUEST_LOCK_H_
+#define XENIA_KERNEL_UTIL_GUEST_LOCK_H_
+
+#include <cstdint>
+
+namespace xe {
+namespace kernel {
+namespace util {
+
+enum class GuestLockType : uint32_t {
+  kSpinLock,
+  kCriticalSection,
+};
+
+// Backoff policy for a thread waiting for a guest lock: a bounded number of
+// PAUSE spins with exponentially growing batches, then a bounded number of
+// yields to let a preempted holder run, after which the waiter should park.
+// Guest threads usually outnumber host cores, so spinning forever starves
+// the holder.
+class GuestLockBackoff {
+ public:
+  GuestLockBackoff(uint32_t spin_limit, uint32_t yield_limit)
+      : spin_limit_(spin_limit), yield_limit_(yield_limit) {}
+
+  // Waits a little before the next acquisition attempt. Returns false once
+  // spinning and yielding have been exhausted and the caller should park.
+  bool Wait();
+
+  uint32_t spin_count() const { return spin_count_; }
+  uint32_t yield_count() const { return yield_count_; }
+
+ private:
+  uint32_t spin_limit_;
+  uint32_t yield_limit_;
+  uint32_t spin_count_ = 0;
+  uint32_t yield_count_ = 0;
+  uint32_t spin_batch_ = 1;
+};
+
+// Guest spinlocks as used by KfAcquireSpinLock and friends: the lock word is
+// 0 when free and 1 when held. Contended waiters park on a host wait queue
+// keyed by the guest address of the lock, and releases wake them.
+void AcquireGuestSpinLock(uint32_t guest_address, uint32_t* lock);
+bool TryAcquireGuestSpinLock(uint32_t guest_address, uint32_t* lock);
+void ReleaseGuestSpinLock(uint32_t guest_address, uint32_t* lock);
+
+// Contention statistics, collected per guest lock address when the
+// guest_lock_stats cvar is set. Acquisitions of locks that park somewhere
+// else, like critical sections on their event, report to these directly.
+bool IsGuestLockStatsEnabled();
+void RecordGuestLockAcquired(GuestLockType type, uint32_t guest_address,
+                             const GuestLockBackoff* backoff = nullptr,
+                             bool parked = false);
+void RecordGuestLockReleased(uint32_t guest_address);
+// Logs the most contended locks, and writes the full table to
+// guest_lock_stats_path if set.
+void DumpGuestLockStats();
+
+}  // namespace util
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_UTIL_GUEST_LOCK_H_
@@ -181,6 +181,56 @@ dword_result_t NtOpenFile_entry(
 }
 DECLARE_XBOXKRNL_EXPORT1(NtOpenFile, kFileSystem, kImplemented);
 
+// Starts a read or write of a file opened for asynchronous I/O on a kernel
+// file I/O worker. When the transfer is done, the I/O status block is written,
+// then the completion ports are notified, the file object and the event are
+// signalled, and the APC is queued to the thread that started it. transfer
+// must not notify the completion itself.
+// Returns false if the request wasn't queued and must be done synchronously.
+// This is the case for transfers at the current file position, which is only
+// known once the transfers before them are done.
+static bool QueueAsyncFileIO(
+    object_ref<XFile> file, object_ref<XEvent> ev, uint32_t apc_routine,
+    uint32_t apc_context, uint32_t io_status_block_ptr, bool at_file_position,
+    std::function<X_STATUS(XFile* file, uint32_t* out_length)> transfer) {
+  if (at_file_position) {
+    return false;
+  }
+  auto thread = retain_object(XThread::GetCurrentThread());
+  auto io_status_block =
+      io_status_block_ptr
+          ? kernel_memory()->TranslateVirtual<X_IO_STATUS_BLOCK*>(
+                io_status_block_ptr)
+          : nullptr;
+  if (io_status_block) {
+    io_status_block->status = X_STATUS_PENDING;
+    io_status_block->information = 0;
+  }
+  if (ev) {
+    ev->Reset();
+  }
+  file->ResetAsyncEvent();
+  return kernel_state()->QueueFileIO([file, ev, thread, apc_routine,
+                                      apc_context, io_status_block,
+                                      io_status_block_ptr, transfer]() {
+    uint32_t length = 0;
+    X_STATUS result = transfer(file.get(), &length);
+    if (io_status_block) {
+      io_status_block->status = result;
+      io_status_block->information = length;
+    }
+    file->NotifyCompletion(apc_context, result, length);
+    if (ev) {
+      ev->Set(0, false);
+    }
+    // Low bit probably means do not queue to IO ports.
+    if ((apc_routine & ~1) && apc_context && thread->is_running()) {
+      thread->EnqueueApc(apc_routine & ~1u, apc_context, io_status_block_ptr,
+                         0);
+    }
+  });
+}
+
 dword_result_t NtReadFile_entry(dword_t file_handle, dword_t event_handle,
                                 lpvoid_t apc_routine_ptr, lpvoid_t apc_context,
                                 pointer_t<X_IO_STATUS_BLOCK> io_status_block,
@@ -200,13 +250,23 @@ dword_result_t NtReadFile_entry(dword_t file_handle, dword_t event_handle,
   }
 
   if (XSUCCEEDED(result)) {
-    if (true || file->is_synchronous()) {
+    uint32_t buffer_address = buffer.guest_address();
+    uint32_t length = buffer_length;
+    uint64_t byte_offset =
+        byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1;
+    uint32_t context = apc_context.guest_address();
+    if (file->is_synchronous() ||
+        !QueueAsyncFileIO(
+            file, ev, apc_routine_ptr.guest_address(), context,
+            io_status_block.guest_address(), byte_offset == uint64_t(-1),
+            [=](XFile* file, uint32_t* out_length) {
+              return file->Read(buffer_address, length, byte_offset,
+                                out_length, context, false);
+            })) {
       // Synchronous.
       uint32_t bytes_read = 0;
-      result = file->Read(
-          buffer.guest_address(), buffer_length,
-          byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
-          &bytes_read, apc_context);
+      result = file->Read(buffer_address, length, byte_offset, &bytes_read,
+                          context);
       if (io_status_block) {
         io_status_block->status = result;
         io_status_block->information = bytes_read;
@@ -231,23 +291,7 @@ dword_result_t NtReadFile_entry(dword_t file_handle, dword_t event_handle,
       // we have written the info out.
       signal_event = true;
     } else {
-      // TODO(benvanik): async.
-
-      // X_STATUS_PENDING if not returning immediately.
-      // XFile is waitable and signalled after each async req completes.
-      // reset the input event (->Reset())
-      /*xeNtReadFileState* call_state = new xeNtReadFileState();
-      XAsyncRequest* request = new XAsyncRequest(
-      state, file,
-      (XAsyncRequest::CompletionCallback)xeNtReadFileCompleted,
-      call_state);*/
-      // result = file->Read(buffer.guest_address(), buffer_length, byte_offset,
-      //                     request);
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_PENDING;
-        io_status_block->information = 0;
-      }
-
+      // The worker fills the I/O status block and sets the event.
       result = X_STATUS_PENDING;
     }
   }
@@ -283,13 +327,25 @@ dword_result_t NtReadFileScatter_entry(
   }
 
   if (XSUCCEEDED(result)) {
-    if (true || file->is_synchronous()) {
+    uint32_t segments_address = segment_array.guest_address();
+    uint32_t read_length = length;
+    uint64_t byte_offset =
+        byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1;
+    uint32_t context = apc_context.guest_address();
+    if (file->is_synchronous() ||
+        !QueueAsyncFileIO(
+            file, ev, apc_routine_ptr.guest_address(), context,
+            io_status_block.guest_address(),
+            !byte_offset || byte_offset == uint64_t(-1),
+            [=](XFile* file, uint32_t* out_length) {
+              return file->ReadScatter(segments_address, read_length,
+                                       byte_offset, out_length, context,
+                                       false);
+            })) {
       // Synchronous.
       uint32_t bytes_read = 0;
-      result = file->ReadScatter(
-          segment_array.guest_address(), length,
-          byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
-          &bytes_read, apc_context);
+      result = file->ReadScatter(segments_address, read_length, byte_offset,
+                                 &bytes_read, context);
       if (io_status_block) {
         io_status_block->status = result;
         io_status_block->information = bytes_read;
@@ -314,26 +370,10 @@ dword_result_t NtReadFileScatter_entry(
       // we have written the info out.
       signal_event = true;
     } else {
-      // TODO(benvanik): async.
-
       // TODO: On Windows it might be worth trying to use Win32 ReadFileScatter
       // here instead of handling it ourselves
 
-      // X_STATUS_PENDING if not returning immediately.
-      // XFile is waitable and signalled after each async req completes.
-      // reset the input event (->Reset())
-      /*xeNtReadFileState* call_state = new xeNtReadFileState();
-      XAsyncRequest* request = new XAsyncRequest(
-      state, file,
-      (XAsyncRequest::CompletionCallback)xeNtReadFileCompleted,
-      call_state);*/
-      // result = file->Read(buffer.guest_address(), buffer_length, byte_offset,
-      //                     request);
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_PENDING;
-        io_status_block->information = 0;
-      }
-
+      // The worker fills the I/O status block and sets the event.
       result = X_STATUS_PENDING;
     }
   }
@@ -373,14 +413,23 @@ dword_result_t NtWriteFile_entry(dword_t file_handle, dword_t event_handle,
 
   // Execute write.
   if (XSUCCEEDED(result)) {
-    // TODO(benvanik): async path.
-    if (true || file->is_synchronous()) {
+    uint32_t buffer_address = buffer.guest_address();
+    uint32_t length = buffer_length;
+    uint64_t byte_offset =
+        byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1;
+    uint32_t context = apc_context.guest_address();
+    if (file->is_synchronous() ||
+        !QueueAsyncFileIO(
+            file, ev, apc_routine.value(), context,
+            io_status_block.guest_address(), byte_offset == uint64_t(-1),
+            [=](XFile* file, uint32_t* out_length) {
+              return file->Write(buffer_address, length, byte_offset,
+                                 out_length, context, false);
+            })) {
       // Synchronous request.
       uint32_t bytes_written = 0;
-      result = file->Write(
-          buffer.guest_address(), buffer_length,
-          byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
-          &bytes_written, apc_context);
+      result = file->Write(buffer_address, length, byte_offset,
+                           &bytes_written, context);
 
       if (io_status_block) {
         io_status_block->status = result;
@@ -406,13 +455,8 @@ dword_result_t NtWriteFile_entry(dword_t file_handle, dword_t event_handle,
       // we have written the info out.
       signal_event = true;
     } else {
-      // X_STATUS_PENDING if not returning immediately.
+      // The worker fills the I/O status block and sets the event.
       result = X_STATUS_PENDING;
-
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_PENDING;
-        io_status_block->information = 0;
-      }
     }
   }
 
@@ -19,6 +19,7 @@
 #include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
+#include "xenia/kernel/util/guest_lock.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
@@ -429,25 +430,41 @@ void RtlEnterCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
     return;
   }
 
-  // Spin loop
-  while (spin_count--) {
+  // Spin loop, with a few yields if the title asked for spinning at all as
+  // the owner may not be running.
+  util::GuestLockBackoff backoff(spin_count, spin_count ? 4 : 0);
+  bool contended = false;
+  while (true) {
     if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
       // Acquired.
       cs->owning_thread = cur_thread;
       cs->recursion_count = 1;
+      util::RecordGuestLockAcquired(util::GuestLockType::kCriticalSection,
+                                    cs.guest_address(),
+                                    contended ? &backoff : nullptr);
       return;
     }
+    contended = true;
+    if (!backoff.Wait()) {
+      break;
+    }
   }
 
+  bool parked = false;
   if (xe::atomic_inc(&cs->lock_count) != 0) {
     // Create a full waiter.
     xeKeWaitForSingleObject(reinterpret_cast<void*>(cs.host_address()), 8, 0, 0,
                             nullptr);
+    parked = true;
   }
 
   assert_true(cs->owning_thread == 0);
   cs->owning_thread = cur_thread;
   cs->recursion_count = 1;
+  util::RecordGuestLockAcquired(util::GuestLockType::kCriticalSection,
+                                cs.guest_address(),
+                                contended || parked ? &backoff : nullptr,
+                                parked);
 }
 DECLARE_XBOXKRNL_EXPORT2(RtlEnterCriticalSection, kNone, kImplemented,
                          kHighFrequency);
@@ -460,6 +477,8 @@ dword_result_t RtlTryEnterCriticalSection_entry(
     // Able to steal the lock right away.
     cs->owning_thread = thread;
     cs->recursion_count = 1;
+    util::RecordGuestLockAcquired(util::GuestLockType::kCriticalSection,
+                                  cs.guest_address());
     return 1;
   } else if (cs->owning_thread == thread) {
     // Already own the lock.
@@ -487,6 +506,7 @@ void RtlLeaveCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   }
 
   // Not owned - unlock!
+  util::RecordGuestLockReleased(cs.guest_address());
   cs->owning_thread = 0;
   if (xe::atomic_dec(&cs->lock_count) != -1) {
     // There were waiters - wake one of them.
@@ -8,6 +8,7 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include "xenia/base/atomic.h"
@@ -17,6 +18,7 @@
 #include "xenia/cpu/processor.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
+#include "xenia/kernel/util/guest_lock.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
@@ -403,7 +405,53 @@ void KeInitializeEvent_entry(pointer_t<X_KEVENT> event_ptr, dword_t event_type,
 }
 DECLARE_XBOXKRNL_EXPORT1(KeInitializeEvent, kThreading, kImplemented);
 
+// Calls to the dispatcher object exports, and how many of them were completed
+// on the guest dispatch header alone.
+struct DispatcherFastPathStats {
+  alignas(64) std::atomic<uint64_t> call_count = {0};
+  std::atomic<uint64_t> fast_path_count = {0};
+
+  void Record(bool fast_path) {
+    call_count.fetch_add(1, std::memory_order_relaxed);
+    if (fast_path) {
+      fast_path_count.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+};
+static DispatcherFastPathStats ke_wait_for_single_object_stats_;
+static DispatcherFastPathStats ke_set_event_stats_;
+static DispatcherFastPathStats ke_release_semaphore_stats_;
+
+void LogDispatcherFastPathStats() {
+  auto log_stats = [](const char* name, const DispatcherFastPathStats& stats) {
+    uint64_t call_count = stats.call_count.load(std::memory_order_relaxed);
+    uint64_t fast_path_count =
+        stats.fast_path_count.load(std::memory_order_relaxed);
+    if (call_count) {
+      XELOGI("{}: {} calls, {} ({:.1f}%) on the fast path", name, call_count,
+             fast_path_count, 100.0 * fast_path_count / call_count);
+    }
+  };
+  log_stats("KeWaitForSingleObject", ke_wait_for_single_object_stats_);
+  log_stats("KeSetEvent", ke_set_event_stats_);
+  log_stats("KeReleaseSemaphore", ke_release_semaphore_stats_);
+}
+
+// Whether the dispatch header belongs to an object already created by
+// GetNativeObject, and therefore holds its signal state.
+static bool IsNativeObjectInitialized(const X_DISPATCH_HEADER* header) {
+  return header->wait_list_flink == kXObjSignature;
+}
+
 uint32_t xeKeSetEvent(X_KEVENT* event_ptr, uint32_t increment, uint32_t wait) {
+  if (IsNativeObjectInitialized(&event_ptr->header) &&
+      event_ptr->header.type <= 1 &&
+      XEvent::TrySetNative(&event_ptr->header)) {
+    ke_set_event_stats_.Record(true);
+    return 1;
+  }
+  ke_set_event_stats_.Record(false);
+
   auto ev = XObject::GetNativeObject<XEvent>(kernel_state(), event_ptr);
   if (!ev) {
     assert_always();
@@ -553,6 +601,19 @@ DECLARE_XBOXKRNL_EXPORT1(KeInitializeSemaphore, kThreading, kImplemented);
 
 uint32_t xeKeReleaseSemaphore(X_KSEMAPHORE* semaphore_ptr, uint32_t increment,
                               uint32_t adjustment, uint32_t wait) {
+  int32_t previous_count = 0;
+  bool released = false;
+  if (IsNativeObjectInitialized(&semaphore_ptr->header) &&
+      semaphore_ptr->header.type == 5) {
+    released = true;
+    if (XSemaphore::TryReleaseNative(semaphore_ptr, int32_t(adjustment),
+                                     &previous_count)) {
+      ke_release_semaphore_stats_.Record(true);
+      return previous_count;
+    }
+  }
+  ke_release_semaphore_stats_.Record(false);
+
   auto sem =
       XObject::GetNativeObject<XSemaphore>(kernel_state(), semaphore_ptr);
   if (!sem) {
@@ -563,6 +624,11 @@ uint32_t xeKeReleaseSemaphore(X_KSEMAPHORE* semaphore_ptr, uint32_t increment,
   // TODO(benvanik): increment thread priority?
   // TODO(benvanik): wait?
 
+  if (released) {
+    // Already released into guest memory, only host waiters are left to wake.
+    sem->ReleaseSemaphore(0);
+    return previous_count;
+  }
   return sem->ReleaseSemaphore(adjustment);
 }
 
@@ -779,6 +845,27 @@ DECLARE_XBOXKRNL_EXPORT1(NtCancelTimer, kThreading, kImplemented);
 uint32_t xeKeWaitForSingleObject(void* object_ptr, uint32_t wait_reason,
                                  uint32_t processor_mode, uint32_t alertable,
                                  uint64_t* timeout_ptr) {
+  // Signaled events and semaphores are acquired straight from guest memory.
+  auto header = reinterpret_cast<X_DISPATCH_HEADER*>(object_ptr);
+  if (IsNativeObjectInitialized(header)) {
+    bool acquired = false;
+    switch (header->type) {
+      case 0:  // EventNotificationObject
+      case 1:  // EventSynchronizationObject
+        acquired = XEvent::TryWaitNative(header);
+        break;
+      case 5:  // SemaphoreObject
+        acquired =
+            XSemaphore::TryWaitNative(reinterpret_cast<X_KSEMAPHORE*>(header));
+        break;
+    }
+    if (acquired) {
+      ke_wait_for_single_object_stats_.Record(true);
+      return X_STATUS_SUCCESS;
+    }
+  }
+  ke_wait_for_single_object_stats_.Record(false);
+
   auto object = XObject::GetNativeObject<XObject>(kernel_state(), object_ptr);
 
   if (!object) {
@@ -917,11 +1004,7 @@ uint32_t xeKeKfAcquireSpinLock(uint32_t* lock) {
   //     lock_ptr);
 
   // Lock.
-  while (!xe::atomic_cas(0, 1, lock)) {
-    // Spin!
-    // TODO(benvanik): error on deadlock?
-    xe::threading::MaybeYield();
-  }
+  util::AcquireGuestSpinLock(kernel_memory()->HostToGuestVirtual(lock), lock);
 
   // Raise IRQL to DISPATCH.
   XThread* thread = XThread::GetCurrentThread();
@@ -943,7 +1026,7 @@ void xeKeKfReleaseSpinLock(uint32_t* lock, dword_t old_irql) {
   thread->LowerIrql(old_irql);
 
   // Unlock.
-  xe::atomic_dec(lock);
+  util::ReleaseGuestSpinLock(kernel_memory()->HostToGuestVirtual(lock), lock);
 }
 
 void KfReleaseSpinLock_entry(lpdword_t lock_ptr, dword_t old_irql) {
@@ -956,10 +1039,7 @@ DECLARE_XBOXKRNL_EXPORT2(KfReleaseSpinLock, kThreading, kImplemented,
 void KeAcquireSpinLockAtRaisedIrql_entry(lpdword_t lock_ptr) {
   // Lock.
   auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  while (!xe::atomic_cas(0, 1, lock)) {
-    // Spin!
-    // TODO(benvanik): error on deadlock?
-  }
+  util::AcquireGuestSpinLock(lock_ptr.guest_address(), lock);
 }
 DECLARE_XBOXKRNL_EXPORT3(KeAcquireSpinLockAtRaisedIrql, kThreading,
                          kImplemented, kBlocking, kHighFrequency);
@@ -967,7 +1047,7 @@ DECLARE_XBOXKRNL_EXPORT3(KeAcquireSpinLockAtRaisedIrql, kThreading,
 dword_result_t KeTryToAcquireSpinLockAtRaisedIrql_entry(lpdword_t lock_ptr) {
   // Lock.
   auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  if (!xe::atomic_cas(0, 1, lock)) {
+  if (!util::TryAcquireGuestSpinLock(lock_ptr.guest_address(), lock)) {
     return 0;
   }
   return 1;
@@ -978,7 +1058,7 @@ DECLARE_XBOXKRNL_EXPORT4(KeTryToAcquireSpinLockAtRaisedIrql, kThreading,
 void KeReleaseSpinLockFromRaisedIrql_entry(lpdword_t lock_ptr) {
   // Unlock.
   auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  xe::atomic_dec(lock);
+  util::ReleaseGuestSpinLock(lock_ptr.guest_address(), lock);
 }
 DECLARE_XBOXKRNL_EXPORT2(KeReleaseSpinLockFromRaisedIrql, kThreading,
                          kImplemented, kHighFrequency);
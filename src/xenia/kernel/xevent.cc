@@ -23,14 +23,16 @@ XEvent::~XEvent() = default;
 void XEvent::Initialize(bool manual_reset, bool initial_state) {
   assert_false(event_);
 
-  this->CreateNative<X_KEVENT>();
-
-  if (manual_reset) {
-    event_ = xe::threading::Event::CreateManualResetEvent(initial_state);
+  manual_reset_ = manual_reset;
+  auto native_event = this->CreateNative<X_KEVENT>();
+  if (native_event) {
+    native_header_ = &native_event->header;
+    native_header_->type = manual_reset ? 0 : 1;
+    native_header_->signal_state = initial_state ? 1 : 0;
+    CreateHostEvent(false);
   } else {
-    event_ = xe::threading::Event::CreateAutoResetEvent(initial_state);
+    CreateHostEvent(initial_state);
   }
-  assert_not_null(event_);
 }
 
 void XEvent::InitializeNative(void* native_ptr, X_DISPATCH_HEADER* header) {
@@ -48,7 +50,13 @@ void XEvent::InitializeNative(void* native_ptr, X_DISPATCH_HEADER* header) {
       return;
   }
 
-  bool initial_state = header->signal_state ? true : false;
+  // The initial state stays in guest memory.
+  native_header_ = header;
+  SetHostWaiters(native_header_, false);
+  CreateHostEvent(false);
+}
+
+void XEvent::CreateHostEvent(bool initial_state) {
   if (manual_reset_) {
     event_ = xe::threading::Event::CreateManualResetEvent(initial_state);
   } else {
@@ -57,27 +65,119 @@ void XEvent::InitializeNative(void* native_ptr, X_DISPATCH_HEADER* header) {
   assert_not_null(event_);
 }
 
+bool XEvent::TryWaitNative(X_DISPATCH_HEADER* header) {
+  uint32_t signal_state = LoadSignalState(header);
+  if (header->type == 0x00) {
+    // Notification events stay signaled.
+    return signal_state != 0;
+  }
+  while (signal_state) {
+    if (CompareExchangeSignalState(header, signal_state, 0)) {
+      return true;
+    }
+    signal_state = LoadSignalState(header);
+  }
+  return false;
+}
+
+bool XEvent::TrySetNative(X_DISPATCH_HEADER* header) {
+  ExchangeSignalState(header, 1);
+  return !HasHostWaiters(header);
+}
+
+bool XEvent::TryAcquireNativeSignalState() {
+  return native_header_ && TryWaitNative(native_header_);
+}
+
+void XEvent::BeginHostWait() {
+  if (!native_header_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(host_wait_mutex_);
+  if (!host_waiter_count_++) {
+    SetHostWaiters(native_header_, true);
+  }
+  MoveSignalStateToHost();
+}
+
+void XEvent::EndHostWait() {
+  if (!native_header_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(host_wait_mutex_);
+  if (!--host_waiter_count_) {
+    MoveSignalStateToGuest();
+  }
+}
+
+void XEvent::MoveSignalStateToHost() {
+  if (ExchangeSignalState(native_header_, 0)) {
+    event_->Set();
+  }
+}
+
+void XEvent::MoveSignalStateToGuest() {
+  // Signals only reach the host event while the header is flagged, and
+  // signalers move them over with the mutex held, so none can be left behind
+  // once the flag is cleared.
+  if (xe::threading::Wait(event_.get(), false, std::chrono::milliseconds(0)) ==
+      xe::threading::WaitResult::kSuccess) {
+    if (manual_reset_) {
+      event_->Reset();
+    }
+    ExchangeSignalState(native_header_, 1);
+  }
+  SetHostWaiters(native_header_, false);
+}
+
 int32_t XEvent::Set(uint32_t priority_increment, bool wait) {
-  event_->Set();
+  if (!native_header_) {
+    event_->Set();
+    return 1;
+  }
+  if (!TrySetNative(native_header_)) {
+    std::lock_guard<std::mutex> lock(host_wait_mutex_);
+    if (host_waiter_count_) {
+      MoveSignalStateToHost();
+    } else {
+      // The last waiter is leaving, or the flag is stale from a save state.
+      MoveSignalStateToGuest();
+    }
+  }
   return 1;
 }
 
 int32_t XEvent::Pulse(uint32_t priority_increment, bool wait) {
-  event_->Pulse();
+  if (!native_header_) {
+    event_->Pulse();
+    return 1;
+  }
+  // Only threads already blocked on the host event can be released.
+  std::lock_guard<std::mutex> lock(host_wait_mutex_);
+  ExchangeSignalState(native_header_, 0);
+  if (host_waiter_count_) {
+    event_->Pulse();
+  }
   return 1;
 }
 
 int32_t XEvent::Reset() {
+  std::lock_guard<std::mutex> lock(host_wait_mutex_);
+  if (native_header_) {
+    ExchangeSignalState(native_header_, 0);
+  }
   event_->Reset();
   return 1;
 }
 
-void XEvent::Clear() { event_->Reset(); }
+void XEvent::Clear() { Reset(); }
 
 bool XEvent::Save(ByteStream* stream) {
   XELOGD("XEvent {:08X} ({})", handle(), manual_reset_ ? "manual" : "auto");
   SaveObject(stream);
 
+  // Only the part of the signal state held by the host event - the rest is in
+  // guest memory.
   bool signaled = true;
   auto result =
       xe::threading::Wait(event_.get(), false, std::chrono::milliseconds(0));
@@ -96,6 +196,8 @@ bool XEvent::Save(ByteStream* stream) {
 
   stream->Write<bool>(signaled);
   stream->Write<bool>(manual_reset_);
+  stream->Write<uint32_t>(
+      native_header_ ? memory()->HostToGuestVirtual(native_header_) : 0);
 
   return true;
 }
@@ -108,17 +210,13 @@ object_ref<XEvent> XEvent::Restore(KernelState* kernel_state,
   evt->RestoreObject(stream);
   bool signaled = stream->Read<bool>();
   evt->manual_reset_ = stream->Read<bool>();
-
-  if (evt->manual_reset_) {
-    evt->event_ = xe::threading::Event::CreateManualResetEvent(false);
-  } else {
-    evt->event_ = xe::threading::Event::CreateAutoResetEvent(false);
+  uint32_t native_header_ptr = stream->Read<uint32_t>();
+  if (native_header_ptr) {
+    evt->native_header_ =
+        evt->memory()->TranslateVirtual<X_DISPATCH_HEADER*>(native_header_ptr);
   }
-  assert_not_null(evt->event_);
 
-  if (signaled) {
-    evt->event_->Set();
-  }
+  evt->CreateHostEvent(signaled);
 
   return object_ref<XEvent>(evt);
 }
@@ -10,6 +10,8 @@
 #ifndef XENIA_KERNEL_XEVENT_H_
 #define XENIA_KERNEL_XEVENT_H_
 
+#include <mutex>
+
 #include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
@@ -23,6 +25,12 @@ struct X_KEVENT {
 };
 static_assert_size(X_KEVENT, 0x10);
 
+// Like the kernel, events keep their signal state in the guest dispatch
+// header, so setting and waiting on an event only takes an atomic operation on
+// guest memory when no thread has to block. The host event is only used for
+// blocking: while host threads wait on it, the header is flagged and signals
+// are moved over to the host event, and whatever it still holds when the last
+// host waiter leaves is moved back.
 class XEvent : public XObject {
  public:
   static const XObject::Type kObjectType = XObject::Type::Event;
@@ -38,16 +46,36 @@ class XEvent : public XObject {
   int32_t Reset();
   void Clear();
 
+  // Fast paths operating on the guest dispatch header of an event alone.
+  // Returns whether the event was signaled, consuming the signal if it is a
+  // synchronization event.
+  static bool TryWaitNative(X_DISPATCH_HEADER* header);
+  // Returns false if host threads are waiting on the event, in which case Set
+  // must be called on the object to wake them.
+  static bool TrySetNative(X_DISPATCH_HEADER* header);
+
   bool Save(ByteStream* stream) override;
   static object_ref<XEvent> Restore(KernelState* kernel_state,
                                     ByteStream* stream);
 
  protected:
   xe::threading::WaitHandle* GetWaitHandle() override { return event_.get(); }
+  bool TryAcquireNativeSignalState() override;
+  void BeginHostWait() override;
+  void EndHostWait() override;
 
  private:
+  void CreateHostEvent(bool initial_state);
+  // These must be called with host_wait_mutex_ held.
+  void MoveSignalStateToHost();
+  void MoveSignalStateToGuest();
+
   bool manual_reset_ = false;
   std::unique_ptr<xe::threading::Event> event_;
+  // Null if the guest object couldn't be allocated.
+  X_DISPATCH_HEADER* native_header_ = nullptr;
+  std::mutex host_wait_mutex_;
+  uint32_t host_waiter_count_ = 0;
 };
 
 }  // namespace kernel
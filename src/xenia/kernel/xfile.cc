@@ -167,14 +167,7 @@ X_STATUS XFile::Read(uint32_t buffer_guest_address, uint32_t buffer_length,
   }
 
   if (notify_completion) {
-    XIOCompletion::IONotification notify;
-    notify.apc_context = apc_context;
-    notify.num_bytes = uint32_t(bytes_read);
-    notify.status = result;
-
-    NotifyIOCompletionPorts(notify);
-
-    async_event_->Set();
+    NotifyCompletion(apc_context, result, uint32_t(bytes_read));
   }
 
   return result;
@@ -182,7 +175,7 @@ X_STATUS XFile::Read(uint32_t buffer_guest_address, uint32_t buffer_length,
 
 X_STATUS XFile::ReadScatter(uint32_t segments_guest_address, uint32_t length,
                             uint64_t byte_offset, uint32_t* out_bytes_read,
-                            uint32_t apc_context) {
+                            uint32_t apc_context, bool notify_completion) {
   X_STATUS result = X_STATUS_SUCCESS;
 
   // segments points to an array of buffer pointers of type
@@ -224,21 +217,16 @@ X_STATUS XFile::ReadScatter(uint32_t segments_guest_address, uint32_t length,
     *out_bytes_read = uint32_t(read_total);
   }
 
-  XIOCompletion::IONotification notify;
-  notify.apc_context = apc_context;
-  notify.num_bytes = uint32_t(read_total);
-  notify.status = result;
-
-  NotifyIOCompletionPorts(notify);
-
-  async_event_->Set();
+  if (notify_completion) {
+    NotifyCompletion(apc_context, result, read_total);
+  }
 
   return result;
 }
 
 X_STATUS XFile::Write(uint32_t buffer_guest_address, uint32_t buffer_length,
                       uint64_t byte_offset, uint32_t* out_bytes_written,
-                      uint32_t apc_context) {
+                      uint32_t apc_context, bool notify_completion) {
   if (byte_offset == uint64_t(-1)) {
     // Write from current position.
     byte_offset = position_;
@@ -252,19 +240,26 @@ X_STATUS XFile::Write(uint32_t buffer_guest_address, uint32_t buffer_length,
     position_ += bytes_written;
   }
 
+  if (out_bytes_written) {
+    *out_bytes_written = uint32_t(bytes_written);
+  }
+
+  if (notify_completion) {
+    NotifyCompletion(apc_context, result, uint32_t(bytes_written));
+  }
+  return result;
+}
+
+void XFile::NotifyCompletion(uint32_t apc_context, X_STATUS status,
+                             uint32_t length) {
   XIOCompletion::IONotification notify;
   notify.apc_context = apc_context;
-  notify.num_bytes = uint32_t(bytes_written);
-  notify.status = result;
+  notify.num_bytes = length;
+  notify.status = status;
 
   NotifyIOCompletionPorts(notify);
 
-  if (out_bytes_written) {
-    *out_bytes_written = uint32_t(bytes_written);
-  }
-
   async_event_->Set();
-  return result;
 }
 
 X_STATUS XFile::SetLength(size_t length) { return file_->SetLength(length); }
@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_XFILE_H_
 #define XENIA_KERNEL_XFILE_H_
 
+#include <atomic>
 #include <string>
 
 #include "xenia/kernel/xevent.h"
@@ -103,11 +104,16 @@ class XFile : public XObject {
 
   X_STATUS ReadScatter(uint32_t segments_guest_address, uint32_t length,
                        uint64_t byte_offset, uint32_t* out_bytes_read,
-                       uint32_t apc_context);
+                       uint32_t apc_context, bool notify_completion = true);
 
   X_STATUS Write(uint32_t buffer_guess_address, uint32_t buffer_length,
                  uint64_t byte_offset, uint32_t* out_bytes_written,
-                 uint32_t apc_context);
+                 uint32_t apc_context, bool notify_completion = true);
+
+  // Queues the completion to the I/O completion ports and signals the file
+  // object, done by the transfers above unless notify_completion is false.
+  void NotifyCompletion(uint32_t apc_context, X_STATUS status,
+                        uint32_t length);
 
   X_STATUS SetLength(size_t length);
 
@@ -120,6 +126,10 @@ class XFile : public XObject {
 
   bool is_synchronous() const { return is_synchronous_; }
 
+  // Unsignals the file object when an asynchronous read or write starts, it's
+  // signalled again when the transfer completes.
+  void ResetAsyncEvent() { async_event_->Reset(); }
+
  protected:
   void NotifyIOCompletionPorts(XIOCompletion::IONotification& notification);
 
@@ -138,7 +148,8 @@ class XFile : public XObject {
 
   // TODO(benvanik): create flags, open state, etc.
 
-  uint64_t position_ = 0;
+  // Also updated by asynchronous transfers on the kernel file I/O workers.
+  std::atomic<uint64_t> position_ = {0};
 
   xe::filesystem::WildcardEngine find_engine_;
   size_t find_index_ = 0;
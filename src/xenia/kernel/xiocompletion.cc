@@ -29,8 +29,8 @@ void XIOCompletion::QueueNotification(IONotification& notification) {
 
 bool XIOCompletion::WaitForNotification(uint64_t wait_ticks,
                                         IONotification* notify) {
-  auto ms = std::chrono::milliseconds(TimeoutTicksToMs(wait_ticks));
-  auto res = threading::Wait(notification_semaphore_.get(), false, ms);
+  auto timeout = TimeoutTicksToDuration(wait_ticks);
+  auto res = threading::Wait(notification_semaphore_.get(), false, timeout);
   if (res == threading::WaitResult::kSuccess) {
     std::unique_lock<std::mutex> lock(notification_lock_);
     assert_false(notifications_.empty());
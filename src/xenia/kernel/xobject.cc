@@ -11,6 +11,7 @@
 
 #include <vector>
 
+#include "xenia/base/atomic.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/kernel/kernel_state.h"
@@ -177,18 +178,24 @@ void XObject::SetAttributes(uint32_t obj_attributes_ptr) {
   }
 }
 
-uint32_t XObject::TimeoutTicksToMs(int64_t timeout_ticks) {
+std::chrono::nanoseconds XObject::TimeoutTicksToDuration(
+    int64_t timeout_ticks) {
   if (timeout_ticks > 0) {
-    // Absolute time, based on January 1, 1601.
-    // TODO(benvanik): convert time to relative time.
-    assert_always();
-    return 0;
-  } else if (timeout_ticks < 0) {
-    // Relative time.
-    return (uint32_t)(-timeout_ticks / 10000);  // Ticks -> MS
-  } else {
-    return 0;
+    // Absolute time, based on January 1, 1601, made relative to the guest
+    // system time.
+    timeout_ticks = std::min(
+        int64_t(Clock::QueryGuestSystemTime()) - timeout_ticks, int64_t(0));
+  }
+  if (!timeout_ticks) {
+    return std::chrono::nanoseconds::zero();
+  }
+  // Relative time, in 100ns ticks. Saturated to an infinite timeout where the
+  // negation or the conversion to nanoseconds would overflow.
+  int64_t scaled_ticks = Clock::ScaleGuestDurationFileTime(timeout_ticks);
+  if (scaled_ticks < -(std::chrono::nanoseconds::max().count() / 100)) {
+    return std::chrono::nanoseconds::max();
   }
+  return xe::chrono::hundrednanoseconds(-scaled_ticks);
 }
 
 X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
@@ -199,13 +206,18 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
     return X_STATUS_SUCCESS;
   }
 
-  auto timeout_ms =
-      opt_timeout ? std::chrono::milliseconds(Clock::ScaleGuestDurationMillis(
-                        TimeoutTicksToMs(*opt_timeout)))
-                  : std::chrono::milliseconds::max();
+  if (TryAcquireNativeSignalState()) {
+    WaitCallback();
+    return X_STATUS_SUCCESS;
+  }
+
+  auto timeout = opt_timeout ? TimeoutTicksToDuration(*opt_timeout)
+                            : std::chrono::nanoseconds::max();
 
+  BeginHostWait();
   auto result =
-      xe::threading::Wait(wait_handle, alertable ? true : false, timeout_ms);
+      xe::threading::Wait(wait_handle, alertable ? true : false, timeout);
+  EndHostWait();
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       WaitCallback();
@@ -226,14 +238,18 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
 X_STATUS XObject::SignalAndWait(XObject* signal_object, XObject* wait_object,
                                 uint32_t wait_reason, uint32_t processor_mode,
                                 uint32_t alertable, uint64_t* opt_timeout) {
-  auto timeout_ms =
-      opt_timeout ? std::chrono::milliseconds(Clock::ScaleGuestDurationMillis(
-                        TimeoutTicksToMs(*opt_timeout)))
-                  : std::chrono::milliseconds::max();
+  auto timeout = opt_timeout ? TimeoutTicksToDuration(*opt_timeout)
+                            : std::chrono::nanoseconds::max();
 
+  // The signal is delivered through the wait handle, so it must hold the
+  // signal state too.
+  signal_object->BeginHostWait();
+  wait_object->BeginHostWait();
   auto result = xe::threading::SignalAndWait(
       signal_object->GetWaitHandle(), wait_object->GetWaitHandle(),
-      alertable ? true : false, timeout_ms);
+      alertable ? true : false, timeout);
+  wait_object->EndHostWait();
+  signal_object->EndHostWait();
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       wait_object->WaitCallback();
@@ -261,14 +277,22 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
     assert_not_null(wait_handles[i]);
   }
 
-  auto timeout_ms =
-      opt_timeout ? std::chrono::milliseconds(Clock::ScaleGuestDurationMillis(
-                        TimeoutTicksToMs(*opt_timeout)))
-                  : std::chrono::milliseconds::max();
+  auto timeout = opt_timeout ? TimeoutTicksToDuration(*opt_timeout)
+                            : std::chrono::nanoseconds::max();
+
+  for (uint32_t i = 0; i < count; ++i) {
+    objects[i]->BeginHostWait();
+  }
+  auto end_host_waits = [count, objects]() {
+    for (uint32_t i = 0; i < count; ++i) {
+      objects[i]->EndHostWait();
+    }
+  };
 
   if (wait_type) {
     auto result = xe::threading::WaitAny(std::move(wait_handles),
-                                         alertable ? true : false, timeout_ms);
+                                         alertable ? true : false, timeout);
+    end_host_waits();
     switch (result.first) {
       case xe::threading::WaitResult::kSuccess:
         objects[result.second]->WaitCallback();
@@ -288,7 +312,8 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
     }
   } else {
     auto result = xe::threading::WaitAll(std::move(wait_handles),
-                                         alertable ? true : false, timeout_ms);
+                                         alertable ? true : false, timeout);
+    end_host_waits();
     switch (result) {
       case xe::threading::WaitResult::kSuccess:
         for (uint32_t i = 0; i < count; i++) {
@@ -310,6 +335,41 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
   }
 }
 
+uint32_t XObject::LoadSignalState(const X_DISPATCH_HEADER* header) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return xe::byte_swap(
+      *reinterpret_cast<const volatile uint32_t*>(&header->signal_state));
+}
+
+uint32_t XObject::ExchangeSignalState(X_DISPATCH_HEADER* header,
+                                      uint32_t new_value) {
+  return xe::byte_swap(xe::atomic_exchange(
+      xe::byte_swap(new_value),
+      reinterpret_cast<volatile uint32_t*>(&header->signal_state)));
+}
+
+bool XObject::CompareExchangeSignalState(X_DISPATCH_HEADER* header,
+                                         uint32_t old_value,
+                                         uint32_t new_value) {
+  return xe::atomic_cas(
+      xe::byte_swap(old_value), xe::byte_swap(new_value),
+      reinterpret_cast<volatile uint32_t*>(&header->signal_state));
+}
+
+bool XObject::HasHostWaiters(const X_DISPATCH_HEADER* header) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return *reinterpret_cast<const volatile uint8_t*>(&header->host_waiters) !=
+         0;
+}
+
+void XObject::SetHostWaiters(X_DISPATCH_HEADER* header, bool host_waiters) {
+  *reinterpret_cast<volatile uint8_t*>(&header->host_waiters) =
+      host_waiters ? 1 : 0;
+  // Ordered against the signal state accesses that follow, which pairs with
+  // the signal state update that precedes HasHostWaiters when signaling.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
 uint8_t* XObject::CreateNative(uint32_t size) {
   auto global_lock = xe::global_critical_region::AcquireDirect();
 
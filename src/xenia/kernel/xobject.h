@@ -12,6 +12,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <string>
 
@@ -53,6 +54,9 @@ typedef struct {
       uint8_t inserted;
       uint8_t debug_active;
       uint8_t dpc_active;
+      // Xenia: set on events and semaphores while host threads are waiting on
+      // their host wait handle, see XEvent.
+      uint8_t host_waiters;
     };
   };
 
@@ -205,6 +209,24 @@ class XObject {
   virtual void WaitCallback() {}
   virtual xe::threading::WaitHandle* GetWaitHandle() { return nullptr; }
 
+  // Objects keeping their signal state in their guest dispatch header can
+  // satisfy waits from it directly, without going through the wait handle.
+  virtual bool TryAcquireNativeSignalState() { return false; }
+  // Bracket host waits on the wait handle. Objects keeping their signal state
+  // in the guest dispatch header move it to the wait handle in between.
+  virtual void BeginHostWait() {}
+  virtual void EndHostWait() {}
+
+  // Atomic accessors for the signal state in the guest dispatch header.
+  static uint32_t LoadSignalState(const X_DISPATCH_HEADER* header);
+  static uint32_t ExchangeSignalState(X_DISPATCH_HEADER* header,
+                                      uint32_t new_value);
+  static bool CompareExchangeSignalState(X_DISPATCH_HEADER* header,
+                                         uint32_t old_value,
+                                         uint32_t new_value);
+  static bool HasHostWaiters(const X_DISPATCH_HEADER* header);
+  static void SetHostWaiters(X_DISPATCH_HEADER* header, bool host_waiters);
+
   // Creates the kernel object for guest code to use. Typically not needed.
   uint8_t* CreateNative(uint32_t size);
   void SetNativePointer(uint32_t native_ptr, bool uninitialized = false);
@@ -220,7 +242,9 @@ class XObject {
     header->wait_list_blink = handle;
   }
 
-  static uint32_t TimeoutTicksToMs(int64_t timeout_ticks);
+  // Converts a guest timeout in 100ns ticks, negative if relative, to the
+  // scaled host duration to wait for.
+  static std::chrono::nanoseconds TimeoutTicksToDuration(int64_t timeout_ticks);
 
   KernelState* kernel_state_;
 
@@ -9,6 +9,8 @@
 
 #include "xenia/kernel/xsemaphore.h"
 
+#include <limits>
+
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
 
@@ -23,11 +25,20 @@ XSemaphore::~XSemaphore() = default;
 bool XSemaphore::Initialize(int32_t initial_count, int32_t maximum_count) {
   assert_false(semaphore_);
 
-  CreateNative(sizeof(X_KSEMAPHORE));
-
   maximum_count_ = maximum_count;
-  semaphore_ = xe::threading::Semaphore::Create(initial_count, maximum_count);
-  return !!semaphore_;
+  if (initial_count < 0 || initial_count > maximum_count ||
+      maximum_count <= 0) {
+    return false;
+  }
+  native_semaphore_ =
+      reinterpret_cast<X_KSEMAPHORE*>(CreateNative(sizeof(X_KSEMAPHORE)));
+  if (native_semaphore_) {
+    native_semaphore_->header.type = 5;  // SemaphoreObject
+    native_semaphore_->header.signal_state = uint32_t(initial_count);
+    native_semaphore_->limit = uint32_t(maximum_count);
+    return CreateHostSemaphore(0);
+  }
+  return CreateHostSemaphore(initial_count);
 }
 
 bool XSemaphore::InitializeNative(void* native_ptr, X_DISPATCH_HEADER* header) {
@@ -35,14 +46,121 @@ bool XSemaphore::InitializeNative(void* native_ptr, X_DISPATCH_HEADER* header) {
 
   auto semaphore = reinterpret_cast<X_KSEMAPHORE*>(native_ptr);
   maximum_count_ = semaphore->limit;
-  semaphore_ = xe::threading::Semaphore::Create(semaphore->header.signal_state,
-                                                semaphore->limit);
+  if (!maximum_count_ || semaphore->header.signal_state > maximum_count_) {
+    return false;
+  }
+  // The initial count stays in guest memory.
+  native_semaphore_ = semaphore;
+  SetHostWaiters(&native_semaphore_->header, false);
+  return CreateHostSemaphore(0);
+}
+
+bool XSemaphore::CreateHostSemaphore(int32_t initial_count) {
+  // With the count split between guest memory and the host semaphore, the
+  // limit is enforced when releasing into guest memory.
+  semaphore_ = xe::threading::Semaphore::Create(
+      initial_count, native_semaphore_ ? std::numeric_limits<int32_t>::max()
+                                       : int32_t(maximum_count_));
   return !!semaphore_;
 }
 
+bool XSemaphore::TryWaitNative(X_KSEMAPHORE* semaphore) {
+  uint32_t count = LoadSignalState(&semaphore->header);
+  while (count) {
+    if (CompareExchangeSignalState(&semaphore->header, count, count - 1)) {
+      return true;
+    }
+    count = LoadSignalState(&semaphore->header);
+  }
+  return false;
+}
+
+bool XSemaphore::TryReleaseNative(X_KSEMAPHORE* semaphore,
+                                  int32_t release_count,
+                                  int32_t* out_previous_count) {
+  uint32_t limit = semaphore->limit;
+  uint32_t count = LoadSignalState(&semaphore->header);
+  while (true) {
+    *out_previous_count = int32_t(count);
+    if (release_count < 0 || count > limit ||
+        uint32_t(release_count) > limit - count) {
+      // Over the limit, nothing is released.
+      return true;
+    }
+    if (CompareExchangeSignalState(&semaphore->header, count,
+                                   count + uint32_t(release_count))) {
+      break;
+    }
+    count = LoadSignalState(&semaphore->header);
+  }
+  return !HasHostWaiters(&semaphore->header);
+}
+
+bool XSemaphore::TryAcquireNativeSignalState() {
+  return native_semaphore_ && TryWaitNative(native_semaphore_);
+}
+
+void XSemaphore::BeginHostWait() {
+  if (!native_semaphore_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(host_wait_mutex_);
+  if (!host_waiter_count_++) {
+    SetHostWaiters(&native_semaphore_->header, true);
+  }
+  MoveSignalStateToHost();
+}
+
+void XSemaphore::EndHostWait() {
+  if (!native_semaphore_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(host_wait_mutex_);
+  if (!--host_waiter_count_) {
+    MoveSignalStateToGuest();
+  }
+}
+
+void XSemaphore::MoveSignalStateToHost() {
+  uint32_t count = ExchangeSignalState(&native_semaphore_->header, 0);
+  if (count) {
+    semaphore_->Release(int32_t(count), nullptr);
+  }
+}
+
+void XSemaphore::MoveSignalStateToGuest() {
+  // See XEvent::MoveSignalStateToGuest.
+  uint32_t count = 0;
+  while (xe::threading::Wait(semaphore_.get(), false,
+                             std::chrono::milliseconds(0)) ==
+         xe::threading::WaitResult::kSuccess) {
+    ++count;
+  }
+  if (count) {
+    uint32_t guest_count = LoadSignalState(&native_semaphore_->header);
+    while (!CompareExchangeSignalState(&native_semaphore_->header, guest_count,
+                                       guest_count + count)) {
+      guest_count = LoadSignalState(&native_semaphore_->header);
+    }
+  }
+  SetHostWaiters(&native_semaphore_->header, false);
+}
+
 int32_t XSemaphore::ReleaseSemaphore(int32_t release_count) {
   int32_t previous_count = 0;
-  semaphore_->Release(release_count, &previous_count);
+  if (!native_semaphore_) {
+    semaphore_->Release(release_count, &previous_count);
+    return previous_count;
+  }
+  if (!TryReleaseNative(native_semaphore_, release_count, &previous_count)) {
+    std::lock_guard<std::mutex> lock(host_wait_mutex_);
+    if (host_waiter_count_) {
+      MoveSignalStateToHost();
+    } else {
+      // The last waiter is leaving, or the flag is stale from a save state.
+      MoveSignalStateToGuest();
+    }
+  }
   return previous_count;
 }
 
@@ -51,7 +169,8 @@ bool XSemaphore::Save(ByteStream* stream) {
     return false;
   }
 
-  // Get the free number of slots from the semaphore.
+  // Get the free number of slots from the semaphore. This is only the part
+  // held by the host semaphore - the rest is in guest memory.
   uint32_t free_count = 0;
   while (
       threading::Wait(semaphore_.get(), false, std::chrono::milliseconds(0)) ==
@@ -63,10 +182,14 @@ bool XSemaphore::Save(ByteStream* stream) {
          maximum_count_);
 
   // Restore the semaphore back to its previous count.
-  semaphore_->Release(free_count, nullptr);
+  if (free_count) {
+    semaphore_->Release(free_count, nullptr);
+  }
 
   stream->Write(maximum_count_);
   stream->Write(free_count);
+  stream->Write<uint32_t>(
+      native_semaphore_ ? memory()->HostToGuestVirtual(native_semaphore_) : 0);
 
   return true;
 }
@@ -82,12 +205,16 @@ object_ref<XSemaphore> XSemaphore::Restore(KernelState* kernel_state,
 
   sem->maximum_count_ = stream->Read<uint32_t>();
   auto free_count = stream->Read<uint32_t>();
+  uint32_t native_semaphore_ptr = stream->Read<uint32_t>();
+  if (native_semaphore_ptr) {
+    sem->native_semaphore_ =
+        sem->memory()->TranslateVirtual<X_KSEMAPHORE*>(native_semaphore_ptr);
+  }
   XELOGD("XSemaphore {:08X} (count {}/{})", sem->handle(), free_count,
          sem->maximum_count_);
 
-  sem->semaphore_ =
-      threading::Semaphore::Create(free_count, sem->maximum_count_);
-  assert_not_null(sem->semaphore_);
+  bool created = sem->CreateHostSemaphore(free_count);
+  assert_true(created);
 
   return object_ref<XSemaphore>(sem);
 }
@@ -10,6 +10,8 @@
 #ifndef XENIA_KERNEL_XSEMAPHORE_H_
 #define XENIA_KERNEL_XSEMAPHORE_H_
 
+#include <mutex>
+
 #include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
@@ -23,6 +25,8 @@ struct X_KSEMAPHORE {
 };
 static_assert_size(X_KSEMAPHORE, 0x14);
 
+// Keeps its count in the guest dispatch header, moving it to the host
+// semaphore while host threads wait on it, the same way XEvent does.
 class XSemaphore : public XObject {
  public:
   static const XObject::Type kObjectType = XObject::Type::Semaphore;
@@ -36,6 +40,15 @@ class XSemaphore : public XObject {
 
   int32_t ReleaseSemaphore(int32_t release_count);
 
+  // Fast paths operating on the guest semaphore alone.
+  // Returns whether the count was nonzero, decrementing it if so.
+  static bool TryWaitNative(X_KSEMAPHORE* semaphore);
+  // Returns false if host threads are waiting on the semaphore, in which case
+  // ReleaseSemaphore must be called on the object with a zero count to wake
+  // them.
+  static bool TryReleaseNative(X_KSEMAPHORE* semaphore, int32_t release_count,
+                               int32_t* out_previous_count);
+
   bool Save(ByteStream* stream) override;
   static object_ref<XSemaphore> Restore(KernelState* kernel_state,
                                         ByteStream* stream);
@@ -44,10 +57,22 @@ class XSemaphore : public XObject {
   xe::threading::WaitHandle* GetWaitHandle() override {
     return semaphore_.get();
   }
+  bool TryAcquireNativeSignalState() override;
+  void BeginHostWait() override;
+  void EndHostWait() override;
 
  private:
+  bool CreateHostSemaphore(int32_t initial_count);
+  // These must be called with host_wait_mutex_ held.
+  void MoveSignalStateToHost();
+  void MoveSignalStateToGuest();
+
   std::unique_ptr<xe::threading::Semaphore> semaphore_;
   uint32_t maximum_count_ = 0;
+  // Null if the guest object couldn't be allocated.
+  X_KSEMAPHORE* native_semaphore_ = nullptr;
+  std::mutex host_wait_mutex_;
+  uint32_t host_waiter_count_ = 0;
 };
 
 }  // namespace kernel
@@ -47,7 +47,10 @@ X_STATUS XTimer::SetTimer(int64_t due_time, uint32_t period_ms,
     return X_STATUS_TIMER_RESUME_IGNORED;
   }
 
-  period_ms = Clock::ScaleGuestDurationMillis(period_ms);
+  // Scaled with 100ns precision, so that short periods aren't rounded down to
+  // zero and made one-shot.
+  auto period = xe::chrono::hundrednanoseconds(
+      -Clock::ScaleGuestDurationFileTime(-int64_t(period_ms) * 10000));
   WinSystemClock::time_point due_tp;
   if (due_time < 0) {
     // Any timer implementation uses absolute times eventually, convert as early
@@ -82,11 +85,10 @@ X_STATUS XTimer::SetTimer(int64_t due_time, uint32_t period_ms,
   }
 
   bool result;
-  if (!period_ms) {
+  if (period == period.zero()) {
     result = timer_->SetOnceAt(due_tp, std::move(callback));
   } else {
-    result = timer_->SetRepeatingAt(
-        due_tp, std::chrono::milliseconds(period_ms), std::move(callback));
+    result = timer_->SetRepeatingAt(due_tp, period, std::move(callback));
   }
 
   return result ? X_STATUS_SUCCESS : X_STATUS_UNSUCCESSFUL;
@@ -10,17 +10,24 @@
 #include "xenia/memory.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <functional>
+#include <thread>
 #include <utility>
 
 #include "third_party/fmt/include/fmt/format.h"
+#include "third_party/snappy/snappy.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/range_bit_map.h"
 #include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/mmio_handler.h"
 
 // TODO(benvanik): move xbox.h out
@@ -38,6 +45,112 @@ uint32_t get_page_count(uint32_t value, uint32_t page_size) {
   return xe::round_up(value, page_size) / page_size;
 }
 
+// Save states store page contents as chunks of this size, compressed
+// independently so that they can be compressed in parallel and skipped by
+// incremental saves if unchanged. Snappy compresses 64 KB blocks
+// independently anyway, so larger chunks wouldn't compress better.
+constexpr uint32_t kSnapshotChunkSize = 64 * 1024;
+// Chunks are compressed or decompressed in parallel in batches of this many,
+// and written or read sequentially between the batches.
+constexpr uint32_t kSnapshotChunkBatchSize = 1024;
+constexpr uint32_t kSnapshotChunkEnd = UINT32_MAX;
+
+// Host threads compressing or decompressing snapshot chunks. Created once per
+// save or restore rather than for every batch of chunks.
+class SnapshotThreadPool {
+ public:
+  SnapshotThreadPool() {
+    uint32_t thread_count = xe::threading::logical_processor_count();
+    for (uint32_t i = 1; i < thread_count; ++i) {
+      threads_.emplace_back([this]() { WorkerMain(); });
+    }
+  }
+
+  ~SnapshotThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+    }
+    work_cond_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Calls function for every index in [0, count), on the calling thread and
+  // the workers.
+  void ParallelFor(uint32_t count,
+                   const std::function<void(uint32_t index)>& function) {
+    if (threads_.empty() || count <= 1) {
+      for (uint32_t i = 0; i < count; ++i) {
+        function(i);
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      function_ = &function;
+      count_ = count;
+      next_index_ = 0;
+      busy_count_ = uint32_t(threads_.size());
+      ++generation_;
+    }
+    work_cond_.notify_all();
+    RunIndices(function, count);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this]() { return !busy_count_; });
+    function_ = nullptr;
+  }
+
+ private:
+  void RunIndices(const std::function<void(uint32_t index)>& function,
+                  uint32_t count) {
+    for (uint32_t index; (index = next_index_++) < count;) {
+      function(index);
+    }
+  }
+
+  void WorkerMain() {
+    uint32_t generation = 0;
+    while (true) {
+      const std::function<void(uint32_t index)>* function;
+      uint32_t count;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cond_.wait(lock, [&]() {
+          return shutdown_ || generation_ != generation;
+        });
+        if (shutdown_) {
+          return;
+        }
+        generation = generation_;
+        function = function_;
+        count = count_;
+      }
+      RunIndices(*function, count);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_count_) {
+          continue;
+        }
+      }
+      done_cond_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable done_cond_;
+  const std::function<void(uint32_t index)>* function_ = nullptr;
+  uint32_t count_ = 0;
+  std::atomic<uint32_t> next_index_ = {0};
+  // Incremented for every ParallelFor, so workers take part once in each.
+  uint32_t generation_ = 0;
+  uint32_t busy_count_ = 0;
+  bool shutdown_ = false;
+};
+
 /**
  * Memory map:
  * 0x00000000 - 0x3FFFFFFF (1024mb) - virtual 4k pages
@@ -580,28 +693,180 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
-bool Memory::Save(ByteStream* stream) {
+bool Memory::Save(ByteStream* stream, bool incremental) {
   XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
+  auto global_lock = global_critical_region_.Acquire();
+  assert_true(!incremental || CanSaveIncremental());
+  uint64_t start_time = Clock::QueryHostUptimeMillis();
+  size_t start_offset = stream->offset();
+  stream->Write(incremental);
+
+  BaseHeap* const heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,
+  };
+
+  // Pages can be written through any view aliasing them, so gather the
+  // written pages of the whole mapping.
+  std::vector<uint64_t> written_mapping_pages;
+  bool write_tracking = incremental && snapshot_write_tracking_;
+  if (write_tracking) {
+    size_t host_page_size = xe::memory::page_size();
+    uint64_t granularity_mask = ~uint64_t(system_allocation_granularity_ - 1);
+    std::vector<uint64_t> written_view_pages;
+    for (size_t n = 0; write_tracking && n < xe::countof(map_info); n++) {
+      size_t view_size = size_t(map_info[n].virtual_address_end -
+                                map_info[n].virtual_address_start + 1);
+      size_t view_page_count = view_size / host_page_size;
+      size_t first_mapping_page =
+          size_t((map_info[n].target_address & granularity_mask) /
+                 host_page_size);
+      written_mapping_pages.resize(
+          std::max(written_mapping_pages.size(),
+                   (first_mapping_page + view_page_count + 63) / 64));
+      written_view_pages.resize((view_page_count + 63) / 64);
+      write_tracking = xe::memory::QueryPageWriteTracking(
+          views_.all_views[n], view_size, written_view_pages.data(), nullptr);
+      for (size_t i = 0; write_tracking && i < written_view_pages.size();
+           i++) {
+        for (uint64_t bits = written_view_pages[i]; bits;
+             bits &= bits - 1) {
+          size_t mapping_page = first_mapping_page + i * 64 + xe::tzcnt(bits);
+          written_mapping_pages[mapping_page >> 6] |= uint64_t(1)
+                                                      << (mapping_page & 63);
+        }
+      }
+    }
+  }
+
+  SnapshotThreadPool thread_pool;
+  std::vector<bool> written_pages;
+  for (BaseHeap* heap : heaps) {
+    bool has_written_pages =
+        write_tracking &&
+        GetWrittenPages(*heap, written_mapping_pages, written_pages);
+    if (!heap->Save(stream, thread_pool, incremental,
+                    has_written_pages ? &written_pages : nullptr)) {
+      XELOGE("Save state is too large for the memory of heap {:08X}",
+             heap->heap_base());
+      return false;
+    }
+  }
+  snapshot_write_tracking_ = xe::memory::ResetPageWriteTracking();
+
+  XELOGI("Saved {} memory state: {:.1f} MiB in {} ms",
+         incremental ? "incremental" : "full",
+         double(stream->offset() - start_offset) / (1024 * 1024),
+         Clock::QueryHostUptimeMillis() - start_time);
+  return true;
+}
 
+bool Memory::GetWrittenPages(const BaseHeap& heap,
+                             const std::vector<uint64_t>& written_mapping_pages,
+                             std::vector<bool>& written_pages) const {
+  const uint8_t* heap_host_base = heap.TranslateRelative(0);
+  size_t heap_size = heap.heap_size();
+  size_t view_index = 0;
+  size_t view_size = 0;
+  for (; view_index < xe::countof(map_info); view_index++) {
+    view_size = size_t(map_info[view_index].virtual_address_end -
+                       map_info[view_index].virtual_address_start + 1);
+    const uint8_t* view = views_.all_views[view_index];
+    if (heap_host_base >= view &&
+        heap_host_base + heap_size <= view + view_size) {
+      break;
+    }
+  }
+  if (view_index >= xe::countof(map_info)) {
+    return false;
+  }
+
+  // Soft-dirty bits are lost when pages leave physical memory, so pages that
+  // are not resident are treated as written.
+  size_t host_page_size = xe::memory::page_size();
+  size_t host_page_count = heap_size / host_page_size;
+  std::vector<uint64_t> resident_pages((host_page_count + 63) / 64);
+  if (!xe::memory::QueryPageWriteTracking(heap_host_base, heap_size, nullptr,
+                                          resident_pages.data())) {
+    return false;
+  }
+  uint64_t granularity_mask = ~uint64_t(system_allocation_granularity_ - 1);
+  size_t first_mapping_page =
+      size_t(((map_info[view_index].target_address & granularity_mask) +
+              (heap_host_base - views_.all_views[view_index])) /
+             host_page_size);
+  uint32_t page_size = heap.page_size();
+  written_pages.assign(heap_size / page_size, false);
+  for (size_t i = 0; i < host_page_count; i++) {
+    size_t mapping_page = first_mapping_page + i;
+    if (((resident_pages[i >> 6] >> (i & 63)) & 1) &&
+        !((written_mapping_pages[mapping_page >> 6] >> (mapping_page & 63)) &
+          1)) {
+      continue;
+    }
+    size_t first_page = i * host_page_size / page_size;
+    size_t last_page = ((i + 1) * host_page_size - 1) / page_size;
+    for (size_t page = first_page; page <= last_page; page++) {
+      written_pages[page] = true;
+    }
+  }
   return true;
 }
 
-bool Memory::Restore(ByteStream* stream) {
+bool Memory::Restore(const std::vector<ByteStream*>& streams) {
   XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t start_time = Clock::QueryHostUptimeMillis();
+
+  BaseHeap* const heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,
+  };
+  SnapshotThreadPool thread_pool;
+  for (size_t i = 0; i < streams.size(); i++) {
+    ByteStream* stream = streams[i];
+    // Only the first save may be a full one.
+    if (stream->Read<bool>() != (i != 0)) {
+      XELOGE("Memory save state {} of {} is of the wrong type", i + 1,
+             streams.size());
+      return false;
+    }
+    for (BaseHeap* heap : heaps) {
+      if (!heap->Restore(stream, thread_pool)) {
+        XELOGE("Memory save state {} of {} is corrupted in heap {:08X}", i + 1,
+               streams.size(), heap->heap_base());
+        return false;
+      }
+    }
+  }
 
+  for (BaseHeap* heap : heaps) {
+    heap->UpdateSnapshot(thread_pool);
+  }
+  snapshot_write_tracking_ = xe::memory::ResetPageWriteTracking();
+
+  // Physical memory was replaced without faulting on the write watches of
+  // the physical views, so invalidate everything watched there. This also
+  // drops the watches, and their owners set them up again on the next use.
+  PhysicalHeap* const physical_heaps[] = {
+      &heaps_.vA0000000, &heaps_.vC0000000, &heaps_.vE0000000};
+  for (PhysicalHeap* physical_heap : physical_heaps) {
+    physical_heap->TriggerCallbacks(global_critical_region_.Acquire(),
+                                    physical_heap->heap_base(),
+                                    physical_heap->heap_size(), true, true);
+  }
+
+  XELOGI("Restored memory state from {} save(s) in {} ms", streams.size(),
+         Clock::QueryHostUptimeMillis() - start_time);
   return true;
 }
 
+bool Memory::CanSaveIncremental() const {
+  return heaps_.v00000000.has_snapshot() && heaps_.v40000000.has_snapshot() &&
+         heaps_.v80000000.has_snapshot() && heaps_.v90000000.has_snapshot() &&
+         heaps_.physical.has_snapshot();
+}
+
 xe::memory::PageAccess ToPageAccess(uint32_t protect) {
   if ((protect & kMemoryProtectRead) && !(protect & kMemoryProtectWrite)) {
     return xe::memory::PageAccess::kReadOnly;
@@ -650,6 +915,8 @@ void BaseHeap::Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
   page_size_ = page_size;
   host_address_offset_ = host_address_offset;
   page_table_.resize(heap_size / page_size);
+  free_pages_.Resize(uint32_t(page_table_.size()));
+  free_pages_.SetAll(true);
 }
 
 void BaseHeap::Dispose() {
@@ -745,81 +1012,349 @@ uint32_t BaseHeap::GetUnreservedPageCount() {
   return count;
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
-  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
+uint32_t BaseHeap::snapshot_chunk_page_count() const {
+  // The committed pages of a chunk are stored as a 64-bit mask.
+  return std::min(std::max(kSnapshotChunkSize / page_size_, uint32_t(1)),
+                  uint32_t(64));
+}
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
-      continue;
+uint64_t BaseHeap::GetSnapshotChunkCommittedPages(uint32_t chunk_index) const {
+  uint32_t chunk_page_count = snapshot_chunk_page_count();
+  uint32_t first_page = chunk_index * chunk_page_count;
+  uint32_t page_count = std::min(chunk_page_count,
+                                 uint32_t(page_table_.size()) - first_page);
+  uint64_t committed_pages = 0;
+  for (uint32_t i = 0; i < page_count; ++i) {
+    if (page_table_[first_page + i].state & kMemoryAllocationCommit) {
+      committed_pages |= uint64_t(1) << i;
     }
+  }
+  return committed_pages;
+}
 
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
+const uint8_t* BaseHeap::ReadSnapshotChunk(uint32_t chunk_index,
+                                           uint64_t committed_pages,
+                                           std::vector<uint8_t>& buffer) {
+  uint32_t first_page = chunk_index * snapshot_chunk_page_count();
+  bool readable = true;
+  for (uint64_t bits = committed_pages; bits; bits &= bits - 1) {
+    const PageEntry& page = page_table_[first_page + xe::tzcnt(bits)];
+    if (!(page.current_protect & kMemoryProtectRead)) {
+      readable = false;
+      break;
+    }
+  }
+  // Committed pages at the beginning of the chunk can be used in place.
+  if (readable && !(committed_pages & (committed_pages + 1))) {
+    return TranslateRelative<const uint8_t*>(first_page * page_size_);
+  }
+  buffer.resize(xe::bit_count(committed_pages) * page_size_);
+  uint8_t* buffer_page = buffer.data();
+  for (uint64_t bits = committed_pages; bits; bits &= bits - 1) {
+    uint32_t page_number = first_page + xe::tzcnt(bits);
+    const PageEntry& page = page_table_[page_number];
+    void* address = TranslateRelative(page_number * page_size_);
+    bool page_readable = (page.current_protect & kMemoryProtectRead) != 0;
+    if (!page_readable) {
+      xe::memory::Protect(address, page_size_, memory::PageAccess::kReadOnly,
+                          nullptr);
+    }
+    std::memcpy(buffer_page, address, page_size_);
+    if (!page_readable) {
+      xe::memory::Protect(address, page_size_,
+                          ToPageAccess(page.current_protect), nullptr);
+    }
+    buffer_page += page_size_;
+  }
+  return buffer.data();
+}
 
-      stream->Write(addr, page_size_);
+bool BaseHeap::Save(ByteStream* stream, SnapshotThreadPool& thread_pool,
+                    bool incremental,
+                    const std::vector<bool>* written_pages) {
+  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
+  auto global_lock = global_critical_region_.Acquire();
 
-      memory::Protect(addr, page_size_, old_access, nullptr);
+  uint32_t chunk_page_count = snapshot_chunk_page_count();
+  uint32_t page_count = uint32_t(page_table_.size());
+  uint32_t chunk_count = (page_count + chunk_page_count - 1) / chunk_page_count;
+  assert_true(!incremental || snapshot_chunks_.size() == chunk_count);
+  if (!incremental) {
+    snapshot_chunks_.assign(chunk_count, SnapshotChunk{0, 0});
+  }
+
+  auto has_space = [stream](size_t size) {
+    // Leave space for the end of the chunk list.
+    return stream->offset() + size + sizeof(uint32_t) <= stream->data_length();
+  };
+
+  size_t page_table_size = page_count * sizeof(PageEntry);
+  std::vector<char> compressed_page_table(
+      snappy::MaxCompressedLength(page_table_size));
+  size_t compressed_page_table_size;
+  snappy::RawCompress(reinterpret_cast<const char*>(page_table_.data()),
+                      page_table_size, compressed_page_table.data(),
+                      &compressed_page_table_size);
+  if (!has_space(sizeof(uint32_t) * 2 + compressed_page_table_size)) {
+    snapshot_chunks_.clear();
+    return false;
+  }
+  stream->Write(page_count);
+  stream->Write(uint32_t(compressed_page_table_size));
+  stream->Write(compressed_page_table.data(), compressed_page_table_size);
+
+  // Chunks of the committed pages that changed since the last snapshot, as
+  // the chunk index and the compressed committed pages of the chunk.
+  struct CompressedChunk {
+    bool changed;
+    size_t size;
+    std::vector<char> data;
+  };
+  std::vector<CompressedChunk> compressed_chunks(
+      std::min(chunk_count, kSnapshotChunkBatchSize));
+  for (uint32_t batch_first = 0; batch_first < chunk_count;
+       batch_first += kSnapshotChunkBatchSize) {
+    uint32_t batch_size =
+        std::min(chunk_count - batch_first, kSnapshotChunkBatchSize);
+    thread_pool.ParallelFor(batch_size, [&](uint32_t i) {
+      uint32_t chunk_index = batch_first + i;
+      CompressedChunk& compressed_chunk = compressed_chunks[i];
+      compressed_chunk.changed = false;
+      SnapshotChunk& snapshot_chunk = snapshot_chunks_[chunk_index];
+      uint64_t committed_pages = GetSnapshotChunkCommittedPages(chunk_index);
+      if (!committed_pages) {
+        snapshot_chunk = {0, 0};
+        return;
+      }
+      bool same_pages = committed_pages == snapshot_chunk.committed_pages;
+      if (incremental && same_pages && written_pages) {
+        uint32_t first_page = chunk_index * chunk_page_count;
+        bool written = false;
+        for (uint64_t bits = committed_pages; !written && bits;
+             bits &= bits - 1) {
+          written = (*written_pages)[first_page + xe::tzcnt(bits)];
+        }
+        if (!written) {
+          return;
+        }
+      }
+      std::vector<uint8_t> buffer;
+      const uint8_t* data =
+          ReadSnapshotChunk(chunk_index, committed_pages, buffer);
+      size_t data_size = xe::bit_count(committed_pages) * page_size_;
+      uint64_t hash = XXH3_64bits_withSeed(data, data_size, committed_pages);
+      if (incremental && same_pages && hash == snapshot_chunk.hash) {
+        return;
+      }
+      snapshot_chunk = {committed_pages, hash};
+      compressed_chunk.data.resize(snappy::MaxCompressedLength(data_size));
+      snappy::RawCompress(reinterpret_cast<const char*>(data), data_size,
+                          compressed_chunk.data.data(), &compressed_chunk.size);
+      compressed_chunk.changed = true;
+    });
+    for (uint32_t i = 0; i < batch_size; ++i) {
+      const CompressedChunk& compressed_chunk = compressed_chunks[i];
+      if (!compressed_chunk.changed) {
+        continue;
+      }
+      if (!has_space(sizeof(uint32_t) * 2 + compressed_chunk.size)) {
+        snapshot_chunks_.clear();
+        return false;
+      }
+      stream->Write(batch_first + i);
+      stream->Write(uint32_t(compressed_chunk.size));
+      stream->Write(compressed_chunk.data.data(), compressed_chunk.size);
     }
   }
+  stream->Write(kSnapshotChunkEnd);
 
   return true;
 }
 
-bool BaseHeap::Restore(ByteStream* stream) {
+bool BaseHeap::Restore(ByteStream* stream, SnapshotThreadPool& thread_pool) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
+  auto global_lock = global_critical_region_.Acquire();
+  snapshot_chunks_.clear();
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
-      continue;
-    }
+  uint32_t page_count = stream->Read<uint32_t>();
+  uint32_t compressed_page_table_size = stream->Read<uint32_t>();
+  if (page_count != page_table_.size() ||
+      stream->offset() + compressed_page_table_size > stream->data_length()) {
+    return false;
+  }
+  // Pages that weren't committed before need to be committed.
+  std::vector<bool> was_committed(page_count);
+  for (uint32_t i = 0; i < page_count; ++i) {
+    was_committed[i] = (page_table_[i].state & kMemoryAllocationCommit) != 0;
+  }
+  const char* compressed_page_table =
+      reinterpret_cast<const char*>(stream->data() + stream->offset());
+  size_t page_table_size;
+  if (!snappy::GetUncompressedLength(compressed_page_table,
+                                     compressed_page_table_size,
+                                     &page_table_size) ||
+      page_table_size != page_count * sizeof(PageEntry) ||
+      !snappy::RawUncompress(compressed_page_table,
+                             compressed_page_table_size,
+                             reinterpret_cast<char*>(page_table_.data()))) {
+    return false;
+  }
+  stream->Advance(compressed_page_table_size);
 
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
+  free_pages_.SetAll(true);
+  for (uint32_t i = 0; i < page_count; ++i) {
+    if (page_table_[i].state) {
+      free_pages_.SetRange(i, 1, false);
     }
+  }
 
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(TranslateRelative(i * page_size_), page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
+  // Make the committed pages writable to read the chunks into them, in runs
+  // of pages that need the same operation. We do not need to reserve any
+  // memory, as the mapping has already taken care of that.
+  for (uint32_t i = 0; i < page_count;) {
+    if (!(page_table_[i].state & kMemoryAllocationCommit)) {
+      ++i;
+      continue;
     }
-
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
+    uint32_t run_end = i + 1;
+    while (run_end < page_count &&
+           (page_table_[run_end].state & kMemoryAllocationCommit) &&
+           was_committed[run_end] == was_committed[i]) {
+      ++run_end;
+    }
+    void* address = TranslateRelative(i * page_size_);
+    size_t length = (run_end - i) * page_size_;
+    if (was_committed[i]) {
+      xe::memory::Protect(address, length, memory::PageAccess::kReadWrite,
                           nullptr);
+    } else {
+      xe::memory::AllocFixed(address, length, memory::AllocationType::kCommit,
+                             memory::PageAccess::kReadWrite);
+    }
+    i = run_end;
+  }
+
+  uint32_t chunk_page_count = snapshot_chunk_page_count();
+  uint32_t chunk_count = (page_count + chunk_page_count - 1) / chunk_page_count;
+  struct CompressedChunk {
+    uint32_t chunk_index;
+    uint32_t size;
+    const char* data;
+  };
+  std::vector<CompressedChunk> compressed_chunks;
+  compressed_chunks.reserve(kSnapshotChunkBatchSize);
+  std::atomic<bool> chunks_valid(true);
+  auto decompress_chunks = [&]() {
+    uint32_t batch_size = uint32_t(compressed_chunks.size());
+    thread_pool.ParallelFor(batch_size, [&](uint32_t i) {
+      const CompressedChunk& compressed_chunk = compressed_chunks[i];
+      uint64_t committed_pages =
+          GetSnapshotChunkCommittedPages(compressed_chunk.chunk_index);
+      size_t data_size;
+      if (!committed_pages ||
+          !snappy::GetUncompressedLength(compressed_chunk.data,
+                                         compressed_chunk.size, &data_size) ||
+          data_size != xe::bit_count(committed_pages) * page_size_) {
+        chunks_valid = false;
+        return;
+      }
+      uint32_t first_page = compressed_chunk.chunk_index * chunk_page_count;
+      if (!(committed_pages & (committed_pages + 1))) {
+        if (!snappy::RawUncompress(
+                compressed_chunk.data, compressed_chunk.size,
+                TranslateRelative<char*>(first_page * page_size_))) {
+          chunks_valid = false;
+        }
+        return;
+      }
+      std::vector<char> buffer(data_size);
+      if (!snappy::RawUncompress(compressed_chunk.data, compressed_chunk.size,
+                                 buffer.data())) {
+        chunks_valid = false;
+        return;
+      }
+      const char* buffer_page = buffer.data();
+      for (uint64_t bits = committed_pages; bits; bits &= bits - 1) {
+        std::memcpy(
+            TranslateRelative((first_page + xe::tzcnt(bits)) * page_size_),
+            buffer_page, page_size_);
+        buffer_page += page_size_;
+      }
+    });
+    compressed_chunks.clear();
+  };
+  while (true) {
+    uint32_t chunk_index = stream->Read<uint32_t>();
+    if (chunk_index == kSnapshotChunkEnd) {
+      break;
+    }
+    uint32_t size = stream->Read<uint32_t>();
+    if (chunk_index >= chunk_count ||
+        stream->offset() + size > stream->data_length()) {
+      return false;
+    }
+    compressed_chunks.push_back(
+        {chunk_index, size,
+         reinterpret_cast<const char*>(stream->data() + stream->offset())});
+    stream->Advance(size);
+    if (compressed_chunks.size() >= kSnapshotChunkBatchSize) {
+      decompress_chunks();
+    }
+  }
+  decompress_chunks();
+  if (!chunks_valid) {
+    return false;
+  }
 
-      stream->Read(addr, page_size_);
-
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
+  // Set the protection of the pages back, in runs of the same protection.
+  for (uint32_t i = 0; i < page_count;) {
+    if (!(page_table_[i].state & kMemoryAllocationCommit)) {
+      ++i;
+      continue;
+    }
+    uint32_t run_end = i + 1;
+    while (run_end < page_count &&
+           (page_table_[run_end].state & kMemoryAllocationCommit) &&
+           page_table_[run_end].current_protect ==
+               page_table_[i].current_protect) {
+      ++run_end;
     }
+    xe::memory::Protect(TranslateRelative(i * page_size_),
+                        (run_end - i) * page_size_,
+                        ToPageAccess(page_table_[i].current_protect), nullptr);
+    i = run_end;
   }
 
   return true;
 }
 
+void BaseHeap::UpdateSnapshot(SnapshotThreadPool& thread_pool) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t chunk_page_count = snapshot_chunk_page_count();
+  uint32_t chunk_count =
+      (uint32_t(page_table_.size()) + chunk_page_count - 1) / chunk_page_count;
+  snapshot_chunks_.resize(chunk_count);
+  thread_pool.ParallelFor(chunk_count, [&](uint32_t chunk_index) {
+    SnapshotChunk& snapshot_chunk = snapshot_chunks_[chunk_index];
+    uint64_t committed_pages = GetSnapshotChunkCommittedPages(chunk_index);
+    if (!committed_pages) {
+      snapshot_chunk = {0, 0};
+      return;
+    }
+    std::vector<uint8_t> buffer;
+    const uint8_t* data =
+        ReadSnapshotChunk(chunk_index, committed_pages, buffer);
+    snapshot_chunk = {
+        committed_pages,
+        XXH3_64bits_withSeed(data, xe::bit_count(committed_pages) * page_size_,
+                             committed_pages)};
+  });
+}
+
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  free_pages_.SetAll(true);
   // TODO(Triang3l): Remove access callbacks from pages if this is a physical
   // memory heap.
 }
@@ -910,6 +1445,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.SetRange(start_page_number, page_count, false);
 
   return true;
 }
@@ -939,84 +1475,20 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
+  // The base page must match the requested alignment. Heap bases are aligned
+  // to far more than any allocation alignment, so aligning page numbers is
+  // equivalent to aligning addresses.
   uint32_t start_page_number = UINT_MAX;
   uint32_t end_page_number = UINT_MAX;
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
-  if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= base_page_number % page_scan_stride;
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
+  uint32_t base_page_number =
+      free_pages_.FindSetRun(low_page_number, high_page_number,
+                             std::max(page_count, uint32_t(1)),
+                             page_scan_stride, top_down);
+  if (base_page_number != RangeBitMap::kNotFound) {
+    start_page_number = base_page_number;
+    end_page_number = base_page_number + page_count - 1;
   }
   if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
     // Out of memory.
@@ -1055,6 +1527,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.SetRange(start_page_number, page_count, false);
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -1145,6 +1618,8 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     auto& page_entry = page_table_[page_number];
     page_entry.qword = 0;
   }
+  free_pages_.SetRange(base_page_number, base_page_entry.region_page_count,
+                       true);
 
   return true;
 }
@@ -19,10 +19,12 @@
 
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/range_bit_map.h"
 #include "xenia/cpu/mmio_handler.h"
 
 namespace xe {
 class ByteStream;
+class SnapshotThreadPool;
 }  // namespace xe
 
 namespace xe {
@@ -187,8 +189,22 @@ class BaseHeap {
   xe::memory::PageAccess QueryRangeAccess(uint32_t low_address,
                                           uint32_t high_address);
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Writes the page table and the committed pages as compressed chunks. If
+  // incremental, only the chunks that changed since the last Save or
+  // UpdateSnapshot are written. written_pages, if not null, has an element
+  // per page that is false if the page is known not to have been written to
+  // since then, so chunks of such pages are skipped without being read.
+  // Chunks are compressed on thread_pool.
+  bool Save(ByteStream* stream, SnapshotThreadPool& thread_pool,
+            bool incremental = false,
+            const std::vector<bool>* written_pages = nullptr);
+  // Restores a heap written by Save. An incremental save is restored on top of
+  // the saves it is based on.
+  bool Restore(ByteStream* stream, SnapshotThreadPool& thread_pool);
+  // Whether there is a snapshot that incremental saves can be based on.
+  bool has_snapshot() const { return !snapshot_chunks_.empty(); }
+  // Makes the current contents the base for incremental saves.
+  void UpdateSnapshot(SnapshotThreadPool& thread_pool);
 
   void Reset();
 
@@ -208,6 +224,24 @@ class BaseHeap {
   uint32_t host_address_offset_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Protected by global_critical_region. Bit per page, set if the page is
+  // unreserved, to find free ranges without walking page_table_.
+  RangeBitMap free_pages_;
+
+  // Committed pages of a save state chunk and the hash of their contents as
+  // of the last snapshot.
+  struct SnapshotChunk {
+    uint64_t committed_pages;
+    uint64_t hash;
+  };
+  uint32_t snapshot_chunk_page_count() const;
+  // Gets the contents of the committed pages of a chunk, gathering them into
+  // buffer if they are not contiguous.
+  const uint8_t* ReadSnapshotChunk(uint32_t chunk_index,
+                                   uint64_t committed_pages,
+                                   std::vector<uint8_t>& buffer);
+  uint64_t GetSnapshotChunkCommittedPages(uint32_t chunk_index) const;
+  std::vector<SnapshotChunk> snapshot_chunks_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -475,11 +509,24 @@ class Memory {
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Writes all guest memory, or if incremental, only the pages that changed
+  // since the last Save or Restore.
+  bool Save(ByteStream* stream, bool incremental = false);
+  // Restores guest memory from a full save followed by the incremental saves
+  // layered on top of it, in order.
+  bool Restore(const std::vector<ByteStream*>& streams);
+  // Whether a snapshot has been saved or restored that an incremental save can
+  // be based on.
+  bool CanSaveIncremental() const;
 
  private:
   int MapViews(uint8_t* mapping_base);
+  // Gets, for each page of a heap, whether it may have been written through
+  // any view since write tracking was reset. Returns false if writes are not
+  // tracked.
+  bool GetWrittenPages(const BaseHeap& heap,
+                       const std::vector<uint64_t>& written_mapping_pages,
+                       std::vector<bool>& written_pages) const;
   void UnmapViews();
 
   static uint32_t HostToGuestVirtualThunk(const void* context,
@@ -515,6 +562,9 @@ class Memory {
     };
     uint8_t* all_views[9];
   } views_ = {{0}};
+  // Whether host page write tracking was reset when the last snapshot was
+  // taken, so it reports the pages written since then.
+  bool snapshot_write_tracking_ = false;
 
   std::unique_ptr<cpu::MMIOHandler> mmio_handler_;
 
@@ -117,6 +117,13 @@ StfsContainerDevice::Error StfsContainerDevice::OpenFiles() {
   if (header_.metadata.data_file_count <= 1) {
     XELOGI("STFS container is a single file.");
     files_.emplace(std::make_pair(0, header_file));
+    auto mmap = MappedMemory::Open(host_path_, MappedMemory::Mode::kRead);
+    if (!mmap) {
+      XELOGE("Error mapping STFS container file.");
+      CloseFiles();
+      return Error::kErrorReadError;
+    }
+    mmaps_.emplace(std::make_pair(0, std::move(mmap)));
     return Error::kSuccess;
   }
 
@@ -157,6 +164,16 @@ StfsContainerDevice::Error StfsContainerDevice::OpenFiles() {
     files_total_size_ += xe::filesystem::Tell(file);
     // no need to seek back, any reads from this file will seek first anyway
     files_.emplace(std::make_pair(i, file));
+
+    // File data is read through mappings, so concurrent reads don't share a
+    // file position or a stdio lock.
+    auto mmap = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+    if (!mmap) {
+      XELOGI("Failed to map SVOD file {}.", xe::path_to_utf8(path));
+      CloseFiles();
+      return Error::kErrorReadError;
+    }
+    mmaps_.emplace(std::make_pair(i, std::move(mmap)));
   }
   XELOGI("SVOD successfully mapped {} files.", fragment_files.size());
   return Error::kSuccess;
@@ -167,6 +184,7 @@ void StfsContainerDevice::CloseFiles() {
     fclose(file.second);
   }
   files_.clear();
+  mmaps_.clear();
   files_total_size_ = 0;
 }
 
@@ -335,7 +353,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSVOD() {
   uint64_t root_creation_timestamp =
       decode_fat_timestamp(root_data.creation_date, root_data.creation_time);
 
-  auto root_entry = new StfsContainerEntry(this, nullptr, "", &files_);
+  auto root_entry = new StfsContainerEntry(this, nullptr, "", &mmaps_);
   root_entry->attributes_ = kFileAttributeDirectory;
   root_entry->access_timestamp_ = root_creation_timestamp;
   root_entry->create_timestamp_ = root_creation_timestamp;
@@ -407,7 +425,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadEntrySVOD(
   // NOTE: SVOD entries don't have timestamps for individual files, which can
   //       cause issues when decrypting games. Using the root entry's timestamp
   //       solves this issues.
-  auto entry = StfsContainerEntry::Create(this, parent, name, &files_);
+  auto entry = StfsContainerEntry::Create(this, parent, name, &mmaps_);
   if (dir_entry.attributes & kFileAttributeDirectory) {
     // Entry is a directory
     entry->attributes_ = kFileAttributeDirectory | kFileAttributeReadOnly;
@@ -465,6 +483,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadEntrySVOD(
         last_record = entry->block_list_.size() - 1;
         last_offset = offset;
       }
+      entry->UpdateBlockIndex();
     }
   }
 
@@ -545,7 +564,7 @@ void StfsContainerDevice::BlockToOffsetSVOD(size_t block, size_t* out_address,
 StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
   auto& file = files_.at(0);
 
-  auto root_entry = new StfsContainerEntry(this, nullptr, "", &files_);
+  auto root_entry = new StfsContainerEntry(this, nullptr, "", &mmaps_);
   root_entry->attributes_ = kFileAttributeDirectory;
   root_entry_ = std::unique_ptr<Entry>(root_entry);
 
@@ -584,7 +603,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
       std::string name(reinterpret_cast<const char*>(dir_entry.name),
                        dir_entry.flags.name_length & 0x3F);
       auto entry =
-          StfsContainerEntry::Create(this, parent_entry, name, &files_);
+          StfsContainerEntry::Create(this, parent_entry, name, &mmaps_);
 
       if (dir_entry.flags.directory) {
         entry->attributes_ = kFileAttributeDirectory;
@@ -641,6 +660,10 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
               dir_entry.allocated_data_blocks());
           assert_always();
         }
+
+        // Data blocks are only split by hash tables unless the package has
+        // been modified, so most files become a few contiguous runs.
+        entry->UpdateBlockIndex();
       }
 
       parent_entry->children_.emplace_back(std::move(entry));
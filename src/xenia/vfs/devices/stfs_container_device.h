@@ -15,6 +15,7 @@
 #include <string>
 #include <unordered_map>
 
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/string_util.h"
 #include "xenia/kernel/util/xex2_info.h"
@@ -128,7 +129,9 @@ class StfsContainerDevice : public Device {
   std::string name_;
   std::filesystem::path host_path_;
 
+  // Used while parsing the package, file data is read through mmaps_.
   std::map<size_t, FILE*> files_;
+  std::map<size_t, std::unique_ptr<MappedMemory>> mmaps_;
   size_t files_total_size_;
 
   size_t svod_base_offset_;
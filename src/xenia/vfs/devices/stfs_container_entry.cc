@@ -18,25 +18,52 @@ namespace vfs {
 
 StfsContainerEntry::StfsContainerEntry(Device* device, Entry* parent,
                                        const std::string_view path,
-                                       MultiFileHandles* files)
+                                       MultiFileMappings* mmaps)
     : Entry(device, parent, path),
-      files_(files),
+      mmaps_(mmaps),
       data_offset_(0),
       data_size_(0),
-      block_(0) {}
+      block_(0),
+      block_offsets_(1, 0) {}
 
 StfsContainerEntry::~StfsContainerEntry() = default;
 
 std::unique_ptr<StfsContainerEntry> StfsContainerEntry::Create(
     Device* device, Entry* parent, const std::string_view name,
-    MultiFileHandles* files) {
+    MultiFileMappings* mmaps) {
   auto path = xe::utf8::join_guest_paths(parent->path(), name);
   auto entry =
-      std::make_unique<StfsContainerEntry>(device, parent, path, files);
+      std::make_unique<StfsContainerEntry>(device, parent, path, mmaps);
 
   return std::move(entry);
 }
 
+void StfsContainerEntry::UpdateBlockIndex() {
+  size_t record_count = 0;
+  for (size_t i = 0; i < block_list_.size(); i++) {
+    const BlockRecord& record = block_list_[i];
+    if (record_count) {
+      BlockRecord& last = block_list_[record_count - 1];
+      if (last.file == record.file &&
+          last.offset + last.length == record.offset) {
+        last.length += record.length;
+        continue;
+      }
+    }
+    block_list_[record_count++] = record;
+  }
+  block_list_.resize(record_count);
+  block_list_.shrink_to_fit();
+
+  block_offsets_.resize(record_count + 1);
+  size_t offset = 0;
+  for (size_t i = 0; i < record_count; i++) {
+    block_offsets_[i] = offset;
+    offset += block_list_[i].length;
+  }
+  block_offsets_[record_count] = offset;
+}
+
 X_STATUS StfsContainerEntry::Open(uint32_t desired_access, File** out_file) {
   *out_file = new StfsContainerFile(desired_access, this);
   return X_STATUS_SUCCESS;
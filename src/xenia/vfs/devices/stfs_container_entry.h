@@ -11,30 +11,32 @@
 #define XENIA_VFS_DEVICES_STFS_CONTAINER_ENTRY_H_
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "xenia/base/mapped_memory.h"
 #include "xenia/vfs/entry.h"
 #include "xenia/vfs/file.h"
 
 namespace xe {
 namespace vfs {
-typedef std::map<size_t, FILE*> MultiFileHandles;
+typedef std::map<size_t, std::unique_ptr<MappedMemory>> MultiFileMappings;
 
 class StfsContainerDevice;
 
 class StfsContainerEntry : public Entry {
  public:
   StfsContainerEntry(Device* device, Entry* parent, const std::string_view path,
-                     MultiFileHandles* files);
+                     MultiFileMappings* mmaps);
   ~StfsContainerEntry() override;
 
   static std::unique_ptr<StfsContainerEntry> Create(Device* device,
                                                     Entry* parent,
                                                     const std::string_view name,
-                                                    MultiFileHandles* files);
+                                                    MultiFileMappings* mmaps);
 
-  MultiFileHandles* files() const { return files_; }
+  MultiFileMappings* mmaps() const { return mmaps_; }
   size_t data_offset() const { return data_offset_; }
   size_t data_size() const { return data_size_; }
   size_t block() const { return block_; }
@@ -47,15 +49,21 @@ class StfsContainerEntry : public Entry {
     size_t length;
   };
   const std::vector<BlockRecord>& block_list() const { return block_list_; }
+  // Offset in the entry of each record, followed by the total length.
+  const std::vector<size_t>& block_offsets() const { return block_offsets_; }
 
  private:
   friend class StfsContainerDevice;
 
-  MultiFileHandles* files_;
+  // Merges contiguous records and updates block_offsets_.
+  void UpdateBlockIndex();
+
+  MultiFileMappings* mmaps_;
   size_t data_offset_;
   size_t data_size_;
   size_t block_;
   std::vector<BlockRecord> block_list_;
+  std::vector<size_t> block_offsets_;
 };
 
 }  // namespace vfs
@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #include "xenia/base/math.h"
 #include "xenia/vfs/devices/stfs_container_entry.h"
@@ -33,36 +34,40 @@ X_STATUS StfsContainerFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_END_OF_FILE;
   }
 
-  size_t src_offset = 0;
   uint8_t* p = reinterpret_cast<uint8_t*>(buffer);
   size_t remaining_length =
       std::min(buffer_length, entry_->size() - byte_offset);
 
-  *out_bytes_read = 0;
-  for (size_t i = 0; i < entry_->block_list().size(); i++) {
-    auto& record = entry_->block_list()[i];
-    if (src_offset + record.length <= byte_offset) {
-      // Doesn't begin in this region. Skip it.
-      src_offset += record.length;
-      continue;
-    }
+  // Find the last record starting at or before the offset. The trailing total
+  // length is never less than an offset within the records.
+  auto& block_list = entry_->block_list();
+  auto& block_offsets = entry_->block_offsets();
+  size_t i = size_t(std::upper_bound(block_offsets.begin(),
+                                     block_offsets.end(), byte_offset) -
+                    block_offsets.begin()) -
+             1;
 
-    size_t read_offset =
-        (byte_offset > src_offset) ? byte_offset - src_offset : 0;
+  *out_bytes_read = 0;
+  size_t read_offset = byte_offset - block_offsets[i];
+  for (; remaining_length && i < block_list.size(); i++) {
+    auto& record = block_list[i];
     size_t read_length =
         std::min(record.length - read_offset, remaining_length);
 
-    auto& file = entry_->files()->at(record.file);
-    xe::filesystem::Seek(file, record.offset + read_offset, SEEK_SET);
-    auto num_read = fread(p, 1, read_length, file);
+    // Records are merged when contiguous, so this is one copy per run.
+    auto& mmap = entry_->mmaps()->at(record.file);
+    size_t src_offset = record.offset + read_offset;
+    if (src_offset + read_length > mmap->size()) {
+      // Truncated package, stop after what is there.
+      read_length = src_offset < mmap->size() ? mmap->size() - src_offset : 0;
+      remaining_length = read_length;
+    }
+    std::memcpy(p, mmap->data() + src_offset, read_length);
 
-    *out_bytes_read += num_read;
-    p += num_read;
-    src_offset += record.length;
+    *out_bytes_read += read_length;
+    p += read_length;
     remaining_length -= read_length;
-    if (remaining_length == 0) {
-      break;
-    }
+    read_offset = 0;
   }
 
   return X_STATUS_SUCCESS;
@@ -33,3 +33,4 @@ project("xenia-vfs-dump")
     project_root,
   })
 
+include("testing")
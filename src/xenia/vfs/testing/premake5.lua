@@ -0,0 +1,20 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+group("tests")
+project("xenia-vfs-stfs-benchmark")
+  uuid("8c3f5e2a-6d41-4b7e-9a0c-1f2d3b4c5e6f")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "fmt",
+    "xenia-base",
+    "xenia-vfs",
+  })
+  files({
+    "stfs_benchmark_main.cc",
+    "../../base/console_app_main_"..platform_suffix..".cc",
+  })
+  filter("platforms:Windows")
+    -- xenia-base needs this
+    links({"xenia-ui"})
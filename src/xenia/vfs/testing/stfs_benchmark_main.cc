@@ -0,0 +1,445 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/console_app_main.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/vfs/devices/stfs_container_device.h"
+#include "xenia/vfs/devices/stfs_xbox.h"
+#include "xenia/vfs/file.h"
+
+// Writes a synthetic read-only STFS package and measures reads through
+// StfsContainerDevice against seeking and reading the package block by block
+// with stdio, which is how the device used to read file data.
+DEFINE_int32(stfs_benchmark_package_size, 96,
+             "Size of the data in the synthetic package in MiB, up to 112.",
+             "Other");
+DEFINE_int32(stfs_benchmark_threads, 4,
+             "Number of threads reading simultaneously in the parallel pass.",
+             "Other");
+DEFINE_int32(stfs_benchmark_passes, 4,
+             "Number of times the sequential pass reads every file.", "Other");
+DEFINE_int32(stfs_benchmark_random_reads, 20000,
+             "Number of reads of 4 to 256 KiB done by the random passes.",
+             "Other");
+
+namespace xe {
+namespace vfs {
+namespace test {
+
+constexpr uint32_t kBlockSize = 0x1000;
+constexpr uint32_t kBlocksPerHashTable = 170;
+constexpr uint32_t kEndOfChain = 0xFFFFFF;
+constexpr uint32_t kFileCount = 8;
+// Every other file is written in runs this long, interleaved with the runs of
+// the other fragmented files like in a package that grew over time.
+constexpr uint32_t kFragmentBlocks = 8;
+
+struct PackageFile {
+  std::string name;
+  size_t length;
+  // Offsets of the data blocks in the package, in file order.
+  std::vector<size_t> block_offsets;
+  std::vector<uint8_t> expected;
+};
+
+// Same as StfsContainerDevice::BlockToOffsetSTFS for read-only packages, which
+// have a single copy of each hash table.
+size_t BlockToOffset(uint32_t block_index) {
+  uint64_t base = kBlocksPerHashTable;
+  uint64_t block = block_index;
+  for (uint32_t i = 0; i < 3; i++) {
+    block += (block_index + base) / base;
+    if (block_index < base) {
+      break;
+    }
+    base *= kBlocksPerHashTable;
+  }
+  return xe::round_up(sizeof(StfsHeader), kBlockSize) + (block << 12);
+}
+
+// Same as StfsContainerDevice::BlockToHashBlockOffsetSTFS for level 0 tables
+// of read-only packages with less than 170 * 170 blocks.
+size_t BlockToHashTableOffset(uint32_t block_index) {
+  uint64_t block = 0;
+  if (block_index >= kBlocksPerHashTable) {
+    // Past the first table, data blocks and the level 1 table.
+    block = (block_index / kBlocksPerHashTable) * (kBlocksPerHashTable + 1) + 1;
+  }
+  return xe::round_up(sizeof(StfsHeader), kBlockSize) + (block << 12);
+}
+
+bool WritePackage(const std::filesystem::path& path, uint32_t block_count,
+                  std::vector<PackageFile>& files) {
+  std::vector<uint8_t> image(BlockToOffset(block_count - 1) + kBlockSize);
+  auto header = std::make_unique<StfsHeader>();
+  header->header.magic = XContentPackageType::kCon;
+  header->header.header_size = uint32_t(sizeof(StfsHeader));
+  header->metadata.volume_type = XContentVolumeType::kStfs;
+  auto& descriptor = header->metadata.volume_descriptor.stfs;
+  descriptor.descriptor_length = uint8_t(sizeof(StfsVolumeDescriptor));
+  descriptor.flags.bits.read_only_format = 1;
+  descriptor.file_table_block_count = 1;
+  descriptor.set_file_table_block_number(0);
+  descriptor.total_block_count = block_count;
+  std::memcpy(image.data(), header.get(), sizeof(StfsHeader));
+
+  // Block 0 is the file table, the rest is split between the files.
+  uint32_t file_block_count =
+      (block_count - 1) / kFileCount / kFragmentBlocks * kFragmentBlocks;
+  uint32_t fragmented_first_block = 1 + file_block_count * (kFileCount / 2);
+  std::vector<uint32_t> next_blocks(block_count, kEndOfChain);
+  for (uint32_t i = 0; i < kFileCount; i++) {
+    std::vector<uint32_t> blocks;
+    for (uint32_t j = 0; j < file_block_count; j++) {
+      if (i < kFileCount / 2) {
+        blocks.push_back(1 + i * file_block_count + j);
+      } else {
+        uint32_t run = j / kFragmentBlocks;
+        blocks.push_back(fragmented_first_block +
+                         (run * (kFileCount / 2) + i - kFileCount / 2) *
+                             kFragmentBlocks +
+                         j % kFragmentBlocks);
+      }
+    }
+    for (size_t j = 0; j + 1 < blocks.size(); j++) {
+      next_blocks[blocks[j]] = blocks[j + 1];
+    }
+
+    PackageFile file;
+    file.name = "file" + std::to_string(i) + ".bin";
+    // Most files end in the middle of their last block.
+    file.length = size_t(file_block_count) * kBlockSize - (i * 0x123) % 0x1000;
+    for (uint32_t block : blocks) {
+      file.block_offsets.push_back(BlockToOffset(block));
+    }
+
+    auto& entry = reinterpret_cast<StfsDirectoryBlock*>(
+                      image.data() + BlockToOffset(0))
+                      ->entries[i];
+    std::memcpy(entry.name, file.name.data(), file.name.size());
+    entry.flags.name_length = uint8_t(file.name.size());
+    entry.flags.contiguous = i < kFileCount / 2;
+    entry.set_valid_data_blocks(file_block_count);
+    entry.set_allocated_data_blocks(file_block_count);
+    entry.set_start_block_number(blocks[0]);
+    entry.directory_index = 0xFFFF;
+    entry.length = uint32_t(file.length);
+    files.push_back(std::move(file));
+  }
+
+  for (uint32_t block = 0; block < block_count; block++) {
+    auto table = reinterpret_cast<StfsHashTable*>(
+        image.data() + BlockToHashTableOffset(block));
+    auto& hash_entry = table->entries[block % kBlocksPerHashTable];
+    hash_entry.set_level0_allocation_state(StfsHashState::kInUse);
+    hash_entry.set_level0_next_block(next_blocks[block]);
+  }
+
+  std::mt19937 random(0x57F5);
+  for (uint32_t block = 1; block < block_count; block++) {
+    uint8_t* data = image.data() + BlockToOffset(block);
+    for (uint32_t i = 0; i < kBlockSize; i += 4) {
+      uint32_t value = random();
+      std::memcpy(data + i, &value, sizeof(value));
+    }
+  }
+  for (auto& file : files) {
+    file.expected.resize(file.block_offsets.size() * kBlockSize);
+    for (size_t j = 0; j < file.block_offsets.size(); j++) {
+      std::memcpy(file.expected.data() + j * kBlockSize,
+                  image.data() + file.block_offsets[j], kBlockSize);
+    }
+    file.expected.resize(file.length);
+  }
+
+  auto out = xe::filesystem::OpenFile(path, "wb");
+  if (!out) {
+    return false;
+  }
+  bool written = fwrite(image.data(), image.size(), 1, out) == 1;
+  fclose(out);
+  return written;
+}
+
+// Reads like StfsContainerFile::ReadSync did before it used mappings: walks
+// the block list from the start and seeks and reads every block.
+size_t ReadStdio(FILE* package, const PackageFile& file, uint8_t* buffer,
+                 size_t length, size_t offset) {
+  length = std::min(length, file.length - offset);
+  size_t src_offset = 0;
+  size_t bytes_read = 0;
+  for (size_t block_offset : file.block_offsets) {
+    if (src_offset + kBlockSize <= offset) {
+      src_offset += kBlockSize;
+      continue;
+    }
+    size_t read_offset = offset > src_offset ? offset - src_offset : 0;
+    size_t read_length = std::min(kBlockSize - read_offset, length);
+    xe::filesystem::Seek(package, block_offset + read_offset, SEEK_SET);
+    size_t num_read = fread(buffer + bytes_read, 1, read_length, package);
+    bytes_read += num_read;
+    src_offset += kBlockSize;
+    length -= read_length;
+    if (!length) {
+      break;
+    }
+  }
+  return bytes_read;
+}
+
+struct RandomRead {
+  uint32_t file;
+  size_t offset;
+  size_t length;
+};
+
+std::vector<RandomRead> MakeRandomReads(const std::vector<PackageFile>& files,
+                                        size_t count) {
+  std::mt19937 random(0x4EAD);
+  std::vector<RandomRead> reads(count);
+  for (auto& read : reads) {
+    read.file = random() % uint32_t(files.size());
+    read.length = (1 + random() % 64) * kBlockSize;
+    // Unaligned so reads start and end inside blocks.
+    read.offset = random() % (files[read.file].length - read.length);
+  }
+  return reads;
+}
+
+class Reader {
+ public:
+  virtual ~Reader() = default;
+  // Each thread reads through its own context.
+  virtual void* OpenContext() = 0;
+  virtual void CloseContext(void* context) = 0;
+  virtual size_t Read(void* context, uint32_t file, uint8_t* buffer,
+                      size_t length, size_t offset) = 0;
+};
+
+class DeviceReader : public Reader {
+ public:
+  explicit DeviceReader(std::vector<Entry*> entries)
+      : entries_(std::move(entries)) {}
+  void* OpenContext() override {
+    auto files = new std::vector<File*>();
+    for (Entry* entry : entries_) {
+      File* file = nullptr;
+      entry->Open(FileAccess::kFileReadData, &file);
+      files->push_back(file);
+    }
+    return files;
+  }
+  void CloseContext(void* context) override {
+    auto files = reinterpret_cast<std::vector<File*>*>(context);
+    for (File* file : *files) {
+      file->Destroy();
+    }
+    delete files;
+  }
+  size_t Read(void* context, uint32_t file, uint8_t* buffer, size_t length,
+              size_t offset) override {
+    auto files = reinterpret_cast<std::vector<File*>*>(context);
+    size_t bytes_read = 0;
+    (*files)[file]->ReadSync(buffer, length, offset, &bytes_read);
+    return bytes_read;
+  }
+
+ private:
+  std::vector<Entry*> entries_;
+};
+
+// The device had one FILE per package, so concurrent reads have to take turns.
+class StdioReader : public Reader {
+ public:
+  StdioReader(FILE* package, const std::vector<PackageFile>& files)
+      : package_(package), files_(files) {}
+  void* OpenContext() override { return nullptr; }
+  void CloseContext(void* context) override {}
+  size_t Read(void* context, uint32_t file, uint8_t* buffer, size_t length,
+              size_t offset) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ReadStdio(package_, files_[file], buffer, length, offset);
+  }
+
+ private:
+  FILE* package_;
+  const std::vector<PackageFile>& files_;
+  std::mutex mutex_;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double GibibytesPerSecond(size_t bytes, Clock::duration duration) {
+  return double(bytes) / (1024.0 * 1024.0 * 1024.0) /
+         std::chrono::duration<double>(duration).count();
+}
+
+bool Verify(Reader& reader, const std::vector<PackageFile>& files,
+            const std::vector<RandomRead>& reads) {
+  void* context = reader.OpenContext();
+  std::vector<uint8_t> buffer;
+  bool matches = true;
+  for (uint32_t i = 0; i < files.size() && matches; i++) {
+    buffer.assign(files[i].length, 0);
+    matches = reader.Read(context, i, buffer.data(), buffer.size(), 0) ==
+                  files[i].length &&
+              buffer == files[i].expected;
+  }
+  for (size_t i = 0; i < std::min(reads.size(), size_t(1000)) && matches;
+       i++) {
+    const RandomRead& read = reads[i];
+    buffer.assign(read.length, 0);
+    matches = reader.Read(context, read.file, buffer.data(), read.length,
+                          read.offset) == read.length &&
+              std::memcmp(buffer.data(),
+                          files[read.file].expected.data() + read.offset,
+                          read.length) == 0;
+  }
+  reader.CloseContext(context);
+  return matches;
+}
+
+void RunPasses(const char* name, Reader& reader,
+               const std::vector<PackageFile>& files,
+               const std::vector<RandomRead>& reads) {
+  const size_t kSequentialReadLength = 1024 * 1024;
+  std::vector<uint8_t> buffer(kSequentialReadLength);
+
+  void* context = reader.OpenContext();
+  size_t sequential_bytes = 0;
+  auto start_time = Clock::now();
+  for (int32_t pass = 0; pass < cvars::stfs_benchmark_passes; pass++) {
+    for (uint32_t i = 0; i < files.size(); i++) {
+      for (size_t offset = 0; offset < files[i].length;
+           offset += kSequentialReadLength) {
+        sequential_bytes += reader.Read(context, i, buffer.data(),
+                                        kSequentialReadLength, offset);
+      }
+    }
+  }
+  auto sequential_time = Clock::now() - start_time;
+
+  size_t random_bytes = 0;
+  start_time = Clock::now();
+  for (const RandomRead& read : reads) {
+    random_bytes += reader.Read(context, read.file, buffer.data(), read.length,
+                                read.offset);
+  }
+  auto random_time = Clock::now() - start_time;
+  reader.CloseContext(context);
+
+  uint32_t thread_count =
+      uint32_t(std::max(cvars::stfs_benchmark_threads, int32_t(1)));
+  std::vector<size_t> thread_bytes(thread_count);
+  std::vector<std::thread> threads;
+  start_time = Clock::now();
+  for (uint32_t i = 0; i < thread_count; i++) {
+    threads.emplace_back([&, i]() {
+      void* thread_context = reader.OpenContext();
+      std::vector<uint8_t> thread_buffer(kSequentialReadLength);
+      for (size_t j = i; j < reads.size(); j += thread_count) {
+        const RandomRead& read = reads[j];
+        thread_bytes[i] +=
+            reader.Read(thread_context, read.file, thread_buffer.data(),
+                        read.length, read.offset);
+      }
+      reader.CloseContext(thread_context);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto parallel_time = Clock::now() - start_time;
+  size_t parallel_bytes = 0;
+  for (size_t bytes : thread_bytes) {
+    parallel_bytes += bytes;
+  }
+
+  XELOGI(
+      "{}: sequential {:.2f} GiB/s, random {:.2f} GiB/s, random on {} "
+      "threads {:.2f} GiB/s",
+      name, GibibytesPerSecond(sequential_bytes, sequential_time),
+      GibibytesPerSecond(random_bytes, random_time), thread_count,
+      GibibytesPerSecond(parallel_bytes, parallel_time));
+}
+
+int main(const std::vector<std::string>& args) {
+  // Level 1 hash tables start after 170 * 170 blocks, which the synthetic
+  // package doesn't write.
+  uint32_t block_count =
+      uint32_t(std::clamp(cvars::stfs_benchmark_package_size, 1, 112)) *
+          (1024 * 1024 / kBlockSize) +
+      1;
+  auto path = std::filesystem::temp_directory_path() / "xenia_stfs_benchmark";
+  std::vector<PackageFile> files;
+  if (!WritePackage(path, block_count, files)) {
+    XELOGE("Failed to write the package to {}", xe::path_to_utf8(path));
+    return 1;
+  }
+  auto reads = MakeRandomReads(files, cvars::stfs_benchmark_random_reads);
+
+  int result = 0;
+  {
+    StfsContainerDevice device("", path);
+    if (!device.Initialize()) {
+      XELOGE("Failed to open the synthetic package");
+      std::filesystem::remove(path);
+      return 1;
+    }
+    std::vector<Entry*> entries;
+    for (auto& file : files) {
+      entries.push_back(device.ResolvePath(file.name));
+    }
+    if (std::find(entries.begin(), entries.end(), nullptr) != entries.end()) {
+      XELOGE("Synthetic package is missing files");
+      result = 1;
+    }
+
+    DeviceReader device_reader(entries);
+    auto package = xe::filesystem::OpenFile(path, "rb");
+    StdioReader stdio_reader(package, files);
+    if (!result && !Verify(device_reader, files, reads)) {
+      XELOGE("StfsContainerFile read wrong data");
+      result = 1;
+    }
+    if (!result && !Verify(stdio_reader, files, reads)) {
+      XELOGE("Reading the package with stdio gave wrong data");
+      result = 1;
+    }
+    if (!result) {
+      XELOGI("{} files of {:.1f} MiB, half of them in runs of {} blocks",
+             files.size(), files[0].length / (1024.0 * 1024.0),
+             kFragmentBlocks);
+      RunPasses("stdio block reads", stdio_reader, files, reads);
+      RunPasses("StfsContainerFile", device_reader, files, reads);
+    }
+    fclose(package);
+  }
+  std::filesystem::remove(path);
+  return result;
+}
+
+}  // namespace test
+}  // namespace vfs
+}  // namespace xe
+
+XE_DEFINE_CONSOLE_APP("xenia-vfs-stfs-benchmark", xe::vfs::test::main, "");